@@ -44,28 +44,41 @@ namespace CAULDRON_DX12
     {
         // load textures 
         //
-        if (m_pGLTFCommon->j3.find("images") != m_pGLTFCommon->j3.end())
+        const std::vector<tfImage> &images = m_pGLTFCommon->m_images;
+        if (!images.empty())
         {
-            
-            m_pTextureNodes = &m_pGLTFCommon->j3["textures"];
-            const json &images = m_pGLTFCommon->j3["images"];
-            const json &materials = m_pGLTFCommon->j3["materials"];
-            for (int textureIndex = 0; textureIndex < m_pTextureNodes->size(); textureIndex++) {
-                m_textureToImage[textureIndex] =   (*m_pTextureNodes)[textureIndex]["source"].get<int>();
-            }
             m_textures.resize(images.size());
             for (int imageIndex = 0; imageIndex < images.size(); imageIndex++)
             {
                 Texture *pTex = &m_textures[imageIndex];
-                std::string filename = m_pGLTFCommon->m_path + images[imageIndex]["uri"].get<std::string>();
+                const tfImage &image = images[imageIndex];
 
-                ExecAsyncIfThereIsAPool(pAsyncPool, [imageIndex, pTex, this, filename, materials]()
+                // images are either files or embedded, in a bufferView (.glb) or in a data URI
+                std::string filename;
+                const char *pImageData = NULL;
+                size_t imageSize = 0;
+                if (!image.m_uri.empty())
+                {
+                    filename = m_pGLTFCommon->m_path + image.m_uri;
+                }
+                else
+                {
+                    filename = image.m_name.empty() ? "image " + std::to_string(imageIndex) : image.m_name;
+                    bool result = m_pGLTFCommon->GetImageData(imageIndex, &pImageData, &imageSize);
+                    assert(result != false);
+                }
+
+                ExecAsyncIfThereIsAPool(pAsyncPool, [imageIndex, pTex, this, filename, pImageData, imageSize]()
                 {
                     bool useSRGB;
                     float cutOff;
-                    GetSrgbAndCutOffOfImageGivenItsUse(imageIndex, materials, m_textureToImage, &useSRGB, &cutOff);
+                    GetSrgbAndCutOffOfImageGivenItsUse(imageIndex, m_pGLTFCommon->m_materials, m_pGLTFCommon->m_textures, &useSRGB, &cutOff);
 
-                    bool result = pTex->InitFromFile(m_pDevice, m_pUploadHeap, filename.c_str(), useSRGB, cutOff);
+                    bool result;
+                    if (pImageData != NULL)
+                        result = pTex->InitFromMemory(m_pDevice, m_pUploadHeap, pImageData, imageSize, filename.c_str(), useSRGB, cutOff);
+                    else
+                        result = pTex->InitFromFile(m_pDevice, m_pUploadHeap, filename.c_str(), useSRGB, cutOff);
                     assert(result != false);
                 });
             }
@@ -80,58 +93,114 @@ namespace CAULDRON_DX12
         }
     }
 
+    // JOINTS are read as integers by the shaders, the rest of the attributes as floats
+    //
+    static bool IsIntegerAttribute(const std::string &attribute)
+    {
+        return attribute.compare(0, 7, "JOINTS_") == 0;
+    }
+
+    // Morphed attributes are rewritten as floats every frame (see GLTFCommon::MorphMeshes()), so their static vertex
+    // buffer is converted to floats too and both can use the same input layout. There are no scaled formats either,
+    // quantized attributes that are not normalized are converted as well.
+    //
+    bool GLTFTexturesAndBuffers::IsUploadedAsFloat(const std::string &attribute, int accessorId) const
+    {
+        const tfAccessor &accessor = m_pGLTFCommon->GetAccessor(accessorId);
+        if (accessor.m_componentType == 5126)
+            return false;
+
+        return m_morphedAccessors[accessorId] || (!accessor.m_normalized && accessor.m_type < 4 && !IsIntegerAttribute(attribute));
+    }
+
     void GLTFTexturesAndBuffers::LoadGeometry()
     {
-        if (m_pGLTFCommon->j3.find("meshes") != m_pGLTFCommon->j3.end())
+        // the format of a vertex buffer must suit all the primitives that share it
+        m_morphedAccessors.assign(m_pGLTFCommon->m_accessors.size(), false);
+        for (const tfMesh &mesh : m_pGLTFCommon->m_meshes)
         {
-            for (const json &mesh : m_pGLTFCommon->j3["meshes"])
+            for (const tfPrimitives &primitive : mesh.m_pPrimitives)
             {
-                for (const json &primitive : mesh["primitives"])
+                for (auto const &attribute : primitive.m_attributes)
                 {
-                    //
-                    //  Load vertex buffers
-                    //
-                    for (const json &attributeId : primitive["attributes"])
-                    {
-                        tfAccessor vertexBufferAcc;
-                        m_pGLTFCommon->GetBufferDetails(attributeId, &vertexBufferAcc);
+                    if (primitive.HasMorphTarget(attribute.first))
+                        m_morphedAccessors[attribute.second] = true;
+                }
+            }
+        }
+
+        for (const tfMesh &mesh : m_pGLTFCommon->m_meshes)
+        {
+            // the source meshes of MergeStaticMeshes() keep their primitives for GetMergedSource() only
+            if (mesh.m_mergedAway)
+                continue;
+
+            for (const tfPrimitives &primitive : mesh.m_pPrimitives)
+            {
+                //
+                //  Load vertex buffers
+                //
+                for (auto const &attribute : primitive.m_attributes)
+                {
+                    int attributeId = attribute.second;
+                    if (m_vertexBufferMap.find(attributeId) != m_vertexBufferMap.end())
+                        continue;
 
-                        D3D12_VERTEX_BUFFER_VIEW vbv;
-                        m_pStaticBufferPool->AllocVertexBuffer(vertexBufferAcc.m_count, vertexBufferAcc.m_stride, vertexBufferAcc.m_data, &vbv);
+                    const tfAccessor &vertexBufferAcc = m_pGLTFCommon->GetAccessor(attributeId);
 
-                        m_vertexBufferMap[attributeId] = vbv;
+                    // quantized attributes stay quantized, interleaved ones are copied into their own buffer
+                    void *pData;
+                    D3D12_VERTEX_BUFFER_VIEW vbv;
+                    if (IsUploadedAsFloat(attribute.first, attributeId))
+                    {
+                        m_pStaticBufferPool->AllocVertexBuffer(vertexBufferAcc.m_count, vertexBufferAcc.m_dimension * sizeof(float), &pData, &vbv);
+                        DequantizeAccessor(vertexBufferAcc, (float *)pData);
                     }
+                    else
+                    {
+                        const int stride = GetVertexStride(vertexBufferAcc);
+                        m_pStaticBufferPool->AllocVertexBuffer(vertexBufferAcc.m_count, stride, &pData, &vbv);
+                        CopyAccessorElements(vertexBufferAcc, stride, pData);
+                    }
+
+                    m_vertexBufferMap[attributeId] = vbv;
+                }
+
+                //
+                //  Load index buffers
+                //
+                int indexAcc = primitive.m_indices;
+                if (indexAcc >= 0)
+                {
+                    const tfAccessor &indexBufferAcc = m_pGLTFCommon->GetAccessor(indexAcc);
 
-                    //
-                    //  Load index buffers
-                    //
-                    int indexAcc = primitive.value("indices", -1);
-                    if (indexAcc >= 0)
+                    D3D12_INDEX_BUFFER_VIEW ibv;
+
+                    // Some exporters use 1-byte indices, need to convert them to shorts
+                    if (indexBufferAcc.m_stride == 1)
+                    {
+                        unsigned short *pIndices = (unsigned short *)malloc(indexBufferAcc.m_count * (2 * indexBufferAcc.m_stride));
+                        for (int i = 0; i < indexBufferAcc.m_count; i++)
+                            pIndices[i] = ((unsigned char *)indexBufferAcc.m_data)[i];
+                        m_pStaticBufferPool->AllocIndexBuffer(indexBufferAcc.m_count, 2 * indexBufferAcc.m_stride, pIndices, &ibv);
+                        free(pIndices);
+                    }
+                    else
                     {
-                        tfAccessor indexBufferAcc;
-                        m_pGLTFCommon->GetBufferDetails(indexAcc, &indexBufferAcc);
-
-                        D3D12_INDEX_BUFFER_VIEW ibv;
-
-                        // Some exporters use 1-byte indices, need to convert them to shorts
-                        if (indexBufferAcc.m_stride == 1)
-                        {
-                            unsigned short *pIndices = (unsigned short *)malloc(indexBufferAcc.m_count * (2 * indexBufferAcc.m_stride));
-                            for (int i = 0; i < indexBufferAcc.m_count; i++)
-                                pIndices[i] = ((unsigned char *)indexBufferAcc.m_data)[i];
-                            m_pStaticBufferPool->AllocIndexBuffer(indexBufferAcc.m_count, 2 * indexBufferAcc.m_stride, pIndices, &ibv);
-                            free(pIndices);
-                        }
-                        else
-                        {
-                            m_pStaticBufferPool->AllocIndexBuffer(indexBufferAcc.m_count, indexBufferAcc.m_stride, indexBufferAcc.m_data, &ibv);
-                        }
-
-                        m_IndexBufferMap[indexAcc] = ibv;
+                        m_pStaticBufferPool->AllocIndexBuffer(indexBufferAcc.m_count, indexBufferAcc.m_stride, indexBufferAcc.m_data, &ibv);
                     }
+
+                    m_IndexBufferMap[indexAcc] = ibv;
                 }
             }
         }
+
+        if (!m_pGLTFCommon->m_nodeInstances.empty() || !m_pGLTFCommon->m_nodeBatches.empty())
+        {
+            InstanceMatrix identity;
+            identity.Set(math::Matrix4::identity());
+            m_pStaticBufferPool->AllocVertexBuffer(1, sizeof(InstanceMatrix), &identity, &m_identityInstance);
+        }
     }
 
     void GLTFTexturesAndBuffers::OnDestroy()
@@ -144,7 +213,7 @@ namespace CAULDRON_DX12
 
     Texture *GLTFTexturesAndBuffers::GetTextureViewByID(int id)
     {
-        int tex = m_pTextureNodes->at(id)["source"];
+        int tex = m_pGLTFCommon->m_textures[id].m_source;
         return &m_textures[tex];
     }
 
@@ -153,8 +222,7 @@ namespace CAULDRON_DX12
     //
     void GLTFTexturesAndBuffers::CreateIndexBuffer(int indexBufferId, uint32_t *pNumIndices, DXGI_FORMAT *pIndexType, D3D12_INDEX_BUFFER_VIEW *pIBV)
     {
-        tfAccessor indexBuffer;
-        m_pGLTFCommon->GetBufferDetails(indexBufferId, &indexBuffer);
+        const tfAccessor &indexBuffer = m_pGLTFCommon->GetAccessor(indexBufferId);
 
         *pNumIndices = indexBuffer.m_count;
         *pIndexType = (indexBuffer.m_stride == 4) ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
@@ -171,6 +239,7 @@ namespace CAULDRON_DX12
 
         // load the rest of the buffers onto the GPU
         pGeometry->m_VBV.resize(vertexBufferIds.size());
+        pGeometry->m_attributeIds = vertexBufferIds;
         for (int i = 0; i < vertexBufferIds.size(); i++)
         {
             pGeometry->m_VBV[i] = m_vertexBufferMap[vertexBufferIds[i]];
@@ -179,12 +248,11 @@ namespace CAULDRON_DX12
 
     // Creates buffers and the input assemby at the same time. It needs a list of attributes to use.
     //
-    void GLTFTexturesAndBuffers::CreateGeometry(const json &primitive, const std::vector<std::string> requiredAttributes, std::vector<std::string> &semanticNames, std::vector<D3D12_INPUT_ELEMENT_DESC> &layout, DefineList &defines, Geometry *pGeometry)
+    void GLTFTexturesAndBuffers::CreateGeometry(const tfPrimitives &primitive, const std::vector<std::string> requiredAttributes, std::vector<std::string> &semanticNames, std::vector<D3D12_INPUT_ELEMENT_DESC> &layout, DefineList &defines, Geometry *pGeometry)
     {
         // Get Index buffer view
         //
-        tfAccessor indexBuffer;
-        int indexBufferId = primitive.value("indices", -1);
+        int indexBufferId = primitive.m_indices;
         CreateIndexBuffer(indexBufferId, &pGeometry->m_NumIndices, &pGeometry->m_indexType, &pGeometry->m_IBV);
 
         // Create vertex buffers and input layout
@@ -193,13 +261,14 @@ namespace CAULDRON_DX12
         layout.resize(requiredAttributes.size());
         semanticNames.resize(requiredAttributes.size());
         pGeometry->m_VBV.resize(requiredAttributes.size());
-        const json &attributes = primitive.at("attributes");
+        pGeometry->m_attributeIds.resize(requiredAttributes.size());
         for (auto attrName : requiredAttributes)
         {
             // get vertex buffer view
             // 
-            const int attr = attributes.find(attrName).value();
+            const int attr = primitive.m_attributes.at(attrName);
             pGeometry->m_VBV[cnt] = m_vertexBufferMap[attr];
+            pGeometry->m_attributeIds[cnt] = attr;
 
             // Set define so the shaders knows this stream is available
             //
@@ -209,14 +278,14 @@ namespace CAULDRON_DX12
             uint32_t semanticIndex = 0;
             SplitGltfAttribute(attrName, &semanticNames[cnt], &semanticIndex);
 
-            const json &inAccessor = m_pGLTFCommon->m_pAccessors->at(attr);
+            const tfAccessor &inAccessor = m_pGLTFCommon->GetAccessor(attr);
 
             // Create Input Layout
             //
             D3D12_INPUT_ELEMENT_DESC l = {};
             l.SemanticName = semanticNames[cnt].c_str(); // we need to set it in the pipeline function (because of multithreading)
             l.SemanticIndex = semanticIndex;
-            l.Format = GetFormat(inAccessor["type"], inAccessor["componentType"]);
+            l.Format = IsUploadedAsFloat(attrName, attr) ? GetFormat(inAccessor.m_dimension, 5126) : GetVertexFormat(inAccessor, IsIntegerAttribute(attrName));
             l.InputSlot = (UINT)cnt;
             l.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA;
             l.InstanceDataStepRate = 0;
@@ -227,20 +296,115 @@ namespace CAULDRON_DX12
         }
     }
 
+    // Appends the per instance stream to a layout made by CreateGeometry(), the rows of the current and previous
+    // instance matrices are read from a single input slot. The stream is bound with the view AllocVisibleInstances() returns.
+    //
+    void GLTFTexturesAndBuffers::AddInstanceStream(std::vector<D3D12_INPUT_ELEMENT_DESC> &layout, DefineList &defines, Geometry *pGeometry)
+    {
+        pGeometry->m_instanceSlot = (int)pGeometry->m_VBV.size();
+
+        defines["HAS_INSTANCE_MATRIX"] = std::string("1");
+
+        for (UINT row = 0; row < 6; row++)
+        {
+            D3D12_INPUT_ELEMENT_DESC l = {};
+            l.SemanticName = "INSTANCE";
+            l.SemanticIndex = row;
+            l.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+            l.InputSlot = (UINT)pGeometry->m_instanceSlot;
+            l.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA;
+            l.InstanceDataStepRate = 1;
+            l.AlignedByteOffset = row * sizeof(math::Vector4);
+            layout.push_back(l);
+        }
+    }
+
     void GLTFTexturesAndBuffers::SetPerFrameConstants()
     {
         m_perFrameConstants = m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_frame), &m_pGLTFCommon->m_perFrameData);
     }
 
+    // Uploads the palettes of this frame, call it once per frame. The ring keeps the allocations of the frames in flight,
+    // so the palettes uploaded the frame before are still valid and are bound as the previous ones for the motion vectors.
+    //
     void GLTFTexturesAndBuffers::SetSkinningMatricesForSkeletons()
     {
+        m_prevSkeletonMatricesBuffer.swap(m_skeletonMatricesBuffer);
         for (auto &t : m_pGLTFCommon->m_worldSpaceSkeletonMats)
         {
-            std::vector<Matrix2> *matrices = &t.second;
-            D3D12_GPU_VIRTUAL_ADDRESS perSkeleton = m_pDynamicBufferRing->AllocConstantBuffer((uint32_t)(matrices->size() * sizeof(Matrix2)), matrices->data());
+            std::vector<SkinningMatrix> *matrices = &t.second;
+            D3D12_GPU_VIRTUAL_ADDRESS perSkeleton = m_pDynamicBufferRing->AllocConstantBuffer((uint32_t)(matrices->size() * sizeof(SkinningMatrix)), matrices->data());
 
             m_skeletonMatricesBuffer[t.first] = perSkeleton;
+
+            // the first frame has no previous palette
+            if (m_prevSkeletonMatricesBuffer.find(t.first) == m_prevSkeletonMatricesBuffer.end())
+                m_prevSkeletonMatricesBuffer[t.first] = perSkeleton;
+        }
+    }
+
+    // Uploads the vertices GLTFCommon::MorphMeshes() computed, call it every frame after MorphMeshes()
+    //
+    void GLTFTexturesAndBuffers::SetMorphedVertexStreams()
+    {
+        m_morphedVertexBufferMap.clear();
+        for (auto &t : m_pGLTFCommon->m_morphedStreams)
+        {
+            for (const tfMorphedStream &stream : t.second)
+            {
+                void *pData;
+                D3D12_VERTEX_BUFFER_VIEW vbv;
+                const uint32_t stride = stream.m_dimension * sizeof(float);
+                if (m_pDynamicBufferRing->AllocVertexBuffer(stream.m_count, stride, &pData, &vbv))
+                {
+                    memcpy(pData, stream.m_data.data(), stream.m_count * stride);
+                    m_morphedVertexBufferMap[std::make_pair(t.first, stream.m_accessor)] = vbv;
+                }
+            }
+        }
+    }
+
+    // Returns false if the node is not morphed, otherwise the vertex buffers of the geometry with the morphed ones replaced
+    //
+    bool GLTFTexturesAndBuffers::GetMorphedVertexBuffers(int nodeIndex, const Geometry &geometry, std::vector<D3D12_VERTEX_BUFFER_VIEW> *pVBV) const
+    {
+        auto it = m_morphedVertexBufferMap.lower_bound(std::make_pair(nodeIndex, -1));
+        if (it == m_morphedVertexBufferMap.end() || it->first.first != nodeIndex)
+            return false;
+
+        *pVBV = geometry.m_VBV;
+        for (size_t i = 0; i < geometry.m_attributeIds.size(); i++)
+        {
+            auto morphed = m_morphedVertexBufferMap.find(std::make_pair(nodeIndex, geometry.m_attributeIds[i]));
+            if (morphed != m_morphedVertexBufferMap.end())
+                (*pVBV)[i] = morphed->second;
         }
+        return true;
+    }
+
+    // Frustum culls the instances of a node with the given camera and writes the visible ones into this frame's per
+    // instance stream, returns how many of them to draw (0 for the nodes drawn by their batch). Nodes without
+    // instances get the identity instance.
+    //
+    uint32_t GLTFTexturesAndBuffers::AllocVisibleInstances(int nodeIndex, const math::Matrix4 &mCameraViewProj, D3D12_VERTEX_BUFFER_VIEW *pInstances)
+    {
+        if (!m_pGLTFCommon->IsNodeInstanced(nodeIndex))
+        {
+            *pInstances = m_identityInstance;
+            return 1;
+        }
+
+        // the nodes of a batch are drawn by its first node
+        uint32_t instanceCount = m_pGLTFCommon->GetNodeInstanceCount(nodeIndex);
+        if (instanceCount == 0)
+            return 0;
+
+        // room for all the instances, the visible ones are compacted at the start
+        InstanceMatrix *pVisible;
+        if (!m_pDynamicBufferRing->AllocVertexBuffer(instanceCount, sizeof(InstanceMatrix), (void **)&pVisible, pInstances))
+            return 0;
+
+        return m_pGLTFCommon->CullInstances(nodeIndex, mCameraViewProj, pVisible);
     }
 
     D3D12_GPU_VIRTUAL_ADDRESS GLTFTexturesAndBuffers::GetSkinningMatricesBuffer(int skinIndex)
@@ -252,4 +416,14 @@ namespace CAULDRON_DX12
 
         return it->second;
     }
+
+    D3D12_GPU_VIRTUAL_ADDRESS GLTFTexturesAndBuffers::GetPrevSkinningMatricesBuffer(int skinIndex)
+    {
+        auto it = m_prevSkeletonMatricesBuffer.find(skinIndex);
+
+        if (it == m_prevSkeletonMatricesBuffer.end())
+            return NULL;
+
+        return it->second;
+    }
 }
@@ -38,6 +38,8 @@ namespace CAULDRON_DX12
         uint32_t m_NumIndices;
         D3D12_INDEX_BUFFER_VIEW m_IBV;
         std::vector<D3D12_VERTEX_BUFFER_VIEW> m_VBV;
+        std::vector<int> m_attributeIds;    // accessor of each of the m_VBV
+        int m_instanceSlot = -1;            // input slot of the per instance stream, after the m_VBV, -1 if there is none
     };
 
     class GLTFTexturesAndBuffers
@@ -45,13 +47,10 @@ namespace CAULDRON_DX12
         Device     *m_pDevice;
         UploadHeap *m_pUploadHeap;
 
-        const json *m_pTextureNodes;
-
         std::vector<Texture> m_textures;
-        // texture id to image id, that is being referenced.
-        std::unordered_map<int, int> m_textureToImage;
 
         std::map<int, D3D12_GPU_VIRTUAL_ADDRESS> m_skeletonMatricesBuffer;
+        std::map<int, D3D12_GPU_VIRTUAL_ADDRESS> m_prevSkeletonMatricesBuffer;    // palettes of the previous frame, still alive in the ring
         std::vector<D3D12_CONSTANT_BUFFER_VIEW_DESC> m_InverseBindMatrices;
 
         StaticBufferPool *m_pStaticBufferPool;
@@ -59,8 +58,19 @@ namespace CAULDRON_DX12
 
         // maps GLTF ids into views
         std::map<int, D3D12_VERTEX_BUFFER_VIEW> m_vertexBufferMap;
+
+        // accessors some primitive has morph targets on, their vertex buffer is uploaded as floats for all the
+        // primitives that use them since there is a single buffer per accessor
+        std::vector<bool> m_morphedAccessors;
+        bool IsUploadedAsFloat(const std::string &attribute, int accessorId) const;
         std::map<int, D3D12_INDEX_BUFFER_VIEW> m_IndexBufferMap;
 
+        // vertex buffers of the morphed attributes for this frame, indexed by node and accessor
+        std::map<std::pair<int, int>, D3D12_VERTEX_BUFFER_VIEW> m_morphedVertexBufferMap;
+
+        // bound as the per instance stream of the nodes that share an instanced mesh but have no instances themselves
+        D3D12_VERTEX_BUFFER_VIEW m_identityInstance = {};
+
     public:
         GLTFCommon *m_pGLTFCommon;
 
@@ -73,13 +83,18 @@ namespace CAULDRON_DX12
 
         void CreateIndexBuffer(int indexBufferId, uint32_t *pNumIndices, DXGI_FORMAT *pIndexType, D3D12_INDEX_BUFFER_VIEW *pIBV);
         void CreateGeometry(int indexBufferId, std::vector<int> &vertexBufferIds, Geometry *pGeometry);
-        void CreateGeometry(const json &primitive, const std::vector<std::string > requiredAttributes, std::vector<std::string> &semanticNames, std::vector<D3D12_INPUT_ELEMENT_DESC> &layout, DefineList &defines, Geometry *pGeometry);
+        void CreateGeometry(const tfPrimitives &primitive, const std::vector<std::string > requiredAttributes, std::vector<std::string> &semanticNames, std::vector<D3D12_INPUT_ELEMENT_DESC> &layout, DefineList &defines, Geometry *pGeometry);
+        void AddInstanceStream(std::vector<D3D12_INPUT_ELEMENT_DESC> &layout, DefineList &defines, Geometry *pGeometry);
 
         void SetPerFrameConstants();
         void SetSkinningMatricesForSkeletons();
+        void SetMorphedVertexStreams();
+        bool GetMorphedVertexBuffers(int nodeIndex, const Geometry &geometry, std::vector<D3D12_VERTEX_BUFFER_VIEW> *pVBV) const;
+        uint32_t AllocVisibleInstances(int nodeIndex, const math::Matrix4 &mCameraViewProj, D3D12_VERTEX_BUFFER_VIEW *pInstances);
 
         Texture *GetTextureViewByID(int id);
         D3D12_GPU_VIRTUAL_ADDRESS GetSkinningMatricesBuffer(int skinIndex);
+        D3D12_GPU_VIRTUAL_ADDRESS GetPrevSkinningMatricesBuffer(int skinIndex);
         D3D12_GPU_VIRTUAL_ADDRESS GetPerFrameConstants() { return m_perFrameConstants; }
     };
 }
\ No newline at end of file
@@ -51,7 +51,7 @@ namespace CAULDRON_DX12
         m_pGLTFTexturesAndBuffers = pGLTFTexturesAndBuffers;
         m_bInvertedDepth = bInvertedDepth;
 
-        const json &j3 = pGLTFTexturesAndBuffers->m_pGLTFCommon->j3;
+        const GLTFCommon *pGLTFCommon = pGLTFTexturesAndBuffers->m_pGLTFCommon;
 
         /////////////////////////////////////////////
         // Create default material
@@ -78,48 +78,40 @@ namespace CAULDRON_DX12
 
         // Create materials (in a depth pass materials are still needed to handle non opaque textures
         //
-        if (j3.find("materials") != j3.end())
+        const std::vector<tfMaterial> &materials = pGLTFCommon->m_materials;
+        m_materialsData.resize(materials.size());
+        for (uint32_t i = 0; i < materials.size(); i++)
         {
-            const json &materials = j3["materials"];
+            const tfMaterial &material = materials[i];
 
-            m_materialsData.resize(materials.size());
-            for (uint32_t i = 0; i < materials.size(); i++)
-            {
-                const json &material = materials[i];
+            DepthMaterial *tfmat = &m_materialsData[i];
 
-                DepthMaterial *tfmat = &m_materialsData[i];
+            // Load material constants. This is a depth pass and we are only interested in the mask texture
+            //               
+            tfmat->m_doubleSided = material.m_doubleSided;
+            tfmat->m_defines["DEF_alphaMode_" + material.m_alphaMode] = std::to_string(1);
 
-                // Load material constants. This is a depth pass and we are only interested in the mask texture
-                //               
-                tfmat->m_doubleSided = GetElementBoolean(material, "doubleSided", false);
-                std::string alphaMode = GetElementString(material, "alphaMode", "OPAQUE");
-                tfmat->m_defines["DEF_alphaMode_" + alphaMode] = std::to_string(1);
+            // If transparent use the baseColorTexture for alpha
+            //
+            if (material.m_alphaMode == "MASK")
+            {
+                tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(material.m_alphaCutoff);
 
-                // If transparent use the baseColorTexture for alpha
-                //
-                if (alphaMode == "MASK")
+                if (material.m_metallicRoughness)
                 {
-                    tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(GetElementFloat(material, "alphaCutoff", 0.5));
-
-                    auto pbrMetallicRoughnessIt = material.find("pbrMetallicRoughness");
-                    if (pbrMetallicRoughnessIt != material.end())
+                    int id, texCoord;
+                    if (material.GetTexture("baseColorTexture", &id, &texCoord))
                     {
-                        const json &pbrMetallicRoughness = pbrMetallicRoughnessIt.value();
-
-                        int id = GetElementInt(pbrMetallicRoughness, "baseColorTexture/index", -1);
-                        if (id >= 0)
-                        {
-                            tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
-
-                            // allocate descriptor table for the texture
-                            tfmat->m_textureCount = 1;
-                            tfmat->m_pTransparency = new CBV_SRV_UAV();
-                            pHeaps->AllocCBV_SRV_UAVDescriptor(tfmat->m_textureCount, tfmat->m_pTransparency);
-                            Texture *pTexture = pGLTFTexturesAndBuffers->GetTextureViewByID(id);
-                            pTexture->CreateSRV(0, tfmat->m_pTransparency);
-                            tfmat->m_defines["ID_baseColorTexture"] = "0";
-                            tfmat->m_defines["ID_baseTexCoord"] = std::to_string(GetElementInt(pbrMetallicRoughness, "baseColorTexture/texCoord", 0));
-                        }
+                        tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
+
+                        // allocate descriptor table for the texture
+                        tfmat->m_textureCount = 1;
+                        tfmat->m_pTransparency = new CBV_SRV_UAV();
+                        pHeaps->AllocCBV_SRV_UAVDescriptor(tfmat->m_textureCount, tfmat->m_pTransparency);
+                        Texture *pTexture = pGLTFTexturesAndBuffers->GetTextureViewByID(id);
+                        pTexture->CreateSRV(0, tfmat->m_pTransparency);
+                        tfmat->m_defines["ID_baseColorTexture"] = "0";
+                        tfmat->m_defines["ID_baseTexCoord"] = std::to_string(texCoord);
                     }
                 }
             }
@@ -127,62 +119,63 @@ namespace CAULDRON_DX12
 
         // Load Meshes
         //
-        if (j3.find("meshes") != j3.end())
+        const std::vector<tfMesh> &meshes = pGLTFCommon->m_meshes;
+        m_meshes.resize(meshes.size());
+        for (uint32_t i = 0; i < meshes.size(); i++)
         {
-            const json &meshes = j3["meshes"];
-            m_meshes.resize(meshes.size());
-            for (uint32_t i = 0; i < meshes.size(); i++)
+            if (meshes[i].m_mergedAway)
+                continue;
+
+            DepthMesh *tfmesh = &m_meshes[i];
+
+            const std::vector<tfPrimitives> &primitives = meshes[i].m_pPrimitives;
+            tfmesh->m_pPrimitives.resize(primitives.size());
+            for (uint32_t p = 0; p < primitives.size(); p++)
             {
-                DepthMesh *tfmesh = &m_meshes[i];
+                const tfPrimitives &primitive = primitives[p];
+                DepthPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
 
-                const json &primitives = meshes[i]["primitives"];
-                tfmesh->m_pPrimitives.resize(primitives.size());
-                for (uint32_t p = 0; p < primitives.size(); p++)
+                ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, &primitive, pPrimitive, depthFormat]()
                 {
-                    const json &primitive = primitives[p];
-                    DepthPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
-
-                    ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, &primitive, pPrimitive, depthFormat]()
+                    // Set Material
+                    //
+                    pPrimitive->m_pMaterial = (primitive.m_material >= 0) ? &m_materialsData[primitive.m_material] : &m_defaultMaterial;
+
+                    // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
+                    //
+                    DefineList defines = pPrimitive->m_pMaterial->m_defines;
+
+                    // make a list of all the attribute names our pass requires, in the case of a depth pass we only need the position and a few other things. 
+                    //
+                    std::vector<std::string > requiredAttributes;
+                    for (auto const & it : primitive.m_attributes)
                     {
-                        // Set Material
-                        //
-                        auto mat = primitive.find("material");
-                        pPrimitive->m_pMaterial = (mat != primitive.end()) ? &m_materialsData[mat.value()] : &m_defaultMaterial;
-
-                        // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
-                        //
-                        DefineList defines = pPrimitive->m_pMaterial->m_defines;
-
-                        // make a list of all the attribute names our pass requires, in the case of a depth pass we only need the position and a few other things. 
-                        //
-                        std::vector<std::string > requiredAttributes;
-                        for (auto const & it : primitive["attributes"].items())
+                        const std::string semanticName = it.first;
+                        if (
+                            (semanticName == "POSITION") || 
+                            (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
+                            (semanticName.substr(0, 6) == "JOINTS") || // for skinning
+                            (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) // if there is transparency this will make sure we use the texture coordinates of that texture
+                            )
                         {
-                            const std::string semanticName = it.key();
-                            if (
-                                (semanticName == "POSITION") || 
-                                (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
-                                (semanticName.substr(0, 6) == "JOINTS") || // for skinning
-                                (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) // if there is transparency this will make sure we use the texture coordinates of that texture
-                                )
-                            {
-                                requiredAttributes.push_back(semanticName);
-                            }
+                            requiredAttributes.push_back(semanticName);
                         }
+                    }
 
-                        // create an input layout from the required attributes
-                        // shader's can tell the slots from the #defines
-                        //
-                        std::vector<std::string> semanticNames;
-                        std::vector<D3D12_INPUT_ELEMENT_DESC> layout;
-                        m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, semanticNames, layout, defines, &pPrimitive->m_geometry);
-
-                        // Create Pipeline
-                        //
-                        bool bUsingSkinning = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i) != -1;
-                        CreatePipeline(bUsingSkinning, layout, defines, pPrimitive, depthFormat);
-                    });
-                }
+                    // create an input layout from the required attributes
+                    // shader's can tell the slots from the #defines
+                    //
+                    std::vector<std::string> semanticNames;
+                    std::vector<D3D12_INPUT_ELEMENT_DESC> layout;
+                    m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, semanticNames, layout, defines, &pPrimitive->m_geometry);
+                    if (m_pGLTFTexturesAndBuffers->m_pGLTFCommon->IsMeshInstanced(i))
+                        m_pGLTFTexturesAndBuffers->AddInstanceStream(layout, defines, &pPrimitive->m_geometry);
+
+                    // Create Pipeline
+                    //
+                    bool bUsingSkinning = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i) != -1;
+                    CreatePipeline(bUsingSkinning, layout, defines, pPrimitive, depthFormat);
+                });
             }
         }
     }
@@ -340,6 +333,7 @@ namespace CAULDRON_DX12
     {
         per_frame *cbPerFrame;
         m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_frame), (void **)&cbPerFrame, &m_perFrameDesc[passIndex]);
+        m_pPerFrame[passIndex] = cbPerFrame;
         return cbPerFrame;
     }
 
@@ -359,64 +353,91 @@ namespace CAULDRON_DX12
         //
         std::vector<tfNode> *pNodes = &m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_nodes;
         Matrix2 *pNodesMatrices = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_worldSpaceMats.data();
+        std::vector<D3D12_VERTEX_BUFFER_VIEW> morphedVBV;
 
-        for (uint32_t i = 0; i < pNodes->size(); i++)
-        {
-            tfNode *pNode = &pNodes->at(i);
-            if ((pNode == NULL) || (pNode->meshIndex < 0))
-                continue;
+        // the instances are culled with the view projection of this pass (the camera of a shadow map, for instance)
+        math::Matrix4 mCameraViewProj = m_pPerFrame[passIndex]->mCameraCurrViewProj;
 
-            // skinning matrices constant buffer
-            D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
-
-            DepthMesh *pMesh = &m_meshes[pNode->meshIndex];
-            for (int p = 0; p < pMesh->m_pPrimitives.size(); p++)
+        // only the primitives the BVH finds in the frustum of the pass are drawn
+        GLTFCommon *pGLTFCommon = m_pGLTFTexturesAndBuffers->m_pGLTFCommon;
+        pGLTFCommon->CullPrimitives(mCameraViewProj, &m_visibleRanges);
+        for (const tfBvhRange &range : m_visibleRanges)
+        {
+            for (uint32_t item = range.m_firstItem; item < range.m_firstItem + range.m_itemCount; item++)
             {
-                DepthPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+                uint32_t i = pGLTFCommon->m_bvhItems[item].m_node;
+                tfNode *pNode = &pNodes->at(i);
+
+                // skinning matrices constant buffer
+                D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
 
-                if (pPrimitive->m_pipelineRender == NULL)
+                D3D12_VERTEX_BUFFER_VIEW instancesView;
+                uint32_t instanceCount = m_pGLTFTexturesAndBuffers->AllocVisibleInstances(i, mCameraViewProj, &instancesView);
+                if (instanceCount == 0)
                     continue;
 
-                // Bind indices and vertices using the right offsets into the buffer
-                //
-                Geometry *pGeometry = &pPrimitive->m_geometry;
+                // batches are drawn with identity world matrices, their instances are the world matrices of the nodes
+                const Matrix2 &drawMats = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetDrawMatrices(i);
 
-                pCommandList->IASetIndexBuffer(&pGeometry->m_IBV);
-                pCommandList->IASetVertexBuffers(0, (UINT)pGeometry->m_VBV.size(), pGeometry->m_VBV.data());
+                // an item is either one primitive or all the primitives of an instanced node
+                DepthMesh *pMesh = &m_meshes[pNode->meshIndex];
+                int primitive = pGLTFCommon->m_bvhItems[item].m_primitive;
+                int firstPrimitive = (primitive < 0) ? 0 : primitive;
+                int lastPrimitive = (primitive < 0) ? (int)pMesh->m_pPrimitives.size() : firstPrimitive + 1;
+                for (int p = firstPrimitive; p < lastPrimitive; p++)
+                {
+                    DepthPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
 
-                // Bind Descriptor sets
-                //                
-                pCommandList->SetGraphicsRootSignature(pPrimitive->m_rootSignature);
+                    if (pPrimitive->m_pipelineRender == NULL)
+                        continue;
 
-                // Set per Object constants
-                //
-                per_object cbPerObject;
-                cbPerObject.mWorld = pNodesMatrices[i].GetCurrent();
-                D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc = m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), &cbPerObject);
+                    // Bind indices and vertices using the right offsets into the buffer
+                    //
+                    Geometry *pGeometry = &pPrimitive->m_geometry;
 
-                if (pPrimitive->m_pMaterial->m_pTransparency == NULL)
-                {
-                    pCommandList->SetGraphicsRootConstantBufferView(0, m_perFrameDesc[passIndex]);
-                    pCommandList->SetGraphicsRootConstantBufferView(1, perObjectDesc);
-                    if (pPerSkeleton != 0)
-                        pCommandList->SetGraphicsRootConstantBufferView(2, pPerSkeleton);
-                }
-                else
-                {
-                    pCommandList->SetGraphicsRootConstantBufferView(0, m_perFrameDesc[passIndex]);
-                    pCommandList->SetGraphicsRootDescriptorTable(1, pPrimitive->m_pMaterial->m_pTransparency->GetGPU());
-                    pCommandList->SetGraphicsRootConstantBufferView(2, perObjectDesc);
-                    if (pPerSkeleton != 0)
-                        pCommandList->SetGraphicsRootConstantBufferView(3, pPerSkeleton);
-                }
+                    pCommandList->IASetIndexBuffer(&pGeometry->m_IBV);
+                    if (m_pGLTFTexturesAndBuffers->GetMorphedVertexBuffers(i, *pGeometry, &morphedVBV))
+                        pCommandList->IASetVertexBuffers(0, (UINT)morphedVBV.size(), morphedVBV.data());
+                    else
+                        pCommandList->IASetVertexBuffers(0, (UINT)pGeometry->m_VBV.size(), pGeometry->m_VBV.data());
+
+                    if (pGeometry->m_instanceSlot >= 0)
+                        pCommandList->IASetVertexBuffers(pGeometry->m_instanceSlot, 1, &instancesView);
 
-                // Bind Pipeline
-                //
-                pCommandList->SetPipelineState(pPrimitive->m_pipelineRender);
+                    // Bind Descriptor sets
+                    //                
+                    pCommandList->SetGraphicsRootSignature(pPrimitive->m_rootSignature);
 
-                // Draw
-                //
-                pCommandList->DrawIndexedInstanced(pGeometry->m_NumIndices, 1, 0, 0, 0);
+                    // Set per Object constants
+                    //
+                    per_object cbPerObject;
+                    cbPerObject.mWorld = drawMats.GetCurrent();
+                    D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc = m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), &cbPerObject);
+
+                    if (pPrimitive->m_pMaterial->m_pTransparency == NULL)
+                    {
+                        pCommandList->SetGraphicsRootConstantBufferView(0, m_perFrameDesc[passIndex]);
+                        pCommandList->SetGraphicsRootConstantBufferView(1, perObjectDesc);
+                        if (pPerSkeleton != 0)
+                            pCommandList->SetGraphicsRootConstantBufferView(2, pPerSkeleton);
+                    }
+                    else
+                    {
+                        pCommandList->SetGraphicsRootConstantBufferView(0, m_perFrameDesc[passIndex]);
+                        pCommandList->SetGraphicsRootDescriptorTable(1, pPrimitive->m_pMaterial->m_pTransparency->GetGPU());
+                        pCommandList->SetGraphicsRootConstantBufferView(2, perObjectDesc);
+                        if (pPerSkeleton != 0)
+                            pCommandList->SetGraphicsRootConstantBufferView(3, pPerSkeleton);
+                    }
+
+                    // Bind Pipeline
+                    //
+                    pCommandList->SetPipelineState(pPrimitive->m_pipelineRender);
+
+                    // Draw
+                    //
+                    pCommandList->DrawIndexedInstanced(pGeometry->m_NumIndices, instanceCount, 0, 0, 0);
+                }
             }
         }
     }
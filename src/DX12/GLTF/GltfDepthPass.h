@@ -78,12 +78,14 @@ namespace CAULDRON_DX12
 
         std::vector<DepthMesh> m_meshes;
         std::vector<DepthMaterial> m_materialsData;
+        std::vector<tfBvhRange> m_visibleRanges;     // scratch of Draw()
 
         DepthMaterial m_defaultMaterial;
 
         GLTFTexturesAndBuffers *m_pGLTFTexturesAndBuffers;
         D3D12_STATIC_SAMPLER_DESC m_samplerDesc;
         D3D12_GPU_VIRTUAL_ADDRESS m_perFrameDesc[5];
+        per_frame *m_pPerFrame[5] = {};    // filled by the caller, their view projection also culls the instances
 
         bool m_bInvertedDepth; 
 
@@ -19,12 +19,19 @@
 
 #include "stdafx.h"
 #include "glTFHelpers.h"
+#include "../common/GLTF/GltfPbrMaterial.h"
+#include "../common/GLTF/GltfStructures.h"
 
 namespace CAULDRON_DX12
 {
     DXGI_FORMAT GetFormat(const std::string &str, int id)
     {
-        if (str == "SCALAR")
+        return GetFormat(GetDimensions(str), id);
+    }
+
+    DXGI_FORMAT GetFormat(int dimension, int id)
+    {
+        if (dimension == 1)
         {
             switch (id)
             {
@@ -37,7 +44,7 @@ namespace CAULDRON_DX12
             case 5126: return DXGI_FORMAT_R32_FLOAT; //(FLOAT)
             }
         }
-        else if (str == "VEC2")
+        else if (dimension == 2)
         {
             switch (id)
             {
@@ -50,7 +57,7 @@ namespace CAULDRON_DX12
             case 5126: return DXGI_FORMAT_R32G32_FLOAT; //(FLOAT)
             }
         }
-        else if (str == "VEC3")
+        else if (dimension == 3)
         {
             switch (id)
             {
@@ -63,7 +70,7 @@ namespace CAULDRON_DX12
             case 5126: return DXGI_FORMAT_R32G32B32_FLOAT; //(FLOAT)
             }
         }
-        else if (str == "VEC4")
+        else if (dimension == 4)
         {
             switch (id)
             {
@@ -80,6 +87,32 @@ namespace CAULDRON_DX12
         return DXGI_FORMAT_UNKNOWN;
     }
 
+    // Format of a vertex attribute, the 8 and 16 bit normalized ones (KHR_mesh_quantization) are read as floats by the
+    // shaders. DX12 has no scaled formats so the non normalized ones that aren't integers (i.e. JOINTS) are uploaded as
+    // floats, see GLTFTexturesAndBuffers::LoadGeometry(). Their vec3 are read with 4 component formats.
+    //
+    DXGI_FORMAT GetVertexFormat(const tfAccessor &accessor, bool bInteger)
+    {
+        if (bInteger || !accessor.m_normalized || accessor.m_type == 4)
+            return GetFormat(accessor.m_dimension, accessor.m_componentType);
+
+        // BYTE, UNSIGNED_BYTE, SHORT, UNSIGNED_SHORT
+        static const DXGI_FORMAT normalized[4][4] =
+        {
+            { DXGI_FORMAT_R8_SNORM,       DXGI_FORMAT_R8_UNORM,       DXGI_FORMAT_R16_SNORM,          DXGI_FORMAT_R16_UNORM },
+            { DXGI_FORMAT_R8G8_SNORM,     DXGI_FORMAT_R8G8_UNORM,     DXGI_FORMAT_R16G16_SNORM,       DXGI_FORMAT_R16G16_UNORM },
+            { DXGI_FORMAT_R8G8B8A8_SNORM, DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R16G16B16A16_SNORM, DXGI_FORMAT_R16G16B16A16_UNORM },
+            { DXGI_FORMAT_R8G8B8A8_SNORM, DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R16G16B16A16_SNORM, DXGI_FORMAT_R16G16B16A16_UNORM },
+        };
+
+        const int dimension = accessor.m_dimension - 1;
+        const int type = accessor.m_componentType - 5120;
+        if (dimension < 0 || dimension > 3 || type < 0 || type > 3)
+            return DXGI_FORMAT_UNKNOWN;
+
+        return normalized[dimension][type];
+    }
+
     void CreateSamplerForPBR(uint32_t samplerIndex, D3D12_STATIC_SAMPLER_DESC *pSamplerDesc)
     {
         ZeroMemory(pSamplerDesc, sizeof(D3D12_STATIC_SAMPLER_DESC));
@@ -53,7 +53,7 @@ namespace CAULDRON_DX12
         m_normalBufferFormat = normalBufferFormat;
         m_motionVectorsBufferFormat = motionVectorsBufferFormat;
 
-        const json &j3 = pGLTFTexturesAndBuffers->m_pGLTFCommon->j3;
+        const GLTFCommon *pGLTFCommon = pGLTFTexturesAndBuffers->m_pGLTFCommon;
 
         /////////////////////////////////////////////
         // Create default material
@@ -63,149 +63,135 @@ namespace CAULDRON_DX12
 
         // Create materials (in a depth pass materials are still needed to handle non opaque textures
         //
-        if (j3.find("materials") != j3.end())
+        const std::vector<tfMaterial> &materials = pGLTFCommon->m_materials;
+        m_materialsData.resize(materials.size());
+        for (uint32_t i = 0; i < materials.size(); i++)
         {
-            const json &materials = j3["materials"];
+            const tfMaterial &material = materials[i];
 
-            m_materialsData.resize(materials.size());
-            for (uint32_t i = 0; i < materials.size(); i++)
-            {
-                const json &material = materials[i];
+            MotionVectorMaterial *tfmat = &m_materialsData[i];
 
-                MotionVectorMaterial *tfmat = &m_materialsData[i];
+            // Load material constants. This is a depth pass and we are only interested in the mask texture
+            //               
+            tfmat->m_doubleSided = material.m_doubleSided;
+            tfmat->m_defines["DEF_alphaMode_" + material.m_alphaMode] = std::to_string(1);
 
-                // Load material constants. This is a depth pass and we are only interested in the mask texture
-                //               
-                tfmat->m_doubleSided = GetElementBoolean(material, "doubleSided", false);
-                std::string alphaMode = GetElementString(material, "alphaMode", "OPAQUE");
-                tfmat->m_defines["DEF_alphaMode_" + alphaMode] = std::to_string(1);
+            std::vector<Texture *> textures;
 
-                std::vector<Texture *> textures;
+            if (normalBufferFormat != DXGI_FORMAT_UNKNOWN)
+            {
+                int index, texCoord;
+                if (material.GetTexture("normalTexture", &index, &texCoord))
+                {
+                    tfmat->m_defines["ID_normalTexture"] = std::to_string(textures.size());
+                    tfmat->m_defines["ID_normalTexCoord"] = std::to_string(texCoord);
+                    textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
+                }
+            }
+            
+            // If transparent use the baseColorTexture for alpha
+            //
+            if (material.m_alphaMode != "OPAQUE")
+            {
+                tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(material.m_alphaCutoff);
 
-                if (normalBufferFormat != DXGI_FORMAT_UNKNOWN)
+                if (material.m_metallicRoughness)
                 {
+                    tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
+
                     int index, texCoord;
-                    if (ProcessGetTextureIndexAndTextCoord(material, "normalTexture", &index, &texCoord))
+                    if (material.GetTexture("baseColorTexture", &index, &texCoord))
                     {
-                        tfmat->m_defines["ID_normalTexture"] = std::to_string(textures.size());
-                        tfmat->m_defines["ID_normalTexCoord"] = std::to_string(texCoord);
+                        tfmat->m_defines["ID_baseColorTexture"] = std::to_string(textures.size());
+                        tfmat->m_defines["ID_baseTexCoord"] = std::to_string(texCoord);
                         textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
                     }
                 }
-                
-                // If transparent use the baseColorTexture for alpha
-                //
-                if (alphaMode != "OPAQUE")
+                else if (material.m_specularGlossiness)
                 {
-                    tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(GetElementFloat(material, "alphaCutoff", 0.5));
-
-                    auto pbrMetallicRoughnessIt = material.find("pbrMetallicRoughness");
-                    if (pbrMetallicRoughnessIt != material.end())
-                    {
-                        tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
+                    tfmat->m_defines["MATERIAL_SPECULARGLOSSINESS"] = "1";
 
-                        int index, texCoord;
-                        if (ProcessGetTextureIndexAndTextCoord(*pbrMetallicRoughnessIt, "baseColorTexture", &index, &texCoord))
-                        {
-                            tfmat->m_defines["ID_baseColorTexture"] = std::to_string(textures.size());
-                            tfmat->m_defines["ID_baseTexCoord"] = std::to_string(texCoord);
-                            textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
-                        }
-                    }
-                    else
+                    int index, texCoord;
+                    if (material.GetTexture("diffuseTexture", &index, &texCoord))
                     {
-                        auto extensions = material.find("extensions");
-                        if (extensions != material.end())
-                        {
-                            auto KHR_materials_pbrSpecularGlossinessIt = extensions->find("KHR_materials_pbrSpecularGlossiness");
-                            if (KHR_materials_pbrSpecularGlossinessIt != extensions->end())
-                            {
-                                tfmat->m_defines["MATERIAL_SPECULARGLOSSINESS"] = "1";
-
-                                int index, texCoord;
-                                if (ProcessGetTextureIndexAndTextCoord(*KHR_materials_pbrSpecularGlossinessIt, "diffuseTexture", &index, &texCoord))
-                                {
-                                    tfmat->m_defines["ID_diffuseTexture"] = std::to_string(textures.size());
-                                    tfmat->m_defines["ID_diffuseTexCoord"] = std::to_string(texCoord);
-                                    textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
-                                }
-                            }
-                        }
+                        tfmat->m_defines["ID_diffuseTexture"] = std::to_string(textures.size());
+                        tfmat->m_defines["ID_diffuseTexCoord"] = std::to_string(texCoord);
+                        textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
                     }
-
-                }
-                
-                // allocate descriptor table for the texture
-                tfmat->m_textureCount = static_cast<int>(textures.size());
-                tfmat->m_pTextureTable = new CBV_SRV_UAV();
-                pHeaps->AllocCBV_SRV_UAVDescriptor(tfmat->m_textureCount, tfmat->m_pTextureTable);
-                for (int i = 0; i < textures.size();i++)
-                {
-                    textures[i]->CreateSRV(i, tfmat->m_pTextureTable);
                 }
 
             }
+            
+            // allocate descriptor table for the texture
+            tfmat->m_textureCount = static_cast<int>(textures.size());
+            tfmat->m_pTextureTable = new CBV_SRV_UAV();
+            pHeaps->AllocCBV_SRV_UAVDescriptor(tfmat->m_textureCount, tfmat->m_pTextureTable);
+            for (int i = 0; i < textures.size();i++)
+            {
+                textures[i]->CreateSRV(i, tfmat->m_pTextureTable);
+            }
+
         }
 
         // Load Meshes
         //
-        if (j3.find("meshes") != j3.end())
+        const std::vector<tfMesh> &meshes = pGLTFCommon->m_meshes;
+        m_meshes.resize(meshes.size());
+        for (uint32_t i = 0; i < meshes.size(); i++)
         {
-            const json &meshes = j3["meshes"];
-            const json &accessors = j3["accessors"];
-            m_meshes.resize(meshes.size());
-            for (uint32_t i = 0; i < meshes.size(); i++)
+            if (meshes[i].m_mergedAway)
+                continue;
+
+            MotionVectorMesh *tfmesh = &m_meshes[i];
+
+            const std::vector<tfPrimitives> &primitives = meshes[i].m_pPrimitives;
+            tfmesh->m_pPrimitives.resize(primitives.size());
+            for (uint32_t p = 0; p < primitives.size(); p++)
             {
-                MotionVectorMesh *tfmesh = &m_meshes[i];
+                const tfPrimitives &primitive = primitives[p];
+                MotionVectorPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
 
-                const json &primitives = meshes[i]["primitives"];
-                tfmesh->m_pPrimitives.resize(primitives.size());
-                for (uint32_t p = 0; p < primitives.size(); p++)
+                ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, pGLTFTexturesAndBuffers, normalBufferFormat, &primitive, pPrimitive]()
                 {
-                    const json &primitive = primitives[p];
-                    MotionVectorPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
-
-                    ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, pGLTFTexturesAndBuffers, normalBufferFormat, &primitive, pPrimitive]()
+                    // Set Material
+                    //
+                    pPrimitive->m_pMaterial = (primitive.m_material >= 0) ? &m_materialsData[primitive.m_material] : &m_defaultMaterial;
+
+                    // specify attributes needed to render the material
+                    //
+                    std::vector<std::string> requiredAttributes;
+                    for (auto const & it : primitive.m_attributes)
                     {
-                        // Set Material
-                        //
-                        auto mat = primitive.find("material");
-                        pPrimitive->m_pMaterial = (mat != primitive.end()) ? &m_materialsData[mat.value()] : &m_defaultMaterial;
-
-                        // specify attributes needed to render the material
-                        //
-                        std::vector<std::string> requiredAttributes;
-                        for (auto const & it : primitive["attributes"].items())
+                        const std::string semanticName = it.first;
+                        if (                            
+                            (semanticName == "POSITION") ||
+                            (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
+                            (semanticName.substr(0, 6) == "JOINTS")  || // for skinning
+                            (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) ||
+                            ((normalBufferFormat != DXGI_FORMAT_UNKNOWN) && ((semanticName == "NORMAL") || (semanticName == "TANGENT"))) // for obvious reasons
+                           )
                         {
-                            const std::string semanticName = it.key();
-                            if (                            
-                                (semanticName == "POSITION") ||
-                                (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
-                                (semanticName.substr(0, 6) == "JOINTS")  || // for skinning
-                                (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) ||
-                                ((normalBufferFormat != DXGI_FORMAT_UNKNOWN) && ((semanticName == "NORMAL") || (semanticName == "TANGENT"))) // for obvious reasons
-                               )
-                            {
-                                requiredAttributes.push_back(semanticName);
-                            }
+                            requiredAttributes.push_back(semanticName);
                         }
+                    }
 
-                        // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
-                        //
-                        DefineList defines = pPrimitive->m_pMaterial->m_defines;
-
-                        // Get input layout from glTF attributes
-                        //
-                        std::vector<std::string> semanticNames;
-                        std::vector<D3D12_INPUT_ELEMENT_DESC> layout;
-                        pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, semanticNames, layout, defines, &pPrimitive->m_Geometry);
-
-                        // Create Pipeline
-                        //
-                        bool bUsingSkinning = pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i) != -1;
-                        CreatePipeline(bUsingSkinning, layout, defines, pPrimitive);
-                    });
-                }
+                    // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
+                    //
+                    DefineList defines = pPrimitive->m_pMaterial->m_defines;
+
+                    // Get input layout from glTF attributes
+                    //
+                    std::vector<std::string> semanticNames;
+                    std::vector<D3D12_INPUT_ELEMENT_DESC> layout;
+                    pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, semanticNames, layout, defines, &pPrimitive->m_Geometry);
+                    if (pGLTFTexturesAndBuffers->m_pGLTFCommon->IsMeshInstanced(i))
+                        pGLTFTexturesAndBuffers->AddInstanceStream(layout, defines, &pPrimitive->m_Geometry);
+
+                    // Create Pipeline
+                    //
+                    bool bUsingSkinning = pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i) != -1;
+                    CreatePipeline(bUsingSkinning, layout, defines, pPrimitive);
+                });
             }
         }
     }
@@ -275,6 +261,11 @@ namespace CAULDRON_DX12
                 RTSlot[idx++].InitAsConstantBufferView(2, 0, D3D12_SHADER_VISIBILITY_VERTEX);          // t2 <- skinning matrices
                 defines["ID_SKINNING_MATRICES"] = "2";
             }
+            if (bUsingSkinning && defines.Has("HAS_MOTION_VECTORS"))
+            {
+                RTSlot[idx++].InitAsConstantBufferView(3, 0, D3D12_SHADER_VISIBILITY_VERTEX);          // b3 <- skinning matrices of the previous frame
+                defines["ID_PREV_SKINNING_MATRICES"] = "3";
+            }
 
             // the root signature contains 3 slots to be used        
             descRootSignature.NumParameters = idx;
@@ -384,6 +375,8 @@ namespace CAULDRON_DX12
         //
         std::vector<tfNode> *pNodes = &m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_nodes;
         Matrix2 *pNodesMatrices = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_worldSpaceMats.data();
+        std::vector<D3D12_VERTEX_BUFFER_VIEW> morphedVBV;
+        math::Matrix4 mCameraViewProj = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_perFrameData.mCameraCurrViewProj;
 
         for (uint32_t i = 0; i < pNodes->size(); i++)
         {
@@ -393,6 +386,16 @@ namespace CAULDRON_DX12
 
             // skinning matrices constant buffer
             D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
+            D3D12_GPU_VIRTUAL_ADDRESS pPrevPerSkeleton = m_pGLTFTexturesAndBuffers->GetPrevSkinningMatricesBuffer(pNode->skinIndex);
+            const bool bPrevSkinning = (pPerSkeleton != 0) && (m_motionVectorsBufferFormat != DXGI_FORMAT_UNKNOWN);
+
+            D3D12_VERTEX_BUFFER_VIEW instancesView;
+            uint32_t instanceCount = m_pGLTFTexturesAndBuffers->AllocVisibleInstances(i, mCameraViewProj, &instancesView);
+            if (instanceCount == 0)
+                continue;
+
+            // batches are drawn with identity world matrices, their instances are the world matrices of the nodes
+            const Matrix2 &drawMats = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetDrawMatrices(i);
 
             MotionVectorMesh *pMesh = &m_meshes[pNode->meshIndex];
             for (int p = 0; p < pMesh->m_pPrimitives.size(); p++)
@@ -405,8 +408,8 @@ namespace CAULDRON_DX12
                 // Set per Object constants
                 //
                 per_object cbPerObject;
-                cbPerObject.mCurrentWorld = pNodesMatrices[i].GetCurrent();
-                cbPerObject.mPreviousWorld = pNodesMatrices[i].GetPrevious();
+                cbPerObject.mCurrentWorld = drawMats.GetCurrent();
+                cbPerObject.mPreviousWorld = drawMats.GetPrevious();
 
                 D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc = m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), &cbPerObject);
 
@@ -415,7 +418,13 @@ namespace CAULDRON_DX12
                 Geometry *pGeometry = &pPrimitive->m_Geometry;              
 
                 pCommandList->IASetIndexBuffer(&pGeometry->m_IBV);
-                pCommandList->IASetVertexBuffers(0, (UINT)pGeometry->m_VBV.size(), pGeometry->m_VBV.data());
+                if (m_pGLTFTexturesAndBuffers->GetMorphedVertexBuffers(i, *pGeometry, &morphedVBV))
+                    pCommandList->IASetVertexBuffers(0, (UINT)morphedVBV.size(), morphedVBV.data());
+                else
+                    pCommandList->IASetVertexBuffers(0, (UINT)pGeometry->m_VBV.size(), pGeometry->m_VBV.data());
+
+                if (pGeometry->m_instanceSlot >= 0)
+                    pCommandList->IASetVertexBuffers(pGeometry->m_instanceSlot, 1, &instancesView);
 
                 // Bind Descriptor sets
                 //                
@@ -427,6 +436,8 @@ namespace CAULDRON_DX12
                     pCommandList->SetGraphicsRootConstantBufferView(1, perObjectDesc);
                     if (pPerSkeleton != 0)
                         pCommandList->SetGraphicsRootConstantBufferView(2, pPerSkeleton);
+                    if (bPrevSkinning)
+                        pCommandList->SetGraphicsRootConstantBufferView(3, pPrevPerSkeleton);
                 }
                 else
                 {
@@ -435,6 +446,8 @@ namespace CAULDRON_DX12
                     pCommandList->SetGraphicsRootConstantBufferView(2, perObjectDesc);
                     if (pPerSkeleton != 0)
                         pCommandList->SetGraphicsRootConstantBufferView(3, pPerSkeleton);
+                    if (bPrevSkinning)
+                        pCommandList->SetGraphicsRootConstantBufferView(4, pPrevPerSkeleton);
                 }
 
                 // Bind Pipeline
@@ -443,7 +456,7 @@ namespace CAULDRON_DX12
 
                 // Draw
                 //
-                pCommandList->DrawIndexedInstanced(pGeometry->m_NumIndices, 1, 0, 0, 0);
+                pCommandList->DrawIndexedInstanced(pGeometry->m_NumIndices, instanceCount, 0, 0, 0);
             }
         }
     }
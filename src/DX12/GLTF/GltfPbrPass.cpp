@@ -70,84 +70,84 @@ namespace CAULDRON_DX12
             CreateDescriptorTableForMaterialTextures(&m_defaultMaterial, texturesBase, pSkyDome, bUseShadowMask, bUseSSAOMask);
         }
 
-        const json &j3 = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->j3;
+        const GLTFCommon *pGLTFCommon = m_pGLTFTexturesAndBuffers->m_pGLTFCommon;
 
         // Load PBR 2.0 Materials
         //
-        const json &materials = j3["materials"];
+        const std::vector<tfMaterial> &materials = pGLTFCommon->m_materials;
         m_materialsData.resize(materials.size());
         for (uint32_t i = 0; i < materials.size(); i++)
         {
             PBRMaterial *tfmat = &m_materialsData[i];
 
-            // Get PBR material parameters and texture IDs
+            // Get PBR material parameters, they were read from the glTF at load time
             //
-            std::map<std::string, int> textureIds;
-            ProcessMaterials(materials[i], &tfmat->m_pbrMaterialParameters, textureIds);
+            tfmat->m_pbrMaterialParameters = materials[i].m_pbrMaterialParameters;
 
             // translate texture IDs into textureViews
             //
             std::map<std::string, Texture *> texturesBase;
-            for (auto const& value : textureIds)
-                texturesBase[value.first] = m_pGLTFTexturesAndBuffers->GetTextureViewByID(value.second);
+            for (auto const& value : materials[i].m_textures)
+                texturesBase[value.first] = m_pGLTFTexturesAndBuffers->GetTextureViewByID(value.second.m_index);
 
             CreateDescriptorTableForMaterialTextures(tfmat, texturesBase, pSkyDome, bUseShadowMask, bUseSSAOMask);
         }
 
         // Load Meshes
         //
-        if (j3.find("meshes") != j3.end())
+        const std::vector<tfMesh> &meshes = pGLTFCommon->m_meshes;
+        m_meshes.resize(meshes.size());
+        for (uint32_t i = 0; i < meshes.size(); i++)
         {
-            const json &meshes = j3["meshes"];
-            m_meshes.resize(meshes.size());
-            for (uint32_t i = 0; i < meshes.size(); i++)
+            if (meshes[i].m_mergedAway)
+                continue;
+
+            const std::vector<tfPrimitives> &primitives = meshes[i].m_pPrimitives;
+
+            // Loop through all the primitives (sets of triangles with a same material) and 
+            // 1) create an input layout for the geometry
+            // 2) then take its material and create a Root descriptor
+            // 3) With all the above, create a pipeline
+            //
+            PBRMesh *tfmesh = &m_meshes[i];
+            tfmesh->m_pPrimitives.resize(primitives.size());
+            for (uint32_t p = 0; p < primitives.size(); p++)
             {
-                const json &primitives = meshes[i]["primitives"];
+                const tfPrimitives &primitive = primitives[p];
+                PBRPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
 
-                // Loop through all the primitives (sets of triangles with a same material) and 
-                // 1) create an input layout for the geometry
-                // 2) then take its material and create a Root descriptor
-                // 3) With all the above, create a pipeline
-                //
-                PBRMesh *tfmesh = &m_meshes[i];
-                tfmesh->m_pPrimitives.resize(primitives.size());
-                for (uint32_t p = 0; p < primitives.size(); p++)
+                ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, &primitive, rtDefines, pPrimitive, bUseSSAOMask]()
                 {
-                    const json &primitive = primitives[p];
-                    PBRPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
-
-                    ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, &primitive, rtDefines, pPrimitive, bUseSSAOMask]()
-                    {
-                        // Sets primitive's material, or set a default material if none was specified in the GLTF
-                        //
-                        auto mat = primitive.find("material");
-                        pPrimitive->m_pMaterial = (mat != primitive.end()) ? &m_materialsData[mat.value()] : &m_defaultMaterial;
-
-                        // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
-                        //
-                        DefineList defines = pPrimitive->m_pMaterial->m_pbrMaterialParameters.m_defines + rtDefines;
-
-                        // make a list of all the attribute names our pass requires, in the case of PBR we need them all
-                        //
-                        std::vector<std::string> requiredAttributes;
-                        for (auto const & it : primitive["attributes"].items())
-                            requiredAttributes.push_back(it.key());
-
-                        // create an input layout from the required attributes
-                        // shader's can tell the slots from the #defines
-                        //
-                        std::vector<std::string> semanticNames;
-                        std::vector<D3D12_INPUT_ELEMENT_DESC> inputLayout;
-                        m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, semanticNames, inputLayout, defines, &pPrimitive->m_geometry);
-
-                        // Create the descriptors, the root signature and the pipeline
-                        //
-                        bool bUsingSkinning = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i) != -1;
-                        CreateRootSignature(bUsingSkinning, defines, pPrimitive, bUseSSAOMask);
-                        CreatePipeline(inputLayout, defines, pPrimitive);
-                        semanticNames;
-                    });
-                }
+                    // Sets primitive's material, or set a default material if none was specified in the GLTF
+                    //
+                    pPrimitive->m_pMaterial = (primitive.m_material >= 0) ? &m_materialsData[primitive.m_material] : &m_defaultMaterial;
+
+                    // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
+                    //
+                    DefineList defines = pPrimitive->m_pMaterial->m_pbrMaterialParameters.m_defines + rtDefines;
+
+                    // make a list of all the attribute names our pass requires, in the case of PBR we need them all
+                    //
+                    std::vector<std::string> requiredAttributes;
+                    for (auto const & it : primitive.m_attributes)
+                        requiredAttributes.push_back(it.first);
+
+                    // create an input layout from the required attributes
+                    // shader's can tell the slots from the #defines
+                    //
+                    std::vector<std::string> semanticNames;
+                    std::vector<D3D12_INPUT_ELEMENT_DESC> inputLayout;
+                    m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, semanticNames, inputLayout, defines, &pPrimitive->m_geometry);
+                    if (m_pGLTFTexturesAndBuffers->m_pGLTFCommon->IsMeshInstanced(i))
+                        m_pGLTFTexturesAndBuffers->AddInstanceStream(inputLayout, defines, &pPrimitive->m_geometry);
+
+                    // Create the descriptors, the root signature and the pipeline
+                    //
+                    bool bUsingSkinning = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i) != -1;
+                    CreateRootSignature(bUsingSkinning, defines, pPrimitive, bUseSSAOMask);
+                    CreatePipeline(inputLayout, defines, pPrimitive);
+                    semanticNames;
+                });
             }
         }
     }
@@ -296,7 +296,7 @@ namespace CAULDRON_DX12
     void GltfPbrPass::CreateRootSignature(bool bUsingSkinning, DefineList &defines, PBRPrimitives *pPrimitive, bool bUseSSAOMask)
     {              
         int rootParamCnt = 0;
-        CD3DX12_ROOT_PARAMETER rootParameter[6];
+        CD3DX12_ROOT_PARAMETER rootParameter[7];
         int desccRangeCnt = 0;
         CD3DX12_DESCRIPTOR_RANGE descRange[3];
 
@@ -338,7 +338,16 @@ namespace CAULDRON_DX12
             rootParamCnt++;
         }
 
-        // the root signature contains up to 5 slots to be used
+        // b3 <- Constant buffer holding the skinning matrices of the previous frame, only needed for the motion vectors
+        pPrimitive->m_bPrevSkinning = bUsingSkinning && defines.Has("HAS_MOTION_VECTORS");
+        if (pPrimitive->m_bPrevSkinning)
+        {
+            rootParameter[rootParamCnt].InitAsConstantBufferView(3, 0, D3D12_SHADER_VISIBILITY_VERTEX);
+            defines["ID_PREV_SKINNING_MATRICES"] = std::to_string(3);
+            rootParamCnt++;
+        }
+
+        // the root signature contains up to 6 slots to be used
         CD3DX12_ROOT_SIGNATURE_DESC descRootSignature = CD3DX12_ROOT_SIGNATURE_DESC();
         descRootSignature.pParameters = rootParameter;
         descRootSignature.NumParameters = rootParamCnt;
@@ -461,70 +470,85 @@ namespace CAULDRON_DX12
     //--------------------------------------------------------------------------------------
     void GltfPbrPass::BuildBatchLists(std::vector<BatchList> *pSolid, std::vector<BatchList> *pTransparent, bool bWireframe/*=false*/)
     {
-        // loop through nodes
+        // loop through the primitives the BVH finds in the frustum
         //
-        std::vector<tfNode> *pNodes = &m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_nodes;
-        Matrix2 *pNodesMatrices = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_worldSpaceMats.data();        
+        GLTFCommon *pGLTFCommon = m_pGLTFTexturesAndBuffers->m_pGLTFCommon;
+        std::vector<tfNode> *pNodes = &pGLTFCommon->m_nodes;
+        Matrix2 *pNodesMatrices = pGLTFCommon->m_worldSpaceMats.data();
 
-        for (uint32_t i = 0; i < pNodes->size(); i++)
+        pGLTFCommon->CullPrimitives(pGLTFCommon->m_perFrameData.mCameraCurrViewProj, &m_visibleRanges);
+        for (const tfBvhRange &range : m_visibleRanges)
         {
-            tfNode *pNode = &pNodes->at(i);
-            if ((pNode == NULL) || (pNode->meshIndex < 0))
-                continue;
-
-            // skinning matrices constant buffer
-            D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
-
-            math::Matrix4 mModelViewProj = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_perFrameData.mCameraCurrViewProj * pNodesMatrices[i].GetCurrent();
-
-            // loop through primitives
-            //
-            PBRMesh *pMesh = &m_meshes[pNode->meshIndex];
-            for (uint32_t p = 0; p < pMesh->m_pPrimitives.size(); p++)
+            for (uint32_t item = range.m_firstItem; item < range.m_firstItem + range.m_itemCount; item++)
             {
-                PBRPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+                uint32_t i = pGLTFCommon->m_bvhItems[item].m_node;
+                tfNode *pNode = &pNodes->at(i);
 
-                if ((bWireframe && pPrimitive->m_PipelineWireframeRender == NULL)
-                    ||(!bWireframe && pPrimitive->m_PipelineRender == NULL))
-                    continue;
+                // skinning matrices constant buffer
+                D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
+                D3D12_GPU_VIRTUAL_ADDRESS pPrevPerSkeleton = m_pGLTFTexturesAndBuffers->GetPrevSkinningMatricesBuffer(pNode->skinIndex);
 
-                // do frustum culling
-                //
-                tfPrimitives boundingBox = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_meshes[pNode->meshIndex].m_pPrimitives[p];
-                if (CameraFrustumToBoxCollision(mModelViewProj, boundingBox.m_center, boundingBox.m_radius))
+                // instanced nodes are culled per instance instead of per primitive, all their primitives share the visible instances
+                D3D12_VERTEX_BUFFER_VIEW instancesView;
+                uint32_t instanceCount = m_pGLTFTexturesAndBuffers->AllocVisibleInstances(i, pGLTFCommon->m_perFrameData.mCameraCurrViewProj, &instancesView);
+                if (instanceCount == 0)
                     continue;
 
-                PBRMaterialParameters *pPbrParams = &pPrimitive->m_pMaterial->m_pbrMaterialParameters;
+                // batches are drawn with identity world matrices, their instances are the world matrices of the nodes
+                const Matrix2 &drawMats = pGLTFCommon->GetDrawMatrices(i);
 
-                // Set per Object constants from material
-                //
-                per_object cbPerObject;
-                cbPerObject.mCurrentWorld = pNodesMatrices[i].GetCurrent();
-                cbPerObject.mPreviousWorld = pNodesMatrices[i].GetPrevious();
-                cbPerObject.m_pbrParams = pPbrParams->m_params;
-                D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc = m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), &cbPerObject);
-
-                // compute depth for sorting
-                //                
-                math::Vector4 v = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_meshes[pNode->meshIndex].m_pPrimitives[p].m_center;
-                float depth = (mModelViewProj * v).getW();
-
-                BatchList t;
-                t.m_depth = depth;
-                t.m_pPrimitive = pPrimitive;
-                t.m_perFrameDesc = m_pGLTFTexturesAndBuffers->GetPerFrameConstants();
-                t.m_perObjectDesc = perObjectDesc;
-                t.m_pPerSkeleton = pPerSkeleton;
-
-                // append primitive to list 
+                math::Matrix4 mModelViewProj = pGLTFCommon->m_perFrameData.mCameraCurrViewProj * pNodesMatrices[i].GetCurrent();
+
+                // loop through primitives, an item is either one primitive or all the primitives of an instanced node
                 //
-                if (pPbrParams->m_blending == false)
-                {
-                    pSolid->push_back(t);
-                }
-                else
+                PBRMesh *pMesh = &m_meshes[pNode->meshIndex];
+                int primitive = pGLTFCommon->m_bvhItems[item].m_primitive;
+                uint32_t firstPrimitive = (primitive < 0) ? 0 : (uint32_t)primitive;
+                uint32_t lastPrimitive = (primitive < 0) ? (uint32_t)pMesh->m_pPrimitives.size() : firstPrimitive + 1;
+                for (uint32_t p = firstPrimitive; p < lastPrimitive; p++)
                 {
-                    pTransparent->push_back(t);
+                    PBRPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+
+                    if ((bWireframe && pPrimitive->m_PipelineWireframeRender == NULL)
+                        ||(!bWireframe && pPrimitive->m_PipelineRender == NULL))
+                        continue;
+
+                    PBRMaterialParameters *pPbrParams = &pPrimitive->m_pMaterial->m_pbrMaterialParameters;
+
+                    // Set per Object constants from material
+                    //
+                    per_object cbPerObject;
+                    cbPerObject.mCurrentWorld = drawMats.GetCurrent();
+                    cbPerObject.mPreviousWorld = drawMats.GetPrevious();
+                    cbPerObject.m_pbrParams = pPbrParams->m_params;
+                    D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc = m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), &cbPerObject);
+
+                    // compute depth for sorting
+                    //                
+                    math::Vector4 v = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_meshes[pNode->meshIndex].m_pPrimitives[p].m_center;
+                    float depth = (mModelViewProj * v).getW();
+
+                    BatchList t;
+                    t.m_depth = depth;
+                    t.m_pPrimitive = pPrimitive;
+                    t.m_perFrameDesc = m_pGLTFTexturesAndBuffers->GetPerFrameConstants();
+                    t.m_perObjectDesc = perObjectDesc;
+                    t.m_pPerSkeleton = pPerSkeleton;
+                    t.m_pPrevPerSkeleton = pPrevPerSkeleton;
+                    t.m_nodeIndex = i;
+                    t.m_instancesView = instancesView;
+                    t.m_instanceCount = instanceCount;
+
+                    // append primitive to list 
+                    //
+                    if (pPbrParams->m_blending == false)
+                    {
+                        pSolid->push_back(t);
+                    }
+                    else
+                    {
+                        pTransparent->push_back(t);
+                    }
                 }
             }
         }
@@ -539,18 +563,29 @@ namespace CAULDRON_DX12
         ID3D12DescriptorHeap *pDescriptorHeaps[] = { m_pResourceViewHeaps->GetCBV_SRV_UAVHeap(), m_pResourceViewHeaps->GetSamplerHeap() };
         pCommandList->SetDescriptorHeaps(2, pDescriptorHeaps);
 
+        std::vector<D3D12_VERTEX_BUFFER_VIEW> morphedVBV;
         for (auto &t : *pBatchList)
         {
-            t.m_pPrimitive->DrawPrimitive(pCommandList, pShadowBufferSRV, t.m_perFrameDesc, t.m_perObjectDesc, t.m_pPerSkeleton, bWireframe);
+            bool bMorphed = m_pGLTFTexturesAndBuffers->GetMorphedVertexBuffers(t.m_nodeIndex, t.m_pPrimitive->m_geometry, &morphedVBV);
+            t.m_pPrimitive->DrawPrimitive(pCommandList, pShadowBufferSRV, t.m_perFrameDesc, t.m_perObjectDesc, t.m_pPerSkeleton, t.m_pPrevPerSkeleton, bWireframe, bMorphed ? &morphedVBV : NULL, &t.m_instancesView, t.m_instanceCount);
         }
     }
 
-    void PBRPrimitives::DrawPrimitive(ID3D12GraphicsCommandList *pCommandList, CBV_SRV_UAV *pShadowBufferSRV, D3D12_GPU_VIRTUAL_ADDRESS perFrameDesc, D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc, D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton, bool bWireframe)
+    void PBRPrimitives::DrawPrimitive(ID3D12GraphicsCommandList *pCommandList, CBV_SRV_UAV *pShadowBufferSRV, D3D12_GPU_VIRTUAL_ADDRESS perFrameDesc, D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc, D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton, D3D12_GPU_VIRTUAL_ADDRESS pPrevPerSkeleton, bool bWireframe, const std::vector<D3D12_VERTEX_BUFFER_VIEW> *pVBV, const D3D12_VERTEX_BUFFER_VIEW *pInstances, uint32_t instanceCount)
     {
-        // Bind indices and vertices using the right offsets into the buffer
+        // Bind indices and vertices using the right offsets into the buffer, morphed meshes bring their own vertex buffers
         //
+        if (pVBV == NULL)
+            pVBV = &m_geometry.m_VBV;
+
         pCommandList->IASetIndexBuffer(&m_geometry.m_IBV);
-        pCommandList->IASetVertexBuffers(0, (UINT)m_geometry.m_VBV.size(), m_geometry.m_VBV.data());
+        pCommandList->IASetVertexBuffers(0, (UINT)pVBV->size(), pVBV->data());
+
+        if (m_geometry.m_instanceSlot >= 0)
+        {
+            assert(pInstances != NULL);
+            pCommandList->IASetVertexBuffers(m_geometry.m_instanceSlot, 1, pInstances);
+        }
 
         // Bind Descriptor sets
         //
@@ -579,6 +614,10 @@ namespace CAULDRON_DX12
         if (pPerSkeleton != 0)
             pCommandList->SetGraphicsRootConstantBufferView(paramIndex++, pPerSkeleton);
 
+        // and the ones of the previous frame for the motion vectors
+        if (m_bPrevSkinning)
+            pCommandList->SetGraphicsRootConstantBufferView(paramIndex++, pPrevPerSkeleton);
+
         // Bind Pipeline
         //
         if (bWireframe)
@@ -588,6 +627,6 @@ namespace CAULDRON_DX12
 
         // Draw
         //
-        pCommandList->DrawIndexedInstanced(m_geometry.m_NumIndices, 1, 0, 0, 0);
+        pCommandList->DrawIndexedInstanced(m_geometry.m_NumIndices, instanceCount, 0, 0, 0);
     }
 }
\ No newline at end of file
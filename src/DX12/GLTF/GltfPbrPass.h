@@ -44,8 +44,9 @@ namespace CAULDRON_DX12
         ID3D12RootSignature	*m_RootSignature;
         ID3D12PipelineState	*m_PipelineRender;
         ID3D12PipelineState *m_PipelineWireframeRender;
+        bool m_bPrevSkinning = false;   // the root signature has a slot for the skinning matrices of the previous frame
 
-        void DrawPrimitive(ID3D12GraphicsCommandList *pCommandList, CBV_SRV_UAV *pShadowBufferSRV, D3D12_GPU_VIRTUAL_ADDRESS perSceneDesc, D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc, D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton, bool bWireframe);
+        void DrawPrimitive(ID3D12GraphicsCommandList *pCommandList, CBV_SRV_UAV *pShadowBufferSRV, D3D12_GPU_VIRTUAL_ADDRESS perSceneDesc, D3D12_GPU_VIRTUAL_ADDRESS perObjectDesc, D3D12_GPU_VIRTUAL_ADDRESS pPerSkeleton, D3D12_GPU_VIRTUAL_ADDRESS pPrevPerSkeleton, bool bWireframe, const std::vector<D3D12_VERTEX_BUFFER_VIEW> *pVBV = NULL, const D3D12_VERTEX_BUFFER_VIEW *pInstances = NULL, uint32_t instanceCount = 1);
     };
 
     struct PBRMesh
@@ -71,6 +72,10 @@ namespace CAULDRON_DX12
             D3D12_GPU_VIRTUAL_ADDRESS m_perFrameDesc;
             D3D12_GPU_VIRTUAL_ADDRESS m_perObjectDesc;
             D3D12_GPU_VIRTUAL_ADDRESS m_pPerSkeleton;
+            D3D12_GPU_VIRTUAL_ADDRESS m_pPrevPerSkeleton;
+            int m_nodeIndex;
+            D3D12_VERTEX_BUFFER_VIEW m_instancesView;   // visible instances, only used by the instanced pipelines
+            uint32_t m_instanceCount;
             operator float() { return -m_depth; }
         };
 
@@ -102,6 +107,7 @@ namespace CAULDRON_DX12
 
         std::vector<PBRMesh>     m_meshes;
         std::vector<PBRMaterial> m_materialsData;
+        std::vector<tfBvhRange>  m_visibleRanges;    // scratch of BuildBatchLists()
 
         GltfPbrPass::per_frame   m_cbPerFrame;
 
@@ -578,6 +578,30 @@ namespace CAULDRON_DX12
         return result;
     }
     
+    // Same as InitFromFile but the encoded image (png, jpg, dds...) is already in memory, i.e. embedded in a .glb
+    //
+    bool Texture::InitFromMemory(Device* pDevice, UploadHeap* pUploadHeap, const void *pData, size_t size, const char *pDebugName, bool useSRGB, float cutOff, D3D12_RESOURCE_FLAGS resourceFlags)
+    {
+        assert(m_pResource == NULL);
+
+        ImgLoader* img = CreateImageLoader(pData, size);
+        bool result = img->Load(pData, size, cutOff, &m_header);
+        if (result)
+        {
+            CreateTextureCommitted(pDevice, pDebugName, useSRGB, resourceFlags);
+            LoadAndUpload(pDevice, pUploadHeap, img, m_pResource);
+        }
+        else
+        {
+            Trace("Error loading texture from memory: %s", pDebugName);
+            assert(result && "Could not decode the image.");
+        }
+
+        delete(img);
+
+        return result;
+    }
+
     void Texture::CreateRawBufferUAV(uint32_t index, Texture* pCounterTex, CBV_SRV_UAV* pRV)
     {
         D3D12_RESOURCE_DESC resourceDesc = m_pResource->GetDesc();
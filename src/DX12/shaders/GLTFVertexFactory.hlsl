@@ -61,6 +61,17 @@ struct VS_INPUT_SCENE
 #ifdef HAS_JOINTS_1
     uint4 Joints1       :    JOINTS1;
 #endif
+
+    // per instance stream, the 3 rows of the current and previous matrices of the instance
+    //
+#ifdef HAS_INSTANCE_MATRIX
+    float4 InstanceRow0 :    INSTANCE0;
+    float4 InstanceRow1 :    INSTANCE1;
+    float4 InstanceRow2 :    INSTANCE2;
+    float4 PrevInstanceRow0 : INSTANCE3;
+    float4 PrevInstanceRow1 : INSTANCE4;
+    float4 PrevInstanceRow2 : INSTANCE5;
+#endif
 };
 
 //--------------------------------------------------------------------------------------
@@ -86,7 +97,21 @@ VS_OUTPUT_SCENE gltfVertexFactory(VS_INPUT_SCENE input)
     };
 #endif
 
-    matrix transMatrix = mul(GetWorldMatrix(), skinningMatrix);
+#ifdef HAS_INSTANCE_MATRIX
+    matrix instanceMatrix = matrix(input.InstanceRow0, input.InstanceRow1, input.InstanceRow2, float4(0, 0, 0, 1));
+    matrix prevInstanceMatrix = matrix(input.PrevInstanceRow0, input.PrevInstanceRow1, input.PrevInstanceRow2, float4(0, 0, 0, 1));
+#else
+    matrix instanceMatrix =
+    {
+        { 1, 0, 0, 0 },
+        { 0, 1, 0, 0 },
+        { 0, 0, 1, 0 },
+        { 0, 0, 0, 1 }
+    };
+    matrix prevInstanceMatrix = instanceMatrix;
+#endif
+
+    matrix transMatrix = mul(GetWorldMatrix(), mul(instanceMatrix, skinningMatrix));
     Output.WorldPos = mul(transMatrix, float4(input.Position, 1)).xyz;
     Output.svPosition = mul(GetCameraViewProj(), float4(Output.WorldPos, 1));
 
@@ -110,7 +135,7 @@ VS_OUTPUT_SCENE gltfVertexFactory(VS_INPUT_SCENE input)
 
     Output.svCurrPosition = Output.svPosition; // current's frame vertex position 
 
-    matrix prevTransMatrix = mul(GetPrevWorldMatrix(), prevSkinningMatrix);
+    matrix prevTransMatrix = mul(GetPrevWorldMatrix(), mul(prevInstanceMatrix, prevSkinningMatrix));
     float3 worldPrevPos = mul(prevTransMatrix, float4(input.Position, 1)).xyz;
     Output.svPrevPosition = mul(GetPrevCameraViewProj(), float4(worldPrevPos, 1));
 #endif
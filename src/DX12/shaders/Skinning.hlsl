@@ -22,36 +22,57 @@
 //--------------------------------------------------------------------------------------
 #ifdef ID_SKINNING_MATRICES
 
-struct Matrix2
+// skinning matrices are stored as the first three rows of the matrix, the last row is always (0,0,0,1)
+// so once blended it is (0,0,0,sum of the weights)
+struct SkinningMatrix
 {
-    matrix m_current;
-    matrix m_previous;
+    float4 m_rows[3];
 };
 
 cbuffer cbPerSkeleton : register(CB(ID_SKINNING_MATRICES))
 {
-    Matrix2 myPerSkeleton_u_ModelMatrix[200];
+    SkinningMatrix myPerSkeleton_u_ModelMatrix[200];
 };
 
+// the passes writing motion vectors bind the palette of the previous frame, the others don't need it
+#ifdef ID_PREV_SKINNING_MATRICES
+cbuffer cbPrevPerSkeleton : register(CB(ID_PREV_SKINNING_MATRICES))
+{
+    SkinningMatrix myPrevPerSkeleton_u_ModelMatrix[200];
+};
+#define PREV_SKINNING_PALETTE myPrevPerSkeleton_u_ModelMatrix
+#else
+#define PREV_SKINNING_PALETTE myPerSkeleton_u_ModelMatrix
+#endif
+
 matrix GetCurrentSkinningMatrix(float4 Weights, uint4 Joints)
 {
-    matrix skinningMatrix =
-        Weights.x * myPerSkeleton_u_ModelMatrix[Joints.x].m_current +
-        Weights.y * myPerSkeleton_u_ModelMatrix[Joints.y].m_current +
-        Weights.z * myPerSkeleton_u_ModelMatrix[Joints.z].m_current +
-        Weights.w * myPerSkeleton_u_ModelMatrix[Joints.w].m_current;
-    return skinningMatrix;
+    float4 rows[3];
+    [unroll]
+    for (int i = 0; i < 3; i++)
+    {
+        rows[i] =
+            Weights.x * myPerSkeleton_u_ModelMatrix[Joints.x].m_rows[i] +
+            Weights.y * myPerSkeleton_u_ModelMatrix[Joints.y].m_rows[i] +
+            Weights.z * myPerSkeleton_u_ModelMatrix[Joints.z].m_rows[i] +
+            Weights.w * myPerSkeleton_u_ModelMatrix[Joints.w].m_rows[i];
+    }
+    return matrix(rows[0], rows[1], rows[2], float4(0, 0, 0, dot(Weights, 1)));
 }
 
 matrix GetPreviousSkinningMatrix(float4 Weights, uint4 Joints)
 {
-    matrix skinningMatrix =
-        Weights.x * myPerSkeleton_u_ModelMatrix[Joints.x].m_previous +
-        Weights.y * myPerSkeleton_u_ModelMatrix[Joints.y].m_previous +
-        Weights.z * myPerSkeleton_u_ModelMatrix[Joints.z].m_previous +
-        Weights.w * myPerSkeleton_u_ModelMatrix[Joints.w].m_previous;
-    return skinningMatrix;
+    float4 rows[3];
+    [unroll]
+    for (int i = 0; i < 3; i++)
+    {
+        rows[i] =
+            Weights.x * PREV_SKINNING_PALETTE[Joints.x].m_rows[i] +
+            Weights.y * PREV_SKINNING_PALETTE[Joints.y].m_rows[i] +
+            Weights.z * PREV_SKINNING_PALETTE[Joints.z].m_rows[i] +
+            Weights.w * PREV_SKINNING_PALETTE[Joints.w].m_rows[i];
+    }
+    return matrix(rows[0], rows[1], rows[2], float4(0, 0, 0, dot(Weights, 1)));
 }
 
 #endif
-
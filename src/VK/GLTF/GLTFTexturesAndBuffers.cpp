@@ -42,30 +42,43 @@ namespace CAULDRON_VK
     {
         // load textures and create views
         //
-        if (m_pGLTFCommon->j3.find("images") != m_pGLTFCommon->j3.end())
+        const std::vector<tfImage> &images = m_pGLTFCommon->m_images;
+        if (!images.empty())
         {
-            m_pTextureNodes = &m_pGLTFCommon->j3["textures"];
-            const json &images = m_pGLTFCommon->j3["images"];
-            const json &materials = m_pGLTFCommon->j3["materials"];
-
             std::vector<Async *> taskQueue(images.size());
-            for (int textureIndex = 0; textureIndex < m_pTextureNodes->size(); textureIndex++) {
-                m_textureToImage[textureIndex] =   (*m_pTextureNodes)[textureIndex]["source"].get<int>();
-            }
             m_textures.resize(images.size());
             m_textureViews.resize(images.size());
             for (int imageIndex = 0; imageIndex < images.size(); imageIndex++)
             {
                 Texture *pTex = &m_textures[imageIndex];
-                std::string filename = m_pGLTFCommon->m_path + images[imageIndex]["uri"].get<std::string>();
+                const tfImage &image = images[imageIndex];
 
-                ExecAsyncIfThereIsAPool(pAsyncPool, [imageIndex, pTex, this, filename, materials]()
+                // images are either files or embedded, in a bufferView (.glb) or in a data URI
+                std::string filename;
+                const char *pImageData = NULL;
+                size_t imageSize = 0;
+                if (!image.m_uri.empty())
+                {
+                    filename = m_pGLTFCommon->m_path + image.m_uri;
+                }
+                else
+                {
+                    filename = image.m_name.empty() ? "image " + std::to_string(imageIndex) : image.m_name;
+                    bool result = m_pGLTFCommon->GetImageData(imageIndex, &pImageData, &imageSize);
+                    assert(result != false);
+                }
+
+                ExecAsyncIfThereIsAPool(pAsyncPool, [imageIndex, pTex, this, filename, pImageData, imageSize]()
                 {
                     bool useSRGB;
                     float cutOff;
-                    GetSrgbAndCutOffOfImageGivenItsUse(imageIndex, materials, m_textureToImage, &useSRGB, &cutOff);
+                    GetSrgbAndCutOffOfImageGivenItsUse(imageIndex, m_pGLTFCommon->m_materials, m_pGLTFCommon->m_textures, &useSRGB, &cutOff);
 
-                    bool result = pTex->InitFromFile(m_pDevice, m_pUploadHeap, filename.c_str(), useSRGB, 0 /*VkImageUsageFlags*/, cutOff);
+                    bool result;
+                    if (pImageData != NULL)
+                        result = pTex->InitFromMemory(m_pDevice, m_pUploadHeap, pImageData, imageSize, filename.c_str(), useSRGB, 0 /*VkImageUsageFlags*/, cutOff);
+                    else
+                        result = pTex->InitFromFile(m_pDevice, m_pUploadHeap, filename.c_str(), useSRGB, 0 /*VkImageUsageFlags*/, cutOff);
                     assert(result != false);
 
                     m_textures[imageIndex].CreateSRV(&m_textureViews[imageIndex]);
@@ -82,58 +95,109 @@ namespace CAULDRON_VK
         }        
     }
 
+    // JOINTS are read as integers by the shaders, the rest of the attributes as floats
+    //
+    static bool IsIntegerAttribute(const std::string &attribute)
+    {
+        return attribute.compare(0, 7, "JOINTS_") == 0;
+    }
+
+    // Morphed attributes are rewritten as floats every frame (see GLTFCommon::MorphMeshes()), so their static vertex
+    // buffer is converted to floats too and both can use the same input layout
+    //
+    bool GLTFTexturesAndBuffers::IsUploadedAsFloat(const std::string &attribute, int accessorId) const
+    {
+        return m_pGLTFCommon->GetAccessor(accessorId).m_componentType != 5126 && m_morphedAccessors[accessorId];
+    }
+
     void GLTFTexturesAndBuffers::LoadGeometry()
     {
-        if (m_pGLTFCommon->j3.find("meshes") != m_pGLTFCommon->j3.end())
+        // the format of a vertex buffer must suit all the primitives that share it
+        m_morphedAccessors.assign(m_pGLTFCommon->m_accessors.size(), false);
+        for (const tfMesh &mesh : m_pGLTFCommon->m_meshes)
         {
-            for (const json &mesh : m_pGLTFCommon->j3["meshes"])
+            for (const tfPrimitives &primitive : mesh.m_pPrimitives)
             {
-                for (const json &primitive : mesh["primitives"])
+                for (auto const &attribute : primitive.m_attributes)
                 {
-                    //
-                    //  Load vertex buffers
-                    //
-                    for (const json &attributeId : primitive["attributes"])
-                    {
-                        tfAccessor vertexBufferAcc;
-                        m_pGLTFCommon->GetBufferDetails(attributeId, &vertexBufferAcc);
+                    if (primitive.HasMorphTarget(attribute.first))
+                        m_morphedAccessors[attribute.second] = true;
+                }
+            }
+        }
+
+        for (const tfMesh &mesh : m_pGLTFCommon->m_meshes)
+        {
+            // the source meshes of MergeStaticMeshes() keep their primitives for GetMergedSource() only
+            if (mesh.m_mergedAway)
+                continue;
+
+            for (const tfPrimitives &primitive : mesh.m_pPrimitives)
+            {
+                //
+                //  Load vertex buffers
+                //
+                for (auto const &attribute : primitive.m_attributes)
+                {
+                    int attributeId = attribute.second;
+                    if (m_vertexBufferMap.find(attributeId) != m_vertexBufferMap.end())
+                        continue;
 
-                        VkDescriptorBufferInfo vbv;
-                        m_pStaticBufferPool->AllocBuffer(vertexBufferAcc.m_count, vertexBufferAcc.m_stride, vertexBufferAcc.m_data, &vbv);
+                    const tfAccessor &vertexBufferAcc = m_pGLTFCommon->GetAccessor(attributeId);
 
-                        m_vertexBufferMap[attributeId] = vbv;
+                    // quantized attributes stay quantized, interleaved ones are copied into their own buffer
+                    void *pData;
+                    VkDescriptorBufferInfo vbv;
+                    if (IsUploadedAsFloat(attribute.first, attributeId))
+                    {
+                        m_pStaticBufferPool->AllocBuffer(vertexBufferAcc.m_count, vertexBufferAcc.m_dimension * sizeof(float), &pData, &vbv);
+                        DequantizeAccessor(vertexBufferAcc, (float *)pData);
                     }
+                    else
+                    {
+                        const int stride = GetVertexStride(vertexBufferAcc);
+                        m_pStaticBufferPool->AllocBuffer(vertexBufferAcc.m_count, stride, &pData, &vbv);
+                        CopyAccessorElements(vertexBufferAcc, stride, pData);
+                    }
+
+                    m_vertexBufferMap[attributeId] = vbv;
+                }
+
+                //
+                //  Load index buffers
+                //
+                int indexAcc = primitive.m_indices;
+                if (indexAcc >= 0)
+                {
+                    const tfAccessor &indexBufferAcc = m_pGLTFCommon->GetAccessor(indexAcc);
 
-                    //
-                    //  Load index buffers
-                    //
-                    int indexAcc = primitive.value("indices", -1);
-                    if (indexAcc >= 0)
+                    VkDescriptorBufferInfo ibv;
+
+                    // Some exporters use 1-byte indices, need to convert them to shorts since the GPU doesn't support 1-byte indices
+                    if (indexBufferAcc.m_stride == 1)
+                    {
+                        unsigned short *pIndices = (unsigned short *)malloc(indexBufferAcc.m_count * (2 * indexBufferAcc.m_stride));
+                        for (int i = 0; i < indexBufferAcc.m_count; i++)
+                            pIndices[i] = ((unsigned char *)indexBufferAcc.m_data)[i];
+                        m_pStaticBufferPool->AllocBuffer(indexBufferAcc.m_count, 2 * indexBufferAcc.m_stride, pIndices, &ibv);
+                        free(pIndices);
+                    }
+                    else
                     {
-                        tfAccessor indexBufferAcc;
-                        m_pGLTFCommon->GetBufferDetails(indexAcc, &indexBufferAcc);
-
-                        VkDescriptorBufferInfo ibv;
-
-                        // Some exporters use 1-byte indices, need to convert them to shorts since the GPU doesn't support 1-byte indices
-                        if (indexBufferAcc.m_stride == 1)
-                        {
-                            unsigned short *pIndices = (unsigned short *)malloc(indexBufferAcc.m_count * (2 * indexBufferAcc.m_stride));
-                            for (int i = 0; i < indexBufferAcc.m_count; i++)
-                                pIndices[i] = ((unsigned char *)indexBufferAcc.m_data)[i];
-                            m_pStaticBufferPool->AllocBuffer(indexBufferAcc.m_count, 2 * indexBufferAcc.m_stride, pIndices, &ibv);
-                            free(pIndices);
-                        }
-                        else
-                        {
-                            m_pStaticBufferPool->AllocBuffer(indexBufferAcc.m_count, indexBufferAcc.m_stride, indexBufferAcc.m_data, &ibv);
-                        }
-
-                        m_IndexBufferMap[indexAcc] = ibv;
+                        m_pStaticBufferPool->AllocBuffer(indexBufferAcc.m_count, indexBufferAcc.m_stride, indexBufferAcc.m_data, &ibv);
                     }
+
+                    m_IndexBufferMap[indexAcc] = ibv;
                 }
             }
         }
+
+        if (!m_pGLTFCommon->m_nodeInstances.empty() || !m_pGLTFCommon->m_nodeBatches.empty())
+        {
+            InstanceMatrix identity;
+            identity.Set(math::Matrix4::identity());
+            m_pStaticBufferPool->AllocBuffer(1, sizeof(InstanceMatrix), &identity, &m_identityInstance);
+        }
     }
 
     void GLTFTexturesAndBuffers::OnDestroy()
@@ -147,7 +211,7 @@ namespace CAULDRON_VK
 
     VkImageView GLTFTexturesAndBuffers::GetTextureViewByID(int id)
     {
-        int tex = m_pTextureNodes->at(id)["source"];
+        int tex = m_pGLTFCommon->m_textures[id].m_source;
         return m_textureViews[tex];
     }
 
@@ -156,8 +220,7 @@ namespace CAULDRON_VK
     //
     void GLTFTexturesAndBuffers::CreateIndexBuffer(int indexBufferId, uint32_t *pNumIndices, VkIndexType *pIndexType, VkDescriptorBufferInfo *pIBV)
     {
-        tfAccessor indexBuffer;
-        m_pGLTFCommon->GetBufferDetails(indexBufferId, &indexBuffer);
+        const tfAccessor &indexBuffer = m_pGLTFCommon->GetAccessor(indexBufferId);
 
         *pNumIndices = indexBuffer.m_count;
         *pIndexType = (indexBuffer.m_stride == 4) ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
@@ -174,6 +237,7 @@ namespace CAULDRON_VK
 
         // load the rest of the buffers onto the GPU
         pGeometry->m_VBV.resize(vertexBufferIds.size());
+        pGeometry->m_attributeIds = vertexBufferIds;
         for (int i = 0; i < vertexBufferIds.size(); i++)
         {
             pGeometry->m_VBV[i] = m_vertexBufferMap[vertexBufferIds[i]];
@@ -182,12 +246,11 @@ namespace CAULDRON_VK
 
     // Creates buffers and the input assemby at the same time. It needs a list of attributes to use.
     //
-    void GLTFTexturesAndBuffers::CreateGeometry(const json &primitive, const std::vector<std::string> requiredAttributes, std::vector<VkVertexInputAttributeDescription> &layout, DefineList &defines, Geometry *pGeometry)
+    void GLTFTexturesAndBuffers::CreateGeometry(const tfPrimitives &primitive, const std::vector<std::string> requiredAttributes, std::vector<VkVertexInputAttributeDescription> &layout, DefineList &defines, Geometry *pGeometry)
     {
         // Get Index buffer view
         //
-        tfAccessor indexBuffer;
-        int indexBufferId = primitive.value("indices", -1);
+        int indexBufferId = primitive.m_indices;
         CreateIndexBuffer(indexBufferId, &pGeometry->m_NumIndices, &pGeometry->m_indexType, &pGeometry->m_IBV);
 
         // Create vertex buffers and input layout
@@ -195,24 +258,25 @@ namespace CAULDRON_VK
         int cnt = 0;
         layout.resize(requiredAttributes.size());
         pGeometry->m_VBV.resize(requiredAttributes.size());
-        const json &attributes = primitive.at("attributes");
+        pGeometry->m_attributeIds.resize(requiredAttributes.size());
         for (auto attrName : requiredAttributes)
         {
             // get vertex buffer view
             // 
-            const int attr = attributes.find(attrName).value();
+            const int attr = primitive.m_attributes.at(attrName);
             pGeometry->m_VBV[cnt] = m_vertexBufferMap[attr];
+            pGeometry->m_attributeIds[cnt] = attr;
 
             // let the compiler know we have this stream
             defines[std::string("ID_") + attrName] = std::to_string(cnt);
 
-            const json &inAccessor = m_pGLTFCommon->m_pAccessors->at(attr);
+            const tfAccessor &inAccessor = m_pGLTFCommon->GetAccessor(attr);
 
             // Create Input Layout
             //
             VkVertexInputAttributeDescription l = {};
             l.location = (uint32_t)cnt;
-            l.format = GetFormat(inAccessor["type"], inAccessor["componentType"]);
+            l.format = IsUploadedAsFloat(attrName, attr) ? GetFormat(inAccessor.m_dimension, 5126) : GetVertexFormat(inAccessor, IsIntegerAttribute(attrName));
             l.offset = 0;
             l.binding = cnt;
             layout[cnt]=l;
@@ -221,6 +285,52 @@ namespace CAULDRON_VK
         }
     }
 
+    // Appends the per instance stream to a layout made by CreateGeometry(), the rows of the current and previous
+    // instance matrices are read from a single binding. The stream is bound with the buffer AllocVisibleInstances() returns.
+    //
+    void GLTFTexturesAndBuffers::AddInstanceStream(std::vector<VkVertexInputAttributeDescription> &layout, DefineList &defines, Geometry *pGeometry)
+    {
+        uint32_t location = (uint32_t)layout.size();
+        pGeometry->m_instanceBinding = (int)pGeometry->m_VBV.size();
+
+        defines["ID_INSTANCE_MATRIX"] = std::to_string(location);
+
+        for (uint32_t row = 0; row < 6; row++)
+        {
+            VkVertexInputAttributeDescription l = {};
+            l.location = location + row;
+            l.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+            l.offset = row * sizeof(math::Vector4);
+            l.binding = (uint32_t)pGeometry->m_instanceBinding;
+            layout.push_back(l);
+        }
+    }
+
+    void GetVertexInputBindings(const std::vector<VkVertexInputAttributeDescription> &layout, const Geometry &geometry, std::vector<VkVertexInputBindingDescription> *pBindings)
+    {
+        pBindings->clear();
+        for (const VkVertexInputAttributeDescription &attribute : layout)
+        {
+            if ((int)attribute.binding == geometry.m_instanceBinding)
+                continue;
+
+            VkVertexInputBindingDescription binding;
+            binding.binding = attribute.binding;
+            binding.stride = SizeOfFormat(attribute.format);
+            binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+            pBindings->push_back(binding);
+        }
+
+        if (geometry.m_instanceBinding >= 0)
+        {
+            VkVertexInputBindingDescription binding;
+            binding.binding = (uint32_t)geometry.m_instanceBinding;
+            binding.stride = sizeof(InstanceMatrix);
+            binding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+            pBindings->push_back(binding);
+        }
+    }
+
     void GLTFTexturesAndBuffers::SetPerFrameConstants()
     {
         per_frame *cbPerFrame;
@@ -232,17 +342,81 @@ namespace CAULDRON_VK
     {
         for (auto &t : m_pGLTFCommon->m_worldSpaceSkeletonMats)
         {
-            std::vector<Matrix2> *matrices = &t.second;
+            std::vector<SkinningMatrix> *matrices = &t.second;
 
             VkDescriptorBufferInfo perSkeleton = {};
-            Matrix2 *cbPerSkeleton;
-            uint32_t size = (uint32_t)(matrices->size() * sizeof(Matrix2));
+            SkinningMatrix *cbPerSkeleton;
+            uint32_t size = (uint32_t)(matrices->size() * sizeof(SkinningMatrix));
             m_pDynamicBufferRing->AllocConstantBuffer(size, (void **)&cbPerSkeleton, &perSkeleton);
             memcpy(cbPerSkeleton, matrices->data(), size);
             m_skeletonMatricesBuffer[t.first] = perSkeleton;
         }
     }
 
+    // Uploads the vertices GLTFCommon::MorphMeshes() computed, call it every frame after MorphMeshes()
+    //
+    void GLTFTexturesAndBuffers::SetMorphedVertexStreams()
+    {
+        m_morphedVertexBufferMap.clear();
+        for (auto &t : m_pGLTFCommon->m_morphedStreams)
+        {
+            for (const tfMorphedStream &stream : t.second)
+            {
+                void *pData;
+                VkDescriptorBufferInfo vbv;
+                const uint32_t stride = stream.m_dimension * sizeof(float);
+                if (m_pDynamicBufferRing->AllocVertexBuffer(stream.m_count, stride, &pData, &vbv))
+                {
+                    memcpy(pData, stream.m_data.data(), stream.m_count * stride);
+                    m_morphedVertexBufferMap[std::make_pair(t.first, stream.m_accessor)] = vbv;
+                }
+            }
+        }
+    }
+
+    // Returns false if the node is not morphed, otherwise the vertex buffers of the geometry with the morphed ones replaced
+    //
+    bool GLTFTexturesAndBuffers::GetMorphedVertexBuffers(int nodeIndex, const Geometry &geometry, std::vector<VkDescriptorBufferInfo> *pVBV) const
+    {
+        auto it = m_morphedVertexBufferMap.lower_bound(std::make_pair(nodeIndex, -1));
+        if (it == m_morphedVertexBufferMap.end() || it->first.first != nodeIndex)
+            return false;
+
+        *pVBV = geometry.m_VBV;
+        for (size_t i = 0; i < geometry.m_attributeIds.size(); i++)
+        {
+            auto morphed = m_morphedVertexBufferMap.find(std::make_pair(nodeIndex, geometry.m_attributeIds[i]));
+            if (morphed != m_morphedVertexBufferMap.end())
+                (*pVBV)[i] = morphed->second;
+        }
+        return true;
+    }
+
+    // Frustum culls the instances of a node with the given camera and writes the visible ones into this frame's per
+    // instance stream, returns how many of them to draw (0 for the nodes drawn by their batch). Nodes without
+    // instances get the identity instance.
+    //
+    uint32_t GLTFTexturesAndBuffers::AllocVisibleInstances(int nodeIndex, const math::Matrix4 &mCameraViewProj, VkDescriptorBufferInfo *pInstances)
+    {
+        if (!m_pGLTFCommon->IsNodeInstanced(nodeIndex))
+        {
+            *pInstances = m_identityInstance;
+            return 1;
+        }
+
+        // the nodes of a batch are drawn by its first node
+        uint32_t instanceCount = m_pGLTFCommon->GetNodeInstanceCount(nodeIndex);
+        if (instanceCount == 0)
+            return 0;
+
+        // room for all the instances, the visible ones are compacted at the start
+        InstanceMatrix *pVisible;
+        if (!m_pDynamicBufferRing->AllocVertexBuffer(instanceCount, sizeof(InstanceMatrix), (void **)&pVisible, pInstances))
+            return 0;
+
+        return m_pGLTFCommon->CullInstances(nodeIndex, mCameraViewProj, pVisible);
+    }
+
     VkDescriptorBufferInfo *GLTFTexturesAndBuffers::GetSkinningMatricesBuffer(int skinIndex)
     {
         auto it = m_skeletonMatricesBuffer.find(skinIndex);
@@ -35,29 +35,41 @@ namespace CAULDRON_VK
         uint32_t m_NumIndices;
         VkDescriptorBufferInfo m_IBV;
         std::vector<VkDescriptorBufferInfo> m_VBV;
+        std::vector<int> m_attributeIds;    // accessor of each of the m_VBV
+        int m_instanceBinding = -1;         // binding of the per instance stream, after the m_VBV, -1 if there is none
     };
 
+    // One binding per vertex stream, the rows of the instance matrices share the per instance binding
+    void GetVertexInputBindings(const std::vector<VkVertexInputAttributeDescription> &layout, const Geometry &geometry, std::vector<VkVertexInputBindingDescription> *pBindings);
+
     class GLTFTexturesAndBuffers
     {
         Device* m_pDevice;
         UploadHeap *m_pUploadHeap;
 
-        const json *m_pTextureNodes;
-
         std::vector<Texture> m_textures;
         std::vector<VkImageView> m_textureViews;
 
         std::map<int, VkDescriptorBufferInfo> m_skeletonMatricesBuffer;
-        // texture id to image id, that is being referenced.
-        std::unordered_map<int, int> m_textureToImage;
 
         StaticBufferPool *m_pStaticBufferPool;
         DynamicBufferRing *m_pDynamicBufferRing;
 
         // maps GLTF ids into views
         std::map<int, VkDescriptorBufferInfo> m_vertexBufferMap;
+
+        // accessors some primitive has morph targets on, their vertex buffer is uploaded as floats for all the
+        // primitives that use them since there is a single buffer per accessor
+        std::vector<bool> m_morphedAccessors;
+        bool IsUploadedAsFloat(const std::string &attribute, int accessorId) const;
         std::map<int, VkDescriptorBufferInfo> m_IndexBufferMap;
 
+        // vertex buffers of the morphed attributes for this frame, indexed by node and accessor
+        std::map<std::pair<int, int>, VkDescriptorBufferInfo> m_morphedVertexBufferMap;
+
+        // bound as the per instance stream when drawing a node without instances with an instanced pipeline
+        VkDescriptorBufferInfo m_identityInstance = {};
+
     public:
         GLTFCommon *m_pGLTFCommon;
 
@@ -70,12 +82,16 @@ namespace CAULDRON_VK
 
         void CreateIndexBuffer(int indexBufferId, uint32_t *pNumIndices, VkIndexType *pIndexType, VkDescriptorBufferInfo *pIBV);
         void CreateGeometry(int indexBufferId, std::vector<int> &vertexBufferIds, Geometry *pGeometry);
-        void CreateGeometry(const json &primitive, const std::vector<std::string> requiredAttributes, std::vector<VkVertexInputAttributeDescription> &layout, DefineList &defines, Geometry *pGeometry);
+        void CreateGeometry(const tfPrimitives &primitive, const std::vector<std::string> requiredAttributes, std::vector<VkVertexInputAttributeDescription> &layout, DefineList &defines, Geometry *pGeometry);
+        void AddInstanceStream(std::vector<VkVertexInputAttributeDescription> &layout, DefineList &defines, Geometry *pGeometry);
 
         VkImageView GetTextureViewByID(int id);
 
         VkDescriptorBufferInfo *GetSkinningMatricesBuffer(int skinIndex);
         void SetSkinningMatricesForSkeletons();
+        void SetMorphedVertexStreams();
+        bool GetMorphedVertexBuffers(int nodeIndex, const Geometry &geometry, std::vector<VkDescriptorBufferInfo> *pVBV) const;
+        uint32_t AllocVisibleInstances(int nodeIndex, const math::Matrix4 &mCameraViewProj, VkDescriptorBufferInfo *pInstances);
         void SetPerFrameConstants();
     };
 }
\ No newline at end of file
@@ -55,7 +55,7 @@ namespace CAULDRON_VK
         m_pGLTFTexturesAndBuffers = pGLTFTexturesAndBuffers;
         m_bInvertedDepth = invertedDepth;
 
-        const json &j3 = pGLTFTexturesAndBuffers->m_pGLTFCommon->j3;
+        const GLTFCommon *pGLTFCommon = pGLTFTexturesAndBuffers->m_pGLTFCommon;
 
         /////////////////////////////////////////////
         // Create default material
@@ -85,47 +85,39 @@ namespace CAULDRON_VK
 
         // Create materials (in a depth pass materials are still needed to handle non opaque textures
         //    
-        if (j3.find("materials") != j3.end())
+        const std::vector<tfMaterial> &materials = pGLTFCommon->m_materials;
+        m_materialsData.resize(materials.size());
+        for (uint32_t i = 0; i < materials.size(); i++)
         {
-            const json &materials = j3["materials"];
+            const tfMaterial &material = materials[i];
 
-            m_materialsData.resize(materials.size());
-            for (uint32_t i = 0; i < materials.size(); i++)
-            {
-                const json &material = materials[i];
+            DepthMaterial *tfmat = &m_materialsData[i];
 
-                DepthMaterial *tfmat = &m_materialsData[i];
+            // Load material constants. This is a depth pass and we are only interested in the mask texture
+            //               
+            tfmat->m_doubleSided = material.m_doubleSided;
+            tfmat->m_defines["DEF_alphaMode_" + material.m_alphaMode] = std::to_string(1);
 
-                // Load material constants. This is a depth pass and we are only interested in the mask texture
-                //               
-                tfmat->m_doubleSided = GetElementBoolean(material, "doubleSided", false);
-                std::string alphaMode = GetElementString(material, "alphaMode", "OPAQUE");
-                tfmat->m_defines["DEF_alphaMode_" + alphaMode] = std::to_string(1);
+            // If transparent use the baseColorTexture for alpha
+            //
+            if (material.m_alphaMode == "MASK")
+            {
+                tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(material.m_alphaCutoff);
 
-                // If transparent use the baseColorTexture for alpha
-                //
-                if (alphaMode == "MASK")
+                if (material.m_metallicRoughness)
                 {
-                    tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(GetElementFloat(material, "alphaCutoff", 0.5));
-
-                    auto pbrMetallicRoughnessIt = material.find("pbrMetallicRoughness");
-                    if (pbrMetallicRoughnessIt != material.end())
+                    int id, texCoord;
+                    if (material.GetTexture("baseColorTexture", &id, &texCoord))
                     {
-                        const json &pbrMetallicRoughness = pbrMetallicRoughnessIt.value();
-
-                        int id = GetElementInt(pbrMetallicRoughness, "baseColorTexture/index", -1);
-                        if (id >= 0)
-                        {
-                            tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
-
-                            // allocate descriptor table for the texture
-                            tfmat->m_textureCount = 1;
-                            tfmat->m_defines["ID_baseColorTexture"] = "0";
-                            tfmat->m_defines["ID_baseTexCoord"] = std::to_string(GetElementInt(pbrMetallicRoughness, "baseColorTexture/texCoord", 0));
-                            m_pResourceViewHeaps->AllocDescriptor(tfmat->m_textureCount, &m_sampler, &tfmat->m_descriptorSetLayout, &tfmat->m_descriptorSet);
-                            VkImageView textureView = pGLTFTexturesAndBuffers->GetTextureViewByID(id);
-                            SetDescriptorSet(m_pDevice->GetDevice(), 0, textureView, &m_sampler, tfmat->m_descriptorSet);
-                        }
+                        tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
+
+                        // allocate descriptor table for the texture
+                        tfmat->m_textureCount = 1;
+                        tfmat->m_defines["ID_baseColorTexture"] = "0";
+                        tfmat->m_defines["ID_baseTexCoord"] = std::to_string(texCoord);
+                        m_pResourceViewHeaps->AllocDescriptor(tfmat->m_textureCount, &m_sampler, &tfmat->m_descriptorSetLayout, &tfmat->m_descriptorSet);
+                        VkImageView textureView = pGLTFTexturesAndBuffers->GetTextureViewByID(id);
+                        SetDescriptorSet(m_pDevice->GetDevice(), 0, textureView, &m_sampler, tfmat->m_descriptorSet);
                     }
                 }
             }
@@ -133,69 +125,70 @@ namespace CAULDRON_VK
 
         // Load Meshes
         //
-        if (j3.find("meshes") != j3.end())
+        const std::vector<tfMesh> &meshes = pGLTFCommon->m_meshes;
+
+        m_meshes.resize(meshes.size());
+        for (uint32_t i = 0; i < meshes.size(); i++)
         {
-            const json &meshes = j3["meshes"];
+            if (meshes[i].m_mergedAway)
+                continue;
 
-            m_meshes.resize(meshes.size());
-            for (uint32_t i = 0; i < meshes.size(); i++)
+            DepthMesh *tfmesh = &m_meshes[i];
+            const std::vector<tfPrimitives> &primitives = meshes[i].m_pPrimitives;
+            tfmesh->m_pPrimitives.resize(primitives.size());
+
+            for (uint32_t p = 0; p < primitives.size(); p++)
             {
-                DepthMesh *tfmesh = &m_meshes[i];
-                const json &primitives = meshes[i]["primitives"];
-                tfmesh->m_pPrimitives.resize(primitives.size());
+                const tfPrimitives &primitive = primitives[p];
+                DepthPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
 
-                for (uint32_t p = 0; p < primitives.size(); p++)
+                ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, &primitive, pPrimitive]()
                 {
-                    const json &primitive = primitives[p];
-                    DepthPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
-
-                    ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, &primitive, pPrimitive]()
+                    // Set Material
+                    //
+                    if (primitive.m_material >= 0)
+                        pPrimitive->m_pMaterial = &m_materialsData[primitive.m_material];
+                    else
+                        pPrimitive->m_pMaterial = &m_defaultMaterial;
+
+                    // make a list of all the attribute names our pass requires, in the case of a depth pass we only need the position and a few other things. 
+                    //
+                    std::vector<std::string > requiredAttributes;
+                    for (auto const & it : primitive.m_attributes)
                     {
-                        // Set Material
-                        //
-                        auto mat = primitive.find("material");
-                        if (mat != primitive.end())
-                            pPrimitive->m_pMaterial = &m_materialsData[mat.value()];
-                        else
-                            pPrimitive->m_pMaterial = &m_defaultMaterial;
-
-                        // make a list of all the attribute names our pass requires, in the case of a depth pass we only need the position and a few other things. 
-                        //
-                        std::vector<std::string > requiredAttributes;
-                        for (auto const & it : primitive["attributes"].items())
+                        const std::string semanticName = it.first;
+                        if (
+                            (semanticName == "POSITION") ||
+                            (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
+                            (semanticName.substr(0, 6) == "JOINTS") || // for skinning
+                            (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) // if there is transparency this will make sure we use the texture coordinates of that texture
+                            )
                         {
-                            const std::string semanticName = it.key();
-                            if (
-                                (semanticName == "POSITION") ||
-                                (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
-                                (semanticName.substr(0, 6) == "JOINTS") || // for skinning
-                                (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) // if there is transparency this will make sure we use the texture coordinates of that texture
-                                )
-                            {
-                                requiredAttributes.push_back(semanticName);
-                            }
+                            requiredAttributes.push_back(semanticName);
                         }
+                    }
 
-                        // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
-                        //
-                        DefineList defines = pPrimitive->m_pMaterial->m_defines;
+                    // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
+                    //
+                    DefineList defines = pPrimitive->m_pMaterial->m_defines;
 
-                        // create an input layout from the required attributes
-                        // shader's can tell the slots from the #defines
-                        //
-                        std::vector<VkVertexInputAttributeDescription> inputLayout;
-                        m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, inputLayout, defines, &pPrimitive->m_geometry);
+                    // create an input layout from the required attributes
+                    // shader's can tell the slots from the #defines
+                    //
+                    std::vector<VkVertexInputAttributeDescription> inputLayout;
+                    m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, inputLayout, defines, &pPrimitive->m_geometry);
+                    if (m_pGLTFTexturesAndBuffers->m_pGLTFCommon->IsMeshInstanced(i))
+                        m_pGLTFTexturesAndBuffers->AddInstanceStream(inputLayout, defines, &pPrimitive->m_geometry);
 
-                        // Create Pipeline
-                        //
-                        {
-                            int skinId = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i);
-                            int inverseMatrixBufferSize = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetInverseBindMatricesBufferSizeByID(skinId);
-                            CreateDescriptors(inverseMatrixBufferSize, &defines, pPrimitive);
-                            CreatePipeline(inputLayout, defines, pPrimitive);
-                        }
-                    });
-                }
+                    // Create Pipeline
+                    //
+                    {
+                        int skinId = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i);
+                        int inverseMatrixBufferSize = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetInverseBindMatricesBufferSizeByID(skinId);
+                        CreateDescriptors(inverseMatrixBufferSize, &defines, pPrimitive);
+                        CreatePipeline(inputLayout, defines, pPrimitive);
+                    }
+                });
             }
         }
     }
@@ -321,13 +314,8 @@ namespace CAULDRON_VK
 
         // vertex input state
 
-        std::vector<VkVertexInputBindingDescription> vi_binding(layout.size());
-        for (int i = 0; i < layout.size(); i++)
-        {
-            vi_binding[i].binding = layout[i].binding;
-            vi_binding[i].stride = SizeOfFormat(layout[i].format);
-            vi_binding[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        }
+        std::vector<VkVertexInputBindingDescription> vi_binding;
+        GetVertexInputBindings(layout, pPrimitive->m_geometry, &vi_binding);
 
         VkPipelineVertexInputStateCreateInfo vi = {};
         vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -483,6 +471,7 @@ namespace CAULDRON_VK
     {
         per_frame *cbPerFrame;
         m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_frame), (void **)&cbPerFrame, &m_perFrameDesc);
+        m_pPerFrame = cbPerFrame;
 
         return cbPerFrame;
     }
@@ -500,58 +489,86 @@ namespace CAULDRON_VK
         //
         std::vector<tfNode> *pNodes = &m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_nodes;
         Matrix2 *pNodesMatrices = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_worldSpaceMats.data();
+        std::vector<VkDescriptorBufferInfo> morphedVBV;
 
-        for (uint32_t i = 0; i < pNodes->size(); i++)
-        {
-            tfNode *pNode = &pNodes->at(i);
-            if ((pNode == NULL) || (pNode->meshIndex < 0))
-                continue;
-
-            // skinning matrices constant buffer
-            VkDescriptorBufferInfo *pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
+        // the instances are culled with the view projection of this pass (the camera of a shadow map, for instance)
+        math::Matrix4 mCameraViewProj = m_pPerFrame->mCameraCurrViewProj;
 
-            DepthMesh *pMesh = &m_meshes[pNode->meshIndex];
-            for (int p = 0; p < pMesh->m_pPrimitives.size(); p++)
+        // only the primitives the BVH finds in the frustum of the pass are drawn
+        GLTFCommon *pGLTFCommon = m_pGLTFTexturesAndBuffers->m_pGLTFCommon;
+        pGLTFCommon->CullPrimitives(mCameraViewProj, &m_visibleRanges);
+        for (const tfBvhRange &range : m_visibleRanges)
+        {
+            for (uint32_t item = range.m_firstItem; item < range.m_firstItem + range.m_itemCount; item++)
             {
-                DepthPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+                uint32_t i = pGLTFCommon->m_bvhItems[item].m_node;
+                tfNode *pNode = &pNodes->at(i);
 
-                if (pPrimitive->m_pipeline == VK_NULL_HANDLE)
+                // skinning matrices constant buffer
+                VkDescriptorBufferInfo *pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
+
+                VkDescriptorBufferInfo instancesDesc;
+                uint32_t instanceCount = m_pGLTFTexturesAndBuffers->AllocVisibleInstances(i, mCameraViewProj, &instancesDesc);
+                if (instanceCount == 0)
                     continue;
 
-                // Set per Object constants
-                //
-                per_object *cbPerObject;
-                VkDescriptorBufferInfo perObjectDesc;
-                m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), (void **)&cbPerObject, &perObjectDesc);
-                cbPerObject->mWorld = pNodesMatrices[i].GetCurrent();
-
-                // Bind indices and vertices using the right offsets into the buffer
-                //
-                Geometry *pGeometry = &pPrimitive->m_geometry;
-                for (uint32_t i = 0; i < pGeometry->m_VBV.size(); i++)
+                // batches are drawn with identity world matrices, their instances are the world matrices of the nodes
+                const Matrix2 &drawMats = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetDrawMatrices(i);
+
+                // an item is either one primitive or all the primitives of an instanced node
+                DepthMesh *pMesh = &m_meshes[pNode->meshIndex];
+                int primitive = pGLTFCommon->m_bvhItems[item].m_primitive;
+                int firstPrimitive = (primitive < 0) ? 0 : primitive;
+                int lastPrimitive = (primitive < 0) ? (int)pMesh->m_pPrimitives.size() : firstPrimitive + 1;
+                for (int p = firstPrimitive; p < lastPrimitive; p++)
                 {
-                    vkCmdBindVertexBuffers(cmd_buf, i, 1, &pGeometry->m_VBV[i].buffer, &pGeometry->m_VBV[i].offset);
-                }
+                    DepthPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+
+                    if (pPrimitive->m_pipeline == VK_NULL_HANDLE)
+                        continue;
+
+                    // Set per Object constants
+                    //
+                    per_object *cbPerObject;
+                    VkDescriptorBufferInfo perObjectDesc;
+                    m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), (void **)&cbPerObject, &perObjectDesc);
+                    cbPerObject->mWorld = drawMats.GetCurrent();
+
+                    // Bind indices and vertices using the right offsets into the buffer
+                    //
+                    Geometry *pGeometry = &pPrimitive->m_geometry;
+                    const std::vector<VkDescriptorBufferInfo> *pVBV = &pGeometry->m_VBV;
+                    if (m_pGLTFTexturesAndBuffers->GetMorphedVertexBuffers(i, *pGeometry, &morphedVBV))
+                        pVBV = &morphedVBV;
+
+                    for (uint32_t v = 0; v < pVBV->size(); v++)
+                    {
+                        vkCmdBindVertexBuffers(cmd_buf, v, 1, &pVBV->at(v).buffer, &pVBV->at(v).offset);
+                    }
+
+                    if (pGeometry->m_instanceBinding >= 0)
+                        vkCmdBindVertexBuffers(cmd_buf, pGeometry->m_instanceBinding, 1, &instancesDesc.buffer, &instancesDesc.offset);
 
-                vkCmdBindIndexBuffer(cmd_buf, pGeometry->m_IBV.buffer, pGeometry->m_IBV.offset, pGeometry->m_indexType);
+                    vkCmdBindIndexBuffer(cmd_buf, pGeometry->m_IBV.buffer, pGeometry->m_IBV.offset, pGeometry->m_indexType);
 
-                // Bind Descriptor sets
-                //
-                VkDescriptorSet descriptorSets[2] = { pPrimitive->m_descriptorSet, pPrimitive->m_pMaterial->m_descriptorSet };
-                uint32_t descritorSetCount = 1 + (pPrimitive->m_pMaterial->m_textureCount > 0 ? 1 : 0);
+                    // Bind Descriptor sets
+                    //
+                    VkDescriptorSet descriptorSets[2] = { pPrimitive->m_descriptorSet, pPrimitive->m_pMaterial->m_descriptorSet };
+                    uint32_t descritorSetCount = 1 + (pPrimitive->m_pMaterial->m_textureCount > 0 ? 1 : 0);
 
-                uint32_t uniformOffsets[3] = { (uint32_t)m_perFrameDesc.offset,  (uint32_t)perObjectDesc.offset, (pPerSkeleton) ? (uint32_t)pPerSkeleton->offset : 0 };
-                uint32_t uniformOffsetsCount = (pPerSkeleton) ? 3 : 2;
+                    uint32_t uniformOffsets[3] = { (uint32_t)m_perFrameDesc.offset,  (uint32_t)perObjectDesc.offset, (pPerSkeleton) ? (uint32_t)pPerSkeleton->offset : 0 };
+                    uint32_t uniformOffsetsCount = (pPerSkeleton) ? 3 : 2;
 
-                vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPrimitive->m_pipelineLayout, 0, descritorSetCount, descriptorSets, uniformOffsetsCount, uniformOffsets);
+                    vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPrimitive->m_pipelineLayout, 0, descritorSetCount, descriptorSets, uniformOffsetsCount, uniformOffsets);
 
-                // Bind Pipeline
-                //
-                vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPrimitive->m_pipeline);
+                    // Bind Pipeline
+                    //
+                    vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pPrimitive->m_pipeline);
 
-                // Draw
-                //
-                vkCmdDrawIndexed(cmd_buf, pGeometry->m_NumIndices, 1, 0, 0, 0);
+                    // Draw
+                    //
+                    vkCmdDrawIndexed(cmd_buf, pGeometry->m_NumIndices, instanceCount, 0, 0, 0);
+                }
             }
         }
 
@@ -81,6 +81,7 @@ namespace CAULDRON_VK
 
         std::vector<DepthMesh> m_meshes;
         std::vector<DepthMaterial> m_materialsData;
+        std::vector<tfBvhRange> m_visibleRanges;     // scratch of Draw()
 
         DepthMaterial m_defaultMaterial;
 
@@ -89,6 +90,7 @@ namespace CAULDRON_VK
         VkRenderPass m_renderPass = VK_NULL_HANDLE;
         VkSampler m_sampler = VK_NULL_HANDLE;
         VkDescriptorBufferInfo m_perFrameDesc;
+        per_frame *m_pPerFrame = NULL;      // filled by the caller, its view projection also culls the instances
 
         bool                     m_bInvertedDepth;
 
@@ -19,12 +19,19 @@
 
 #include "stdafx.h"
 #include "GltfHelpers.h"
+#include "../common/GLTF/GltfPbrMaterial.h"
+#include "../common/GLTF/GltfStructures.h"
 
 namespace CAULDRON_VK
 {
     VkFormat GetFormat(const std::string &str, int id)
     {
-        if (str == "SCALAR")
+        return GetFormat(GetDimensions(str), id);
+    }
+
+    VkFormat GetFormat(int dimension, int id)
+    {
+        if (dimension == 1)
         {
             switch (id)
             {
@@ -37,7 +44,7 @@ namespace CAULDRON_VK
             case 5126: return VK_FORMAT_R32_SFLOAT; //(FLOAT)
             }
         }
-        else if (str == "VEC2")
+        else if (dimension == 2)
         {
             switch (id)
             {
@@ -50,7 +57,7 @@ namespace CAULDRON_VK
             case 5126: return VK_FORMAT_R32G32_SFLOAT; //(FLOAT)
             }
         }
-        else if (str == "VEC3")
+        else if (dimension == 3)
         {
             switch (id)
             {
@@ -63,7 +70,7 @@ namespace CAULDRON_VK
             case 5126: return VK_FORMAT_R32G32B32_SFLOAT; //(FLOAT)
             }
         }
-        else if (str == "VEC4")
+        else if (dimension == 4)
         {
             switch (id)
             {
@@ -80,6 +87,38 @@ namespace CAULDRON_VK
         return VK_FORMAT_UNDEFINED;
     }
 
+    // Format of a vertex attribute, the 8 and 16 bit ones (KHR_mesh_quantization) are read as floats by the shaders
+    // unless bInteger is set (i.e. JOINTS). Their vec3 are read with 4 component formats, see GetVertexStride()
+    //
+    VkFormat GetVertexFormat(const tfAccessor &accessor, bool bInteger)
+    {
+        if (bInteger || accessor.m_type == 4)
+            return GetFormat(accessor.m_dimension, accessor.m_componentType);
+
+        // BYTE, UNSIGNED_BYTE, SHORT, UNSIGNED_SHORT
+        static const VkFormat normalized[4][4] =
+        {
+            { VK_FORMAT_R8_SNORM,       VK_FORMAT_R8_UNORM,       VK_FORMAT_R16_SNORM,          VK_FORMAT_R16_UNORM },
+            { VK_FORMAT_R8G8_SNORM,     VK_FORMAT_R8G8_UNORM,     VK_FORMAT_R16G16_SNORM,       VK_FORMAT_R16G16_UNORM },
+            { VK_FORMAT_R8G8B8A8_SNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16B16A16_SNORM, VK_FORMAT_R16G16B16A16_UNORM },
+            { VK_FORMAT_R8G8B8A8_SNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16B16A16_SNORM, VK_FORMAT_R16G16B16A16_UNORM },
+        };
+        static const VkFormat scaled[4][4] =
+        {
+            { VK_FORMAT_R8_SSCALED,       VK_FORMAT_R8_USCALED,       VK_FORMAT_R16_SSCALED,          VK_FORMAT_R16_USCALED },
+            { VK_FORMAT_R8G8_SSCALED,     VK_FORMAT_R8G8_USCALED,     VK_FORMAT_R16G16_SSCALED,       VK_FORMAT_R16G16_USCALED },
+            { VK_FORMAT_R8G8B8A8_SSCALED, VK_FORMAT_R8G8B8A8_USCALED, VK_FORMAT_R16G16B16A16_SSCALED, VK_FORMAT_R16G16B16A16_USCALED },
+            { VK_FORMAT_R8G8B8A8_SSCALED, VK_FORMAT_R8G8B8A8_USCALED, VK_FORMAT_R16G16B16A16_SSCALED, VK_FORMAT_R16G16B16A16_USCALED },
+        };
+
+        const int dimension = accessor.m_dimension - 1;
+        const int type = accessor.m_componentType - 5120;
+        if (dimension < 0 || dimension > 3 || type < 0 || type > 3)
+            return VK_FORMAT_UNDEFINED;
+
+        return accessor.m_normalized ? normalized[dimension][type] : scaled[dimension][type];
+    }
+
     uint32_t SizeOfFormat(VkFormat format)
     {
         switch (format)
@@ -24,5 +24,7 @@
 namespace CAULDRON_VK
 {
     VkFormat GetFormat(const std::string &str, int id);
+    VkFormat GetFormat(int dimension, int id);
+    VkFormat GetVertexFormat(const tfAccessor &accessor, bool bInteger);
     uint32_t SizeOfFormat(VkFormat format);
 }
@@ -57,7 +57,7 @@ namespace CAULDRON_VK
         m_normalBufferFormat = normalBufferFormat;
         m_motionVectorsBufferFormat = motionVectorsBufferFormat;
 
-        const json &j3 = pGLTFTexturesAndBuffers->m_pGLTFCommon->j3;
+        const GLTFCommon *pGLTFCommon = pGLTFTexturesAndBuffers->m_pGLTFCommon;
 
         /////////////////////////////////////////////
         // Create default material
@@ -87,85 +87,71 @@ namespace CAULDRON_VK
 
         // Create materials (in a depth pass materials are still needed to handle non opaque textures
         //
-        if (j3.find("materials") != j3.end())
+        const std::vector<tfMaterial> &materials = pGLTFCommon->m_materials;
+        m_materialsData.resize(materials.size());
+        for (uint32_t i = 0; i < materials.size(); i++)
         {
-            const json &materials = j3["materials"];
+            const tfMaterial &material = materials[i];
 
-            m_materialsData.resize(materials.size());
-            for (uint32_t i = 0; i < materials.size(); i++)
-            {
-                const json &material = materials[i];
+            MotionVectorMaterial *tfmat = &m_materialsData[i];
 
-                MotionVectorMaterial *tfmat = &m_materialsData[i];
+            // Load material constants. This is a depth pass and we are only interested in the mask texture
+            //               
+            tfmat->m_doubleSided = material.m_doubleSided;
+            tfmat->m_defines["DEF_alphaMode_" + material.m_alphaMode] = std::to_string(1);
 
-                // Load material constants. This is a depth pass and we are only interested in the mask texture
-                //               
-                tfmat->m_doubleSided = GetElementBoolean(material, "doubleSided", false);
-                std::string alphaMode = GetElementString(material, "alphaMode", "OPAQUE");
-                tfmat->m_defines["DEF_alphaMode_" + alphaMode] = std::to_string(1);
+            std::vector<VkImageView> textures;
 
-                std::vector<VkImageView> textures;
+            if (normalBufferFormat != VK_FORMAT_UNDEFINED)
+            {
+                int index, texCoord;
+                if (material.GetTexture("normalTexture", &index, &texCoord))
+                {
+                    tfmat->m_defines["ID_normalTexture"] = std::to_string(textures.size());
+                    tfmat->m_defines["ID_normalTexCoord"] = std::to_string(texCoord);
+                    textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
+                }
+            }
 
-                if (normalBufferFormat != VK_FORMAT_UNDEFINED)
+            // If transparent use the baseColorTexture for alpha
+            //
+            if (material.m_alphaMode != "OPAQUE")
+            {
+                tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(material.m_alphaCutoff);
+
+                if (material.m_metallicRoughness)
                 {
+                    tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
+
                     int index, texCoord;
-                    if (ProcessGetTextureIndexAndTextCoord(material, "normalTexture", &index, &texCoord))
+                    if (material.GetTexture("baseColorTexture", &index, &texCoord))
                     {
-                        tfmat->m_defines["ID_normalTexture"] = std::to_string(textures.size());
-                        tfmat->m_defines["ID_normalTexCoord"] = std::to_string(texCoord);
+                        tfmat->m_defines["ID_baseColorTexture"] = std::to_string(textures.size());
+                        tfmat->m_defines["ID_baseTexCoord"] = std::to_string(texCoord);
                         textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
                     }
                 }
-
-                // If transparent use the baseColorTexture for alpha
-                //
-                if (alphaMode != "OPAQUE")
+                else if (material.m_specularGlossiness)
                 {
-                    tfmat->m_defines["DEF_alphaCutoff"] = std::to_string(GetElementFloat(material, "alphaCutoff", 0.5));
-
-                    auto pbrMetallicRoughnessIt = material.find("pbrMetallicRoughness");
-                    if (pbrMetallicRoughnessIt != material.end())
-                    {
-                        tfmat->m_defines["MATERIAL_METALLICROUGHNESS"] = "1";
+                    tfmat->m_defines["MATERIAL_SPECULARGLOSSINESS"] = "1";
 
-                        int index, texCoord;
-                        if (ProcessGetTextureIndexAndTextCoord(*pbrMetallicRoughnessIt, "baseColorTexture", &index, &texCoord))
-                        {
-                            tfmat->m_defines["ID_baseColorTexture"] = std::to_string(textures.size());
-                            tfmat->m_defines["ID_baseTexCoord"] = std::to_string(texCoord);
-                            textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
-                        }
-                    }
-                    else
+                    int index, texCoord;
+                    if (material.GetTexture("diffuseTexture", &index, &texCoord))
                     {
-                        auto extensions = material.find("extensions");
-                        if (extensions != material.end())
-                        {
-                            auto KHR_materials_pbrSpecularGlossinessIt = extensions->find("KHR_materials_pbrSpecularGlossiness");
-                            if (KHR_materials_pbrSpecularGlossinessIt != extensions->end())
-                            {
-                                tfmat->m_defines["MATERIAL_SPECULARGLOSSINESS"] = "1";
-
-                                int index, texCoord;
-                                if (ProcessGetTextureIndexAndTextCoord(*KHR_materials_pbrSpecularGlossinessIt, "diffuseTexture", &index, &texCoord))
-                                {
-                                    tfmat->m_defines["ID_diffuseTexture"] = std::to_string(textures.size());
-                                    tfmat->m_defines["ID_diffuseTexCoord"] = std::to_string(texCoord);
-                                    textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
-                                }
-                            }
-                        }
+                        tfmat->m_defines["ID_diffuseTexture"] = std::to_string(textures.size());
+                        tfmat->m_defines["ID_diffuseTexCoord"] = std::to_string(texCoord);
+                        textures.push_back(pGLTFTexturesAndBuffers->GetTextureViewByID(index));
                     }
                 }
-                
-                // allocate descriptor table for the texture
-                tfmat->m_textureCount = static_cast<int>(textures.size());
-                m_pResourceViewHeaps->AllocDescriptor(tfmat->m_textureCount, NULL, &tfmat->m_descriptorSetLayout, &tfmat->m_descriptorSet);
-                int cnt = 0;
-                for (auto const &it : textures)
-                {
-                    SetDescriptorSet(m_pDevice->GetDevice(), cnt++, it, &m_sampler, tfmat->m_descriptorSet);                    
-                }
+            }
+            
+            // allocate descriptor table for the texture
+            tfmat->m_textureCount = static_cast<int>(textures.size());
+            m_pResourceViewHeaps->AllocDescriptor(tfmat->m_textureCount, NULL, &tfmat->m_descriptorSetLayout, &tfmat->m_descriptorSet);
+            int cnt = 0;
+            for (auto const &it : textures)
+            {
+                SetDescriptorSet(m_pDevice->GetDevice(), cnt++, it, &m_sampler, tfmat->m_descriptorSet);                    
             }
         }
 
@@ -184,63 +170,63 @@ namespace CAULDRON_VK
 
         // Load Meshes
         //
-        if (j3.find("meshes") != j3.end())
+        const std::vector<tfMesh> &meshes = pGLTFCommon->m_meshes;
+        m_meshes.resize(meshes.size());
+        for (uint32_t i = 0; i < meshes.size(); i++)
         {
-            const json &meshes = j3["meshes"];
-            const json &accessors = j3["accessors"];
-            m_meshes.resize(meshes.size());
-            for (uint32_t i = 0; i < meshes.size(); i++)
+            if (meshes[i].m_mergedAway)
+                continue;
+
+            MotionVectorMesh *tfmesh = &m_meshes[i];
+
+            const std::vector<tfPrimitives> &primitives = meshes[i].m_pPrimitives;
+            tfmesh->m_pPrimitives.resize(primitives.size());
+            for (uint32_t p = 0; p < primitives.size(); p++)
             {
-                MotionVectorMesh *tfmesh = &m_meshes[i];
+                const tfPrimitives &primitive = primitives[p];
+                MotionVectorPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
 
-                const json &primitives = meshes[i]["primitives"];
-                tfmesh->m_pPrimitives.resize(primitives.size());
-                for (uint32_t p = 0; p < primitives.size(); p++)
+                ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, formatsCount, normalBufferFormat, renderPass, definesRenderTargets, &primitive, pPrimitive]()
                 {
-                    const json &primitive = primitives[p];
-                    MotionVectorPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
-
-                    ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, formatsCount, normalBufferFormat, renderPass, definesRenderTargets, &primitive, pPrimitive]()
+                    // Set Material
+                    //
+                    pPrimitive->m_pMaterial = (primitive.m_material >= 0) ? &m_materialsData[primitive.m_material] : &m_defaultMaterial;
+
+                    // specify attributes needed to render the material
+                    //
+                    std::vector<std::string> requiredAttributes;
+                    for (auto const & it : primitive.m_attributes)
                     {
-                        // Set Material
-                        //
-                        auto mat = primitive.find("material");
-                        pPrimitive->m_pMaterial = (mat != primitive.end()) ? &m_materialsData[mat.value()] : &m_defaultMaterial;
-
-                        // specify attributes needed to render the material
-                        //
-                        std::vector<std::string> requiredAttributes;
-                        for (auto const & it : primitive["attributes"].items())
+                        const std::string semanticName = it.first;
+                        if (
+                            (semanticName == "POSITION") ||
+                            (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
+                            (semanticName.substr(0, 6) == "JOINTS") || // for skinning
+                            (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) ||
+                            ((normalBufferFormat != DXGI_FORMAT_UNKNOWN) && ((semanticName == "NORMAL") || (semanticName == "TANGENT"))) // for obvious reasons
+                            )
                         {
-                            const std::string semanticName = it.key();
-                            if (
-                                (semanticName == "POSITION") ||
-                                (semanticName.substr(0, 7) == "WEIGHTS") || // for skinning
-                                (semanticName.substr(0, 6) == "JOINTS") || // for skinning
-                                (DoesMaterialUseSemantic(pPrimitive->m_pMaterial->m_defines, semanticName) == true) ||
-                                ((normalBufferFormat != DXGI_FORMAT_UNKNOWN) && ((semanticName == "NORMAL") || (semanticName == "TANGENT"))) // for obvious reasons
-                                )
-                            {
-                                requiredAttributes.push_back(semanticName);
-                            }
+                            requiredAttributes.push_back(semanticName);
                         }
+                    }
 
-                        // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
-                        //
-                        DefineList defines = definesRenderTargets + pPrimitive->m_pMaterial->m_defines;
-
-                        // Get input layout from glTF attributes
-                        //
-                        std::vector<VkVertexInputAttributeDescription> layout;
-                        m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, layout, defines, &pPrimitive->m_geometry);
-
-                        // Create Pipeline
-                        //
-                        int skinId = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i);
-                        int inverseMatrixBufferSize = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetInverseBindMatricesBufferSizeByID(skinId);
-                        CreatePipeline(renderPass, formatsCount, inverseMatrixBufferSize, layout, defines, pPrimitive);
-                    });
-                }
+                    // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
+                    //
+                    DefineList defines = definesRenderTargets + pPrimitive->m_pMaterial->m_defines;
+
+                    // Get input layout from glTF attributes
+                    //
+                    std::vector<VkVertexInputAttributeDescription> layout;
+                    m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, layout, defines, &pPrimitive->m_geometry);
+                    if (m_pGLTFTexturesAndBuffers->m_pGLTFCommon->IsMeshInstanced(i))
+                        m_pGLTFTexturesAndBuffers->AddInstanceStream(layout, defines, &pPrimitive->m_geometry);
+
+                    // Create Pipeline
+                    //
+                    int skinId = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i);
+                    int inverseMatrixBufferSize = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetInverseBindMatricesBufferSizeByID(skinId);
+                    CreatePipeline(renderPass, formatsCount, inverseMatrixBufferSize, layout, defines, pPrimitive);
+                });
             }
         }
     }
@@ -362,13 +348,8 @@ namespace CAULDRON_VK
         /////////////////////////////////////////////
         // Create a Pipeline 
         {
-            std::vector<VkVertexInputBindingDescription> vi_binding(layout.size());
-            for (int i = 0; i < layout.size(); i++)
-            {
-                vi_binding[i].binding = layout[i].binding;
-                vi_binding[i].stride = SizeOfFormat(layout[i].format);
-                vi_binding[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-            }
+            std::vector<VkVertexInputBindingDescription> vi_binding;
+            GetVertexInputBindings(layout, pPrimitive->m_geometry, &vi_binding);
 
             VkPipelineVertexInputStateCreateInfo vi = {};
             vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -547,6 +528,8 @@ namespace CAULDRON_VK
         //
         std::vector<tfNode> *pNodes = &m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_nodes;
         Matrix2 *pNodesMatrices = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_worldSpaceMats.data();
+        std::vector<VkDescriptorBufferInfo> morphedVBV;
+        math::Matrix4 mCameraViewProj = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_perFrameData.mCameraCurrViewProj;
 
         for (uint32_t i = 0; i < pNodes->size(); i++)
         {
@@ -557,6 +540,14 @@ namespace CAULDRON_VK
             // skinning matrices constant buffer
             VkDescriptorBufferInfo *pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
 
+            VkDescriptorBufferInfo instancesDesc;
+            uint32_t instanceCount = m_pGLTFTexturesAndBuffers->AllocVisibleInstances(i, mCameraViewProj, &instancesDesc);
+            if (instanceCount == 0)
+                continue;
+
+            // batches are drawn with identity world matrices, their instances are the world matrices of the nodes
+            const Matrix2 &drawMats = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetDrawMatrices(i);
+
             MotionVectorMesh *pMesh = &m_meshes[pNode->meshIndex];
             for (int p = 0; p < pMesh->m_pPrimitives.size(); p++)
             {
@@ -568,19 +559,26 @@ namespace CAULDRON_VK
                 // Set per Object constants
                 //
                 per_object cbPerObject;
-                cbPerObject.mCurrentWorld = pNodesMatrices[i].GetCurrent();
-                cbPerObject.mPreviousWorld = pNodesMatrices[i].GetPrevious();
+                cbPerObject.mCurrentWorld = drawMats.GetCurrent();
+                cbPerObject.mPreviousWorld = drawMats.GetPrevious();
 
                 VkDescriptorBufferInfo perObjectDesc = m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), &cbPerObject);
 
                 // Bind indices and vertices using the right offsets into the buffer
                 //
                 Geometry *pGeometry = &pPrimitive->m_geometry;
-                for (uint32_t i = 0; i < pGeometry->m_VBV.size(); i++)
+                const std::vector<VkDescriptorBufferInfo> *pVBV = &pGeometry->m_VBV;
+                if (m_pGLTFTexturesAndBuffers->GetMorphedVertexBuffers(i, *pGeometry, &morphedVBV))
+                    pVBV = &morphedVBV;
+
+                for (uint32_t v = 0; v < pVBV->size(); v++)
                 {
-                    vkCmdBindVertexBuffers(cmd_buf, i, 1, &pGeometry->m_VBV[i].buffer, &pGeometry->m_VBV[i].offset);
+                    vkCmdBindVertexBuffers(cmd_buf, v, 1, &pVBV->at(v).buffer, &pVBV->at(v).offset);
                 }
 
+                if (pGeometry->m_instanceBinding >= 0)
+                    vkCmdBindVertexBuffers(cmd_buf, pGeometry->m_instanceBinding, 1, &instancesDesc.buffer, &instancesDesc.offset);
+
                 vkCmdBindIndexBuffer(cmd_buf, pGeometry->m_IBV.buffer, pGeometry->m_IBV.offset, pGeometry->m_indexType);
 
                 // Bind Descriptor sets
@@ -599,7 +597,7 @@ namespace CAULDRON_VK
 
                 // Draw
                 //
-                vkCmdDrawIndexed(cmd_buf, pGeometry->m_NumIndices, 1, 0, 0, 0);
+                vkCmdDrawIndexed(cmd_buf, pGeometry->m_NumIndices, instanceCount, 0, 0, 0);
             }
         }
 
@@ -134,83 +134,83 @@ namespace CAULDRON_VK
 
         // Load PBR 2.0 Materials
         //
-        const json &j3 = pGLTFTexturesAndBuffers->m_pGLTFCommon->j3;
+        const GLTFCommon *pGLTFCommon = pGLTFTexturesAndBuffers->m_pGLTFCommon;
 
-        const json &materials = j3["materials"];
+        const std::vector<tfMaterial> &materials = pGLTFCommon->m_materials;
         m_materialsData.resize(materials.size());
         for (uint32_t i = 0; i < materials.size(); i++)
         {
             PBRMaterial *tfmat = &m_materialsData[i];
 
-            // Get PBR material parameters and texture IDs
+            // Get PBR material parameters, they were read from the glTF at load time
             //
-            std::map<std::string, int> textureIds;
-            ProcessMaterials(materials[i], &tfmat->m_pbrMaterialParameters, textureIds);
+            tfmat->m_pbrMaterialParameters = materials[i].m_pbrMaterialParameters;
 
             // translate texture IDs into textureViews
             //
             std::map<std::string, VkImageView> texturesBase;
-            for (auto const& value : textureIds)
-                texturesBase[value.first] = m_pGLTFTexturesAndBuffers->GetTextureViewByID(value.second);
+            for (auto const& value : materials[i].m_textures)
+                texturesBase[value.first] = m_pGLTFTexturesAndBuffers->GetTextureViewByID(value.second.m_index);
 
             CreateDescriptorTableForMaterialTextures(tfmat, texturesBase, pSkyDome, ShadowMapViewPool, bUseSSAOMask);
         }
 
         // Load Meshes
         //
-        if (j3.find("meshes") != j3.end())
+        const std::vector<tfMesh> &meshes = pGLTFCommon->m_meshes;
+
+        m_meshes.resize(meshes.size());
+        for (uint32_t i = 0; i < meshes.size(); i++)
         {
-            const json &meshes = j3["meshes"];
+            if (meshes[i].m_mergedAway)
+                continue;
 
-            m_meshes.resize(meshes.size());
-            for (uint32_t i = 0; i < meshes.size(); i++)
-            {
-                const json &primitives = meshes[i]["primitives"];
+            const std::vector<tfPrimitives> &primitives = meshes[i].m_pPrimitives;
 
-                // Loop through all the primitives (sets of triangles with a same material) and 
-                // 1) create an input layout for the geometry
-                // 2) then take its material and create a Root descriptor
-                // 3) With all the above, create a pipeline
-                //
-                PBRMesh *tfmesh = &m_meshes[i];
-                tfmesh->m_pPrimitives.resize(primitives.size());
+            // Loop through all the primitives (sets of triangles with a same material) and 
+            // 1) create an input layout for the geometry
+            // 2) then take its material and create a Root descriptor
+            // 3) With all the above, create a pipeline
+            //
+            PBRMesh *tfmesh = &m_meshes[i];
+            tfmesh->m_pPrimitives.resize(primitives.size());
 
-                for (uint32_t p = 0; p < primitives.size(); p++)
-                {
-                    const json &primitive = primitives[p];                
-                    PBRPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
+            for (uint32_t p = 0; p < primitives.size(); p++)
+            {
+                const tfPrimitives &primitive = primitives[p];
+                PBRPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
 
-                    ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, rtDefines, &primitive, pPrimitive, bUseSSAOMask]()
-                    {
-                        // Sets primitive's material, or set a default material if none was specified in the GLTF
-                        //
-                        auto mat = primitive.find("material");
-                        pPrimitive->m_pMaterial = (mat != primitive.end()) ? &m_materialsData[mat.value()] : &m_defaultMaterial;
-
-                        // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
-                        //
-                        DefineList defines = pPrimitive->m_pMaterial->m_pbrMaterialParameters.m_defines + rtDefines;
-
-                        // make a list of all the attribute names our pass requires, in the case of PBR we need them all
-                        //
-                        std::vector<std::string> requiredAttributes;
-                        for (auto const & it : primitive["attributes"].items())
-                            requiredAttributes.push_back(it.key());
-
-                        // create an input layout from the required attributes
-                        // shader's can tell the slots from the #defines
-                        //
-                        std::vector<VkVertexInputAttributeDescription> inputLayout;
-                        m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, inputLayout, defines, &pPrimitive->m_geometry);
-
-                        // Create descriptors and pipelines
-                        //
-                        int skinId = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i);
-                        int inverseMatrixBufferSize = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetInverseBindMatricesBufferSizeByID(skinId);
-                        CreateDescriptors(inverseMatrixBufferSize, &defines, pPrimitive, bUseSSAOMask);
-                        CreatePipeline(inputLayout, defines, pPrimitive);
-                    });
-                }
+                ExecAsyncIfThereIsAPool(pAsyncPool, [this, i, rtDefines, &primitive, pPrimitive, bUseSSAOMask]()
+                {
+                    // Sets primitive's material, or set a default material if none was specified in the GLTF
+                    //
+                    pPrimitive->m_pMaterial = (primitive.m_material >= 0) ? &m_materialsData[primitive.m_material] : &m_defaultMaterial;
+
+                    // holds all the #defines from materials, geometry and texture IDs, the VS & PS shaders need this to get the bindings and code paths
+                    //
+                    DefineList defines = pPrimitive->m_pMaterial->m_pbrMaterialParameters.m_defines + rtDefines;
+
+                    // make a list of all the attribute names our pass requires, in the case of PBR we need them all
+                    //
+                    std::vector<std::string> requiredAttributes;
+                    for (auto const & it : primitive.m_attributes)
+                        requiredAttributes.push_back(it.first);
+
+                    // create an input layout from the required attributes
+                    // shader's can tell the slots from the #defines
+                    //
+                    std::vector<VkVertexInputAttributeDescription> inputLayout;
+                    m_pGLTFTexturesAndBuffers->CreateGeometry(primitive, requiredAttributes, inputLayout, defines, &pPrimitive->m_geometry);
+                    if (m_pGLTFTexturesAndBuffers->m_pGLTFCommon->IsMeshInstanced(i))
+                        m_pGLTFTexturesAndBuffers->AddInstanceStream(inputLayout, defines, &pPrimitive->m_geometry);
+
+                    // Create descriptors and pipelines
+                    //
+                    int skinId = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->FindMeshSkinId(i);
+                    int inverseMatrixBufferSize = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->GetInverseBindMatricesBufferSizeByID(skinId);
+                    CreateDescriptors(inverseMatrixBufferSize, &defines, pPrimitive, bUseSSAOMask);
+                    CreatePipeline(inputLayout, defines, pPrimitive);
+                });
             }
         }
     }
@@ -473,13 +473,8 @@ namespace CAULDRON_VK
 
         // vertex input state
 
-        std::vector<VkVertexInputBindingDescription> vi_binding(layout.size());
-        for (int i = 0; i < layout.size(); i++)
-        {
-            vi_binding[i].binding = layout[i].binding;
-            vi_binding[i].stride = SizeOfFormat(layout[i].format);
-            vi_binding[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        }
+        std::vector<VkVertexInputBindingDescription> vi_binding;
+        GetVertexInputBindings(layout, pPrimitive->m_geometry, &vi_binding);
 
         VkPipelineVertexInputStateCreateInfo vi = {};
         vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -732,71 +727,84 @@ namespace CAULDRON_VK
     //--------------------------------------------------------------------------------------
     void GltfPbrPass::BuildBatchLists(std::vector<BatchList> *pSolid, std::vector<BatchList> *pTransparent, bool bWireframe/*=false*/)
     {
-        // loop through nodes
+        // loop through the primitives the BVH finds in the frustum
         //
-        std::vector<tfNode> *pNodes = &m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_nodes;
-        Matrix2 *pNodesMatrices = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_worldSpaceMats.data();
+        GLTFCommon *pGLTFCommon = m_pGLTFTexturesAndBuffers->m_pGLTFCommon;
+        std::vector<tfNode> *pNodes = &pGLTFCommon->m_nodes;
+        Matrix2 *pNodesMatrices = pGLTFCommon->m_worldSpaceMats.data();
 
-        for (uint32_t i = 0; i < pNodes->size(); i++)
+        pGLTFCommon->CullPrimitives(pGLTFCommon->m_perFrameData.mCameraCurrViewProj, &m_visibleRanges);
+        for (const tfBvhRange &range : m_visibleRanges)
         {
-            tfNode *pNode = &pNodes->at(i);
-            if ((pNode == NULL) || (pNode->meshIndex < 0))
-                continue;
-
-            // skinning matrices constant buffer
-            VkDescriptorBufferInfo *pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
-
-            math::Matrix4 mModelViewProj =  m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_perFrameData.mCameraCurrViewProj * pNodesMatrices[i].GetCurrent();
-
-            // loop through primitives
-            //
-            PBRMesh *pMesh = &m_meshes[pNode->meshIndex];
-            for (uint32_t p = 0; p < pMesh->m_pPrimitives.size(); p++)
+            for (uint32_t item = range.m_firstItem; item < range.m_firstItem + range.m_itemCount; item++)
             {
-                PBRPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+                uint32_t i = pGLTFCommon->m_bvhItems[item].m_node;
+                tfNode *pNode = &pNodes->at(i);
 
-                if ((bWireframe && pPrimitive->m_pipelineWireframe == VK_NULL_HANDLE)
-                    || (!bWireframe && pPrimitive->m_pipeline == VK_NULL_HANDLE))
-                    continue;
+                // skinning matrices constant buffer
+                VkDescriptorBufferInfo *pPerSkeleton = m_pGLTFTexturesAndBuffers->GetSkinningMatricesBuffer(pNode->skinIndex);
 
-                // do frustrum culling
-                //
-                tfPrimitives boundingBox = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_meshes[pNode->meshIndex].m_pPrimitives[p];
-                if (CameraFrustumToBoxCollision(mModelViewProj, boundingBox.m_center, boundingBox.m_radius))
+                // instanced nodes are culled per instance instead of per primitive, all their primitives share the visible instances
+                VkDescriptorBufferInfo instancesDesc;
+                uint32_t instanceCount = m_pGLTFTexturesAndBuffers->AllocVisibleInstances(i, pGLTFCommon->m_perFrameData.mCameraCurrViewProj, &instancesDesc);
+                if (instanceCount == 0)
                     continue;
 
-                PBRMaterialParameters *pPbrParams = &pPrimitive->m_pMaterial->m_pbrMaterialParameters;
-
-                // Set per Object constants from material
-                //
-                per_object *cbPerObject;
-                VkDescriptorBufferInfo perObjectDesc;
-                m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), (void **)&cbPerObject, &perObjectDesc);
-                cbPerObject->mCurrentWorld = pNodesMatrices[i].GetCurrent();
-                cbPerObject->mPreviousWorld = pNodesMatrices[i].GetPrevious();
-                cbPerObject->m_pbrParams = pPbrParams->m_params;
-
-                // compute depth for sorting
-                //
-                math::Vector4 v = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_meshes[pNode->meshIndex].m_pPrimitives[p].m_center;
-                float depth = (mModelViewProj * v).getW();
+                // batches are drawn with identity world matrices, their instances are the world matrices of the nodes
+                const Matrix2 &drawMats = pGLTFCommon->GetDrawMatrices(i);
 
-                BatchList t;
-                t.m_depth = depth;
-                t.m_pPrimitive = pPrimitive;
-                t.m_perFrameDesc = m_pGLTFTexturesAndBuffers->m_perFrameConstants;
-                t.m_perObjectDesc = perObjectDesc;
-                t.m_pPerSkeleton = pPerSkeleton;
+                math::Matrix4 mModelViewProj = pGLTFCommon->m_perFrameData.mCameraCurrViewProj * pNodesMatrices[i].GetCurrent();
 
-                // append primitive to list 
+                // loop through primitives, an item is either one primitive or all the primitives of an instanced node
                 //
-                if (pPbrParams->m_blending == false)
+                PBRMesh *pMesh = &m_meshes[pNode->meshIndex];
+                int primitive = pGLTFCommon->m_bvhItems[item].m_primitive;
+                uint32_t firstPrimitive = (primitive < 0) ? 0 : (uint32_t)primitive;
+                uint32_t lastPrimitive = (primitive < 0) ? (uint32_t)pMesh->m_pPrimitives.size() : firstPrimitive + 1;
+                for (uint32_t p = firstPrimitive; p < lastPrimitive; p++)
                 {
-                    pSolid->push_back(t);
-                }
-                else
-                {
-                    pTransparent->push_back(t);
+                    PBRPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+
+                    if ((bWireframe && pPrimitive->m_pipelineWireframe == VK_NULL_HANDLE)
+                        || (!bWireframe && pPrimitive->m_pipeline == VK_NULL_HANDLE))
+                        continue;
+
+                    PBRMaterialParameters *pPbrParams = &pPrimitive->m_pMaterial->m_pbrMaterialParameters;
+
+                    // Set per Object constants from material
+                    //
+                    per_object *cbPerObject;
+                    VkDescriptorBufferInfo perObjectDesc;
+                    m_pDynamicBufferRing->AllocConstantBuffer(sizeof(per_object), (void **)&cbPerObject, &perObjectDesc);
+                    cbPerObject->mCurrentWorld = drawMats.GetCurrent();
+                    cbPerObject->mPreviousWorld = drawMats.GetPrevious();
+                    cbPerObject->m_pbrParams = pPbrParams->m_params;
+
+                    // compute depth for sorting
+                    //
+                    math::Vector4 v = m_pGLTFTexturesAndBuffers->m_pGLTFCommon->m_meshes[pNode->meshIndex].m_pPrimitives[p].m_center;
+                    float depth = (mModelViewProj * v).getW();
+
+                    BatchList t;
+                    t.m_depth = depth;
+                    t.m_pPrimitive = pPrimitive;
+                    t.m_perFrameDesc = m_pGLTFTexturesAndBuffers->m_perFrameConstants;
+                    t.m_perObjectDesc = perObjectDesc;
+                    t.m_pPerSkeleton = pPerSkeleton;
+                    t.m_nodeIndex = i;
+                    t.m_instancesDesc = instancesDesc;
+                    t.m_instanceCount = instanceCount;
+
+                    // append primitive to list 
+                    //
+                    if (pPbrParams->m_blending == false)
+                    {
+                        pSolid->push_back(t);
+                    }
+                    else
+                    {
+                        pTransparent->push_back(t);
+                    }
                 }
             }
         }
@@ -806,21 +814,32 @@ namespace CAULDRON_VK
     {
         SetPerfMarkerBegin(commandBuffer, "gltfPBR");
         
+        std::vector<VkDescriptorBufferInfo> morphedVBV;
         for (auto &t : *pBatchList)
         {
-            t.m_pPrimitive->DrawPrimitive(commandBuffer, t.m_perFrameDesc, t.m_perObjectDesc, t.m_pPerSkeleton, bWireframe);
+            bool bMorphed = m_pGLTFTexturesAndBuffers->GetMorphedVertexBuffers(t.m_nodeIndex, t.m_pPrimitive->m_geometry, &morphedVBV);
+            t.m_pPrimitive->DrawPrimitive(commandBuffer, t.m_perFrameDesc, t.m_perObjectDesc, t.m_pPerSkeleton, bWireframe, bMorphed ? &morphedVBV : NULL, &t.m_instancesDesc, t.m_instanceCount);
         }
 
         SetPerfMarkerEnd(commandBuffer);
     }
 
-    void PBRPrimitives::DrawPrimitive(VkCommandBuffer cmd_buf, VkDescriptorBufferInfo perFrameDesc, VkDescriptorBufferInfo perObjectDesc, VkDescriptorBufferInfo *pPerSkeleton, bool bWireframe)
+    void PBRPrimitives::DrawPrimitive(VkCommandBuffer cmd_buf, VkDescriptorBufferInfo perFrameDesc, VkDescriptorBufferInfo perObjectDesc, VkDescriptorBufferInfo *pPerSkeleton, bool bWireframe, const std::vector<VkDescriptorBufferInfo> *pVBV, const VkDescriptorBufferInfo *pInstances, uint32_t instanceCount)
     {
-        // Bind indices and vertices using the right offsets into the buffer
+        // Bind indices and vertices using the right offsets into the buffer, morphed meshes bring their own vertex buffers
         //
-        for (uint32_t i = 0; i < m_geometry.m_VBV.size(); i++)
+        if (pVBV == NULL)
+            pVBV = &m_geometry.m_VBV;
+
+        for (uint32_t i = 0; i < pVBV->size(); i++)
+        {
+            vkCmdBindVertexBuffers(cmd_buf, i, 1, &pVBV->at(i).buffer, &pVBV->at(i).offset);
+        }
+
+        if (m_geometry.m_instanceBinding >= 0)
         {
-            vkCmdBindVertexBuffers(cmd_buf, i, 1, &m_geometry.m_VBV[i].buffer, &m_geometry.m_VBV[i].offset);
+            assert(pInstances != NULL);
+            vkCmdBindVertexBuffers(cmd_buf, m_geometry.m_instanceBinding, 1, &pInstances->buffer, &pInstances->offset);
         }
 
         vkCmdBindIndexBuffer(cmd_buf, m_geometry.m_IBV.buffer, m_geometry.m_IBV.offset, m_geometry.m_indexType);
@@ -844,6 +863,6 @@ namespace CAULDRON_VK
 
         // Draw
         //
-        vkCmdDrawIndexed(cmd_buf, m_geometry.m_NumIndices, 1, 0, 0, 0);
+        vkCmdDrawIndexed(cmd_buf, m_geometry.m_NumIndices, instanceCount, 0, 0, 0);
     }
 }
\ No newline at end of file
@@ -49,7 +49,7 @@ namespace CAULDRON_VK
         VkDescriptorSet m_uniformsDescriptorSet = VK_NULL_HANDLE;
         VkDescriptorSetLayout m_uniformsDescriptorSetLayout = VK_NULL_HANDLE;
 
-        void DrawPrimitive(VkCommandBuffer cmd_buf, VkDescriptorBufferInfo perSceneDesc, VkDescriptorBufferInfo perObjectDesc, VkDescriptorBufferInfo *pPerSkeleton, bool bWireframe);
+        void DrawPrimitive(VkCommandBuffer cmd_buf, VkDescriptorBufferInfo perSceneDesc, VkDescriptorBufferInfo perObjectDesc, VkDescriptorBufferInfo *pPerSkeleton, bool bWireframe, const std::vector<VkDescriptorBufferInfo> *pVBV = NULL, const VkDescriptorBufferInfo *pInstances = NULL, uint32_t instanceCount = 1);
     };
 
     struct PBRMesh
@@ -75,6 +75,9 @@ namespace CAULDRON_VK
             VkDescriptorBufferInfo m_perFrameDesc;
             VkDescriptorBufferInfo m_perObjectDesc;
             VkDescriptorBufferInfo *m_pPerSkeleton;
+            int m_nodeIndex;
+            VkDescriptorBufferInfo m_instancesDesc;     // visible instances, only used by the instanced pipelines
+            uint32_t m_instanceCount;
             operator float() { return -m_depth; }
         };
 
@@ -106,6 +109,7 @@ namespace CAULDRON_VK
 
         std::vector<PBRMesh> m_meshes;
         std::vector<PBRMaterial> m_materialsData;
+        std::vector<tfBvhRange> m_visibleRanges;     // scratch of BuildBatchLists()
 
         GltfPbrPass::per_frame m_cbPerFrame;
 
@@ -503,6 +503,31 @@ namespace CAULDRON_VK
         return result;
     }
 
+    // Same as InitFromFile but the encoded image (png, jpg, dds...) is already in memory, i.e. embedded in a .glb
+    //
+    bool Texture::InitFromMemory(Device *pDevice, UploadHeap *pUploadHeap, const void *pData, size_t size, const char *pName, bool useSRGB, VkImageUsageFlags usageFlags, float cutOff)
+    {
+        m_pDevice = pDevice;
+        assert(m_pResource == NULL);
+
+        ImgLoader* img = CreateImageLoader(pData, size);
+        bool result = img->Load(pData, size, cutOff, &m_header);
+        if (result)
+        {
+            m_pResource = CreateTextureCommitted(pDevice, pUploadHeap, pName, useSRGB, usageFlags);
+            LoadAndUpload(pDevice, pUploadHeap, img, m_pResource);
+        }
+        else
+        {
+            Trace("Error loading texture from memory: %s", pName);
+            assert(result && "Could not decode the image.");
+        }
+
+        delete(img);
+
+        return result;
+    }
+
     bool Texture::InitFromData(Device* pDevice, UploadHeap& uploadHeap, const IMG_INFO& header, const void* data, const char* name)
     {
         assert(!m_pResource && !m_pDevice);
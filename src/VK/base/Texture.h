@@ -47,6 +47,7 @@ namespace CAULDRON_VK
                                const char*           name       = nullptr,
                                VkImageUsageFlagBits  usageFlags = {});
         bool InitFromFile(Device* pDevice, UploadHeap* pUploadHeap, const char *szFilename, bool useSRGB = false, VkImageUsageFlags usageFlags = 0, float cutOff = 1.0f);
+        bool InitFromMemory(Device* pDevice, UploadHeap* pUploadHeap, const void *pData, size_t size, const char *pName, bool useSRGB = false, VkImageUsageFlags usageFlags = 0, float cutOff = 1.0f);
         bool InitFromData(Device* pDevice, UploadHeap& uploadHeap, const IMG_INFO& header, const void* data, const char* name = nullptr);
 
         VkImage Resource() const { return m_pResource; }
@@ -45,6 +45,16 @@
     layout (location = ID_JOINTS_1) in  uvec4 a_Joints1;
 #endif
 
+#ifdef ID_INSTANCE_MATRIX
+    // per instance stream, the 3 rows of the current and previous matrices of the instance
+    layout (location = ID_INSTANCE_MATRIX) in vec4 a_InstanceRow0;
+    layout (location = ID_INSTANCE_MATRIX + 1) in vec4 a_InstanceRow1;
+    layout (location = ID_INSTANCE_MATRIX + 2) in vec4 a_InstanceRow2;
+    layout (location = ID_INSTANCE_MATRIX + 3) in vec4 a_PrevInstanceRow0;
+    layout (location = ID_INSTANCE_MATRIX + 4) in vec4 a_PrevInstanceRow1;
+    layout (location = ID_INSTANCE_MATRIX + 5) in vec4 a_PrevInstanceRow2;
+#endif
+
 layout (location = 0) out VS2PS Output;
 
 void gltfVertexFactory()
@@ -65,7 +75,15 @@ void gltfVertexFactory()
     };
 #endif
 
-	mat4 transMatrix = GetWorldMatrix() * skinningMatrix;
+#ifdef ID_INSTANCE_MATRIX
+    mat4 instanceMatrix = transpose(mat4(a_InstanceRow0, a_InstanceRow1, a_InstanceRow2, vec4(0, 0, 0, 1)));
+    mat4 prevInstanceMatrix = transpose(mat4(a_PrevInstanceRow0, a_PrevInstanceRow1, a_PrevInstanceRow2, vec4(0, 0, 0, 1)));
+#else
+    mat4 instanceMatrix = mat4(1.0);
+    mat4 prevInstanceMatrix = mat4(1.0);
+#endif
+
+	mat4 transMatrix = GetWorldMatrix() * instanceMatrix * skinningMatrix;
 	vec4 pos = transMatrix * vec4(a_Position,1);
 	Output.WorldPos = vec3(pos.xyz) / pos.w;
 	gl_Position = GetCameraViewProj() * pos; // needs w for proper perspective correction
@@ -73,7 +91,7 @@ void gltfVertexFactory()
 #ifdef HAS_MOTION_VECTORS
 	Output.CurrPosition = gl_Position; // current's frame vertex position 
 
-	mat4 prevTransMatrix = GetPrevWorldMatrix() * skinningMatrix;
+	mat4 prevTransMatrix = GetPrevWorldMatrix() * prevInstanceMatrix * skinningMatrix;
 	vec3 worldPrevPos = (prevTransMatrix * vec4(a_Position, 1)).xyz;
 	Output.PrevPosition = GetPrevCameraViewProj() * vec4(worldPrevPos, 1);
 #endif
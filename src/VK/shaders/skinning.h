@@ -19,36 +19,36 @@
 
 #ifdef ID_SKINNING_MATRICES
 
-struct Matrix2
+// skinning matrices are stored as the first three rows of the matrix, the last row is always (0,0,0,1)
+// so once blended it is (0,0,0,sum of the weights)
+struct SkinningMatrix
 {
-    mat4 m_current;
-    mat4 m_previous;
+    vec4 m_rows[3];
 };
 
 
 layout (std140, binding = ID_SKINNING_MATRICES) uniform perSkeleton
 {
-    Matrix2 u_ModelMatrix[200];
+    SkinningMatrix u_ModelMatrix[200];
 } myPerSkeleton;
 
-mat4 GetCurrentSkinningMatrix(vec4 Weights, uvec4 Joints)
+mat4 GetSkinningMatrix(vec4 row0, vec4 row1, vec4 row2, vec4 Weights)
 {
-    mat4 skinningMatrix =
-        Weights.x * myPerSkeleton.u_ModelMatrix[Joints.x].m_current +
-        Weights.y * myPerSkeleton.u_ModelMatrix[Joints.y].m_current +
-        Weights.z * myPerSkeleton.u_ModelMatrix[Joints.z].m_current +
-        Weights.w * myPerSkeleton.u_ModelMatrix[Joints.w].m_current;
-    return skinningMatrix;
+    return transpose(mat4(row0, row1, row2, vec4(0, 0, 0, dot(Weights, vec4(1)))));
 }
 
-mat4 GetPreviousSkinningMatrix(vec4 Weights, uvec4 Joints)
+mat4 GetCurrentSkinningMatrix(vec4 Weights, uvec4 Joints)
 {
-    mat4 skinningMatrix =
-        Weights.x * myPerSkeleton.u_ModelMatrix[Joints.x].m_previous +
-        Weights.y * myPerSkeleton.u_ModelMatrix[Joints.y].m_previous +
-        Weights.z * myPerSkeleton.u_ModelMatrix[Joints.z].m_previous +
-        Weights.w * myPerSkeleton.u_ModelMatrix[Joints.w].m_previous;
-    return skinningMatrix;
+    vec4 rows[3];
+    for (int i = 0; i < 3; i++)
+    {
+        rows[i] =
+            Weights.x * myPerSkeleton.u_ModelMatrix[Joints.x].m_rows[i] +
+            Weights.y * myPerSkeleton.u_ModelMatrix[Joints.y].m_rows[i] +
+            Weights.z * myPerSkeleton.u_ModelMatrix[Joints.z].m_rows[i] +
+            Weights.w * myPerSkeleton.u_ModelMatrix[Joints.w].m_rows[i];
+    }
+    return GetSkinningMatrix(rows[0], rows[1], rows[2], Weights);
 }
 
 #endif
@@ -0,0 +1,669 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "GltfAnimation.h"
+#include "GltfHelpers.h"
+
+enum { COMPONENT_TRANSLATION, COMPONENT_ROTATION, COMPONENT_SCALE, COMPONENT_COUNT };
+
+//
+// Rotations are quantized with the "smallest three" encoding: the largest component of the unit quaternion is
+// dropped (q and -q are the same rotation so it's made positive) and rebuilt from the other three. These are in
+// [-1/sqrt(2), 1/sqrt(2)] and get 15 bits each, the index of the largest component takes the low bit of 2 of the words.
+//
+static const float QUAT_RANGE = 0.70710678f;
+static const float QUAT_SCALE = 32767.0f;
+
+static void EncodeRotation(const math::Vector4 &q, uint16_t *pWords)
+{
+    float v[4] = { q.getX(), q.getY(), q.getZ(), q.getW() };
+
+    int largest = 0;
+    for (int c = 1; c < 4; c++)
+    {
+        if (fabsf(v[c]) > fabsf(v[largest]))
+            largest = c;
+    }
+
+    float sign = (v[largest] < 0.0f) ? -1.0f : 1.0f;
+    for (int c = 0, word = 0; c < 4; c++)
+    {
+        if (c == largest)
+            continue;
+
+        float n = std::min(std::max(sign * v[c] / (2.0f * QUAT_RANGE) + 0.5f, 0.0f), 1.0f);
+        pWords[word++] = (uint16_t)((uint32_t)(n * QUAT_SCALE + 0.5f) << 1);
+    }
+
+    pWords[0] |= largest & 1;
+    pWords[1] |= largest >> 1;
+}
+
+static inline __m128 DecodeRotation(const uint16_t *pWords)
+{
+    const float scale = 2.0f * QUAT_RANGE / QUAT_SCALE;
+    float a = (pWords[0] >> 1) * scale - QUAT_RANGE;
+    float b = (pWords[1] >> 1) * scale - QUAT_RANGE;
+    float c = (pWords[2] >> 1) * scale - QUAT_RANGE;
+    float d = sqrtf(std::max(1.0f - (a * a + b * b + c * c), 0.0f));
+
+    switch ((pWords[0] & 1) | ((pWords[1] & 1) << 1))
+    {
+    case 0: return _mm_setr_ps(d, a, b, c);
+    case 1: return _mm_setr_ps(a, d, b, c);
+    case 2: return _mm_setr_ps(a, b, d, c);
+    default: return _mm_setr_ps(a, b, c, d);
+    }
+}
+
+//
+// Error of interpolating between 2 keys instead of using the key in between, for rotations it's the nlerp along the
+// shortest path and the sign of the quaternions doesn't matter.
+//
+static float InterpolationError(const math::Vector4 &a, math::Vector4 b, float frac, const math::Vector4 &value, bool bRotation)
+{
+    if (!bRotation)
+        return maxElem(absPerElem(a + (b - a) * frac - value));
+
+    if (dot(a, b) < 0.0f)
+        b = -b;
+
+    math::Vector4 q = a + (b - a) * frac;
+    float qLength = length(q);
+    if (qLength > 0.0f)
+        q /= qLength;
+
+    return std::min(maxElem(absPerElem(q - value)), maxElem(absPerElem(q + value)));
+}
+
+//
+// Returns the keys that must be kept for the track to stay within tolerance. Linear tracks drop the keys that
+// the lerp between the kept keys around them reproduces, step tracks drop the keys that don't change the value.
+//
+static std::vector<int> ReduceKeys(const std::vector<float> &times, const std::vector<math::Vector4> &values, tfSampler::Interpolation interpolation, bool bRotation, float tolerance)
+{
+    const int count = (int)times.size();
+
+    std::vector<int> keys;
+    keys.push_back(0);
+
+    if (interpolation == tfSampler::INTERPOLATION_STEP)
+    {
+        for (int k = 1; k < count; k++)
+        {
+            if (InterpolationError(values[keys.back()], values[keys.back()], 0.0f, values[k], bRotation) > tolerance)
+                keys.push_back(k);
+        }
+        return keys;
+    }
+
+    // grow the segment that starts at the last kept key for as long as the keys it skips are within tolerance
+    for (int end = 2; end < count; end++)
+    {
+        const int first = keys.back();
+        for (int k = first + 1; k < end; k++)
+        {
+            float frac = (times[k] - times[first]) / (times[end] - times[first]);
+            if (InterpolationError(values[first], values[end], frac, values[k], bRotation) > tolerance)
+            {
+                keys.push_back(end - 1);
+                break;
+            }
+        }
+    }
+
+    if (count > 1)
+        keys.push_back(count - 1);
+
+    return keys;
+}
+
+static void PackTrack(const tfSampler *pSampler, const math::Vector4 &defaultValue, bool bRotation, bool bCompress, float tolerance, tfPackedAnimation *pPacked)
+{
+    tfPackedTrack track;
+
+    if (pSampler != NULL)
+    {
+        const int dimension = pSampler->m_value.m_dimension;
+        const int valuesPerKey = (pSampler->m_interpolation == tfSampler::INTERPOLATION_CUBICSPLINE) ? 3 : 1;
+
+        std::vector<float> times(pSampler->m_time.m_count);
+        std::vector<math::Vector4> values(pSampler->m_value.m_count);
+        for (int k = 0; k < pSampler->m_time.m_count; k++)
+        {
+            times[k] = *(const float *)pSampler->m_time.Get(k);
+        }
+        for (int v = 0; v < pSampler->m_value.m_count; v++)
+        {
+            const float *pValue = (const float *)pSampler->m_value.Get(v);
+            values[v] = math::Vector4(pValue[0], pValue[1], pValue[2], (dimension == 4) ? pValue[3] : 0.0f);
+        }
+
+        // cubic splines are kept as they are, removing keys would need refitting the tangents
+        std::vector<int> keys;
+        if (bCompress && valuesPerKey == 1)
+        {
+            keys = ReduceKeys(times, values, pSampler->m_interpolation, bRotation, tolerance);
+        }
+        else
+        {
+            for (int k = 0; k < (int)times.size(); k++)
+                keys.push_back(k);
+        }
+
+        track.m_firstKey = (uint32_t)pPacked->m_times.size();
+        track.m_keyCount = (uint32_t)keys.size();
+        track.m_interpolation = (uint8_t)pSampler->m_interpolation;
+        track.m_quantized = bCompress && bRotation && valuesPerKey == 1;
+        track.m_firstValue = (uint32_t)(track.m_quantized ? pPacked->m_rotations.size() / 3 : pPacked->m_values.size());
+
+        for (int k : keys)
+        {
+            pPacked->m_times.push_back(times[k]);
+
+            if (track.m_quantized)
+            {
+                size_t offset = pPacked->m_rotations.size();
+                pPacked->m_rotations.resize(offset + 3);
+                EncodeRotation(values[k], &pPacked->m_rotations[offset]);
+                continue;
+            }
+
+            for (int v = 0; v < valuesPerKey; v++)
+                pPacked->m_values.push_back(values[k * valuesPerKey + v]);
+        }
+    }
+
+    pPacked->m_tracks.push_back(track);
+    pPacked->m_defaults.push_back(defaultValue);
+}
+
+void PackAnimation(const tfAnimation &animation, const std::vector<tfNode> &nodes, bool bCompress, float tolerance, tfPackedAnimation *pPacked)
+{
+    *pPacked = tfPackedAnimation();
+
+    for (auto it = animation.m_channels.begin(); it != animation.m_channels.end(); it++)
+    {
+        // channels that only animate morph target weights are sampled with SampleWeights()
+        if (it->second.m_pTranslation == NULL && it->second.m_pRotation == NULL && it->second.m_pScale == NULL)
+            continue;
+
+        // animated nodes use TRS, not a matrix, so their m_rotation is a pure rotation
+        const Transform &transform = nodes[it->first].m_transform;
+        math::Quat rotation(transform.m_rotation.getUpper3x3());
+
+        pPacked->m_nodes.push_back(it->first);
+        PackTrack(it->second.m_pTranslation, transform.m_translation, false, bCompress, tolerance, pPacked);
+        PackTrack(it->second.m_pRotation, math::Vector4(rotation), true, bCompress, tolerance, pPacked);
+        PackTrack(it->second.m_pScale, transform.m_scale, false, bCompress, tolerance, pPacked);
+    }
+
+    // the keys were appended one by one, drop the extra capacity
+    pPacked->m_times.shrink_to_fit();
+    pPacked->m_values.shrink_to_fit();
+    pPacked->m_rotations.shrink_to_fit();
+}
+
+static inline __m128 GetKeyValue(const tfPackedAnimation &packed, const tfPackedTrack &track, int index)
+{
+    if (track.m_quantized)
+        return DecodeRotation(&packed.m_rotations[(track.m_firstValue + index) * 3]);
+
+    return packed.m_values[track.m_firstValue + index].get128();
+}
+
+//
+// Fetches the 2 keys around time of a track and the interpolation factor between them.
+// Step and cubic spline tracks are fully evaluated here, they return the same value twice and a factor of 0.
+//
+static inline void SampleTrack(const tfPackedAnimation &packed, size_t trackIndex, float time, int *pCursors, __m128 *pCurr, __m128 *pNext, float *pFrac)
+{
+    const tfPackedTrack &track = packed.m_tracks[trackIndex];
+    if (track.m_keyCount == 0)
+    {
+        *pCurr = *pNext = packed.m_defaults[trackIndex].get128();
+        *pFrac = 0.0f;
+        return;
+    }
+
+    const float *pTimes = &packed.m_times[track.m_firstKey];
+
+    int curr = FindKeyFromCursor(pTimes, track.m_keyCount, time, &pCursors[trackIndex]);
+    int next = std::min<int>(curr + 1, track.m_keyCount - 1);
+    if (curr < 0) curr++;
+
+    *pFrac = 0.0f;
+
+    if (track.m_interpolation == tfSampler::INTERPOLATION_STEP || curr == next)
+    {
+        if (track.m_interpolation == tfSampler::INTERPOLATION_CUBICSPLINE)
+            curr = curr * 3 + 1;
+
+        *pCurr = *pNext = GetKeyValue(packed, track, curr);
+        return;
+    }
+
+    float frac = (time - pTimes[curr]) / (pTimes[next] - pTimes[curr]);
+
+    if (track.m_interpolation == tfSampler::INTERPOLATION_CUBICSPLINE)
+    {
+        // Hermite spline, the keys are stored as in-tangent, value, out-tangent
+        const float dt = pTimes[next] - pTimes[curr];
+        const float t2 = frac * frac;
+        const float t3 = t2 * frac;
+
+        const math::Vector4 *pValues = &packed.m_values[track.m_firstValue];
+        __m128 result = _mm_mul_ps(pValues[curr * 3 + 1].get128(), _mm_set1_ps(2.0f * t3 - 3.0f * t2 + 1.0f));
+        result = _mm_add_ps(result, _mm_mul_ps(pValues[curr * 3 + 2].get128(), _mm_set1_ps((t3 - 2.0f * t2 + frac) * dt)));
+        result = _mm_add_ps(result, _mm_mul_ps(pValues[next * 3 + 1].get128(), _mm_set1_ps(-2.0f * t3 + 3.0f * t2)));
+        result = _mm_add_ps(result, _mm_mul_ps(pValues[next * 3 + 0].get128(), _mm_set1_ps((t3 - t2) * dt)));
+
+        *pCurr = *pNext = result;
+        return;
+    }
+
+    *pCurr = GetKeyValue(packed, track, curr);
+    *pNext = GetKeyValue(packed, track, next);
+    *pFrac = frac;
+}
+
+static inline __m128 Lerp(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+//
+// Slerp of 4 quaternion pairs given as SoA. It's a nlerp whose t is corrected with a polynomial of the angle between
+// the quaternions, see "Approximating slerp" (Kapoulkine). The error stays around 1e-3 even for keys that are far apart.
+//
+static inline void Slerp4(const __m128 a[4], __m128 b[4], __m128 t, __m128 result[4])
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    // take the shortest path
+    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])), _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+    __m128 flip = _mm_and_ps(d, signMask);
+    for (int c = 0; c < 4; c++)
+        b[c] = _mm_xor_ps(b[c], flip);
+    d = _mm_xor_ps(d, flip);
+
+    // A = 1.0904 + d * (-3.2452 + d * (3.55645 - d * 1.43519))
+    // B = 0.848013 + d * (-1.06021 + d * 0.215638)
+    // t' = t + t * (t - 0.5) * (t - 1) * (A * (t - 0.5)^2 + B)
+    __m128 A = _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)));
+    A = _mm_add_ps(_mm_set1_ps(-3.2452f), _mm_mul_ps(d, A));
+    A = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, A));
+    __m128 B = _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)));
+    B = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, B));
+
+    __m128 tHalf = _mm_sub_ps(t, half);
+    __m128 k = _mm_add_ps(_mm_mul_ps(A, _mm_mul_ps(tHalf, tHalf)), B);
+    __m128 ot = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, tHalf), _mm_mul_ps(_mm_sub_ps(t, one), k)));
+
+    for (int c = 0; c < 4; c++)
+        result[c] = Lerp(a[c], b[c], ot);
+
+    // normalize, keys with a zero length quaternion stay zero
+    __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(result[0], result[0]), _mm_mul_ps(result[1], result[1])), _mm_add_ps(_mm_mul_ps(result[2], result[2]), _mm_mul_ps(result[3], result[3])));
+    __m128 invLength = _mm_and_ps(_mm_div_ps(one, _mm_sqrt_ps(length2)), _mm_cmpgt_ps(length2, zero));
+    for (int c = 0; c < 4; c++)
+        result[c] = _mm_mul_ps(result[c], invLength);
+}
+
+static const __m128 s_identity[COMPONENT_COUNT] = { _mm_setzero_ps(), _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f), _mm_set1_ps(1.0f) };
+
+//
+// Samples the channels [first, first + lanes) of an animation, lanes <= 4. The results are SoA, each register holds
+// a coordinate of the 4 channels: t is the translation, q the rotation and s the scale.
+// pCursors holds the key found by the last lookup of each track, see FindKeyFromCursor().
+//
+static inline void EvaluateChannels4(const tfPackedAnimation &packed, float time, int *pCursors, size_t first, size_t lanes, __m128 t[3], __m128 q[4], __m128 s[3])
+{
+    // gather the keys of 4 channels and transpose them
+    //
+    __m128 curr[COMPONENT_COUNT][4], next[COMPONENT_COUNT][4], frac[COMPONENT_COUNT];
+    for (int component = 0; component < COMPONENT_COUNT; component++)
+    {
+        VECTORMATH_ALIGNED(float f[4]);
+        for (size_t lane = 0; lane < 4; lane++)
+        {
+            if (lane < lanes)
+            {
+                SampleTrack(packed, (first + lane) * COMPONENT_COUNT + component, time, pCursors, &curr[component][lane], &next[component][lane], &f[lane]);
+            }
+            else
+            {
+                curr[component][lane] = next[component][lane] = s_identity[component];
+                f[lane] = 0.0f;
+            }
+        }
+
+        _MM_TRANSPOSE4_PS(curr[component][0], curr[component][1], curr[component][2], curr[component][3]);
+        _MM_TRANSPOSE4_PS(next[component][0], next[component][1], next[component][2], next[component][3]);
+        frac[component] = _mm_load_ps(f);
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+        t[c] = Lerp(curr[COMPONENT_TRANSLATION][c], next[COMPONENT_TRANSLATION][c], frac[COMPONENT_TRANSLATION]);
+        s[c] = Lerp(curr[COMPONENT_SCALE][c], next[COMPONENT_SCALE][c], frac[COMPONENT_SCALE]);
+    }
+    Slerp4(curr[COMPONENT_ROTATION], next[COMPONENT_ROTATION], frac[COMPONENT_ROTATION], q);
+}
+
+//
+// translation * rotation * scale of 4 SoA transforms, same as Transform::GetWorldMat().
+// cols[c][lane] is the column c of the matrix of each lane.
+//
+static inline void ComposeMatrices4(const __m128 t[3], const __m128 q[4], const __m128 s[3], __m128 cols[4][4])
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    __m128 x2 = _mm_mul_ps(q[0], two), y2 = _mm_mul_ps(q[1], two), z2 = _mm_mul_ps(q[2], two);
+    __m128 xx = _mm_mul_ps(q[0], x2), yy = _mm_mul_ps(q[1], y2), zz = _mm_mul_ps(q[2], z2);
+    __m128 xy = _mm_mul_ps(q[0], y2), xz = _mm_mul_ps(q[0], z2), yz = _mm_mul_ps(q[1], z2);
+    __m128 wx = _mm_mul_ps(q[3], x2), wy = _mm_mul_ps(q[3], y2), wz = _mm_mul_ps(q[3], z2);
+
+    cols[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), s[0]);
+    cols[0][1] = _mm_mul_ps(_mm_add_ps(xy, wz), s[0]);
+    cols[0][2] = _mm_mul_ps(_mm_sub_ps(xz, wy), s[0]);
+    cols[0][3] = _mm_setzero_ps();
+
+    cols[1][0] = _mm_mul_ps(_mm_sub_ps(xy, wz), s[1]);
+    cols[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), s[1]);
+    cols[1][2] = _mm_mul_ps(_mm_add_ps(yz, wx), s[1]);
+    cols[1][3] = _mm_setzero_ps();
+
+    cols[2][0] = _mm_mul_ps(_mm_add_ps(xz, wy), s[2]);
+    cols[2][1] = _mm_mul_ps(_mm_sub_ps(yz, wx), s[2]);
+    cols[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), s[2]);
+    cols[2][3] = _mm_setzero_ps();
+
+    cols[3][0] = t[0];
+    cols[3][1] = t[1];
+    cols[3][2] = t[2];
+    cols[3][3] = one;
+
+    // back to one column per register
+    for (int c = 0; c < 4; c++)
+        _MM_TRANSPOSE4_PS(cols[c][0], cols[c][1], cols[c][2], cols[c][3]);
+}
+
+void EvaluatePackedAnimation(const tfPackedAnimation &packed, float time, int *pCursors, math::Matrix4 *pMats)
+{
+    const size_t channelCount = packed.m_nodes.size();
+    for (size_t first = 0; first < channelCount; first += 4)
+    {
+        const size_t lanes = std::min<size_t>(4, channelCount - first);
+
+        __m128 t[3], q[4], s[3], cols[4][4];
+        EvaluateChannels4(packed, time, pCursors, first, lanes, t, q, s);
+        ComposeMatrices4(t, q, s, cols);
+
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            pMats[packed.m_nodes[first + lane]] = math::Matrix4(math::Vector4(cols[0][lane]), math::Vector4(cols[1][lane]), math::Vector4(cols[2][lane]), math::Vector4(cols[3][lane]));
+        }
+    }
+}
+
+// product of 4 SoA quaternion pairs
+static inline void QuatMul4(const __m128 a[4], const __m128 b[4], __m128 result[4])
+{
+    result[0] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[3], b[0]), _mm_mul_ps(a[0], b[3])), _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1])));
+    result[1] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[3], b[1]), _mm_mul_ps(a[1], b[3])), _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2])));
+    result[2] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[3], b[2]), _mm_mul_ps(a[2], b[3])), _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0])));
+    result[3] = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(a[3], b[3]), _mm_mul_ps(a[0], b[0])), _mm_add_ps(_mm_mul_ps(a[1], b[1]), _mm_mul_ps(a[2], b[2])));
+}
+
+//
+// Loads the poses of up to 4 nodes (or the rest pose of 4 channels) as SoA, the missing lanes get the identity
+//
+static inline void GatherPoses4(const tfPose *pPoses, const tfNodeIdx *pNodes, size_t lanes, __m128 t[4], __m128 q[4], __m128 s[4])
+{
+    for (size_t lane = 0; lane < 4; lane++)
+    {
+        const tfPose *pPose = (lane < lanes) ? &pPoses[pNodes ? pNodes[lane] : lane] : NULL;
+        t[lane] = pPose ? pPose->m_translation.get128() : s_identity[COMPONENT_TRANSLATION];
+        q[lane] = pPose ? pPose->m_rotation.get128() : s_identity[COMPONENT_ROTATION];
+        s[lane] = pPose ? pPose->m_scale.get128() : s_identity[COMPONENT_SCALE];
+    }
+
+    _MM_TRANSPOSE4_PS(t[0], t[1], t[2], t[3]);
+    _MM_TRANSPOSE4_PS(q[0], q[1], q[2], q[3]);
+    _MM_TRANSPOSE4_PS(s[0], s[1], s[2], s[3]);
+}
+
+void InitPackedAnimationPoses(const tfPackedAnimation &packed, tfPose *pPoses)
+{
+    for (size_t c = 0; c < packed.m_nodes.size(); c++)
+    {
+        tfPose &pose = pPoses[packed.m_nodes[c]];
+        pose.m_translation = packed.m_defaults[c * COMPONENT_COUNT + COMPONENT_TRANSLATION];
+        pose.m_rotation = packed.m_defaults[c * COMPONENT_COUNT + COMPONENT_ROTATION];
+        pose.m_scale = packed.m_defaults[c * COMPONENT_COUNT + COMPONENT_SCALE];
+    }
+}
+
+void BlendPackedAnimation(const tfPackedAnimation &packed, float time, float weight, bool bAdditive, size_t firstChannel, size_t lastChannel, int *pCursors, tfPose *pPoses)
+{
+    const __m128 w = _mm_set1_ps(weight);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    lastChannel = std::min(lastChannel, packed.m_nodes.size());
+    for (size_t first = firstChannel; first < lastChannel; first += 4)
+    {
+        const size_t lanes = std::min<size_t>(4, lastChannel - first);
+
+        __m128 t[3], q[4], s[3];
+        EvaluateChannels4(packed, time, pCursors, first, lanes, t, q, s);
+
+        __m128 bt[4], bq[4], bs[4];
+        GatherPoses4(pPoses, &packed.m_nodes[first], lanes, bt, bq, bs);
+
+        __m128 rq[4];
+        if (bAdditive)
+        {
+            // the layer is applied as its difference with the rest pose of the nodes (the defaults of the channels)
+            //
+            __m128 rt[4], rs[4];
+            tfPose rest[4];
+            for (size_t lane = 0; lane < lanes; lane++)
+            {
+                const size_t channel = first + lane;
+                rest[lane].m_translation = packed.m_defaults[channel * COMPONENT_COUNT + COMPONENT_TRANSLATION];
+                rest[lane].m_rotation = packed.m_defaults[channel * COMPONENT_COUNT + COMPONENT_ROTATION];
+                rest[lane].m_scale = packed.m_defaults[channel * COMPONENT_COUNT + COMPONENT_SCALE];
+            }
+            GatherPoses4(rest, NULL, lanes, rt, rq, rs);
+
+            for (int c = 0; c < 3; c++)
+            {
+                t[c] = _mm_add_ps(bt[c], _mm_mul_ps(_mm_sub_ps(t[c], rt[c]), w));
+
+                // a rest scale of 0 can't be divided, the layer leaves those alone
+                __m128 ratio = _mm_and_ps(_mm_div_ps(s[c], rs[c]), _mm_cmpneq_ps(rs[c], zero));
+                ratio = _mm_or_ps(ratio, _mm_andnot_ps(_mm_cmpneq_ps(rs[c], zero), one));
+                s[c] = _mm_mul_ps(bs[c], Lerp(one, ratio, w));
+            }
+
+            // delta = conjugate(rest) * q, scaled by the weight and applied on top of the current rotation
+            for (int c = 0; c < 3; c++)
+                rq[c] = _mm_xor_ps(rq[c], signMask);
+
+            __m128 delta[4], weighted[4];
+            QuatMul4(rq, q, delta);
+
+            const __m128 identity[4] = { zero, zero, zero, one };
+            Slerp4(identity, delta, w, weighted);
+            QuatMul4(bq, weighted, q);
+        }
+        else
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                t[c] = Lerp(bt[c], t[c], w);
+                s[c] = Lerp(bs[c], s[c], w);
+            }
+
+            for (int c = 0; c < 4; c++)
+                rq[c] = q[c];
+            Slerp4(bq, rq, w, q);
+        }
+
+        // back to AoS
+        //
+        __m128 t3 = zero, s3 = zero;
+        _MM_TRANSPOSE4_PS(t[0], t[1], t[2], t3);
+        _MM_TRANSPOSE4_PS(q[0], q[1], q[2], q[3]);
+        _MM_TRANSPOSE4_PS(s[0], s[1], s[2], s3);
+        const __m128 tAoS[4] = { t[0], t[1], t[2], t3 };
+        const __m128 sAoS[4] = { s[0], s[1], s[2], s3 };
+
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            tfPose &pose = pPoses[packed.m_nodes[first + lane]];
+            pose.m_translation = math::Vector4(tAoS[lane]);
+            pose.m_rotation = math::Vector4(q[lane]);
+            pose.m_scale = math::Vector4(sAoS[lane]);
+        }
+    }
+}
+
+void ComposePoses(const tfPose *pPoses, const tfNodeIdx *pNodes, size_t count, math::Matrix4 *pMats)
+{
+    for (size_t first = 0; first < count; first += 4)
+    {
+        const size_t lanes = std::min<size_t>(4, count - first);
+
+        __m128 t[4], q[4], s[4], cols[4][4];
+        GatherPoses4(pPoses, &pNodes[first], lanes, t, q, s);
+        ComposeMatrices4(t, q, s, cols);
+
+        for (size_t lane = 0; lane < lanes; lane++)
+        {
+            pMats[pNodes[first + lane]] = math::Matrix4(math::Vector4(cols[0][lane]), math::Vector4(cols[1][lane]), math::Vector4(cols[2][lane]), math::Vector4(cols[3][lane]));
+        }
+    }
+}
+
+//
+// The weights can be floats or normalized integers, index counts the scalars of the output
+//
+static float GetWeight(const tfAccessor &values, int index)
+{
+    const char *pValue = (const char *)values.m_data + (size_t)values.m_stride * index;
+    switch (values.m_componentType)
+    {
+        case 5120: return NormalizeComponent(*(const int8_t *)pValue, 5120);
+        case 5121: return NormalizeComponent(*(const uint8_t *)pValue, 5121);
+        case 5122: return NormalizeComponent(*(const int16_t *)pValue, 5122);
+        case 5123: return NormalizeComponent(*(const uint16_t *)pValue, 5123);
+    }
+    return *(const float *)pValue;
+}
+
+int SampleWeights(const tfSampler &sampler, float time, int *pCursor, float *pWeights, int count)
+{
+    const float *pTimes = (const float *)sampler.m_time.m_data;
+    const tfAccessor &values = sampler.m_value;
+    const int keyCount = sampler.m_time.m_count;
+    const int valuesPerKey = (sampler.m_interpolation == tfSampler::INTERPOLATION_CUBICSPLINE) ? 3 : 1;
+
+    // each key holds the weights of all the targets of the mesh, whatever the number the caller wants
+    const int targetCount = (keyCount > 0) ? values.m_count / (keyCount * valuesPerKey) : 0;
+    count = std::min(count, targetCount);
+    if (count <= 0)
+        return 0;
+
+    int curr = sampler.FindKey(time, pCursor);
+    int next = std::min<int>(curr + 1, keyCount - 1);
+    if (curr < 0) curr++;
+
+    if (sampler.m_interpolation == tfSampler::INTERPOLATION_CUBICSPLINE)
+    {
+        // each key has the in-tangents, the values and the out-tangents of all the targets
+        const int currKey = curr * 3 * targetCount;
+        const int nextKey = next * 3 * targetCount;
+        if (curr == next)
+        {
+            for (int i = 0; i < count; i++)
+                pWeights[i] = GetWeight(values, currKey + targetCount + i);
+            return count;
+        }
+
+        const float dt = pTimes[next] - pTimes[curr];
+        const float t = (time - pTimes[curr]) / dt;
+        const float t2 = t * t;
+        const float t3 = t2 * t;
+        for (int i = 0; i < count; i++)
+        {
+            pWeights[i] = (2.0f * t3 - 3.0f * t2 + 1.0f) * GetWeight(values, currKey + targetCount + i) + (t3 - 2.0f * t2 + t) * dt * GetWeight(values, currKey + 2 * targetCount + i) +
+                          (-2.0f * t3 + 3.0f * t2) * GetWeight(values, nextKey + targetCount + i) + (t3 - t2) * dt * GetWeight(values, nextKey + i);
+        }
+        return count;
+    }
+
+    const int currKey = curr * targetCount;
+    const int nextKey = next * targetCount;
+    float frac = (curr == next || sampler.m_interpolation == tfSampler::INTERPOLATION_STEP) ? 0.0f : (time - pTimes[curr]) / (pTimes[next] - pTimes[curr]);
+    for (int i = 0; i < count; i++)
+    {
+        const float currWeight = GetWeight(values, currKey + i);
+        pWeights[i] = currWeight + (GetWeight(values, nextKey + i) - currWeight) * frac;
+    }
+    return count;
+}
+
+//
+// The deltas are float3 and the output has 3 or 4 floats per vertex, each delta is added with a single 4 wide
+// load/store. The 4th lane of the weights is 0 so the float following the xyz (next delta, next vertex or the w of
+// a tangent) is left untouched, the vectors have one float of padding for the last element.
+//
+void MorphVertexStream(const tfAccessor &base, const tfMorphDelta *const *ppDeltas, const float *pWeights, size_t targetCount, float *pOut)
+{
+    const int dimension = base.m_dimension;
+
+    // quantized attributes are converted to floats, the morphed streams are always floats
+    DequantizeAccessor(base, pOut);
+
+    for (size_t t = 0; t < targetCount; t++)
+    {
+        const tfMorphDelta *pDelta = ppDeltas[t];
+        if (pDelta == NULL || pWeights[t] == 0.0f)
+            continue;
+
+        const __m128 w = _mm_setr_ps(pWeights[t], pWeights[t], pWeights[t], 0.0f);
+        const uint32_t *pIndices = pDelta->m_indices.data();
+        const float *pDeltas = pDelta->m_deltas.data();
+        const size_t count = pDelta->m_indices.size();
+        for (size_t i = 0; i < count; i++)
+        {
+            float *pVertex = &pOut[pIndices[i] * dimension];
+            _mm_storeu_ps(pVertex, _mm_add_ps(_mm_loadu_ps(pVertex), _mm_mul_ps(_mm_loadu_ps(&pDeltas[i * 3]), w)));
+        }
+    }
+}
+
@@ -0,0 +1,61 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#pragma once
+
+#include "GltfPbrMaterial.h"
+#include "GltfStructures.h"
+
+//
+// SIMD evaluation of the animations. At load time the channels of each animation are repacked into flat arrays
+// (tfPackedAnimation), then the channels are evaluated 4 at a time with SSE: lerp of the translations and scales,
+// approximated slerp of the rotations and TRS to matrix. Step and cubic spline tracks are sampled per channel.
+//
+
+// Repacks the channels of an animation, the nodes provide the values of the components that are not animated.
+// When bCompress is set the keys that can be interpolated within tolerance are removed and the rotations are quantized.
+void PackAnimation(const tfAnimation &animation, const std::vector<tfNode> &nodes, bool bCompress, float tolerance, tfPackedAnimation *pPacked);
+
+// Writes the local matrix of each animated node in pMats, indexed by node. pCursors has one entry per track
+// (m_tracks.size()), the key found by the last lookup of each track, see FindKeyFromCursor().
+void EvaluatePackedAnimation(const tfPackedAnimation &packed, float time, int *pCursors, math::Matrix4 *pMats);
+
+// Sets the poses of the nodes animated by the animation to their rest pose, pPoses is indexed by node
+void InitPackedAnimationPoses(const tfPackedAnimation &packed, tfPose *pPoses);
+
+// Samples the channels [firstChannel, lastChannel) and blends them into the poses of their nodes, see tfAnimationLayer.
+// Different channels of an animation target different nodes, so disjoint channel ranges can be blended concurrently.
+// pCursors has one entry per track (m_tracks.size()) and belongs to the caller, the packed animation is never written
+// so the instances can evaluate it concurrently.
+void BlendPackedAnimation(const tfPackedAnimation &packed, float time, float weight, bool bAdditive, size_t firstChannel, size_t lastChannel, int *pCursors, tfPose *pPoses);
+
+// Writes the local matrix of the pose of each node of pNodes in pMats, indexed by node
+void ComposePoses(const tfPose *pPoses, const tfNodeIdx *pNodes, size_t count, math::Matrix4 *pMats);
+
+//
+// Morph targets
+//
+
+// Samples the weights of the first count morph targets of a "weights" channel, the number of targets per key comes from
+// the size of the output. Returns the number of weights written, fewer than count when the channel has fewer targets.
+// pCursor is the key found by the previous call for this channel, see FindKeyFromCursor().
+int SampleWeights(const tfSampler &sampler, float time, int *pCursor, float *pWeights, int count);
+
+// Writes the base attribute plus the weighted deltas of the morph targets into pOut, base.m_count * base.m_dimension
+// floats plus one of padding. ppDeltas has one entry per target, NULL for the targets that don't have the attribute.
+void MorphVertexStream(const tfAccessor &base, const tfMorphDelta *const *ppDeltas, const float *pWeights, size_t targetCount, float *pOut);
@@ -0,0 +1,381 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "GltfCommon.h"
+#include "Misc/Misc.h"
+#include "Misc/FrustumCulling.h"
+
+//
+// Bounding volume hierarchy
+//
+// The passes used to visit every primitive of every node and test its box with CameraFrustumToBoxCollision(). The
+// primitives of the transformed scene are now the items of a BVH built over their world space boxes, so CullPrimitives()
+// skips the subtrees that are out of the frustum and takes the ones that are fully inside it without testing their items.
+//
+// The BVH is built by TransformScene() when all the nodes are transformed (first frame, new scene, new world matrix or new
+// nodes) by splitting the items at the median of the longest axis of their centers. The following calls only refit it:
+// the items whose node moved get new boxes and the nodes above them are merged again, the tree itself doesn't change.
+//
+// The nodes drawn with instances are a single item whose box holds all their instances, CullInstances() still culls
+// the instances one by one.
+//
+// When the occlusion buffer was rendered for the same view projection (see RenderOccluders()) the nodes and items that
+// are in the frustum are also tested against it, the subtrees inside the frustum are then visited down to their items.
+//
+
+static const uint32_t BvhLeafSize = 16;     // the items of a leaf are culled in one CullBoxes() call
+static const uint32_t Outside = ~0u;
+
+//
+// Tests a box against the planes of planeMask. Returns Outside when it is behind one of them, otherwise the mask of the
+// planes it straddles (0 when it is fully inside), which are the only ones its children need to be tested against.
+//
+static uint32_t ClassifyBox(const FrustumPlanes &frustum, const math::Vector4 &min, const math::Vector4 &max, uint32_t planeMask)
+{
+    uint32_t straddled = 0;
+    for (uint32_t i = 0; i < FrustumPlaneCount; i++)
+    {
+        if ((planeMask & (1 << i)) == 0)
+            continue;
+
+        // the distances of the corners farthest along and against the normal of the plane
+        const math::Vector4 &plane = frustum.m_planes[i];
+        float farthest = plane.getW();
+        float nearest = plane.getW();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float n = plane.getElem(axis);
+            farthest += n * (n > 0.0f ? max.getElem(axis) : min.getElem(axis));
+            nearest += n * (n > 0.0f ? min.getElem(axis) : max.getElem(axis));
+        }
+
+        if (farthest < 0.0f)
+            return Outside;
+        if (nearest < 0.0f)
+            straddled |= 1 << i;
+    }
+
+    return straddled;
+}
+
+static void AddRange(uint32_t firstItem, uint32_t itemCount, std::vector<tfBvhRange> *pRanges)
+{
+    if (!pRanges->empty() && pRanges->back().m_firstItem + pRanges->back().m_itemCount == firstItem)
+    {
+        pRanges->back().m_itemCount += itemCount;
+        return;
+    }
+
+    pRanges->push_back({ firstItem, itemCount });
+}
+
+//
+// World space box of an item, the instanced nodes cover all their instances
+//
+AxisAlignedBoundingBox GLTFCommon::GetBvhItemBounds(const tfBvhItem &item) const
+{
+    const tfMesh &mesh = m_meshes[m_nodes[item.m_node].meshIndex];
+    if (item.m_primitive >= 0)
+    {
+        const tfPrimitives &primitive = mesh.m_pPrimitives[item.m_primitive];
+        return TransformBoundingBox(m_worldSpaceMats[item.m_node].GetCurrent(), primitive.m_center, primitive.m_radius);
+    }
+
+    AxisAlignedBoundingBox meshBounds;
+    for (const tfPrimitives &primitive : mesh.m_pPrimitives)
+    {
+        meshBounds.Grow(primitive.m_center - primitive.m_radius);
+        meshBounds.Grow(primitive.m_center + primitive.m_radius);
+    }
+
+    math::Vector4 center = (meshBounds.m_min + meshBounds.m_max) * 0.5f;
+    math::Vector4 extent = meshBounds.m_max - center;
+    center.setW(1.0f);
+    extent.setW(0.0f);
+
+    AxisAlignedBoundingBox bounds;
+    if (IsNodeBatched(item.m_node))
+    {
+        for (tfNodeIdx node : m_nodeBatches[m_nodeBatchIndex[item.m_node]])
+            bounds.Merge(TransformBoundingBox(m_worldSpaceMats[node].GetCurrent(), center, extent));
+    }
+    else
+    {
+        const math::Matrix4 world = m_worldSpaceMats[item.m_node].GetCurrent();
+        for (const InstanceMatrix &instance : m_nodeInstances.at(item.m_node))
+            bounds.Merge(TransformBoundingBox(world * instance.Get(), center, extent));
+    }
+
+    return bounds;
+}
+
+//
+// Splits the items of a node at the median of the longest axis of their centers until the leaves have at most
+// BvhLeafSize items. The two children of a node are allocated together so the second one is always m_left + 1.
+//
+static void BuildBvhNode(uint32_t nodeIndex, std::vector<tfBvhNode> &nodes, std::vector<uint32_t> &order, const std::vector<AxisAlignedBoundingBox> &bounds)
+{
+    const uint32_t first = nodes[nodeIndex].m_firstItem;
+    const uint32_t count = nodes[nodeIndex].m_itemCount;
+
+    AxisAlignedBoundingBox box;
+    AxisAlignedBoundingBox centers;
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        box.Merge(bounds[order[i]]);
+        centers.Grow((bounds[order[i]].m_min + bounds[order[i]].m_max) * 0.5f);
+    }
+    nodes[nodeIndex].m_min = box.m_min;
+    nodes[nodeIndex].m_max = box.m_max;
+
+    if (count <= BvhLeafSize)
+        return;
+
+    math::Vector4 size = centers.m_max - centers.m_min;
+    int axis = (size.getX() >= size.getY() && size.getX() >= size.getZ()) ? 0 : (size.getY() >= size.getZ() ? 1 : 2);
+
+    const uint32_t middle = first + count / 2;
+    std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count, [&bounds, axis](uint32_t a, uint32_t b)
+    {
+        return bounds[a].m_min.getElem(axis) + bounds[a].m_max.getElem(axis) < bounds[b].m_min.getElem(axis) + bounds[b].m_max.getElem(axis);
+    });
+
+    const uint32_t left = (uint32_t)nodes.size();
+    nodes[nodeIndex].m_left = left;
+    nodes.push_back({ box.m_min, box.m_max, first, middle - first, 0, (int)nodeIndex });
+    nodes.push_back({ box.m_min, box.m_max, middle, first + count - middle, 0, (int)nodeIndex });
+
+    BuildBvhNode(left, nodes, order, bounds);
+    BuildBvhNode(left + 1, nodes, order, bounds);
+}
+
+void GLTFCommon::BuildBvh()
+{
+    Profile p("GLTFCommon::BuildBvh");
+
+    m_bvhItems.clear();
+    m_bvhNodes.clear();
+    m_bvhNodeItemStart.assign(m_nodes.size() + 1, 0);
+    m_bvhNodeItems.clear();
+
+    std::vector<tfBvhItem> items;
+    std::vector<AxisAlignedBoundingBox> bounds;
+    for (tfNodeIdx node : m_scenes[m_transformedScene].m_flatNodes)
+    {
+        int meshIndex = m_nodes[node].meshIndex;
+        if (meshIndex < 0 || m_meshes[meshIndex].m_pPrimitives.empty())
+            continue;
+
+        if (IsNodeInstanced(node))
+        {
+            // the nodes of a batch are drawn by its first node
+            if (GetNodeInstanceCount(node) > 0)
+                items.push_back({ node, -1 });
+            continue;
+        }
+
+        for (int primitive = 0; primitive < (int)m_meshes[meshIndex].m_pPrimitives.size(); primitive++)
+            items.push_back({ node, primitive });
+    }
+
+    if (items.empty())
+        return;
+
+    bounds.resize(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+        bounds[i] = GetBvhItemBounds(items[i]);
+
+    std::vector<uint32_t> order(items.size());
+    for (uint32_t i = 0; i < (uint32_t)order.size(); i++)
+        order[i] = i;
+
+    m_bvhNodes.reserve(2 * (items.size() / BvhLeafSize + 1));
+    m_bvhNodes.push_back({ math::Vector4(0.0f), math::Vector4(0.0f), 0, (uint32_t)items.size(), 0, -1 });
+    BuildBvhNode(0, m_bvhNodes, order, bounds);
+
+    // the items are stored in the order of the leaves
+    m_bvhItems.resize(items.size());
+    m_bvhItemBoxes.Resize(items.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        m_bvhItems[i] = items[order[i]];
+        m_bvhItemBoxes.Set(i, bounds[order[i]]);
+    }
+
+    m_bvhItemLeaves.resize(items.size());
+    for (uint32_t n = 0; n < (uint32_t)m_bvhNodes.size(); n++)
+    {
+        const tfBvhNode &node = m_bvhNodes[n];
+        if (node.m_left != 0)
+            continue;
+
+        for (uint32_t i = node.m_firstItem; i < node.m_firstItem + node.m_itemCount; i++)
+            m_bvhItemLeaves[i] = n;
+    }
+
+    m_bvhNodeDirty.assign(m_bvhNodes.size(), 0);
+    m_bvhItemDirty.assign(m_bvhItems.size(), 0);
+
+    // index from the nodes to the items they move, counted then filled
+    auto forEachItemNode = [this](const tfBvhItem &item, auto &&f)
+    {
+        if (item.m_primitive < 0 && IsNodeBatched(item.m_node))
+        {
+            for (tfNodeIdx node : m_nodeBatches[m_nodeBatchIndex[item.m_node]])
+                f(node);
+        }
+        else
+        {
+            f((tfNodeIdx)item.m_node);
+        }
+    };
+
+    for (const tfBvhItem &item : m_bvhItems)
+        forEachItemNode(item, [this](tfNodeIdx node) { m_bvhNodeItemStart[node + 1]++; });
+    for (size_t n = 0; n < m_nodes.size(); n++)
+        m_bvhNodeItemStart[n + 1] += m_bvhNodeItemStart[n];
+
+    std::vector<uint32_t> cursors(m_bvhNodeItemStart.begin(), m_bvhNodeItemStart.end() - 1);
+    m_bvhNodeItems.resize(m_bvhNodeItemStart.back());
+    for (uint32_t i = 0; i < (uint32_t)m_bvhItems.size(); i++)
+        forEachItemNode(m_bvhItems[i], [this, &cursors, i](tfNodeIdx node) { m_bvhNodeItems[cursors[node]++] = i; });
+}
+
+//
+// Updates the boxes of the items moved by the nodes TransformScene() recomputed and of the nodes above them, so the cost
+// follows what moved rather than the size of the scene. The children always come after their parent so the nodes are
+// merged again from the last one to the first one.
+//
+void GLTFCommon::RefitBvh()
+{
+    m_bvhRefitNodes.clear();
+    m_bvhRefitItems.clear();
+    for (tfNodeIdx node : m_movedNodes)
+    {
+        for (uint32_t k = m_bvhNodeItemStart[node]; k < m_bvhNodeItemStart[node + 1]; k++)
+        {
+            // the item of a batch is refit once however many of its nodes moved
+            const uint32_t i = m_bvhNodeItems[k];
+            if (m_bvhItemDirty[i])
+                continue;
+
+            m_bvhItemDirty[i] = 1;
+            m_bvhRefitItems.push_back(i);
+            m_bvhItemBoxes.Set(i, GetBvhItemBounds(m_bvhItems[i]));
+
+            for (int n = (int)m_bvhItemLeaves[i]; n >= 0 && !m_bvhNodeDirty[n]; n = m_bvhNodes[n].m_parent)
+            {
+                m_bvhNodeDirty[n] = 1;
+                m_bvhRefitNodes.push_back((uint32_t)n);
+            }
+        }
+    }
+
+    for (uint32_t i : m_bvhRefitItems)
+        m_bvhItemDirty[i] = 0;
+
+    if (m_bvhRefitNodes.empty())
+        return;
+
+    std::sort(m_bvhRefitNodes.begin(), m_bvhRefitNodes.end(), std::greater<uint32_t>());
+    for (uint32_t n : m_bvhRefitNodes)
+    {
+        tfBvhNode &node = m_bvhNodes[n];
+        AxisAlignedBoundingBox box;
+        if (node.m_left == 0)
+        {
+            for (uint32_t i = node.m_firstItem; i < node.m_firstItem + node.m_itemCount; i++)
+                box.Merge(m_bvhItemBoxes.Get(i));
+        }
+        else
+        {
+            for (uint32_t child = node.m_left; child < node.m_left + 2; child++)
+            {
+                box.Grow(m_bvhNodes[child].m_min);
+                box.Grow(m_bvhNodes[child].m_max);
+            }
+        }
+
+        node.m_min = box.m_min;
+        node.m_max = box.m_max;
+        m_bvhNodeDirty[n] = 0;
+    }
+}
+
+//
+// Hierarchical frustum and occlusion culling of the primitives of the transformed scene, pVisible receives the ranges of
+// m_bvhItems that are visible, in increasing order
+//
+void GLTFCommon::CullPrimitives(const math::Matrix4 &mCameraViewProj, std::vector<tfBvhRange> *pVisible) const
+{
+    pVisible->clear();
+    if (m_bvhNodes.empty())
+        return;
+
+    FrustumPlanes frustum;
+    GetFrustumPlanes(mCameraViewProj, &frustum);
+
+    const bool bOcclusion = m_occlusionBuffer.IsValidFor(mCameraViewProj);
+
+    // the median splits keep the depth under 32, the stack holds at most one pending sibling per level
+    std::pair<uint32_t, uint32_t> stack[64];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = std::make_pair(0u, 0x1fu);
+
+    while (stackSize > 0)
+    {
+        const uint32_t nodeIndex = stack[stackSize - 1].first;
+        const uint32_t planeMask = stack[stackSize - 1].second;
+        stackSize--;
+
+        const tfBvhNode &node = m_bvhNodes[nodeIndex];
+        const uint32_t straddled = ClassifyBox(frustum, node.m_min, node.m_max, planeMask);
+        if (straddled == Outside)
+            continue;
+
+        if (bOcclusion && !m_occlusionBuffer.IsBoxVisible(node.m_min, node.m_max))
+            continue;
+
+        if (straddled == 0 && !bOcclusion)
+        {
+            AddRange(node.m_firstItem, node.m_itemCount, pVisible);
+        }
+        else if (node.m_left == 0)
+        {
+            uint32_t visibleMask = (1u << node.m_itemCount) - 1;
+            if (straddled != 0)
+                CullBoxes(frustum, m_bvhItemBoxes, node.m_firstItem, node.m_itemCount, &visibleMask);
+            if (bOcclusion)
+                m_occlusionBuffer.CullBoxes(m_bvhItemBoxes, node.m_firstItem, node.m_itemCount, &visibleMask);
+
+            for (uint32_t i = 0; i < node.m_itemCount; i++)
+            {
+                if (visibleMask & (1u << i))
+                    AddRange(node.m_firstItem + i, 1, pVisible);
+            }
+        }
+        else
+        {
+            // the second child is pushed first so the ranges come out in order
+            stack[stackSize++] = std::make_pair(node.m_left + 1, straddled);
+            stack[stackSize++] = std::make_pair(node.m_left, straddled);
+        }
+    }
+}
@@ -20,64 +20,535 @@
 #include "stdafx.h"
 #include "GltfCommon.h"
 #include "GltfHelpers.h"
+#include "GltfAnimation.h"
 #include "Misc/Misc.h"
+#include "Misc/Async.h"
+#include "Misc/Hash.h"
+#include "Misc/Base64.h"
+#include "Misc/MeshoptDecoder.h"
+#include "Misc/MeshOptimizer.h"
 
-bool GLTFCommon::Load(const std::string &path, const std::string &filename)
+#include <atomic>
+
+//
+// .glb container, a 12 byte header followed by a JSON chunk and an optional BIN chunk
+//
+static const uint32_t GLB_MAGIC = 0x46546C67;       // "glTF"
+static const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;  // "JSON"
+static const uint32_t GLB_CHUNK_BIN = 0x004E4942;   // "BIN\0"
+
+struct GlbHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t length;
+};
+
+struct GlbChunkHeader
+{
+    uint32_t length;
+    uint32_t type;
+};
+
+static bool ParseGlb(const char *pData, size_t size, const char **ppJsonChunk, size_t *pJsonChunkSize, const char **ppBinChunk, size_t *pBinChunkSize)
+{
+    if (size < sizeof(GlbHeader))
+        return false;
+
+    const GlbHeader *pHeader = (const GlbHeader *)pData;
+    if (pHeader->magic != GLB_MAGIC || pHeader->version != 2 || pHeader->length > size)
+        return false;
+
+    size_t offset = sizeof(GlbHeader);
+    while (offset + sizeof(GlbChunkHeader) <= pHeader->length)
+    {
+        const GlbChunkHeader *pChunk = (const GlbChunkHeader *)(pData + offset);
+        const char *pChunkData = pData + offset + sizeof(GlbChunkHeader);
+        if (offset + sizeof(GlbChunkHeader) + pChunk->length > pHeader->length)
+            return false;
+
+        if (pChunk->type == GLB_CHUNK_JSON && *ppJsonChunk == NULL)
+        {
+            *ppJsonChunk = pChunkData;
+            *pJsonChunkSize = pChunk->length;
+        }
+        else if (pChunk->type == GLB_CHUNK_BIN && *ppBinChunk == NULL)
+        {
+            // the BIN chunk is referenced by the first buffer, it is used in place
+            *ppBinChunk = pChunkData;
+            *pBinChunkSize = pChunk->length;
+        }
+
+        // chunks are 4 byte aligned, unknown chunks are skipped
+        offset += sizeof(GlbChunkHeader) + AlignUp<size_t>(pChunk->length, 4);
+    }
+
+    return *ppJsonChunk != NULL;
+}
+
+static bool IsGlbFile(const std::string &filename)
+{
+    return filename.size() > 4 && _stricmp(filename.c_str() + filename.size() - 4, ".glb") == 0;
+}
+
+static bool IsDataUri(const std::string &uri)
+{
+    return uri.compare(0, 5, "data:") == 0;
+}
+
+//
+// Runs a load job on the ThreadPool and counts it in pSync so the caller can wait for it, or runs it right away
+//
+static void ExecLoadJob(bool bParallel, Sync *pSync, std::function<void()> job)
+{
+    if (!bParallel)
+    {
+        job();
+        return;
+    }
+
+    pSync->Inc();
+    GetThreadPool()->AddJob([pSync, job]()
+    {
+        job();
+        pSync->Dec();
+    });
+}
+
+// guards the lists of allocations and mappings, buffers might be read from several threads
+static std::mutex s_fileDataMutex;
+
+//
+// Reads a whole file, the returned memory is owned by the GLTFCommon and released on Unload()
+// When bMap is true the file is mapped read-only instead of being copied into the heap.
+//
+const char *GLTFCommon::LoadFileData(const std::string &filename, bool bMap, size_t *pSize)
+{
+    if (bMap)
+    {
+        MemoryMappedFile *pFile = new MemoryMappedFile();
+        if (!pFile->Open(filename.c_str()))
+        {
+            delete pFile;
+            return NULL;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(s_fileDataMutex);
+            m_mappedFiles.push_back(pFile);
+        }
+        *pSize = pFile->GetSize();
+        return pFile->GetData();
+    }
+
+    char *pData;
+    if (!ReadFile(filename.c_str(), &pData, pSize, true))
+        return NULL;
+
+    {
+        std::unique_lock<std::mutex> lock(s_fileDataMutex);
+        m_allocatedData.push_back(pData);
+    }
+    return pData;
+}
+
+//
+// Decodes a "data:[<mediatype>];base64,<data>" uri, the returned memory is owned by the GLTFCommon and released on Unload()
+//
+const char *GLTFCommon::LoadDataUri(const std::string &uri, size_t *pSize)
+{
+    size_t comma = uri.find(',');
+    if (comma == std::string::npos || comma < 7 || uri.compare(comma - 7, 7, ";base64") != 0)
+    {
+        Trace("Only base64 data URIs are supported\n");
+        return NULL;
+    }
+
+    // decode straight from the json string into the final storage
+    const char *pSrc = uri.c_str() + comma + 1;
+    size_t srcSize = uri.size() - comma - 1;
+
+    char *pData = (char *)malloc(std::max<size_t>(Base64GetDecodedSize(pSrc, srcSize), 1));
+    if (!Base64Decode(pSrc, srcSize, pData, pSize))
+    {
+        free(pData);
+        return NULL;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(s_fileDataMutex);
+        m_allocatedData.push_back(pData);
+    }
+    return pData;
+}
+
+bool GLTFCommon::Load(const std::string &path, const std::string &filename, const GLTFLoadOptions &options)
 {
     Profile p("GLTFCommon::Load");
 
     m_path = path;
+    m_compressAnimations = options.m_compressAnimations;
+    m_animationTolerance = options.m_animationTolerance;
 
-    std::ifstream f(path + filename);
-    if (!f)
+    // An up to date compiled scene replaces the whole load. It is keyed by a hash of the json, the files the
+    // scene was compiled from are checked by LoadCompiledScene().
+    //
+    size_t sourceKey = 0;
+    if (!options.m_compiledSceneFilename.empty())
     {
-        Trace(format("The file %s cannot be found\n", filename.c_str()));
-        return false;
+        MemoryMappedFile source;
+        if (source.Open((path + filename).c_str()))
+        {
+            // only the JSON chunk of a .glb is hashed, its BIN chunk is checked by size and write time
+            const char *pJson = NULL;
+            size_t jsonSize = 0;
+            const char *pBin = NULL;
+            size_t binSize = 0;
+            bool bParsed = true;
+            if (IsGlbFile(filename))
+            {
+                bParsed = ParseGlb(source.GetData(), source.GetSize(), &pJson, &jsonSize, &pBin, &binSize);
+            }
+            else
+            {
+                pJson = source.GetData();
+                jsonSize = source.GetSize();
+            }
+
+            if (bParsed)
+            {
+                // the animations are stored packed, so the compression settings are part of the key
+                sourceKey = HashInt(options.m_optimizeMeshes, Hash(pJson, jsonSize));
+                sourceKey = HashInt(options.m_compressAnimations, HashFloat(options.m_animationTolerance, sourceKey));
+                if (LoadCompiledScene(options.m_compiledSceneFilename, sourceKey))
+                {
+                    if (options.m_mergeStaticMeshes)
+                        MergeStaticMeshes(options.m_mergeChunkVertices);
+                    if (options.m_buildMeshlets)
+                        BuildMeshlets(options.m_parallelLoad, options.m_meshletMaxVertices, options.m_meshletMaxTriangles);
+                    return true;
+                }
+            }
+        }
+    }
+
+    // When streaming, each element of the big arrays is turned into its typed structure as soon as it has been
+    // parsed and then discarded, the parser only keeps a placeholder for it.
+    //
+    std::string topLevelKey;
+    json::parser_callback_t callback = nullptr;
+    if (options.m_streamingParse)
+    {
+        callback = [this, &topLevelKey](int depth, json::parse_event_t event, json &parsed)
+        {
+            if (depth == 1 && event == json::parse_event_t::key)
+                topLevelKey = parsed.get<std::string>();
+            else if (depth == 2 && event == json::parse_event_t::object_end)
+                return !LoadTypedElement(topLevelKey, parsed);
+
+            return true;
+        };
+    }
+
+    const char *pBinChunk = NULL;
+    size_t binChunkSize = 0;
+
+    if (IsGlbFile(filename))
+    {
+        size_t size;
+        const char *pGlb = LoadFileData(path + filename, options.m_mapBuffers, &size);
+        if (pGlb == NULL)
+        {
+            Trace(format("The file %s cannot be found\n", filename.c_str()));
+            return false;
+        }
+
+        const char *pJsonChunk = NULL;
+        size_t jsonChunkSize = 0;
+        if (!ParseGlb(pGlb, size, &pJsonChunk, &jsonChunkSize, &pBinChunk, &binChunkSize))
+        {
+            Trace(format("The file %s is not a valid .glb\n", filename.c_str()));
+            return false;
+        }
+
+        j3 = json::parse(pJsonChunk, pJsonChunk + jsonChunkSize, callback);
     }
+    else
+    {
+        std::ifstream f(path + filename);
+        if (!f)
+        {
+            Trace(format("The file %s cannot be found\n", filename.c_str()));
+            return false;
+        }
 
-    f >> j3;
+        j3 = json::parse(f, callback);
+    }
 
-    // Load Buffers
+    // Without streaming the typed structures are filled from the DOM
     //
-    if (j3.find("buffers") != j3.end())
+    if (!options.m_streamingParse)
     {
-        const json &buffers = j3["buffers"];
-        m_buffersData.resize(buffers.size());
-        for (int i = 0; i < buffers.size(); i++)
+        for (const char *arrayName : { "meshes", "materials", "images", "textures", "samplers" })
         {
-            const std::string &name = buffers[i]["uri"];
-            std::ifstream ff(path + name, std::ios::in | std::ios::binary);
+            auto it = j3.find(arrayName);
+            if (it == j3.end())
+                continue;
 
-            ff.seekg(0, ff.end);
-            std::streamoff length = ff.tellg();
-            ff.seekg(0, ff.beg);
+            for (const json &element : it.value())
+                LoadTypedElement(arrayName, element);
+        }
+    }
+
+    // Sections that only need the json are decoded while the buffers are being read. Accessors, skins and
+    // animations need the buffers so they wait for the reads to be done, skins also need the nodes.
+    //
+    const json &root = j3;
+    bool bParallel = options.m_parallelLoad;
+    Sync sync;
+    std::atomic<bool> bFailed(false);
 
-            char *p = new char[length];
-            ff.read(p, length);
-            m_buffersData[i] = p;
+    if (root.find("buffers") != root.end())
+    {
+        const json &buffers = root["buffers"];
+        m_buffersData.resize(buffers.size());
+        for (int i = 0; i < buffers.size(); i++)
+        {
+            ExecLoadJob(bParallel, &sync, [this, &buffers, i, pBinChunk, &options, &bFailed]()
+            {
+                if (!LoadBuffer(i, buffers[i], pBinChunk, options.m_mapBuffers))
+                    bFailed = true;
+            });
         }
     }
 
-    // Load Meshes
+    ExecLoadJob(bParallel, &sync, [this, &root]() { LoadLights(root); });
+    ExecLoadJob(bParallel, &sync, [this, &root]() { LoadCameras(root); LoadNodes(root); }); // nodes set the node index of the cameras
+    ExecLoadJob(bParallel, &sync, [this, &root]() { LoadScenes(root); });
+    sync.Wait();
+
+    if (bFailed || !DecodeMeshoptBufferViews(bParallel))
+        return false;
+
+    // Resolve accessors once, so nobody has to go through the json after loading
     //
     m_pAccessors = &j3["accessors"];
     m_pBufferViews = &j3["bufferViews"];
-    const json &meshes = j3["meshes"];
-    m_meshes.resize(meshes.size());
-    for (int i = 0; i < meshes.size(); i++)
+    ResolveAccessors(bParallel);
+    DecodeSparseAccessors();
+
+    ExecLoadJob(bParallel, &sync, [this]() { ComputePrimitiveBounds(); });
+    ExecLoadJob(bParallel, &sync, [this]() { LoadMorphTargets(); });
+    ExecLoadJob(bParallel, &sync, [this, &root]() { LoadSkins(root); });
+    ExecLoadJob(bParallel, &sync, [this, &root]() { LoadInstances(root); });
+
+    if (root.find("animations") != root.end())
+    {
+        const json &animations = root["animations"];
+        m_animations.resize(animations.size());
+        for (int i = 0; i < animations.size(); i++)
+        {
+            ExecLoadJob(bParallel, &sync, [this, &animations, i]() { LoadAnimation(animations[i], &m_animations[i]); });
+        }
+    }
+    sync.Wait();
+
+    if (options.m_optimizeMeshes)
+        OptimizeMeshes(bParallel);
+
+    InitTransformedData();
+
+    if (!options.m_compiledSceneFilename.empty())
+        SaveCompiledScene(options.m_compiledSceneFilename, filename, sourceKey);
+
+    // the compiled scene keeps the source meshes, so it does not depend on the merge or meshlet options
+    if (options.m_mergeStaticMeshes)
+        MergeStaticMeshes(options.m_mergeChunkVertices);
+    if (options.m_buildMeshlets)
+        BuildMeshlets(bParallel, options.m_meshletMaxVertices, options.m_meshletMaxTriangles);
+
+    // Everything the passes need is in the typed structures now
+    //
+    if (options.m_streamingParse)
+    {
+        j3.clear();
+        m_pAccessors = NULL;
+        m_pBufferViews = NULL;
+    }
+
+    return true;
+}
+
+//
+// EXT_meshopt_compression, the bufferViews of a fallback buffer are decoded from compressed bufferViews of another buffer
+//
+static bool IsMeshoptFallback(const json &buffer)
+{
+    auto extensions = buffer.find("extensions");
+    if (extensions == buffer.end())
+        return false;
+
+    auto meshopt = extensions->find("EXT_meshopt_compression");
+    return meshopt != extensions->end() && meshopt->value("fallback", false);
+}
+
+static MeshoptFilter GetMeshoptFilter(const std::string &filter)
+{
+    if (filter == "OCTAHEDRAL")
+        return MESHOPT_FILTER_OCTAHEDRAL;
+    if (filter == "QUATERNION")
+        return MESHOPT_FILTER_QUATERNION;
+    if (filter == "EXPONENTIAL")
+        return MESHOPT_FILTER_EXPONENTIAL;
+    return MESHOPT_FILTER_NONE;
+}
+
+//
+// Reads buffer i, a buffer without uri is the BIN chunk of the .glb. Meshopt fallback buffers are not read (their uri,
+// if any, only has data for loaders without the extension), they get storage that DecodeMeshoptBufferViews() fills.
+//
+bool GLTFCommon::LoadBuffer(int i, const json &buffer, const char *pBinChunk, bool bMap)
+{
+    if (IsMeshoptFallback(buffer))
     {
-        tfMesh *tfmesh = &m_meshes[i];
-        auto &primitives = meshes[i]["primitives"];
-        tfmesh->m_pPrimitives.resize(primitives.size());
-        for (int p = 0; p < primitives.size(); p++)
+        char *pData = (char *)malloc(std::max<size_t>(buffer["byteLength"].get<size_t>(), 1));
         {
-            tfPrimitives *pPrimitive = &tfmesh->m_pPrimitives[p];
+            std::unique_lock<std::mutex> lock(s_fileDataMutex);
+            m_allocatedData.push_back(pData);
+        }
+        m_buffersData[i] = pData;
+        return true;
+    }
+
+    auto uri = buffer.find("uri");
+    if (uri == buffer.end())
+    {
+        // no uri means the buffer is the BIN chunk of the .glb
+        if (i != 0 || pBinChunk == NULL)
+        {
+            Trace(format("Buffer %i has no uri\n", i));
+            return false;
+        }
+
+        m_buffersData[i] = pBinChunk;
+        return true;
+    }
+
+    const std::string &name = uri->get_ref<const std::string &>();
+
+    size_t length;
+    const char *pData;
+    if (IsDataUri(name))
+    {
+        pData = LoadDataUri(name, &length);
+        if (pData == NULL || length < buffer["byteLength"].get<size_t>())
+        {
+            Trace(format("Buffer %i has an invalid data URI\n", i));
+            return false;
+        }
+    }
+    else
+    {
+        pData = LoadFileData(m_path + name, bMap, &length);
+        if (pData == NULL)
+        {
+            Trace(format("The buffer %s cannot be found\n", name.c_str()));
+            return false;
+        }
+    }
 
-            int positionId = primitives[p]["attributes"]["POSITION"];
-            const json &accessor = m_pAccessors->at(positionId);
+    m_buffersData[i] = pData;
+    return true;
+}
 
-            math::Vector4 max = GetVector(GetElementJsonArray(accessor, "max", { 0.0, 0.0, 0.0, 0.0 }));
-            math::Vector4 min = GetVector(GetElementJsonArray(accessor, "min", { 0.0, 0.0, 0.0, 0.0 }));
+//
+// Decodes the compressed bufferViews into their fallback buffers, so once the accessors are resolved nothing else has to
+// know about the compression. The streams are sequential, each bufferView is decoded as a job of its own.
+//
+bool GLTFCommon::DecodeMeshoptBufferViews(bool bParallel)
+{
+    auto it = j3.find("bufferViews");
+    if (it == j3.end())
+        return true;
+
+    const json &buffers = j3["buffers"];
+    const json &bufferViews = it.value();
+
+    Sync sync;
+    std::atomic<bool> bFailed(false);
+    for (int i = 0; i < bufferViews.size(); i++)
+    {
+        const json &bufferView = bufferViews[i];
+        auto extensions = bufferView.find("extensions");
+        if (extensions == bufferView.end())
+            continue;
+        auto meshopt = extensions->find("EXT_meshopt_compression");
+        if (meshopt == extensions->end())
+            continue;
+
+        // a bufferView of a buffer that has its own data doesn't need decoding
+        int bufferIdx = bufferView["buffer"].get<int>();
+        if (!IsMeshoptFallback(buffers[bufferIdx]))
+            continue;
+
+        const json &compression = meshopt.value();
+        int sourceIdx = compression["buffer"].get<int>();
+        size_t sourceOffset = compression.value("byteOffset", (size_t)0);
+        size_t sourceSize = compression["byteLength"].get<size_t>();
+        size_t stride = compression["byteStride"].get<size_t>();
+        size_t count = compression["count"].get<size_t>();
+        std::string mode = compression["mode"].get<std::string>();
+        MeshoptFilter filter = GetMeshoptFilter(compression.value("filter", std::string("NONE")));
+
+        size_t offset = bufferView.value("byteOffset", (size_t)0);
+        if (sourceIdx < 0 || sourceIdx >= m_buffersData.size() || sourceOffset + sourceSize > buffers[sourceIdx]["byteLength"].get<size_t>() ||
+            offset + count * stride > buffers[bufferIdx]["byteLength"].get<size_t>())
+        {
+            Trace(format("BufferView %i has an invalid EXT_meshopt_compression range\n", i));
+            return false;
+        }
+
+        // the fallback buffers are allocated by LoadBuffer()
+        char *pDst = const_cast<char *>(m_buffersData[bufferIdx]) + offset;
+        const uint8_t *pSrc = (const uint8_t *)m_buffersData[sourceIdx] + sourceOffset;
+
+        ExecLoadJob(bParallel, &sync, [pDst, pSrc, sourceSize, stride, count, mode, filter, i, &bFailed]()
+        {
+            bool bDecoded;
+            if (mode == "ATTRIBUTES")
+                bDecoded = MeshoptDecodeVertexBuffer(pDst, count, stride, pSrc, sourceSize) && MeshoptDecodeFilter(pDst, count, stride, filter);
+            else if (mode == "TRIANGLES")
+                bDecoded = MeshoptDecodeIndexBuffer(pDst, count, stride, pSrc, sourceSize);
+            else if (mode == "INDICES")
+                bDecoded = MeshoptDecodeIndexSequence(pDst, count, stride, pSrc, sourceSize);
+            else
+                bDecoded = false;
+
+            if (!bDecoded)
+            {
+                Trace(format("BufferView %i can't be decoded (EXT_meshopt_compression, %s)\n", i, mode.c_str()));
+                bFailed = true;
+            }
+        });
+    }
+    sync.Wait();
+
+    return !bFailed;
+}
+
+void GLTFCommon::ComputePrimitiveBounds()
+{
+    for (tfMesh &mesh : m_meshes)
+    {
+        for (tfPrimitives &primitive : mesh.m_pPrimitives)
+        {
+            tfPrimitives *pPrimitive = &primitive;
+
+            int positionId = pPrimitive->m_attributes.at("POSITION");
+            const tfAccessor &accessor = m_accessors[positionId];
+
+            math::Vector4 max = accessor.m_max;
+            math::Vector4 min = accessor.m_min;
 
             pPrimitive->m_center = (min + max) * 0.5f;
             pPrimitive->m_radius = max - pPrimitive->m_center;
@@ -85,12 +556,226 @@ bool GLTFCommon::Load(const std::string &path, const std::string &filename)
             pPrimitive->m_center = math::Vector4(pPrimitive->m_center.getXYZ(), 1.0f); //set the W to 1 since this is a position not a direction
         }
     }
+}
 
-    // Load lights
-    //
-    if (j3.find("extensions") != j3.end())
+//
+// Vertex cache, overdraw and vertex fetch optimization of the triangle lists (see Misc/MeshOptimizer.h). The optimized
+// indices and vertices go to new accessors in a buffer appended to m_buffersData, so the compiled scene saves them like
+// any other buffer and the source accessors are left untouched. The primitives sharing the same vertex accessors are
+// remapped together, their vertices are numbered in the order all of them use them and only the used ones are copied,
+// so they keep sharing a single vertex buffer. The vertices of the primitives with morph targets keep their order
+// since the targets are indexed by vertex.
+//
+void GLTFCommon::OptimizeMeshes(bool bParallel)
+{
+    Profile p("GLTFCommon::OptimizeMeshes");
+
+    struct OptimizeJob
+    {
+        tfPrimitives *m_pPrimitive;
+        int m_indices;                                  // source accessor
+        std::vector<uint32_t> m_triangles;
+    };
+
+    struct OptimizeGroup
+    {
+        std::map<std::string, int> m_attributes;        // source accessors, shared by all the primitives of the group
+        std::vector<OptimizeJob> m_jobs;
+        bool m_bRemap;
+        std::vector<uint32_t> m_remap;
+        size_t m_usedCount;
+    };
+
+    const uint32_t cacheSize = 16;
+    const uint64_t alignment = 16;
+
+    std::vector<OptimizeGroup> groups;
+    std::map<std::map<std::string, int>, size_t> sharedGroups;
+    for (tfMesh &mesh : m_meshes)
+    {
+        for (tfPrimitives &primitive : mesh.m_pPrimitives)
+        {
+            auto position = primitive.m_attributes.find("POSITION");
+            if (primitive.m_mode != 4 || position == primitive.m_attributes.end())
+                continue;
+
+            const int vertexCount = m_accessors[position->second].m_count;
+            const int indexCount = (primitive.m_indices >= 0) ? m_accessors[primitive.m_indices].m_count : vertexCount;
+            if (indexCount < 3)
+                continue;
+
+            // the primitives with morph targets are never remapped so they get a group of their own
+            const bool bRemap = primitive.m_targets.empty();
+            auto shared = bRemap ? sharedGroups.find(primitive.m_attributes) : sharedGroups.end();
+            size_t groupIndex = (shared != sharedGroups.end()) ? shared->second : groups.size();
+            if (groupIndex == groups.size())
+            {
+                OptimizeGroup group;
+                group.m_attributes = primitive.m_attributes;
+                group.m_bRemap = bRemap;
+                group.m_usedCount = vertexCount;
+                groups.push_back(std::move(group));
+                if (bRemap)
+                    sharedGroups[primitive.m_attributes] = groupIndex;
+            }
+
+            OptimizeJob job;
+            job.m_pPrimitive = &primitive;
+            job.m_indices = primitive.m_indices;
+            groups[groupIndex].m_jobs.push_back(std::move(job));
+        }
+    }
+
+    if (groups.empty())
+        return;
+
+    // reorder the triangles of each primitive then number the vertices of each group
+    Sync sync;
+    for (OptimizeGroup &group : groups)
+    {
+        ExecLoadJob(bParallel, &sync, [this, &group, cacheSize]()
+        {
+            const tfAccessor &positions = m_accessors[group.m_attributes.at("POSITION")];
+            const size_t vertexCount = positions.m_count;
+
+            std::vector<float> xyz;
+            bool bValid = true;
+            for (OptimizeJob &job : group.m_jobs)
+            {
+                std::vector<uint32_t> &triangles = job.m_triangles;
+                triangles.resize((job.m_indices >= 0) ? m_accessors[job.m_indices].m_count : vertexCount);
+                for (size_t i = 0; i < triangles.size(); i++)
+                    triangles[i] = (job.m_indices >= 0) ? GetIndex(m_accessors[job.m_indices], (int)i) : (uint32_t)i;
+
+                // out of range indices leave the triangles in their order and the vertices of the group untouched
+                if (!std::all_of(triangles.begin(), triangles.end(), [vertexCount](uint32_t index) { return index < vertexCount; }))
+                {
+                    bValid = false;
+                    continue;
+                }
+
+                if (xyz.empty())
+                {
+                    xyz.resize(vertexCount * 3);
+                    DequantizeAccessor(positions, xyz.data());
+                }
+
+                std::vector<uint32_t> clusters;
+                OptimizeVertexCache(triangles.data(), triangles.size(), vertexCount, cacheSize, &clusters);
+                OptimizeOverdraw(triangles.data(), triangles.size(), xyz.data(), vertexCount, cacheSize, clusters, 1.05f);
+            }
+
+            group.m_bRemap = group.m_bRemap && bValid;
+            if (!group.m_bRemap)
+                return;
+
+            std::vector<uint32_t> allTriangles;
+            for (const OptimizeJob &job : group.m_jobs)
+                allTriangles.insert(allTriangles.end(), job.m_triangles.begin(), job.m_triangles.end());
+
+            group.m_remap.resize(vertexCount);
+            group.m_usedCount = OptimizeVertexFetchRemap(group.m_remap.data(), allTriangles.data(), allTriangles.size(), vertexCount);
+            for (OptimizeJob &job : group.m_jobs)
+            {
+                for (uint32_t &index : job.m_triangles)
+                    index = group.m_remap[index];
+            }
+        });
+    }
+    sync.Wait();
+
+    // lay out the new accessors in the generated buffer, the vertices of a group are shared by its primitives
+    std::vector<uint64_t> offsets;
+    uint64_t bufferSize = 0;
+    for (OptimizeGroup &group : groups)
+    {
+        for (OptimizeJob &job : group.m_jobs)
+        {
+            tfAccessor indices = {};
+            indices.m_count = (int)job.m_triangles.size();
+            indices.m_dimension = 1;
+            indices.m_type = (group.m_usedCount <= 65536) ? 2 : 4;
+            indices.m_stride = indices.m_type;
+            indices.m_componentType = (indices.m_type == 2) ? 5123 : 5125;
+            offsets.push_back(bufferSize);
+            bufferSize = AlignUp<uint64_t>(bufferSize + (uint64_t)indices.m_count * indices.m_stride, alignment);
+            job.m_pPrimitive->m_indices = (int)m_accessors.size();
+            m_accessors.push_back(indices);
+        }
+
+        if (!group.m_bRemap)
+            continue;
+
+        for (auto const &attribute : group.m_attributes)
+        {
+            tfAccessor accessor = m_accessors[attribute.second];
+            accessor.m_count = (int)group.m_usedCount;
+            accessor.m_stride = GetVertexStride(accessor);
+            accessor.m_sparse = tfSparseAccessor();
+            offsets.push_back(bufferSize);
+            bufferSize = AlignUp<uint64_t>(bufferSize + (uint64_t)accessor.m_count * accessor.m_stride, alignment);
+            for (OptimizeJob &job : group.m_jobs)
+                job.m_pPrimitive->m_attributes[attribute.first] = (int)m_accessors.size();
+            m_accessors.push_back(accessor);
+        }
+    }
+
+    // cleared so the padding saved in the compiled scene is always the same
+    char *pBuffer = (char *)malloc((size_t)bufferSize);
+    memset(pBuffer, 0, (size_t)bufferSize);
+    m_allocatedData.push_back(pBuffer);
+    m_buffersData.push_back(pBuffer);
+    m_generatedBufferSizes.push_back(bufferSize);
+
+    // the new accessors were appended in the same order as the offsets
+    size_t firstAccessor = m_accessors.size() - offsets.size();
+    for (size_t i = 0; i < offsets.size(); i++)
+        m_accessors[firstAccessor + i].m_data = pBuffer + offsets[i];
+
+    for (const OptimizeGroup &group : groups)
     {
-        const json &extensions = j3["extensions"];
+        ExecLoadJob(bParallel, &sync, [this, &group]()
+        {
+            for (const OptimizeJob &job : group.m_jobs)
+            {
+                tfAccessor &indices = m_accessors[job.m_pPrimitive->m_indices];
+                if (indices.m_type == 2)
+                {
+                    for (size_t i = 0; i < job.m_triangles.size(); i++)
+                        ((uint16_t *)indices.m_data)[i] = (uint16_t)job.m_triangles[i];
+                }
+                else
+                {
+                    memcpy((void *)indices.m_data, job.m_triangles.data(), job.m_triangles.size() * sizeof(uint32_t));
+                }
+            }
+
+            if (!group.m_bRemap)
+                return;
+
+            const tfPrimitives &primitive = *group.m_jobs[0].m_pPrimitive;
+            for (auto const &attribute : group.m_attributes)
+            {
+                const tfAccessor &source = m_accessors[attribute.second];
+                tfAccessor &dst = m_accessors[primitive.m_attributes.at(attribute.first)];
+                const int elementSize = source.m_dimension * source.m_type;
+                const size_t vertexCount = std::min<size_t>(source.m_count, group.m_remap.size());
+                for (size_t v = 0; v < vertexCount; v++)
+                {
+                    if (group.m_remap[v] != ~0u)
+                        memcpy((char *)dst.m_data + (size_t)group.m_remap[v] * dst.m_stride, source.Get((int)v), elementSize);
+                }
+            }
+        });
+    }
+    sync.Wait();
+}
+
+void GLTFCommon::LoadLights(const json &root)
+{
+    if (root.find("extensions") != root.end())
+    {
+        const json &extensions = root["extensions"];
         if (extensions.find("KHR_lights_punctual") != extensions.end())
         {
             const json &KHR_lights_punctual = extensions["KHR_lights_punctual"];
@@ -172,314 +857,895 @@ bool GLTFCommon::Load(const std::string &path, const std::string &filename)
                                     std::string BiasString = lightName.substr(offset, endOffset - offset);
                                     float Bias = (m_lights[i].m_type == LightType_Spot) ? (70.0f / 100000.0f) : (1000.0f / 100000.0f);
 
-                                    try {
-                                        Bias = std::stof(BiasString);
-                                    }
-                                    catch (std::invalid_argument)
-                                    {
-                                        // Wasn't a valid argument to convert to float, use default
-                                    }
-                                    catch (std::out_of_range)
-                                    {
-                                        // Value larger than a float can hold (also invalid), use default
-                                    }
+                                    try {
+                                        Bias = std::stof(BiasString);
+                                    }
+                                    catch (std::invalid_argument)
+                                    {
+                                        // Wasn't a valid argument to convert to float, use default
+                                    }
+                                    catch (std::out_of_range)
+                                    {
+                                        // Value larger than a float can hold (also invalid), use default
+                                    }
+
+                                    // Set what we have 
+                                    m_lights[i].m_bias = Bias;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void GLTFCommon::LoadCameras(const json &root)
+{
+    if (root.find("cameras") != root.end())
+    {
+        const json &cameras = root["cameras"];
+        m_cameras.resize(cameras.size());
+        for (int i = 0; i < cameras.size(); i++)
+        {
+            const json &camera = cameras[i];
+            tfCamera *tfcamera = &m_cameras[i];
+
+            tfcamera->yfov = GetElementFloat(camera, "perspective/yfov", 0.1f);
+            tfcamera->znear = GetElementFloat(camera, "perspective/znear", 0.1f);
+            tfcamera->zfar = GetElementFloat(camera, "perspective/zfar", 100.0f);
+            tfcamera->m_nodeIndex = -1;
+        }
+    }
+}
+
+void GLTFCommon::LoadNodes(const json &root)
+{
+    if (root.find("nodes") != root.end())
+    {
+        const json &nodes = root["nodes"];
+        m_nodes.resize(nodes.size());
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            tfNode *tfnode = &m_nodes[i];
+
+            // Read node data
+            //
+            json::object_t node = nodes[i];
+
+            if (node.find("children") != node.end())
+            {
+                for (int c = 0; c < node["children"].size(); c++)
+                {
+                    int nodeID = node["children"][c];
+                    tfnode->m_children.push_back(nodeID);
+                }
+            }
+
+            tfnode->meshIndex = GetElementInt(node, "mesh", -1);
+            tfnode->skinIndex = GetElementInt(node, "skin", -1);
+
+            int cameraIdx = GetElementInt(node, "camera", -1);
+            if (cameraIdx >= 0)
+                m_cameras[cameraIdx].m_nodeIndex = i;
+
+            int lightIdx = GetElementInt(node, "extensions/KHR_lights_punctual/light", -1);
+            if (lightIdx >= 0)
+            {
+                m_lightInstances.push_back({ lightIdx, i});
+            }
+
+            tfnode->m_transform.m_translation = GetElementVector(node, "translation", math::Vector4(0, 0, 0, 0));
+            tfnode->m_transform.m_scale = GetElementVector(node, "scale", math::Vector4(1, 1, 1, 0));
+
+
+            if (node.find("name") != node.end())
+                tfnode->m_name = GetElementString(node, "name", "unnamed");
+
+            if (node.find("rotation") != node.end())
+                tfnode->m_transform.m_rotation = math::Matrix4(math::Quat(GetVector(node["rotation"].get<json::array_t>())), math::Vector3(0.f, 0.f, 0.f));
+            else if (node.find("matrix") != node.end())
+                tfnode->m_transform.m_rotation = GetMatrix(node["matrix"].get<json::array_t>());
+            else
+                tfnode->m_transform.m_rotation = math::Matrix4::identity();
+
+            if (node.find("weights") != node.end())
+                tfnode->m_weights = node["weights"].get<std::vector<float>>();
+        }
+    }
+}
+
+void GLTFCommon::LoadScenes(const json &root)
+{
+    if (root.find("scenes") != root.end())
+    {
+        const json &scenes = root["scenes"];
+        m_scenes.resize(scenes.size());
+        for (int i = 0; i < scenes.size(); i++)
+        {
+            auto scene = scenes[i];
+            for (int n = 0; n < scene["nodes"].size(); n++)
+            {
+                int nodeId = scene["nodes"][n];
+                m_scenes[i].m_nodes.push_back(nodeId);
+            }
+        }
+    }
+}
+
+void GLTFCommon::LoadSkins(const json &root)
+{
+    if (root.find("skins") != root.end())
+    {
+        const json &skins = root["skins"];
+        m_skins.resize(skins.size());
+        for (uint32_t i = 0; i < skins.size(); i++)
+        {
+            GetBufferDetails(skins[i]["inverseBindMatrices"].get<int>(), &m_skins[i].m_InverseBindMatrices);
+
+            if (skins[i].find("skeleton") != skins[i].end())
+                m_skins[i].m_pSkeleton = &m_nodes[skins[i]["skeleton"]];
+
+            const json &joints = skins[i]["joints"];
+            for (uint32_t n = 0; n < joints.size(); n++)
+            {
+                m_skins[i].m_jointsNodeIdx.push_back(joints[n]);
+            }
+
+        }
+    }
+}
+
+//
+// EXT_mesh_gpu_instancing, the node's mesh is drawn once per element of the TRS accessors, each element giving a local
+// transform that goes before the one of the node
+//
+void GLTFCommon::LoadInstances(const json &root)
+{
+    if (root.find("nodes") == root.end())
+        return;
+
+    const json &nodes = root["nodes"];
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        if (m_nodes[i].meshIndex < 0)
+            continue;
+
+        const json::object_t &node = nodes[i].get_ref<const json::object_t &>();
+        int translationId = GetElementInt(node, "extensions/EXT_mesh_gpu_instancing/attributes/TRANSLATION", -1);
+        int rotationId = GetElementInt(node, "extensions/EXT_mesh_gpu_instancing/attributes/ROTATION", -1);
+        int scaleId = GetElementInt(node, "extensions/EXT_mesh_gpu_instancing/attributes/SCALE", -1);
+        if (translationId < 0 && rotationId < 0 && scaleId < 0)
+            continue;
+
+        // all the accessors have the same count, rotations can be normalized integers (KHR_mesh_quantization)
+        int count = m_accessors[translationId >= 0 ? translationId : (rotationId >= 0 ? rotationId : scaleId)].m_count;
+        std::vector<float> translations(count * 3, 0.0f), rotations(count * 4, 0.0f), scales(count * 3, 1.0f);
+        if (translationId >= 0)
+            DequantizeAccessor(m_accessors[translationId], translations.data());
+        if (rotationId >= 0)
+            DequantizeAccessor(m_accessors[rotationId], rotations.data());
+        else
+            for (int n = 0; n < count; n++)
+                rotations[n * 4 + 3] = 1.0f;
+        if (scaleId >= 0)
+            DequantizeAccessor(m_accessors[scaleId], scales.data());
+
+        std::vector<InstanceMatrix> &instances = m_nodeInstances[i];
+        instances.resize(count);
+        for (int n = 0; n < count; n++)
+        {
+            const float *t = &translations[n * 3];
+            const float *r = &rotations[n * 4];
+            const float *s = &scales[n * 3];
+            math::Matrix4 local = math::Matrix4::translation(math::Vector3(t[0], t[1], t[2])) *
+                math::Matrix4::rotation(normalize(math::Quat(r[0], r[1], r[2], r[3]))) *
+                math::Matrix4::scale(math::Vector3(s[0], s[1], s[2]));
+            instances[n].Set(local);
+        }
+    }
+}
+
+void GLTFCommon::LoadAnimation(const json &animation, tfAnimation *tfanim)
+{
+    const json &channels = animation["channels"];
+    const json &samplers = animation["samplers"];
+
+    for (int c = 0; c < channels.size(); c++)
+    {
+        json::object_t channel = channels[c];
+        int sampler = channel["sampler"];
+        int node = GetElementInt(channel, "target/node", -1);
+        std::string path = GetElementString(channel, "target/path", std::string());
+
+        tfChannel *tfchannel;
+
+        auto ch = tfanim->m_channels.find(node);
+        if (ch == tfanim->m_channels.end())
+        {
+            tfchannel = &tfanim->m_channels[node];
+        }
+        else
+        {
+            tfchannel = &ch->second;
+        }
+
+        tfSampler *tfsmp = new tfSampler();
+
+        std::string interpolation = samplers[sampler].value("interpolation", std::string("LINEAR"));
+        if (interpolation == "STEP")
+            tfsmp->m_interpolation = tfSampler::INTERPOLATION_STEP;
+        else if (interpolation == "CUBICSPLINE")
+            tfsmp->m_interpolation = tfSampler::INTERPOLATION_CUBICSPLINE;
+
+        // Get time line
+        //
+        GetBufferDetails(samplers[sampler]["input"], &tfsmp->m_time);
+        assert(tfsmp->m_time.m_stride == 4);
+
+        tfanim->m_duration = std::max<float>(tfanim->m_duration, *(float*)tfsmp->m_time.Get(tfsmp->m_time.m_count - 1));
+
+        // Get value line, cubic splines have an in-tangent, a value and an out-tangent per key
+        //
+        GetBufferDetails(samplers[sampler]["output"], &tfsmp->m_value);
+        const int valuesPerKey = (tfsmp->m_interpolation == tfSampler::INTERPOLATION_CUBICSPLINE) ? 3 : 1;
+
+        // Index appropriately
+        // 
+        if (path == "translation")
+        {
+            tfchannel->m_pTranslation = tfsmp;
+            assert(tfsmp->m_value.m_stride == 3 * 4);
+            assert(tfsmp->m_value.m_dimension == 3);
+            assert(tfsmp->m_value.m_count == tfsmp->m_time.m_count * valuesPerKey);
+        }
+        else if (path == "rotation")
+        {
+            tfchannel->m_pRotation = tfsmp;
+            assert(tfsmp->m_value.m_stride == 4 * 4);
+            assert(tfsmp->m_value.m_dimension == 4);
+            assert(tfsmp->m_value.m_count == tfsmp->m_time.m_count * valuesPerKey);
+        }
+        else if (path == "scale")
+        {
+            tfchannel->m_pScale = tfsmp;
+            assert(tfsmp->m_value.m_stride == 3 * 4);
+            assert(tfsmp->m_value.m_dimension == 3);
+            assert(tfsmp->m_value.m_count == tfsmp->m_time.m_count * valuesPerKey);
+        }
+        else if (path == "weights")
+        {
+            // the weights of all the morph targets of the mesh are stored for each key, as floats or normalized integers
+            tfchannel->m_pWeights = tfsmp;
+            assert(tfsmp->m_value.m_dimension == 1);
+            assert(tfsmp->m_value.m_count % (tfsmp->m_time.m_count * valuesPerKey) == 0);
+        }
+        else
+        {
+            delete tfsmp;
+        }
+    }
+
+    PackAnimation(*tfanim, m_nodes, m_compressAnimations, m_animationTolerance, &tfanim->m_packed);
+}
+
+void GLTFCommon::Unload()
+{
+    for (int i = 0; i < m_allocatedData.size(); i++)
+    {
+        free(m_allocatedData[i]);
+    }
+    m_allocatedData.clear();
+
+    for (int i = 0; i < m_mappedFiles.size(); i++)
+    {
+        delete m_mappedFiles[i];
+    }
+    m_mappedFiles.clear();
+    m_generatedBufferSizes.clear();
+
+    m_buffersData.clear();
+    m_accessors.clear();
+    m_bufferViews.clear();
+
+    m_meshes.clear();
+    m_materials.clear();
+    m_images.clear();
+    m_textures.clear();
+    m_textureSamplers.clear();
+
+    m_animations.clear();
+    m_trackCursors.clear();
+    m_weightCursors.clear();
+    m_nodes.clear();
+    m_scenes.clear();
+    m_lights.clear();
+    m_lightInstances.clear();
+    m_skins.clear();
+    m_cameras.clear();
+
+    m_morphWeights.clear();
+    m_morphedStreams.clear();
+    m_defaultMorphWeights.clear();
+    m_nodeInstances.clear();
+    m_nodeBatches.clear();
+    m_nodeBatchIndex.clear();
+    m_mergedRanges.clear();
+    m_bvhItems.clear();
+    m_bvhNodes.clear();
+    m_bvhItemBoxes.Clear();
+    m_bvhItemLeaves.clear();
+    m_bvhNodeDirty.clear();
+    m_bvhItemDirty.clear();
+    m_bvhNodeItemStart.clear();
+    m_bvhNodeItems.clear();
+    m_movedNodes.clear();
+    m_occluderMeshes.clear();
+    m_occlusionBuffer.OnDestroy();
+
+    j3.clear();
+}
+
+//
+// Samples all the channels of an animation and writes the local matrix of each animated node in pMats, which is
+// indexed by node. Components without a channel take the value of the node's transform.
+//
+void GLTFCommon::EvaluateAnimation(uint32_t animationIndex, float time, math::Matrix4 *pMats)
+{
+    if (animationIndex >= m_animations.size())
+        return;
+
+    const tfAnimation *anim = &m_animations[animationIndex];
+
+    //loop animation
+    time = fmod(time, anim->m_duration);
+
+    EvaluatePackedAnimation(anim->m_packed, time, GetTrackCursors(animationIndex), pMats);
+}
+
+//
+// Cursors of the tracks of an animation, allocated the first time it is played. The channel ranges blended
+// concurrently by SetAnimationLayers() use disjoint tracks, so they don't share any cursor.
+//
+int *GLTFCommon::GetTrackCursors(uint32_t animationIndex)
+{
+    m_trackCursors.resize(m_animations.size());
+    std::vector<int> &cursors = m_trackCursors[animationIndex];
+    cursors.resize(m_animations[animationIndex].m_packed.m_tracks.size());
+    return cursors.data();
+}
+
+//
+// Animates the matrices (they are still in object space)
+//
+void GLTFCommon::SetAnimationTime(uint32_t animationIndex, float time)
+{
+    if (animationIndex < m_animations.size())
+    {
+        EvaluateAnimation(animationIndex, time, m_animatedMats.data());
+
+        for (tfNodeIdx nodeIdx : m_animations[animationIndex].m_packed.m_nodes)
+            m_dirtyNodes[nodeIdx] = 1;
 
-                                    // Set what we have 
-                                    m_lights[i].m_bias = Bias;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+        BlendMorphWeights(animationIndex, fmod(time, m_animations[animationIndex].m_duration), 1.0f, false);
     }
+}
 
-    // Load cameras
-    //
-    if (j3.find("cameras") != j3.end())
+//
+// Samples the "weights" channels of an animation and blends them into m_morphWeights, like BlendPackedAnimation()
+// does for the poses: an override layer lerps towards the sampled weights, an additive one adds its difference with
+// the default weights.
+//
+void GLTFCommon::BlendMorphWeights(uint32_t animationIndex, float time, float weight, bool bAdditive)
+{
+    const tfAnimation &anim = m_animations[animationIndex];
+    m_weightCursors.resize(m_animations.size());
+    std::vector<int> &cursors = m_weightCursors[animationIndex];
+    cursors.resize(anim.m_channels.size());
+
+    std::vector<float> sampled;
+    int channelIndex = -1;
+    for (auto const &channel : anim.m_channels)
     {
-        const json &cameras = j3["cameras"];
-        m_cameras.resize(cameras.size());
-        for (int i = 0; i < cameras.size(); i++)
-        {
-            const json &camera = cameras[i];
-            tfCamera *tfcamera = &m_cameras[i];
+        channelIndex++;
+        if (channel.second.m_pWeights == NULL)
+            continue;
 
-            tfcamera->yfov = GetElementFloat(camera, "perspective/yfov", 0.1f);
-            tfcamera->znear = GetElementFloat(camera, "perspective/znear", 0.1f);
-            tfcamera->zfar = GetElementFloat(camera, "perspective/zfar", 100.0f);
-            tfcamera->m_nodeIndex = -1;
+        auto weights = m_morphWeights.find(channel.first);
+        if (weights == m_morphWeights.end())
+            continue;
+
+        std::vector<float> &current = weights->second;
+        const std::vector<float> &defaults = m_defaultMorphWeights.at(channel.first);
+        sampled.resize(current.size());
+        const int count = SampleWeights(*channel.second.m_pWeights, time, &cursors[channelIndex], sampled.data(), (int)sampled.size());
+
+        for (int i = 0; i < count; i++)
+        {
+            if (bAdditive)
+                current[i] += weight * (sampled[i] - defaults[i]);
+            else
+                current[i] += weight * (sampled[i] - current[i]);
         }
     }
+}
 
-    // Load nodes
-    //
-    if (j3.find("nodes") != j3.end())
+//
+// Blends several animations into m_animatedMats, see tfAnimationLayer. Nodes animated by any of the layers start
+// from their rest pose, the other nodes are left alone.
+//
+void GLTFCommon::SetAnimationLayers(const std::vector<tfAnimationLayer> &layers)
+{
+    m_layerPoses.resize(m_nodes.size());
+    m_layerNodeMask.assign(m_nodes.size(), 0);
+    m_layerNodes.clear();
+
+    for (const tfAnimationLayer &layer : layers)
     {
-        const json &nodes = j3["nodes"];
-        m_nodes.resize(nodes.size());
-        for (int i = 0; i < nodes.size(); i++)
-        {
-            tfNode *tfnode = &m_nodes[i];
+        if (layer.m_animationIndex >= m_animations.size())
+            continue;
 
-            // Read node data
-            //
-            json::object_t node = nodes[i];
+        const tfPackedAnimation &packed = m_animations[layer.m_animationIndex].m_packed;
+        InitPackedAnimationPoses(packed, m_layerPoses.data());
 
-            if (node.find("children") != node.end())
+        for (tfNodeIdx nodeIdx : packed.m_nodes)
+        {
+            if (m_layerNodeMask[nodeIdx] == 0)
             {
-                for (int c = 0; c < node["children"].size(); c++)
-                {
-                    int nodeID = node["children"][c];
-                    tfnode->m_children.push_back(nodeID);
-                }
+                m_layerNodeMask[nodeIdx] = 1;
+                m_layerNodes.push_back(nodeIdx);
             }
+        }
+    }
 
-            tfnode->meshIndex = GetElementInt(node, "mesh", -1);
-            tfnode->skinIndex = GetElementInt(node, "skin", -1);
+    // layers are applied in order, the channels of each layer are split in ranges across the ThreadPool
+    //
+    const size_t batchSize = 256;
+    for (const tfAnimationLayer &layer : layers)
+    {
+        if (layer.m_animationIndex >= m_animations.size())
+            continue;
 
-            int cameraIdx = GetElementInt(node, "camera", -1);
-            if (cameraIdx >= 0)
-                m_cameras[cameraIdx].m_nodeIndex = i;
+        const tfAnimation &anim = m_animations[layer.m_animationIndex];
+        const float time = fmod(layer.m_time, anim.m_duration);
+        int *pCursors = GetTrackCursors(layer.m_animationIndex);
 
-            int lightIdx = GetElementInt(node, "extensions/KHR_lights_punctual/light", -1);
-            if (lightIdx >= 0)
-            {
-                m_lightInstances.push_back({ lightIdx, i});
-            }
+        ExecBatches(anim.m_packed.m_nodes.size(), batchSize, [this, &anim, &layer, time, pCursors](size_t first, size_t last)
+        {
+            BlendPackedAnimation(anim.m_packed, time, layer.m_weight, layer.m_additive, first, last, pCursors, m_layerPoses.data());
+        });
+    }
 
-            tfnode->m_transform.m_translation = GetElementVector(node, "translation", math::Vector4(0, 0, 0, 0));
-            tfnode->m_transform.m_scale = GetElementVector(node, "scale", math::Vector4(1, 1, 1, 0));
+    ExecBatches(m_layerNodes.size(), batchSize, [this](size_t first, size_t last)
+    {
+        ComposePoses(m_layerPoses.data(), &m_layerNodes[first], last - first, m_animatedMats.data());
+    });
 
+    for (tfNodeIdx nodeIdx : m_layerNodes)
+        m_dirtyNodes[nodeIdx] = 1;
 
-            if (node.find("name") != node.end())
-                tfnode->m_name = GetElementString(node, "name", "unnamed");
+    // the morph weights animated by any of the layers start from their defaults too
+    for (const tfAnimationLayer &layer : layers)
+    {
+        if (layer.m_animationIndex >= m_animations.size())
+            continue;
 
-            if (node.find("rotation") != node.end())
-                tfnode->m_transform.m_rotation = math::Matrix4(math::Quat(GetVector(node["rotation"].get<json::array_t>())), math::Vector3(0.f, 0.f, 0.f));
-            else if (node.find("matrix") != node.end())
-                tfnode->m_transform.m_rotation = GetMatrix(node["matrix"].get<json::array_t>());
-            else
-                tfnode->m_transform.m_rotation = math::Matrix4::identity();
+        for (auto const &channel : m_animations[layer.m_animationIndex].m_channels)
+        {
+            auto weights = m_morphWeights.find(channel.first);
+            if (channel.second.m_pWeights != NULL && weights != m_morphWeights.end())
+                weights->second = m_defaultMorphWeights[channel.first];
         }
     }
 
-    // Load scenes
-    //
-    if (j3.find("scenes") != j3.end())
+    for (const tfAnimationLayer &layer : layers)
     {
-        const json &scenes = j3["scenes"];
-        m_scenes.resize(scenes.size());
-        for (int i = 0; i < scenes.size(); i++)
+        if (layer.m_animationIndex >= m_animations.size())
+            continue;
+
+        const tfAnimation &anim = m_animations[layer.m_animationIndex];
+        BlendMorphWeights(layer.m_animationIndex, fmod(layer.m_time, anim.m_duration), layer.m_weight, layer.m_additive);
+    }
+}
+
+static void LoadMesh(const json &mesh, tfMesh *pMesh)
+{
+    const json &primitives = mesh["primitives"];
+    pMesh->m_pPrimitives.resize(primitives.size());
+    for (int p = 0; p < primitives.size(); p++)
+    {
+        const json &primitive = primitives[p];
+        tfPrimitives *pPrimitive = &pMesh->m_pPrimitives[p];
+
+        for (auto const &it : primitive["attributes"].items())
+            pPrimitive->m_attributes[it.key()] = it.value().get<int>();
+
+        pPrimitive->m_indices = primitive.value("indices", -1);
+        pPrimitive->m_material = primitive.value("material", -1);
+        pPrimitive->m_mode = primitive.value("mode", 4);
+
+        auto targets = primitive.find("targets");
+        if (targets != primitive.end())
         {
-            auto scene = scenes[i];
-            for (int n = 0; n < scene["nodes"].size(); n++)
+            pPrimitive->m_targets.resize(targets->size());
+            for (int t = 0; t < targets->size(); t++)
             {
-                int nodeId = scene["nodes"][n];
-                m_scenes[i].m_nodes.push_back(nodeId);
+                for (auto const &it : targets->at(t).items())
+                    pPrimitive->m_targets[t][it.key()] = it.value().get<int>();
             }
         }
     }
 
-    // Load skins
+    auto weights = mesh.find("weights");
+    if (weights != mesh.end())
+        pMesh->m_weights = weights->get<std::vector<float>>();
+}
+
+static void LoadMaterial(const json &material, tfMaterial *pMaterial)
+{
+    // constants, #defines and the IDs of the textures the PBR shaders use
+    //
+    std::map<std::string, int> textureIds;
+    ProcessMaterials(material, &pMaterial->m_pbrMaterialParameters, textureIds);
+
+    pMaterial->m_doubleSided = GetElementBoolean(material, "doubleSided", false);
+    pMaterial->m_alphaMode = GetElementString(material, "alphaMode", "OPAQUE");
+    pMaterial->m_alphaCutoff = GetElementFloat(material, "alphaCutoff", 0.5);
+    pMaterial->m_metallicRoughness = material.find("pbrMetallicRoughness") != material.end();
+
+    auto extensions = material.find("extensions");
+    if (!pMaterial->m_metallicRoughness && extensions != material.end())
+        pMaterial->m_specularGlossiness = extensions->find("KHR_materials_pbrSpecularGlossiness") != extensions->end();
+
+    // keep the texture coordinate set of each of those textures
     //
-    if (j3.find("skins") != j3.end())
+    static const char *texturePaths[] =
     {
-        const json &skins = j3["skins"];
-        m_skins.resize(skins.size());
-        for (uint32_t i = 0; i < skins.size(); i++)
-        {
-            GetBufferDetails(skins[i]["inverseBindMatrices"].get<int>(), &m_skins[i].m_InverseBindMatrices);
+        "normalTexture",
+        "emissiveTexture",
+        "occlusionTexture",
+        "pbrMetallicRoughness/baseColorTexture",
+        "pbrMetallicRoughness/metallicRoughnessTexture",
+        "extensions/KHR_materials_pbrSpecularGlossiness/diffuseTexture",
+        "extensions/KHR_materials_pbrSpecularGlossiness/specularGlossinessTexture",
+    };
+
+    for (const char *texturePath : texturePaths)
+    {
+        const char *textureName = strrchr(texturePath, '/');
+        textureName = (textureName != NULL) ? textureName + 1 : texturePath;
 
-            if (skins[i].find("skeleton") != skins[i].end())
-                m_skins[i].m_pSkeleton = &m_nodes[skins[i]["skeleton"]];
+        if (textureIds.find(textureName) == textureIds.end())
+            continue;
 
-            const json &joints = skins[i]["joints"];
-            for (uint32_t n = 0; n < joints.size(); n++)
-            {
-                m_skins[i].m_jointsNodeIdx.push_back(joints[n]);
-            }
+        tfTextureRef *pRef = &pMaterial->m_textures[textureName];
+        ProcessGetTextureIndexAndTextCoord(material, texturePath, &pRef->m_index, &pRef->m_texCoord);
+    }
+}
+
+static void LoadImage(const json &image, tfImage *pImage)
+{
+    pImage->m_name = image.value("name", "");
+
+    // data URIs are decoded by the GLTFCommon, no need to copy them
+    auto uri = image.find("uri");
+    if (uri != image.end() && !IsDataUri(uri->get_ref<const std::string &>()))
+        pImage->m_uri = uri->get<std::string>();
+
+    pImage->m_mimeType = image.value("mimeType", "");
+    pImage->m_bufferView = image.value("bufferView", -1);
+}
+
+static void LoadTexture(const json &texture, tfTexture *pTexture)
+{
+    pTexture->m_source = texture.value("source", -1);
+    pTexture->m_sampler = texture.value("sampler", -1);
+}
+
+static void LoadTextureSampler(const json &sampler, tfTextureSampler *pSampler)
+{
+    pSampler->m_magFilter = sampler.value("magFilter", -1);
+    pSampler->m_minFilter = sampler.value("minFilter", -1);
+    pSampler->m_wrapS = sampler.value("wrapS", 10497);
+    pSampler->m_wrapT = sampler.value("wrapT", 10497);
+}
+
+//
+// Converts an element of one of the top level arrays into its typed structure, returns false if the array is not one
+// we keep typed structures for, in that case the element stays in the DOM
+//
+bool GLTFCommon::LoadTypedElement(const std::string &arrayName, const json &element)
+{
+    if (arrayName == "meshes")
+    {
+        m_meshes.emplace_back();
+        LoadMesh(element, &m_meshes.back());
+    }
+    else if (arrayName == "materials")
+    {
+        m_materials.emplace_back();
+        LoadMaterial(element, &m_materials.back());
+    }
+    else if (arrayName == "images")
+    {
+        m_images.emplace_back();
+        LoadImage(element, &m_images.back());
 
+        auto uri = element.find("uri");
+        if (uri != element.end() && IsDataUri(uri->get_ref<const std::string &>()))
+        {
+            tfImage *pImage = &m_images.back();
+            pImage->m_data = LoadDataUri(uri->get_ref<const std::string &>(), &pImage->m_size);
+            if (pImage->m_data == NULL)
+                Trace(format("Image %i has an invalid data URI\n", (int)m_images.size() - 1));
         }
     }
+    else if (arrayName == "textures")
+    {
+        m_textures.emplace_back();
+        LoadTexture(element, &m_textures.back());
+    }
+    else if (arrayName == "samplers")
+    {
+        m_textureSamplers.emplace_back();
+        LoadTextureSampler(element, &m_textureSamplers.back());
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+//
+// Reads up to 4 components of an accessor's min/max array, missing ones are set to 0
+//
+static math::Vector4 GetMinMaxVector(const json &values, const tfAccessor &accessor)
+{
+    // the bounds of normalized (quantized) accessors are in integer units
+    float v[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (size_t i = 0; i < values.size() && i < 4; i++)
+        v[i] = accessor.m_normalized ? NormalizeComponent(values[i].get<float>(), accessor.m_componentType) : values[i].get<float>();
+
+    return math::Vector4(v[0], v[1], v[2], v[3]);
+}
+
+//
+// Turns the accessors and bufferViews from the json into tfAccessors and tfBufferViews that point straight into the buffers
+//
+void GLTFCommon::ResolveAccessors(bool bParallel)
+{
+    m_bufferViews.resize(m_pBufferViews->size());
+    for (int i = 0; i < m_pBufferViews->size(); i++)
+    {
+        const json &bufferView = m_pBufferViews->at(i);
+        tfBufferView *pBufferView = &m_bufferViews[i];
+
+        int32_t bufferIdx = bufferView.value("buffer", -1);
+        assert(bufferIdx >= 0 && bufferIdx < m_buffersData.size());
+
+        pBufferView->m_data = m_buffersData[bufferIdx] + bufferView.value("byteOffset", 0);
+        pBufferView->m_byteLength = bufferView["byteLength"].get<size_t>();
+        pBufferView->m_byteStride = bufferView.value("byteStride", 0);
+    }
 
-    // Load animations
+    // accessors don't depend on each other, resolve them in batches
     //
-    if (j3.find("animations") != j3.end())
+    const int batchSize = 1024;
+    Sync sync;
+    m_accessors.resize(m_pAccessors->size());
+    for (int first = 0; first < m_accessors.size(); first += batchSize)
     {
-        const json &animations = j3["animations"];
-        m_animations.resize(animations.size());
-        for (int i = 0; i < animations.size(); i++)
+        int last = std::min<int>(first + batchSize, (int)m_accessors.size());
+        ExecLoadJob(bParallel, &sync, [this, first, last]()
         {
-            const json &channels = animations[i]["channels"];
-            const json &samplers = animations[i]["samplers"];
-
-            tfAnimation *tfanim = &m_animations[i];
-            for (int c = 0; c < channels.size(); c++)
-            {
-                json::object_t channel = channels[c];
-                int sampler = channel["sampler"];
-                int node = GetElementInt(channel, "target/node", -1);
-                std::string path = GetElementString(channel, "target/path", std::string());
+            for (int i = first; i < last; i++)
+                ResolveAccessor(m_pAccessors->at(i), &m_accessors[i]);
+        });
+    }
+    sync.Wait();
+}
 
-                tfChannel *tfchannel;
+void GLTFCommon::ResolveAccessor(const json &inAccessor, tfAccessor *pAccessor) const
+{
+    // accessors without a bufferView are all zeros (unless they are sparse), their data stays NULL
+    int32_t bufferViewIdx = inAccessor.value("bufferView", -1);
+    if (bufferViewIdx >= 0)
+        pAccessor->m_data = m_bufferViews[bufferViewIdx].m_data + inAccessor.value("byteOffset", 0);
 
-                auto ch = tfanim->m_channels.find(node);
-                if (ch == tfanim->m_channels.end())
-                {
-                    tfchannel = &tfanim->m_channels[node];
-                }
-                else
-                {
-                    tfchannel = &ch->second;
-                }
+    pAccessor->m_dimension = GetDimensions(inAccessor["type"]);
+    pAccessor->m_componentType = inAccessor["componentType"];
+    pAccessor->m_type = GetFormatSize(pAccessor->m_componentType);
+    pAccessor->m_stride = pAccessor->m_dimension * pAccessor->m_type;
+    pAccessor->m_count = inAccessor["count"];
+    pAccessor->m_normalized = inAccessor.value("normalized", false);
 
-                tfSampler *tfsmp = new tfSampler();
+    // interleaved vertex attributes
+    if (bufferViewIdx >= 0 && m_bufferViews[bufferViewIdx].m_byteStride > 0)
+        pAccessor->m_stride = m_bufferViews[bufferViewIdx].m_byteStride;
 
-                // Get time line
-                //
-                GetBufferDetails(samplers[sampler]["input"], &tfsmp->m_time);
-                assert(tfsmp->m_time.m_stride == 4);
+    auto min = inAccessor.find("min");
+    if (min != inAccessor.end())
+        pAccessor->m_min = GetMinMaxVector(min.value(), *pAccessor);
 
-                tfanim->m_duration = std::max<float>(tfanim->m_duration, *(float*)tfsmp->m_time.Get(tfsmp->m_time.m_count - 1));
+    auto max = inAccessor.find("max");
+    if (max != inAccessor.end())
+        pAccessor->m_max = GetMinMaxVector(max.value(), *pAccessor);
 
-                // Get value line
-                //
-                GetBufferDetails(samplers[sampler]["output"], &tfsmp->m_value);
+    auto sparse = inAccessor.find("sparse");
+    if (sparse != inAccessor.end())
+    {
+        const json &indices = sparse.value()["indices"];
+        const json &values = sparse.value()["values"];
 
-                // Index appropriately
-                // 
-                if (path == "translation")
-                {
-                    tfchannel->m_pTranslation = tfsmp;
-                    assert(tfsmp->m_value.m_stride == 3 * 4);
-                    assert(tfsmp->m_value.m_dimension == 3);
-                }
-                else if (path == "rotation")
-                {
-                    tfchannel->m_pRotation = tfsmp;
-                    assert(tfsmp->m_value.m_stride == 4 * 4);
-                    assert(tfsmp->m_value.m_dimension == 4);
-                }
-                else if (path == "scale")
-                {
-                    tfchannel->m_pScale = tfsmp;
-                    assert(tfsmp->m_value.m_stride == 3 * 4);
-                    assert(tfsmp->m_value.m_dimension == 3);
-                }
-            }
-        }
+        pAccessor->m_sparse.m_count = sparse.value()["count"];
+        pAccessor->m_sparse.m_indices = m_bufferViews[indices["bufferView"].get<int>()].m_data + indices.value("byteOffset", 0);
+        pAccessor->m_sparse.m_indexType = GetFormatSize(indices["componentType"]);
+        pAccessor->m_sparse.m_values = m_bufferViews[values["bufferView"].get<int>()].m_data + values.value("byteOffset", 0);
     }
+}
 
-    InitTransformedData();
+void GLTFCommon::GetBufferDetails(int accessor, tfAccessor *pAccessor) const
+{
+    *pAccessor = m_accessors[accessor];
 
-    return true;
+    // sparse accessors and accessors without bufferView were decoded by DecodeSparseAccessors()
+    assert(pAccessor->m_data != NULL);
 }
 
-void GLTFCommon::Unload()
+//
+// Reads the index of the i-th sparse element
+//
+static uint32_t GetSparseIndex(const tfSparseAccessor &sparse, int i)
 {
-    for (int i = 0; i < m_buffersData.size(); i++)
+    switch (sparse.m_indexType)
     {
-        delete[] m_buffersData[i];
+    case 1: return ((const uint8_t *)sparse.m_indices)[i];
+    case 2: return ((const uint16_t *)sparse.m_indices)[i];
+    default: return ((const uint32_t *)sparse.m_indices)[i];
     }
-    m_buffersData.clear();
-
-    m_animations.clear();
-    m_nodes.clear();
-    m_scenes.clear();
-    m_lights.clear();
-    m_lightInstances.clear();
-
-    j3.clear();
 }
 
 //
-// Animates the matrices (they are still in object space)
+// Writes the dense elements of an accessor, its data (or zeros when it has no bufferView) with the sparse values applied
 //
-void GLTFCommon::SetAnimationTime(uint32_t animationIndex, float time)
+static void DecodeAccessor(const tfAccessor &accessor, const void *pBase, char *pDst)
 {
-    if (animationIndex < m_animations.size())
+    // the copy keeps the stride of the accessor, the sparse values are tightly packed
+    const size_t elementSize = accessor.m_dimension * accessor.m_type;
+    if (pBase == NULL)
+        memset(pDst, 0, accessor.m_count * accessor.m_stride);
+    else if (elementSize == accessor.m_stride)
+        memcpy(pDst, pBase, accessor.m_count * elementSize);
+    else
     {
-        tfAnimation *anim = &m_animations[animationIndex];
+        for (int i = 0; i < accessor.m_count; i++)
+            memcpy(pDst + i * accessor.m_stride, (const char *)pBase + i * accessor.m_stride, elementSize);
+    }
 
-        //loop animation
-        time = fmod(time, anim->m_duration);
+    const tfSparseAccessor &sparse = accessor.m_sparse;
+    for (int i = 0; i < sparse.m_count; i++)
+    {
+        uint32_t index = GetSparseIndex(sparse, i);
+        if (index < (uint32_t)accessor.m_count)
+            memcpy(pDst + index * accessor.m_stride, (const char *)sparse.m_values + i * elementSize, elementSize);
+    }
+}
 
-        for (auto it = anim->m_channels.begin(); it != anim->m_channels.end(); it++)
+//
+// Sparse accessors and accessors without bufferView get a dense copy so the rest of the code can keep reading m_data.
+// Accessors only used by morph targets are left alone, LoadMorphTargets() keeps them sparse.
+//
+void GLTFCommon::DecodeSparseAccessors()
+{
+    std::vector<uint8_t> morphOnly(m_accessors.size(), 0);
+    for (const tfMesh &mesh : m_meshes)
+    {
+        for (const tfPrimitives &primitive : mesh.m_pPrimitives)
         {
-            Transform *pSourceTrans = &m_nodes[it->first].m_transform;
-            Transform animated;
-
-            float frac, *pCurr, *pNext;
-
-            // Animate translation
-            //
-            if (it->second.m_pTranslation != NULL)
-            {
-                it->second.m_pTranslation->SampleLinear(time, &frac, &pCurr, &pNext);
-                animated.m_translation = ((1.0f - frac) * math::Vector4(pCurr[0], pCurr[1], pCurr[2], 0)) + ((frac) * math::Vector4(pNext[0], pNext[1], pNext[2], 0));
-            }
-            else
-            {
-                animated.m_translation = pSourceTrans->m_translation;
-            }
-
-            // Animate rotation
-            //
-            if (it->second.m_pRotation != NULL)
-            {
-                it->second.m_pRotation->SampleLinear(time, &frac, &pCurr, &pNext);
-                animated.m_rotation = math::Matrix4(math::slerp(frac, math::Quat(pCurr[0], pCurr[1], pCurr[2], pCurr[3]), math::Quat(pNext[0], pNext[1], pNext[2], pNext[3])), math::Vector3(0.0f, 0.0f, 0.0f));
-            }
-            else
-            {
-                animated.m_rotation = pSourceTrans->m_rotation;
-            }
+            for (auto const &target : primitive.m_targets)
+                for (auto const &attribute : target)
+                    morphOnly[attribute.second] = 1;
+        }
+    }
+    for (const tfMesh &mesh : m_meshes)
+    {
+        for (const tfPrimitives &primitive : mesh.m_pPrimitives)
+        {
+            for (auto const &attribute : primitive.m_attributes)
+                morphOnly[attribute.second] = 0;
+        }
+    }
 
-            // Animate scale
-            //
-            if (it->second.m_pScale != NULL)
-            {
-                it->second.m_pScale->SampleLinear(time, &frac, &pCurr, &pNext);
-                animated.m_scale = ((1.0f - frac) * math::Vector4(pCurr[0], pCurr[1], pCurr[2], 0)) + ((frac) * math::Vector4(pNext[0], pNext[1], pNext[2], 0));
-            }
-            else
-            {
-                animated.m_scale = pSourceTrans->m_scale;
-            }
+    for (size_t i = 0; i < m_accessors.size(); i++)
+    {
+        tfAccessor &accessor = m_accessors[i];
+        if (morphOnly[i] || accessor.m_sparse.m_decoded || (accessor.m_data != NULL && accessor.m_sparse.m_count == 0))
+            continue;
 
-            m_animatedMats[it->first] = animated.GetWorldMat();
+        char *pData = (char *)malloc(std::max<size_t>(accessor.m_count * accessor.m_stride, 1));
+        DecodeAccessor(accessor, accessor.m_data, pData);
+        {
+            std::lock_guard<std::mutex> lock(s_fileDataMutex);
+            m_allocatedData.push_back(pData);
         }
+
+        accessor.m_sparse.m_base = accessor.m_data;
+        accessor.m_sparse.m_decoded = true;
+        accessor.m_data = pData;
     }
 }
 
-void GLTFCommon::GetBufferDetails(int accessor, tfAccessor *pAccessor) const
+//
+// Converts a morph target accessor into deltas for the vertices it displaces. Sparse accessors on top of zeros (the
+// usual way of storing them) are taken as they are, otherwise the zero deltas of the dense data are dropped.
+//
+static void LoadMorphDelta(const tfAccessor &accessor, tfMorphDelta *pDelta)
 {
-    const json &inAccessor = m_pAccessors->at(accessor);
+    assert(accessor.m_dimension == 3);
 
-    int32_t bufferViewIdx = inAccessor.value("bufferView", -1);
-    assert(bufferViewIdx >= 0);
-    const json &bufferView = m_pBufferViews->at(bufferViewIdx);
+    // quantized targets (KHR_mesh_quantization) are converted to floats
+    const float *pValues;
+    std::vector<float> dense;
+    int count;
+    if (accessor.m_sparse.m_count > 0 && accessor.m_data == NULL && accessor.m_componentType == 5126)
+    {
+        pValues = (const float *)accessor.m_sparse.m_values;
+        count = accessor.m_sparse.m_count;
+    }
+    else
+    {
+        std::vector<char> decoded(accessor.m_count * accessor.m_stride);
+        DecodeAccessor(accessor, accessor.m_sparse.m_decoded ? accessor.m_sparse.m_base : accessor.m_data, decoded.data());
+
+        tfAccessor decodedAccessor = accessor;
+        decodedAccessor.m_data = decoded.data();
+        decodedAccessor.m_sparse = tfSparseAccessor();
+        dense.resize(accessor.m_count * 3);
+        DequantizeAccessor(decodedAccessor, dense.data());
 
-    int32_t bufferIdx = bufferView.value("buffer", -1);
-    assert(bufferIdx >= 0);
+        pValues = dense.data();
+        count = accessor.m_count;
+    }
 
-    char *buffer = m_buffersData[bufferIdx];
+    for (int i = 0; i < count; i++)
+    {
+        const float *pValue = &pValues[i * 3];
+        if (pValue[0] == 0.0f && pValue[1] == 0.0f && pValue[2] == 0.0f)
+            continue;
 
-    int32_t offset = bufferView.value("byteOffset", 0);
+        uint32_t index = dense.empty() ? GetSparseIndex(accessor.m_sparse, i) : (uint32_t)i;
+        if (index >= (uint32_t)accessor.m_count)
+            continue;
 
-    int byteLength = bufferView["byteLength"];
+        pDelta->m_indices.push_back(index);
+        pDelta->m_deltas.insert(pDelta->m_deltas.end(), pValue, pValue + 3);
+    }
 
-    int32_t byteOffset = inAccessor.value("byteOffset", 0);
-    offset += byteOffset;
-    byteLength -= byteOffset;
+    pDelta->m_deltas.push_back(0.0f);
+    pDelta->m_indices.shrink_to_fit();
+    pDelta->m_deltas.shrink_to_fit();
+}
 
-    pAccessor->m_data = &buffer[offset];
-    pAccessor->m_dimension = GetDimensions(inAccessor["type"]);
-    pAccessor->m_type = GetFormatSize(inAccessor["componentType"]);
-    pAccessor->m_stride = pAccessor->m_dimension * pAccessor->m_type;
-    pAccessor->m_count = inAccessor["count"];
+void GLTFCommon::LoadMorphTargets()
+{
+    for (tfMesh &mesh : m_meshes)
+    {
+        for (tfPrimitives &primitive : mesh.m_pPrimitives)
+        {
+            primitive.m_morphTargets.resize(primitive.m_targets.size());
+            for (size_t t = 0; t < primitive.m_targets.size(); t++)
+            {
+                for (auto const &attribute : primitive.m_targets[t])
+                {
+                    if (attribute.first == "POSITION" || attribute.first == "NORMAL" || attribute.first == "TANGENT")
+                        LoadMorphDelta(m_accessors[attribute.second], &primitive.m_morphTargets[t].m_attributes[attribute.first]);
+                }
+            }
+        }
+    }
 }
 
 void GLTFCommon::GetAttributesAccessors(const json &gltfAttributes, std::vector<char*> *pStreamNames, std::vector<tfAccessor> *pAccessors) const
@@ -497,6 +1763,36 @@ void GLTFCommon::GetAttributesAccessors(const json &gltfAttributes, std::vector<
     }
 }
 
+//
+// Returns the memory a bufferView points to, this is how images are embedded in .glb files
+//
+//
+// Returns the data of an image embedded in the glTF, either in a bufferView or in a data URI
+//
+bool GLTFCommon::GetImageData(int imageIndex, const char **ppData, size_t *pSize) const
+{
+    const tfImage &image = m_images[imageIndex];
+    if (image.m_data != NULL)
+    {
+        *ppData = image.m_data;
+        *pSize = image.m_size;
+        return true;
+    }
+
+    return GetBufferViewData(image.m_bufferView, ppData, pSize);
+}
+
+bool GLTFCommon::GetBufferViewData(int bufferViewIdx, const char **ppData, size_t *pSize) const
+{
+    if (bufferViewIdx < 0 || bufferViewIdx >= m_bufferViews.size())
+        return false;
+
+    *ppData = m_bufferViews[bufferViewIdx].m_data;
+    *pSize = m_bufferViews[bufferViewIdx].m_byteLength;
+
+    return true;
+}
+
 //
 // Given a mesh find the skin it belongs to
 //
@@ -513,6 +1809,142 @@ int GLTFCommon::FindMeshSkinId(int meshId) const
     return -1;
 }
 
+//
+// True when the mesh is drawn with instanced draws, by a node that uses EXT_mesh_gpu_instancing or by a batch of nodes.
+// The passes then build its pipelines with the per instance stream, the nodes that draw the same mesh on their own use
+// a single identity instance.
+//
+bool GLTFCommon::IsMeshInstanced(int meshIndex) const
+{
+    for (auto &t : m_nodeInstances)
+    {
+        if (m_nodes[t.first].meshIndex == meshIndex)
+            return true;
+    }
+
+    for (const std::vector<tfNodeIdx> &batch : m_nodeBatches)
+    {
+        if (m_nodes[batch[0]].meshIndex == meshIndex)
+            return true;
+    }
+
+    return false;
+}
+
+//
+// True when the node draws instances, the passes cull them in CullInstances() instead of culling the node
+//
+bool GLTFCommon::IsNodeInstanced(int nodeIndex) const
+{
+    return IsNodeBatched(nodeIndex) || m_nodeInstances.find(nodeIndex) != m_nodeInstances.end();
+}
+
+//
+// Number of instances CullInstances() can write for the node, 0 for the nodes drawn by their batch
+//
+uint32_t GLTFCommon::GetNodeInstanceCount(int nodeIndex) const
+{
+    if (IsNodeBatched(nodeIndex))
+    {
+        const std::vector<tfNodeIdx> &batch = m_nodeBatches[m_nodeBatchIndex[nodeIndex]];
+        return batch[0] == nodeIndex ? (uint32_t)batch.size() : 0;
+    }
+
+    auto it = m_nodeInstances.find(nodeIndex);
+    return it == m_nodeInstances.end() ? 1 : (uint32_t)it->second.size();
+}
+
+//
+// Matrices the passes set as the world matrices of a node's draw, the identity for the batches since their instances
+// already are world matrices
+//
+const Matrix2 &GLTFCommon::GetDrawMatrices(int nodeIndex) const
+{
+    return IsNodeBatched(nodeIndex) ? m_identityMats : m_worldSpaceMats[nodeIndex];
+}
+
+//
+// Bounding box of all the primitives of a mesh, as a center and an extent for TransformBoundingBox()
+//
+static void GetMeshBounds(const tfMesh &mesh, math::Vector4 *pCenter, math::Vector4 *pExtent)
+{
+    AxisAlignedBoundingBox bounds;
+    for (const tfPrimitives &primitive : mesh.m_pPrimitives)
+    {
+        bounds.Grow(primitive.m_center - primitive.m_radius);
+        bounds.Grow(primitive.m_center + primitive.m_radius);
+    }
+
+    *pCenter = (bounds.m_min + bounds.m_max) * 0.5f;
+    *pExtent = bounds.m_max - *pCenter;
+    pCenter->setW(1.0f);
+    pExtent->setW(0.0f);
+}
+
+//
+// Frustum culls the instances of a node against the bounding box of its mesh, the visible ones are compacted into
+// pVisible (which must hold GetNodeInstanceCount() instances). Returns the number of visible instances.
+// The first node of a batch culls the whole batch, its instances being the world matrices of the nodes, which all
+// belong to the same scene.
+// The world boxes of all the instances are written to arrays first and tested with a single CullBoxes() call.
+//
+uint32_t GLTFCommon::CullInstances(int nodeIndex, const math::Matrix4 &mCameraViewProj, InstanceMatrix *pVisible) const
+{
+    static thread_local BoundingBoxArrays s_boxes;
+    static thread_local std::vector<uint32_t> s_visibleMask;
+
+    math::Vector4 center, extent;
+    GetMeshBounds(m_meshes[m_nodes[nodeIndex].meshIndex], &center, &extent);
+
+    FrustumPlanes frustum;
+    GetFrustumPlanes(mCameraViewProj, &frustum);
+
+    uint32_t visibleCount = 0;
+    if (IsNodeBatched(nodeIndex))
+    {
+        const std::vector<tfNodeIdx> &batch = m_nodeBatches[m_nodeBatchIndex[nodeIndex]];
+        if (batch[0] != nodeIndex)
+            return 0;
+
+        s_boxes.Resize(batch.size());
+        for (size_t i = 0; i < batch.size(); i++)
+            s_boxes.Set(i, TransformBoundingBox(m_worldSpaceMats[batch[i]].GetCurrent(), center, extent));
+
+        s_visibleMask.resize(DivideRoundingUp<size_t>(batch.size(), 32));
+        CullBoxes(frustum, s_boxes, 0, batch.size(), s_visibleMask.data());
+
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            const Matrix2 &world = m_worldSpaceMats[batch[i]];
+            if (s_visibleMask[i / 32] & (1u << (i % 32)))
+                pVisible[visibleCount++].Set(world.GetCurrent(), world.GetPrevious());
+        }
+
+        return visibleCount;
+    }
+
+    auto it = m_nodeInstances.find(nodeIndex);
+    if (it == m_nodeInstances.end())
+        return 0;
+
+    const std::vector<InstanceMatrix> &instances = it->second;
+    const math::Matrix4 mNodeWorld = m_worldSpaceMats[nodeIndex].GetCurrent();
+    s_boxes.Resize(instances.size());
+    for (size_t i = 0; i < instances.size(); i++)
+        s_boxes.Set(i, TransformBoundingBox(mNodeWorld * instances[i].Get(), center, extent));
+
+    s_visibleMask.resize(DivideRoundingUp<size_t>(instances.size(), 32));
+    CullBoxes(frustum, s_boxes, 0, instances.size(), s_visibleMask.data());
+
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        if (s_visibleMask[i / 32] & (1u << (i % 32)))
+            pVisible[visibleCount++] = instances[i];
+    }
+
+    return visibleCount;
+}
+
 //
 // given a skinId return the size of the skeleton matrices (vulkan needs this to compute the offsets into the uniform buffers)
 //
@@ -521,21 +1953,74 @@ int GLTFCommon::GetInverseBindMatricesBufferSizeByID(int id) const
     if (id == -1 || (id >= m_skins.size()))
         return -1;
 
-    return m_skins[id].m_InverseBindMatrices.m_count * (4 * 4 * sizeof(float));
+    // size of the skinning matrices buffer of the skin, one SkinningMatrix per inverse bind matrix
+    return m_skins[id].m_InverseBindMatrices.m_count * sizeof(SkinningMatrix);
+}
+
+//
+// Flattens the hierarchy of a scene, nodes are sorted by depth so the parents always come before their children.
+// This way TransformScene() is a linear sweep and all the nodes of a level can be transformed in parallel.
+//
+void GLTFCommon::FlattenScene(tfScene *pScene) const
+{
+    pScene->m_flatNodes.assign(pScene->m_nodes.begin(), pScene->m_nodes.end());
+    pScene->m_flatParents.assign(pScene->m_nodes.size(), -1);
+    pScene->m_levels.assign(1, 0);
+
+    uint32_t first = 0;
+    while (first < pScene->m_flatNodes.size())
+    {
+        uint32_t last = (uint32_t)pScene->m_flatNodes.size();
+        pScene->m_levels.push_back(last);
+
+        for (uint32_t i = first; i < last; i++)
+        {
+            for (tfNodeIdx child : m_nodes[pScene->m_flatNodes[i]].m_children)
+            {
+                pScene->m_flatNodes.push_back(child);
+                pScene->m_flatParents.push_back(i);
+            }
+        }
+
+        first = last;
+    }
 }
 
 //
-// Transforms a node hierarchy recursively 
+// Transforms the nodes [first, last) of a flattened scene, their parents must be transformed already.
+// Only the nodes that are dirty or have a dirty parent are recomputed, the nodes that changed in the previous
+// transform just get their previous matrix updated and the rest is left untouched. The recomputed nodes are appended
+// to pMovedNodes.
 //
-void GLTFCommon::TransformNodes(const math::Matrix4& world, const std::vector<tfNodeIdx> *pNodes)
+void GLTFCommon::TransformFlatNodes(const tfScene &scene, const math::Matrix4& world, uint32_t first, uint32_t last, std::vector<tfNodeIdx> *pMovedNodes)
 {
-    for (uint32_t n = 0; n < pNodes->size(); n++)
+    const tfNodeIdx *pNodes = scene.m_flatNodes.data();
+    const int *pParents = scene.m_flatParents.data();
+    math::Matrix4 *pWorld = m_flatWorldMats.data();
+    uint8_t *pFlatDirty = m_flatDirty.data();
+
+    for (uint32_t i = first; i < last; i++)
     {
-        uint32_t nodeIdx = pNodes->at(n);
+        int parent = pParents[i];
+        tfNodeIdx nodeIdx = pNodes[i];
 
-        math::Matrix4 m = world * m_animatedMats[nodeIdx];
-        m_worldSpaceMats[nodeIdx].Set(m);
-        TransformNodes(m, &m_nodes[nodeIdx].m_children);
+        bool bDirty = m_bAllNodesDirty || m_dirtyNodes[nodeIdx] || (parent >= 0 && pFlatDirty[parent]);
+        pFlatDirty[i] = bDirty;
+
+        if (bDirty)
+        {
+            math::Matrix4 m = ((parent < 0) ? world : pWorld[parent]) * m_animatedMats[nodeIdx];
+            pWorld[i] = m;
+            m_worldSpaceMats[nodeIdx].Set(m);
+            m_worldChanged[nodeIdx] = 1;
+            pMovedNodes->push_back(nodeIdx);
+        }
+        else if (m_worldChanged[nodeIdx])
+        {
+            // static from now on, previous = current for the motion vectors
+            m_worldSpaceMats[nodeIdx].Set(m_worldSpaceMats[nodeIdx].GetCurrent());
+            m_worldChanged[nodeIdx] = 0;
+        }
     }
 }
 
@@ -560,6 +2045,166 @@ void GLTFCommon::InitTransformedData()
     {
         m_animatedMats[i] = m_nodes[i].m_transform.GetWorldMat();
     }
+
+    for (tfScene &scene : m_scenes)
+    {
+        FlattenScene(&scene);
+    }
+
+    m_dirtyNodes.assign(m_nodes.size(), 1);
+    m_bAllNodesDirty = true;
+
+    // nodes whose mesh has morph targets get their weights and a copy of each morphed attribute
+    m_morphWeights.clear();
+    m_morphedStreams.clear();
+    m_defaultMorphWeights.clear();
+    for (int i = 0; i < m_nodes.size(); i++)
+    {
+        if (m_nodes[i].meshIndex < 0)
+            continue;
+
+        const tfMesh &mesh = m_meshes[m_nodes[i].meshIndex];
+        size_t targetCount = 0;
+        std::vector<tfMorphedStream> streams;
+        for (int p = 0; p < mesh.m_pPrimitives.size(); p++)
+        {
+            const tfPrimitives &primitive = mesh.m_pPrimitives[p];
+            targetCount = std::max(targetCount, primitive.m_targets.size());
+
+            for (const char *pAttribute : { "POSITION", "NORMAL", "TANGENT" })
+            {
+                auto attribute = primitive.m_attributes.find(pAttribute);
+                if (attribute == primitive.m_attributes.end())
+                    continue;
+
+                bool bMorphed = false;
+                for (const tfMorphTarget &target : primitive.m_morphTargets)
+                    bMorphed |= target.m_attributes.find(pAttribute) != target.m_attributes.end();
+                if (!bMorphed)
+                    continue;
+
+                const tfAccessor &accessor = m_accessors[attribute->second];
+                tfMorphedStream stream;
+                stream.m_primitive = p;
+                stream.m_accessor = attribute->second;
+                stream.m_attribute = pAttribute;
+                stream.m_dimension = accessor.m_dimension;
+                stream.m_count = accessor.m_count;
+                stream.m_data.resize(accessor.m_count * accessor.m_dimension + 1);
+                streams.push_back(std::move(stream));
+            }
+        }
+
+        if (targetCount == 0)
+            continue;
+
+        std::vector<float> weights = m_nodes[i].m_weights.empty() ? mesh.m_weights : m_nodes[i].m_weights;
+        weights.resize(targetCount, 0.0f);
+        m_defaultMorphWeights[i] = weights;
+        m_morphWeights[i] = weights;
+        m_morphedStreams[i] = std::move(streams);
+    }
+
+    MorphMeshes();
+    BatchNodes();
+}
+
+//
+// Groups the nodes of a scene that reference the same mesh so the passes draw them with a single instanced draw. Only
+// the nodes whose draws are identical but for their world matrix can be merged: skinned and morphed nodes have their
+// own matrices or vertices, the nodes with EXT_mesh_gpu_instancing already use the instance stream and the blended
+// primitives have to be sorted back to front one by one.
+// The batches never span scenes since only the nodes of the transformed scene have valid matrices and are drawn, the
+// nodes that belong to several scenes are drawn on their own.
+//
+void GLTFCommon::BatchNodes()
+{
+    // Set() shifts the current matrix into the previous one, so it takes two calls to make both the identity
+    m_identityMats.Set(math::Matrix4::identity());
+    m_identityMats.Set(math::Matrix4::identity());
+
+    // scene of each node, -1 when it is in none and -2 when it is in several
+    std::vector<int> nodeScenes(m_nodes.size(), -1);
+    for (int s = 0; s < (int)m_scenes.size(); s++)
+    {
+        for (tfNodeIdx node : m_scenes[s].m_flatNodes)
+            nodeScenes[node] = (nodeScenes[node] == -1 || nodeScenes[node] == s) ? s : -2;
+    }
+
+    std::map<std::pair<int, int>, std::vector<tfNodeIdx>> meshNodes;
+    for (int i = 0; i < m_nodes.size(); i++)
+    {
+        const tfNode &node = m_nodes[i];
+        if (node.meshIndex < 0 || node.skinIndex != -1 || m_morphWeights.find(i) != m_morphWeights.end() || m_nodeInstances.find(i) != m_nodeInstances.end())
+            continue;
+        if (nodeScenes[i] < 0)
+            continue;
+
+        meshNodes[std::make_pair(nodeScenes[i], node.meshIndex)].push_back((tfNodeIdx)i);
+    }
+
+    m_nodeBatches.clear();
+    m_nodeBatchIndex.assign(m_nodes.size(), -1);
+    for (auto &t : meshNodes)
+    {
+        if (t.second.size() < 2)
+            continue;
+
+        bool bBlended = false;
+        for (const tfPrimitives &primitive : m_meshes[t.first.second].m_pPrimitives)
+            bBlended |= primitive.m_material >= 0 && m_materials[primitive.m_material].m_alphaMode == "BLEND";
+        if (bBlended)
+            continue;
+
+        for (tfNodeIdx node : t.second)
+            m_nodeBatchIndex[node] = (int)m_nodeBatches.size();
+        m_nodeBatches.push_back(std::move(t.second));
+    }
+}
+
+//
+// Applies m_morphWeights to the morph targets and writes the results in m_morphedStreams, the nodes are processed
+// in parallel. The vertex buffers of the morphed nodes are then uploaded by GLTFTexturesAndBuffers every frame.
+//
+void GLTFCommon::MorphMeshes()
+{
+    std::vector<std::pair<const int, std::vector<tfMorphedStream>> *> nodes;
+    for (auto &it : m_morphedStreams)
+        nodes.push_back(&it);
+
+    ExecBatches(nodes.size(), 1, [this, &nodes](size_t first, size_t last)
+    {
+        std::vector<const tfMorphDelta *> deltas;
+        for (size_t n = first; n < last; n++)
+        {
+            const int nodeIndex = nodes[n]->first;
+            const tfMesh &mesh = m_meshes[m_nodes[nodeIndex].meshIndex];
+            const std::vector<float> &weights = m_morphWeights.at(nodeIndex);
+
+            for (tfMorphedStream &stream : nodes[n]->second)
+            {
+                const tfPrimitives &primitive = mesh.m_pPrimitives[stream.m_primitive];
+
+                deltas.clear();
+                for (const tfMorphTarget &target : primitive.m_morphTargets)
+                {
+                    auto delta = target.m_attributes.find(stream.m_attribute);
+                    deltas.push_back(delta != target.m_attributes.end() ? &delta->second : NULL);
+                }
+
+                MorphVertexStream(m_accessors[stream.m_accessor], deltas.data(), weights.data(), std::min(deltas.size(), weights.size()), stream.m_data.data());
+            }
+        }
+    });
+}
+
+//
+// Poses a node by hand and flags it for the next TransformScene(), SetAnimationTime() does the same for the animated nodes
+//
+void GLTFCommon::SetAnimatedMatrix(tfNodeIdx nodeIdx, const math::Matrix4 &mat)
+{
+    m_animatedMats[nodeIdx] = mat;
+    m_dirtyNodes[nodeIdx] = 1;
 }
 
 //
@@ -567,27 +2212,147 @@ void GLTFCommon::InitTransformedData()
 //
 void GLTFCommon::TransformScene(int sceneIndex, const math::Matrix4& world)
 {
+    // everything is recomputed when nodes were added, or when the scene or its world matrix change
+    //
+    if (m_worldChanged.size() != m_nodes.size() || m_transformedScene != sceneIndex || memcmp(&m_transformedWorld, &world, sizeof(world)) != 0)
+    {
+        m_bAllNodesDirty = true;
+    }
+    bool bRebuildBvh = m_bAllNodesDirty || m_bvhNodes.empty();
+    m_transformedScene = sceneIndex;
+    m_transformedWorld = world;
+
     m_worldSpaceMats.resize(m_nodes.size());
+    m_worldChanged.resize(m_nodes.size(), 1);
+    m_dirtyNodes.resize(m_nodes.size(), 1);
+
+    // transform the nodes level by level, large levels are split in batches across the ThreadPool
+    //
+    const tfScene &scene = m_scenes[sceneIndex];
+    m_flatWorldMats.resize(scene.m_flatNodes.size());
+    m_flatDirty.resize(scene.m_flatNodes.size());
+    m_movedNodes.clear();
+    for (size_t level = 0; level + 1 < scene.m_levels.size(); level++)
+    {
+        uint32_t first = scene.m_levels[level];
+        uint32_t last = scene.m_levels[level + 1];
+
+        const uint32_t batchSize = 8192;
+        if (last - first < 2 * batchSize)
+        {
+            TransformFlatNodes(scene, world, first, last, &m_movedNodes);
+            continue;
+        }
+
+        // each batch collects its moved nodes on its own, they are appended once all are done
+        std::vector<std::vector<tfNodeIdx>> movedNodes((last - first + batchSize - 1) / batchSize);
+
+        Sync sync;
+        for (uint32_t batch = first + batchSize; batch < last; batch += batchSize)
+        {
+            uint32_t batchLast = std::min(batch + batchSize, last);
+            std::vector<tfNodeIdx> *pMovedNodes = &movedNodes[(batch - first) / batchSize];
+            sync.Inc();
+            GetThreadPool()->AddJob([this, &scene, &world, &sync, batch, batchLast, pMovedNodes]()
+            {
+                TransformFlatNodes(scene, world, batch, batchLast, pMovedNodes);
+                sync.Dec();
+            });
+        }
+
+        TransformFlatNodes(scene, world, first, first + batchSize, &movedNodes[0]);
+        sync.Wait();
+
+        for (const std::vector<tfNodeIdx> &nodes : movedNodes)
+            m_movedNodes.insert(m_movedNodes.end(), nodes.begin(), nodes.end());
+    }
 
-    // transform all the nodes of the scene (and make 
-    //           
-    std::vector<int> sceneNodes = { m_scenes[sceneIndex].m_nodes };
-    TransformNodes(world, &sceneNodes);
+    // the BVH of the primitives follows the nodes, see GltfBvh.cpp
+    if (bRebuildBvh)
+        BuildBvh();
+    else
+        RefitBvh();
+
+    m_bAllNodesDirty = false;
+    memset(m_dirtyNodes.data(), 0, m_dirtyNodes.size());
 
     //process skeletons, takes the skinning matrices from the scene and puts them into a buffer that the vertex shader will consume
     //
-    for (uint32_t i = 0; i < m_skins.size(); i++)
-    {
-        tfSkins &skin = m_skins[i];
 
-        //pick the matrices that affect the skin and multiply by the inverse of the bind      
-        math::Matrix4* pM = (math::Matrix4*)skin.m_InverseBindMatrices.m_data;
+    size_t jointCount = 0;
+    for (const tfSkins &skin : m_skins)
+    {
+        jointCount += skin.m_InverseBindMatrices.m_count;
+    }
 
-        std::vector<Matrix2> &skinningMats = m_worldSpaceSkeletonMats[i];
-        for (int j = 0; j < skin.m_InverseBindMatrices.m_count; j++)
+    // skins are independent, when there are enough joints they are spread across the ThreadPool
+    const size_t parallelJointCount = 1024;
+    if (m_skins.size() < 2 || jointCount < parallelJointCount)
+    {
+        for (uint32_t i = 0; i < m_skins.size(); i++)
         {
-            skinningMats[j].Set(m_worldSpaceMats[skin.m_jointsNodeIdx[j]].GetCurrent() * pM[j]);
+            UpdateSkinningMatrices(i);
         }
+        return;
+    }
+
+    Sync sync;
+    for (uint32_t i = 1; i < m_skins.size(); i++)
+    {
+        sync.Inc();
+        GetThreadPool()->AddJob([this, &sync, i]()
+        {
+            UpdateSkinningMatrices(i);
+            sync.Dec();
+        });
+    }
+
+    UpdateSkinningMatrices(0);
+    sync.Wait();
+}
+
+//
+// Multiplies the world matrices of the joints of a skin by their inverse bind matrices.
+// Only touches the data of that skin so different skins can be processed concurrently.
+//
+void GLTFCommon::UpdateSkinningMatrices(uint32_t skinIndex)
+{
+    const tfSkins &skin = m_skins[skinIndex];
+    std::vector<SkinningMatrix> &skinningMats = m_worldSpaceSkeletonMats.find(skinIndex)->second;
+
+    // skins whose joints didn't move are skipped
+    bool bChanged = false;
+    for (int j = 0; j < skin.m_InverseBindMatrices.m_count && !bChanged; j++)
+    {
+        bChanged = m_worldChanged[skin.m_jointsNodeIdx[j]] != 0;
+    }
+
+    if (!bChanged)
+        return;
+
+    ComputeSkinningMatrices(skinIndex, m_worldSpaceMats.data(), skinningMats.data());
+}
+
+//
+// Picks the world matrices of the joints of a skin (pWorldMats is indexed by node) and multiplies them by the
+// inverse of the bind, the results follow the m_jointsNodeIdx order.
+//
+void GLTFCommon::ComputeSkinningMatrices(uint32_t skinIndex, const Matrix2 *pWorldMats, SkinningMatrix *pSkinningMats) const
+{
+    const tfSkins &skin = m_skins[skinIndex];
+
+    //the buffer data is not guaranteed to be 16 byte aligned, hence the unaligned loads
+    const char *pIBM = (const char *)skin.m_InverseBindMatrices.m_data;
+    for (int j = 0; j < skin.m_InverseBindMatrices.m_count; j++, pIBM += skin.m_InverseBindMatrices.m_stride)
+    {
+        const float *pM = (const float *)pIBM;
+        math::Matrix4 inverseBind(
+            math::Vector4(_mm_loadu_ps(pM + 0)),
+            math::Vector4(_mm_loadu_ps(pM + 4)),
+            math::Vector4(_mm_loadu_ps(pM + 8)),
+            math::Vector4(_mm_loadu_ps(pM + 12)));
+
+        pSkinningMats[j].Set(pWorldMats[skin.m_jointsNodeIdx[j]].GetCurrent() * inverseBind);
     }
 }
 
@@ -664,6 +2429,9 @@ per_frame* GLTFCommon::SetPerFrameData(const Camera& cam)
             pSL->shadowMapIndex = -1;
     }
 
+    if (m_occlusionCulling)
+        RenderOccluders(m_perFrameData.mCameraCurrViewProj);
+
     return &m_perFrameData;
 }
 
@@ -673,6 +2441,7 @@ tfNodeIdx GLTFCommon::AddNode(const tfNode& node)
     m_nodes.push_back(node);
     tfNodeIdx idx = (tfNodeIdx)(m_nodes.size() - 1);
     m_scenes[0].m_nodes.push_back(idx);
+    FlattenScene(&m_scenes[0]);
     
     m_animatedMats.push_back(node.m_transform.GetWorldMat());
 
@@ -690,6 +2459,19 @@ int GLTFCommon::AddLight(const tfNode& node, const tfLight& light)
     return lightInstanceID;
 }
 
+static bool IsBoxInside(const AxisAlignedBoundingBox &inner, const AxisAlignedBoundingBox &outer)
+{
+    if (outer.m_isEmpty)
+        return false;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (inner.m_min.getElem(axis) < outer.m_min.getElem(axis) || inner.m_max.getElem(axis) > outer.m_max.getElem(axis))
+            return false;
+    }
+    return true;
+}
+
 //
 // Computes the orthographic matrix for a directional light in order to cover the whole scene
 //
@@ -697,20 +2479,43 @@ math::Matrix4 GLTFCommon::ComputeDirectionalLightOrthographicMatrix(const math::
 
     AxisAlignedBoundingBox projectedBoundingBox;
 
-    // NOTE: we consider all objects here, but the scene might not display all of them.
-    for (uint32_t i = 0; i < m_nodes.size(); ++i)
+    // the primitives of the transformed scene are walked through the BVH, a subtree whose box is already inside the
+    // projected box can't grow it so it is skipped
+    std::vector<uint32_t> stack;
+    if (!m_bvhNodes.empty())
+        stack.push_back(0);
+
+    while (!stack.empty())
     {
-        tfNode* pNode = &m_nodes.at(i);
-        if ((pNode == NULL) || (pNode->meshIndex < 0))
+        const tfBvhNode &node = m_bvhNodes[stack.back()];
+        stack.pop_back();
+
+        math::Vector4 center = (node.m_min + node.m_max) * 0.5f;
+        center.setW(1.0f);
+        AxisAlignedBoundingBox nodeBox = TransformBoundingBox(mLightView, center, node.m_max - center);
+        if (IsBoxInside(nodeBox, projectedBoundingBox))
             continue;
 
-        std::vector<tfPrimitives>& primitives = m_meshes[pNode->meshIndex].m_pPrimitives;
-        // loop through primitives
-        //
-        for (size_t p = 0; p < primitives.size(); ++p)
+        if (node.m_left != 0)
+        {
+            stack.push_back(node.m_left + 1);
+            stack.push_back(node.m_left);
+            continue;
+        }
+
+        for (uint32_t i = node.m_firstItem; i < node.m_firstItem + node.m_itemCount; i++)
         {
-            tfPrimitives boundingBox = m_meshes[pNode->meshIndex].m_pPrimitives[p];
-            projectedBoundingBox.Merge(GetAABBInGivenSpace(mLightView * m_worldSpaceMats[i].GetCurrent(), boundingBox.m_center, boundingBox.m_radius));
+            const tfBvhItem &item = m_bvhItems[i];
+            if (item.m_primitive < 0)
+            {
+                math::Vector4 itemCenter(m_bvhItemBoxes.m_center[0][i], m_bvhItemBoxes.m_center[1][i], m_bvhItemBoxes.m_center[2][i], 1.0f);
+                math::Vector4 itemExtent(m_bvhItemBoxes.m_extent[0][i], m_bvhItemBoxes.m_extent[1][i], m_bvhItemBoxes.m_extent[2][i], 0.0f);
+                projectedBoundingBox.Merge(TransformBoundingBox(mLightView, itemCenter, itemExtent));
+                continue;
+            }
+
+            const tfPrimitives &boundingBox = m_meshes[m_nodes[item.m_node].meshIndex].m_pPrimitives[item.m_primitive];
+            projectedBoundingBox.Merge(TransformBoundingBox(mLightView * m_worldSpaceMats[item.m_node].GetCurrent(), boundingBox.m_center, boundingBox.m_radius));
         }
     }
 
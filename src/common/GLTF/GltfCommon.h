@@ -20,6 +20,10 @@
 #pragma once
 #include "json.h"
 #include "../Misc/Camera.h"
+#include "../Misc/MemoryMappedFile.h"
+#include "../Misc/FrustumCulling.h"
+#include "../Misc/OcclusionCulling.h"
+#include "GltfPbrMaterial.h"
 #include "GltfStructures.h"
 
 // The GlTF file is loaded in 2 steps
@@ -51,6 +55,69 @@ public:
     math::Matrix4 GetPrevious() const { return m_previous; }
 };
 
+//
+// Skinning matrix as uploaded to the shaders, the bottom row of a joint matrix is always (0,0,0,1) so only
+// the first three rows are stored. That is 48 bytes per joint instead of the 128 bytes of a Matrix2, the
+// previous matrices are the palette uploaded the frame before, see GLTFTexturesAndBuffers.
+//
+class SkinningMatrix
+{
+    math::Vector4 m_rows[3];
+public:
+    void Set(const math::Matrix4& m)
+    {
+        __m128 r0 = m.getCol0().get128();
+        __m128 r1 = m.getCol1().get128();
+        __m128 r2 = m.getCol2().get128();
+        __m128 r3 = m.getCol3().get128();
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        m_rows[0] = math::Vector4(r0);
+        m_rows[1] = math::Vector4(r1);
+        m_rows[2] = math::Vector4(r2);
+    }
+};
+
+//
+// Matrix of an instance as uploaded to the shaders, a per instance vertex stream with the first three rows of the current
+// and previous matrices like the skinning matrices. The matrix of the draw (see GetDrawMatrices()) is applied on top in
+// the shaders, for EXT_mesh_gpu_instancing it is the world matrix of the node and the instances hold their local matrix.
+//
+class InstanceMatrix
+{
+    math::Vector4 m_current[3];
+    math::Vector4 m_previous[3];
+
+    static void GetRows(const math::Matrix4& m, math::Vector4 *pRows)
+    {
+        __m128 r0 = m.getCol0().get128();
+        __m128 r1 = m.getCol1().get128();
+        __m128 r2 = m.getCol2().get128();
+        __m128 r3 = m.getCol3().get128();
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        pRows[0] = math::Vector4(r0);
+        pRows[1] = math::Vector4(r1);
+        pRows[2] = math::Vector4(r2);
+    }
+public:
+    void Set(const math::Matrix4& current, const math::Matrix4& previous)
+    {
+        GetRows(current, m_current);
+        GetRows(previous, m_previous);
+    }
+    void Set(const math::Matrix4& m) { Set(m, m); }
+    math::Matrix4 Get() const
+    {
+        __m128 c0 = m_current[0].get128();
+        __m128 c1 = m_current[1].get128();
+        __m128 c2 = m_current[2].get128();
+        __m128 c3 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        return math::Matrix4(math::Vector4(c0), math::Vector4(c1), math::Vector4(c2), math::Vector4(c3));
+    }
+};
+
 //
 // Structures holding the per frame constant buffer data. 
 //
@@ -99,6 +166,52 @@ struct per_frame
     float     lodBias = 0.0f;
 };
 
+//
+// Options that control how GLTFCommon::Load reads the files
+//
+struct GLTFLoadOptions
+{
+    // m_buffersData points straight into read-only mappings of the .glb/.bin files instead of heap copies,
+    // pages get loaded on demand and the peak memory usage during load is much lower
+    bool m_mapBuffers = false;
+
+    // meshes, materials, images, textures and samplers are converted into their typed structures while the json
+    // is being parsed, so the DOM never holds them. The rest of the DOM (j3) is released once loading is done.
+    bool m_streamingParse = false;
+
+    // buffers are read concurrently and independent sections are decoded as jobs on the ThreadPool,
+    // Load() still returns once everything is loaded so it must not be called from a ThreadPool job
+    bool m_parallelLoad = false;
+
+    // when set, the resolved scene and its buffers are loaded from this file if it is up to date with the glTF,
+    // otherwise the glTF is loaded as usual and the file is (re)written. See GltfCompiledScene.cpp
+    std::string m_compiledSceneFilename;
+
+    // animation curves are compressed when they are packed: keys that the interpolation of their neighbours
+    // reproduces within m_animationTolerance are removed and the rotation keys are quantized to 48 bits.
+    // Cubic spline tracks are kept as they are.
+    bool m_compressAnimations = false;
+    float m_animationTolerance = 0.0001f;
+
+    // the primitives of the static nodes (nodes that no animation moves, without skin, morph targets or instances) are
+    // transformed to the scene's space and merged by material into one mesh per scene. Every merged primitive is a chunk
+    // of about m_mergeChunkVertices vertices that are close to each other, so the chunks can still be culled.
+    // See GltfMeshMerge.cpp
+    bool m_mergeStaticMeshes = false;
+    uint32_t m_mergeChunkVertices = 65536;
+
+    // the triangles are reordered for the post-transform vertex cache and for less overdraw, the vertices are renumbered
+    // in the order they are used and the indices are narrowed to 16 bits when possible. The optimized streams are stored
+    // in the compiled scene. See GLTFCommon::OptimizeMeshes()
+    bool m_optimizeMeshes = false;
+
+    // the triangle lists are split into meshlets of at most m_meshletMaxVertices vertices and m_meshletMaxTriangles
+    // triangles, each with a bounding sphere and a backface cone for CullMeshlets(). See GltfMeshlets.cpp
+    bool m_buildMeshlets = false;
+    uint32_t m_meshletMaxVertices = 64;
+    uint32_t m_meshletMaxTriangles = 124;
+};
+
 //
 // GLTFCommon, common stuff that is API agnostic
 //
@@ -110,6 +223,10 @@ public:
     std::string m_path;
     std::vector<tfScene> m_scenes;
     std::vector<tfMesh> m_meshes;
+    std::vector<tfMaterial> m_materials;
+    std::vector<tfImage> m_images;
+    std::vector<tfTexture> m_textures;
+    std::vector<tfTextureSampler> m_textureSamplers;
     std::vector<tfSkins> m_skins;
     std::vector<tfLight> m_lights;
     std::vector<LightInstance> m_lightInstances;
@@ -118,37 +235,164 @@ public:
     std::vector<tfNode> m_nodes;
 
     std::vector<tfAnimation> m_animations;
-    std::vector<char *> m_buffersData;
+    std::vector<const char *> m_buffersData;
 
     const json *m_pAccessors;
     const json *m_pBufferViews;
 
-    std::vector<math::Matrix4> m_animatedMats;       // object space matrices of each node after being animated
+    // accessors and bufferViews resolved at load time, indexed by their glTF ids
+    std::vector<tfAccessor> m_accessors;
+    std::vector<tfBufferView> m_bufferViews;
 
     std::vector<Matrix2> m_worldSpaceMats;     // world space matrices of each node after processing the hierarchy
-    std::map<int, std::vector<Matrix2>> m_worldSpaceSkeletonMats; // skinning matrices, following the m_jointsNodeIdx order
+    std::map<int, std::vector<SkinningMatrix>> m_worldSpaceSkeletonMats; // skinning matrices, following the m_jointsNodeIdx order
+
+    // morph targets, indexed by the nodes whose mesh has targets
+    std::map<int, std::vector<float>> m_morphWeights;                   // current weights, set by the animations
+    std::map<int, std::vector<tfMorphedStream>> m_morphedStreams;       // vertices computed by MorphMeshes()
+
+    // local matrices of the instances of the nodes that use EXT_mesh_gpu_instancing, indexed by node
+    std::map<int, std::vector<InstanceMatrix>> m_nodeInstances;
+
+    // nodes that draw the same mesh without skin, morph targets, instances or blended materials are grouped into batches
+    // that are drawn by their first node with one instanced draw, the world matrices of the nodes being the instances
+    std::vector<std::vector<tfNodeIdx>> m_nodeBatches;
+    std::vector<int> m_nodeBatchIndex;      // batch of each node, -1 if the node is drawn on its own
+
+    // where the indices of the merged primitives come from, indexed by merged mesh and primitive, sorted by m_firstIndex
+    std::map<std::pair<int, int>, std::vector<tfMergedRange>> m_mergedRanges;
+
+    // primitives of the transformed scene sorted by the leaves of m_bvhNodes, rebuilt or refit by TransformScene()
+    std::vector<tfBvhItem> m_bvhItems;
+    std::vector<tfBvhNode> m_bvhNodes;
+
+    // CPU occlusion culling, SetPerFrameData() rasterizes the m_maxOccluders largest opaque primitives in view and
+    // CullPrimitives() then also drops the items that are hidden behind them for the camera of that frame
+    bool m_occlusionCulling = false;
+    uint32_t m_maxOccluders = 64;
 
     per_frame m_perFrameData;
 
-    bool Load(const std::string &path, const std::string &filename);
+    bool Load(const std::string &path, const std::string &filename, const GLTFLoadOptions &options = GLTFLoadOptions());
     void Unload();
 
     // misc functions
     int FindMeshSkinId(int meshId) const;
     int GetInverseBindMatricesBufferSizeByID(int id) const;
+    const tfAccessor &GetAccessor(int accessor) const { return m_accessors[accessor]; }
     void GetBufferDetails(int accessor, tfAccessor *pAccessor) const;
     void GetAttributesAccessors(const json &gltfAttributes, std::vector<char*> *pStreamNames, std::vector<tfAccessor> *pAccessors) const;
+    bool GetBufferViewData(int bufferViewIdx, const char **ppData, size_t *pSize) const;
+    bool GetImageData(int imageIndex, const char **ppData, size_t *pSize) const;
 
     // transformation and animation functions
     void SetAnimationTime(uint32_t animationIndex, float time);
+    void SetAnimationLayers(const std::vector<tfAnimationLayer> &layers);
+    void EvaluateAnimation(uint32_t animationIndex, float time, math::Matrix4 *pMats);
     void TransformScene(int sceneIndex, const math::Matrix4& world);
+    // object space matrices of each node after being animated, only TransformScene() picks up the changes made through
+    // SetAnimatedMatrix()
+    const std::vector<math::Matrix4> &GetAnimatedMatrices() const { return m_animatedMats; }
+    void SetAnimatedMatrix(tfNodeIdx nodeIdx, const math::Matrix4 &mat);
+    void ComputeSkinningMatrices(uint32_t skinIndex, const Matrix2 *pWorldMats, SkinningMatrix *pSkinningMats) const;
+    void MorphMeshes();
+    bool IsMeshInstanced(int meshIndex) const;
+    bool IsNodeInstanced(int nodeIndex) const;
+    bool IsNodeBatched(int nodeIndex) const { return nodeIndex < (int)m_nodeBatchIndex.size() && m_nodeBatchIndex[nodeIndex] >= 0; }
+    uint32_t GetNodeInstanceCount(int nodeIndex) const;
+    uint32_t CullInstances(int nodeIndex, const math::Matrix4 &mCameraViewProj, InstanceMatrix *pVisible) const;
+    const Matrix2 &GetDrawMatrices(int nodeIndex) const;
+    const tfMergedRange *GetMergedSource(int meshIndex, int primitiveIndex, uint32_t triangle) const;
+    uint32_t CullMeshlets(int nodeIndex, int primitiveIndex, const per_frame &perFrame, uint32_t *pVisible) const;
+    void CullPrimitives(const math::Matrix4 &mCameraViewProj, std::vector<tfBvhRange> *pVisible) const;
+    void RenderOccluders(const math::Matrix4 &mCameraViewProj);
     per_frame *SetPerFrameData(const Camera& cam);
     bool GetCamera(uint32_t cameraIdx, Camera *pCam) const;
     tfNodeIdx AddNode(const tfNode& node);
     int AddLight(const tfNode& node, const tfLight& light);
 
 private:
+    // storage backing m_buffersData, either heap allocations or file mappings
+    std::vector<char *> m_allocatedData;
+    std::vector<MemoryMappedFile *> m_mappedFiles;
+    std::vector<uint64_t> m_generatedBufferSizes;  // buffers appended to m_buffersData after the glTF ones, see OptimizeMeshes()
+
+    // world matrices of the nodes of the last transformed scene, in the flattened order
+    std::vector<math::Matrix4> m_flatWorldMats;
+
+    std::vector<math::Matrix4> m_animatedMats;       // object space matrices of each node after being animated
+
+    // incremental transforms, TransformScene() only recomputes the dirty nodes and their subtrees
+    std::vector<uint8_t> m_dirtyNodes;      // m_animatedMats changed since the last TransformScene()
+    std::vector<uint8_t> m_worldChanged;    // world matrix changed in the last TransformScene()
+    std::vector<uint8_t> m_flatDirty;       // dirty nodes and subtrees of the current TransformScene(), in the flattened order
+    std::vector<tfNodeIdx> m_movedNodes;    // nodes whose world matrix was recomputed by the last TransformScene()
+    bool m_bAllNodesDirty = true;
+    bool m_compressAnimations = false;
+    float m_animationTolerance = 0.0f;
+
+    // scratch of SetAnimationLayers(), the blended poses (indexed by node) and the nodes touched by the layers
+    std::vector<tfPose> m_layerPoses;
+    std::vector<tfNodeIdx> m_layerNodes;
+    std::vector<uint8_t> m_layerNodeMask;
+
+    // keys found by the last lookups of the animations played by this GLTFCommon, per animation: one per track of the
+    // packed animation and one per "weights" channel, in the order of m_channels. See FindKeyFromCursor().
+    std::vector<std::vector<int>> m_trackCursors;
+    std::vector<std::vector<int>> m_weightCursors;
+
+    // weights of the morphed nodes when no animation drives them, from the node or else from its mesh
+    std::map<int, std::vector<float>> m_defaultMorphWeights;
+    Matrix2 m_identityMats;                 // draw matrices of the batches, their instances are the world matrices
+    // world bounds of the m_bvhItems, the leaf holding each of them and the scratch of RefitBvh()
+    BoundingBoxArrays m_bvhItemBoxes;
+    std::vector<uint32_t> m_bvhItemLeaves;
+    std::vector<uint8_t> m_bvhNodeDirty;
+    std::vector<uint32_t> m_bvhRefitNodes;
+    std::vector<uint8_t> m_bvhItemDirty;
+    std::vector<uint32_t> m_bvhRefitItems;
+    // items moved by each node, m_bvhNodeItems[m_bvhNodeItemStart[node], m_bvhNodeItemStart[node + 1]), the item of a
+    // batch is moved by all its nodes
+    std::vector<uint32_t> m_bvhNodeItemStart;
+    std::vector<uint32_t> m_bvhNodeItems;
+    // occluder meshes indexed by mesh and primitive, built when the primitive is first picked as an occluder
+    std::map<std::pair<int, int>, tfOccluderMesh> m_occluderMeshes;
+    OcclusionBuffer m_occlusionBuffer;
+    int m_transformedScene = -1;
+    math::Matrix4 m_transformedWorld;
+
+    const char *LoadFileData(const std::string &filename, bool bMap, size_t *pSize);
+    const char *LoadDataUri(const std::string &uri, size_t *pSize);
+    bool LoadTypedElement(const std::string &arrayName, const json &element);
+    bool LoadBuffer(int i, const json &buffer, const char *pBinChunk, bool bMap);
+    void LoadLights(const json &root);
+    void LoadCameras(const json &root);
+    void LoadNodes(const json &root);
+    void LoadScenes(const json &root);
+    void LoadSkins(const json &root);
+    void LoadInstances(const json &root);
+    void LoadAnimation(const json &animation, tfAnimation *tfanim);
+    bool DecodeMeshoptBufferViews(bool bParallel);
+    void ResolveAccessors(bool bParallel);
+    void ResolveAccessor(const json &inAccessor, tfAccessor *pAccessor) const;
+    void DecodeSparseAccessors();
+    void LoadMorphTargets();
+    void ComputePrimitiveBounds();
+    void OptimizeMeshes(bool bParallel);
+    void BatchNodes();
+    void MergeStaticMeshes(uint32_t chunkVertices);
+    void BuildMeshlets(bool bParallel, uint32_t maxVertices, uint32_t maxTriangles);
+    AxisAlignedBoundingBox GetBvhItemBounds(const tfBvhItem &item) const;
+    void BuildBvh();
+    void RefitBvh();
+    const tfOccluderMesh &GetOccluderMesh(int meshIndex, int primitiveIndex);
+    bool LoadCompiledScene(const std::string &cacheFilename, size_t sourceKey);
+    bool SaveCompiledScene(const std::string &cacheFilename, const std::string &filename, size_t sourceKey) const;
     void InitTransformedData(); //this is called after loading the data from the GLTF
-    void TransformNodes(const math::Matrix4& world, const std::vector<tfNodeIdx> *pNodes);
+    void FlattenScene(tfScene *pScene) const;
+    void UpdateSkinningMatrices(uint32_t skinIndex);
+    int *GetTrackCursors(uint32_t animationIndex);
+    void BlendMorphWeights(uint32_t animationIndex, float time, float weight, bool bAdditive);
+    void TransformFlatNodes(const tfScene &scene, const math::Matrix4& world, uint32_t first, uint32_t last, std::vector<tfNodeIdx> *pMovedNodes);
     math::Matrix4 ComputeDirectionalLightOrthographicMatrix(const math::Matrix4& mLightView);
 };
@@ -0,0 +1,814 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "GltfCommon.h"
+#include "Misc/Misc.h"
+#include "Misc/Hash.h"
+
+//
+// Compiled scene, the fully resolved GLTFCommon state in a single file:
+//
+//     CompiledSceneHeader
+//     dependencies (files the scene was compiled from, with their size and last write time)
+//     buffer ranges, bufferViews, accessors, meshes, materials, images, textures, samplers,
+//     nodes, scenes, skins, animations, lights, light instances, cameras, images decoded from data URIs
+//     buffers and dense copies of the sparse accessors (16 byte aligned)
+//
+// The file is mapped as a whole, m_buffersData and the decoded accessors point straight into the mapping. Structures
+// without pointers are stored as raw memory, pointers into the buffers are stored as offsets from the start of the
+// buffers and fixed up on load. The work done on the loaded data is stored too: the decoded sparse accessors, the morph
+// target deltas and the packed animations. The maps and strings are still read element by element, and
+// InitTransformedData() sets up the runtime state as after a regular load.
+//
+static const uint32_t COMPILED_SCENE_MAGIC = 0x4E435343;    // "CSCN"
+static const uint32_t COMPILED_SCENE_VERSION = 6;           // bump this every time the layout of the file changes
+static const uint64_t NULL_OFFSET = ~0ull;
+
+struct CompiledSceneHeader
+{
+    uint32_t m_magic;
+    uint32_t m_version;
+    uint64_t m_layoutKey;       // sizes of the structures that are stored as raw memory
+    uint64_t m_sourceKey;       // hash of the glTF json, see GLTFCommon::Load()
+    uint64_t m_buffersOffset;
+    uint64_t m_fileSize;
+};
+
+static uint64_t GetLayoutKey()
+{
+    size_t result = HashInt(sizeof(void *));
+    result = HashInt(sizeof(tfBufferView), result);
+    result = HashInt(sizeof(tfAccessor), result);
+    result = HashInt(sizeof(tfTexture), result);
+    result = HashInt(sizeof(tfTextureSampler), result);
+    result = HashInt(sizeof(Transform), result);
+    result = HashInt(sizeof(tfLight), result);
+    result = HashInt(sizeof(InstanceMatrix), result);
+    result = HashInt(sizeof(LightInstance), result);
+    result = HashInt(sizeof(tfCamera), result);
+    result = HashInt(sizeof(PBRMaterialParametersConstantBuffer), result);
+    result = HashInt(sizeof(tfPackedTrack), result);
+    return result;
+}
+
+static bool GetFileStamp(const std::string &filename, uint64_t *pSize, uint64_t *pWriteTime)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes))
+        return false;
+
+    *pSize = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    *pWriteTime = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+struct CompiledSceneBuffer
+{
+    const char *m_pData;
+    uint64_t m_size;
+    uint64_t m_offset;          // from the start of the buffers
+};
+
+class CompiledSceneWriter
+{
+public:
+    CompiledSceneWriter(std::ofstream *pFile, const std::vector<CompiledSceneBuffer> &buffers) : m_pFile(pFile), m_buffers(buffers) {}
+
+    void Write(const void *pData, size_t size)
+    {
+        m_pFile->write((const char *)pData, size);
+        m_offset += size;
+    }
+
+    template<typename T> void Write(const T &value)
+    {
+        Write(&value, sizeof(T));
+    }
+
+    void WriteString(const std::string &str)
+    {
+        Write((uint32_t)str.size());
+        Write(str.data(), str.size());
+    }
+
+    // only for structures without pointers
+    template<typename T> void WriteArray(const std::vector<T> &values)
+    {
+        Write((uint32_t)values.size());
+        Write(values.data(), values.size() * sizeof(T));
+    }
+
+    void Align(uint64_t alignment)
+    {
+        static const char zeros[16] = {};
+        assert(alignment <= sizeof(zeros));
+        Write(zeros, (size_t)(AlignUp<uint64_t>(m_offset, alignment) - m_offset));
+    }
+
+    uint64_t GetOffset() const { return m_offset; }
+
+    const void *ToOffset(const void *ptr) const
+    {
+        if (ptr == NULL)
+            return (const void *)NULL_OFFSET;
+
+        for (const CompiledSceneBuffer &buffer : m_buffers)
+        {
+            if (ptr >= buffer.m_pData && ptr <= buffer.m_pData + buffer.m_size)
+                return (const void *)(buffer.m_offset + ((const char *)ptr - buffer.m_pData));
+        }
+
+        assert(!"pointer is not in any of the buffers");
+        return (const void *)NULL_OFFSET;
+    }
+
+    // the dense copies of the decoded accessors are written with the buffers, see SaveCompiledScene()
+    tfAccessor ToOffsets(tfAccessor accessor) const
+    {
+        accessor.m_data = ToOffset(accessor.m_data);
+        accessor.m_sparse.m_indices = ToOffset(accessor.m_sparse.m_indices);
+        accessor.m_sparse.m_values = ToOffset(accessor.m_sparse.m_values);
+        accessor.m_sparse.m_base = ToOffset(accessor.m_sparse.m_base);
+        return accessor;
+    }
+
+private:
+    std::ofstream *m_pFile;
+    const std::vector<CompiledSceneBuffer> &m_buffers;
+    uint64_t m_offset = 0;
+};
+
+class CompiledSceneReader
+{
+public:
+    CompiledSceneReader(const char *pData, size_t size) : m_pCurr(pData), m_pEnd(pData + size) {}
+
+    bool Read(void *pData, size_t size)
+    {
+        if (size > (size_t)(m_pEnd - m_pCurr))
+        {
+            m_bFailed = true;
+            memset(pData, 0, size);
+            return false;
+        }
+
+        memcpy(pData, m_pCurr, size);
+        m_pCurr += size;
+        return true;
+    }
+
+    template<typename T> T Read()
+    {
+        T value;
+        Read(&value, sizeof(T));
+        return value;
+    }
+
+    std::string ReadString()
+    {
+        uint32_t size = Read<uint32_t>();
+        if (size > (size_t)(m_pEnd - m_pCurr))
+        {
+            m_bFailed = true;
+            return std::string();
+        }
+
+        std::string str(m_pCurr, size);
+        m_pCurr += size;
+        return str;
+    }
+
+    template<typename T> void ReadArray(std::vector<T> *pValues)
+    {
+        uint32_t count = Read<uint32_t>();
+        if (count > (size_t)(m_pEnd - m_pCurr) / std::max<size_t>(sizeof(T), 1))
+        {
+            m_bFailed = true;
+            return;
+        }
+
+        pValues->resize(count);
+        Read(pValues->data(), count * sizeof(T));
+    }
+
+    // returns a pointer to the data instead of copying it
+    const char *ReadBytes(size_t size)
+    {
+        if (size > (size_t)(m_pEnd - m_pCurr))
+        {
+            m_bFailed = true;
+            return NULL;
+        }
+
+        const char *pData = m_pCurr;
+        m_pCurr += size;
+        return pData;
+    }
+
+    // the count of a list of elements that take at least one byte each
+    uint32_t ReadCount()
+    {
+        uint32_t count = Read<uint32_t>();
+        if (count > (size_t)(m_pEnd - m_pCurr))
+        {
+            m_bFailed = true;
+            return 0;
+        }
+        return count;
+    }
+
+    bool Failed() const { return m_bFailed; }
+
+private:
+    const char *m_pCurr;
+    const char *m_pEnd;
+    bool m_bFailed = false;
+};
+
+static const void *FromOffset(const void *offset, const char *pBuffers, uint64_t buffersSize)
+{
+    uint64_t o = (uint64_t)offset;
+    if (o == NULL_OFFSET || o > buffersSize)
+        return NULL;
+
+    return pBuffers + o;
+}
+
+static void FromOffsets(tfAccessor *pAccessor, const char *pBuffers, uint64_t buffersSize)
+{
+    pAccessor->m_data = FromOffset(pAccessor->m_data, pBuffers, buffersSize);
+    pAccessor->m_sparse.m_indices = FromOffset(pAccessor->m_sparse.m_indices, pBuffers, buffersSize);
+    pAccessor->m_sparse.m_values = FromOffset(pAccessor->m_sparse.m_values, pBuffers, buffersSize);
+    pAccessor->m_sparse.m_base = FromOffset(pAccessor->m_sparse.m_base, pBuffers, buffersSize);
+}
+
+//
+// Skins and samplers hold copies of their accessors, the ones that were sparse or had no bufferView are saved pointing
+// to the dense data DecodeSparseAccessors() made for the same accessor
+//
+static void FindDecodedAccessor(const std::vector<tfAccessor> &accessors, tfAccessor *pAccessor)
+{
+    if (pAccessor->m_data != NULL && pAccessor->m_sparse.m_count == 0)
+        return;
+
+    for (const tfAccessor &accessor : accessors)
+    {
+        if (accessor.m_sparse.m_decoded && accessor.m_sparse.m_base == pAccessor->m_data && accessor.m_sparse.m_values == pAccessor->m_sparse.m_values &&
+            accessor.m_count == pAccessor->m_count && accessor.m_stride == pAccessor->m_stride && accessor.m_componentType == pAccessor->m_componentType)
+        {
+            *pAccessor = accessor;
+            return;
+        }
+    }
+}
+
+//
+// Writes the current state, called at the end of Load() while the json is still around
+//
+bool GLTFCommon::SaveCompiledScene(const std::string &cacheFilename, const std::string &filename, size_t sourceKey) const
+{
+    Profile p("GLTFCommon::SaveCompiledScene");
+
+    // the source file and the external buffers
+    //
+    std::vector<std::string> dependencies = { filename };
+    std::vector<CompiledSceneBuffer> buffers(m_buffersData.size());
+
+    uint64_t buffersSize = 0;
+    auto it = j3.find("buffers");
+    if (it != j3.end())
+    {
+        const json &jsonBuffers = it.value();
+        for (int i = 0; i < jsonBuffers.size(); i++)
+        {
+            buffers[i].m_pData = m_buffersData[i];
+            buffers[i].m_size = jsonBuffers[i]["byteLength"].get<uint64_t>();
+            buffers[i].m_offset = buffersSize;
+            buffersSize = AlignUp<uint64_t>(buffersSize + buffers[i].m_size, 16);
+
+            // meshopt fallback buffers hold the decoded data, their uri is never read
+            auto uri = jsonBuffers[i].find("uri");
+            auto extensions = jsonBuffers[i].find("extensions");
+            bool bFallback = extensions != jsonBuffers[i].end() && extensions->value("EXT_meshopt_compression", json::object()).value("fallback", false);
+            if (uri != jsonBuffers[i].end() && uri->get_ref<const std::string &>().compare(0, 5, "data:") != 0 && !bFallback)
+                dependencies.push_back(uri->get<std::string>());
+        }
+    }
+
+    // buffers made while loading, i.e. the optimized meshes
+    const size_t firstGenerated = m_buffersData.size() - m_generatedBufferSizes.size();
+    for (size_t i = 0; i < m_generatedBufferSizes.size(); i++)
+    {
+        CompiledSceneBuffer &buffer = buffers[firstGenerated + i];
+        buffer.m_pData = m_buffersData[firstGenerated + i];
+        buffer.m_size = m_generatedBufferSizes[i];
+        buffer.m_offset = buffersSize;
+        buffersSize = AlignUp<uint64_t>(buffersSize + buffer.m_size, 16);
+    }
+
+    // dense copies of the sparse accessors and of the accessors without bufferView, they follow the buffers but aren't
+    // part of m_buffersData
+    const size_t bufferCount = buffers.size();
+    for (const tfAccessor &accessor : m_accessors)
+    {
+        if (!accessor.m_sparse.m_decoded)
+            continue;
+
+        CompiledSceneBuffer buffer;
+        buffer.m_pData = (const char *)accessor.m_data;
+        buffer.m_size = (uint64_t)accessor.m_count * accessor.m_stride;
+        buffer.m_offset = buffersSize;
+        buffers.push_back(buffer);
+        buffersSize = AlignUp<uint64_t>(buffersSize + buffer.m_size, 16);
+    }
+
+    std::ofstream file(cacheFilename, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        Trace(format("Can't write the compiled scene %s\n", cacheFilename.c_str()));
+        return false;
+    }
+
+    // the header is written last, a partially written file is never valid
+    //
+    CompiledSceneHeader header = {};
+    CompiledSceneWriter w(&file, buffers);
+    w.Write(header);
+
+    w.Write((uint32_t)dependencies.size());
+    for (const std::string &dependency : dependencies)
+    {
+        uint64_t size = 0, writeTime = 0;
+        GetFileStamp(m_path + dependency, &size, &writeTime);
+        w.WriteString(dependency);
+        w.Write(size);
+        w.Write(writeTime);
+    }
+
+    w.Write((uint32_t)bufferCount);
+    for (size_t i = 0; i < bufferCount; i++)
+    {
+        w.Write(buffers[i].m_offset);
+        w.Write(buffers[i].m_size);
+    }
+
+    std::vector<tfBufferView> bufferViews = m_bufferViews;
+    for (tfBufferView &bufferView : bufferViews)
+        bufferView.m_data = (const char *)w.ToOffset(bufferView.m_data);
+    w.WriteArray(bufferViews);
+
+    std::vector<tfAccessor> accessors(m_accessors.size());
+    for (int i = 0; i < m_accessors.size(); i++)
+        accessors[i] = w.ToOffsets(m_accessors[i]);
+    w.WriteArray(accessors);
+
+    w.Write((uint32_t)m_meshes.size());
+    for (const tfMesh &mesh : m_meshes)
+    {
+        w.Write((uint32_t)mesh.m_pPrimitives.size());
+        for (const tfPrimitives &primitive : mesh.m_pPrimitives)
+        {
+            w.Write(primitive.m_center);
+            w.Write(primitive.m_radius);
+            w.Write((uint32_t)primitive.m_attributes.size());
+            for (auto const &attribute : primitive.m_attributes)
+            {
+                w.WriteString(attribute.first);
+                w.Write(attribute.second);
+            }
+            w.Write(primitive.m_indices);
+            w.Write(primitive.m_material);
+            w.Write(primitive.m_mode);
+            w.Write((uint32_t)primitive.m_targets.size());
+            for (auto const &target : primitive.m_targets)
+            {
+                w.Write((uint32_t)target.size());
+                for (auto const &attribute : target)
+                {
+                    w.WriteString(attribute.first);
+                    w.Write(attribute.second);
+                }
+            }
+            for (const tfMorphTarget &target : primitive.m_morphTargets)
+            {
+                w.Write((uint32_t)target.m_attributes.size());
+                for (auto const &attribute : target.m_attributes)
+                {
+                    w.WriteString(attribute.first);
+                    w.WriteArray(attribute.second.m_indices);
+                    w.WriteArray(attribute.second.m_deltas);
+                }
+            }
+        }
+        w.WriteArray(mesh.m_weights);
+    }
+
+    w.Write((uint32_t)m_materials.size());
+    for (const tfMaterial &material : m_materials)
+    {
+        w.Write(material.m_doubleSided);
+        w.WriteString(material.m_alphaMode);
+        w.Write(material.m_alphaCutoff);
+        w.Write(material.m_metallicRoughness);
+        w.Write(material.m_specularGlossiness);
+        w.Write((uint32_t)material.m_textures.size());
+        for (auto const &texture : material.m_textures)
+        {
+            w.WriteString(texture.first);
+            w.Write(texture.second.m_index);
+            w.Write(texture.second.m_texCoord);
+        }
+
+        const PBRMaterialParameters &pbr = material.m_pbrMaterialParameters;
+        w.Write(pbr.m_doubleSided);
+        w.Write(pbr.m_blending);
+        w.Write((uint32_t)pbr.m_defines.size());
+        for (auto const &define : pbr.m_defines)
+        {
+            w.WriteString(define.first);
+            w.WriteString(define.second);
+        }
+        w.Write(pbr.m_params);
+    }
+
+    w.Write((uint32_t)m_images.size());
+    for (const tfImage &image : m_images)
+    {
+        w.WriteString(image.m_name);
+        w.WriteString(image.m_uri);
+        w.WriteString(image.m_mimeType);
+        w.Write(image.m_bufferView);
+    }
+
+    w.WriteArray(m_textures);
+    w.WriteArray(m_textureSamplers);
+
+    w.Write((uint32_t)m_nodes.size());
+    for (const tfNode &node : m_nodes)
+    {
+        w.WriteArray(node.m_children);
+        w.Write(node.skinIndex);
+        w.Write(node.meshIndex);
+        w.Write(node.channel);
+        w.Write(node.bIsJoint);
+        w.WriteString(node.m_name);
+        w.Write(node.m_transform);
+        w.WriteArray(node.m_weights);
+    }
+
+    w.Write((uint32_t)m_scenes.size());
+    for (const tfScene &scene : m_scenes)
+        w.WriteArray(scene.m_nodes);
+
+    w.Write((uint32_t)m_nodeInstances.size());
+    for (auto const &instances : m_nodeInstances)
+    {
+        w.Write(instances.first);
+        w.WriteArray(instances.second);
+    }
+
+    w.Write((uint32_t)m_skins.size());
+    for (const tfSkins &skin : m_skins)
+    {
+        tfAccessor inverseBindMatrices = skin.m_InverseBindMatrices;
+        FindDecodedAccessor(m_accessors, &inverseBindMatrices);
+        w.Write(w.ToOffsets(inverseBindMatrices));
+        w.Write((int)((skin.m_pSkeleton != NULL) ? skin.m_pSkeleton - m_nodes.data() : -1));
+        w.WriteArray(skin.m_jointsNodeIdx);
+    }
+
+    w.Write((uint32_t)m_animations.size());
+    for (const tfAnimation &animation : m_animations)
+    {
+        w.Write(animation.m_duration);
+        w.Write((uint32_t)animation.m_channels.size());
+        for (auto const &channel : animation.m_channels)
+        {
+            w.Write(channel.first);
+            for (const tfSampler *pSampler : { channel.second.m_pTranslation, channel.second.m_pRotation, channel.second.m_pScale, channel.second.m_pWeights })
+            {
+                w.Write(pSampler != NULL);
+                if (pSampler != NULL)
+                {
+                    tfAccessor time = pSampler->m_time;
+                    tfAccessor value = pSampler->m_value;
+                    FindDecodedAccessor(m_accessors, &time);
+                    FindDecodedAccessor(m_accessors, &value);
+                    w.Write(w.ToOffsets(time));
+                    w.Write(w.ToOffsets(value));
+                    w.Write((int)pSampler->m_interpolation);
+                }
+            }
+        }
+
+        const tfPackedAnimation &packed = animation.m_packed;
+        w.WriteArray(packed.m_nodes);
+        w.WriteArray(packed.m_tracks);
+        w.WriteArray(packed.m_defaults);
+        w.WriteArray(packed.m_times);
+        w.WriteArray(packed.m_values);
+        w.WriteArray(packed.m_rotations);
+    }
+
+    w.WriteArray(m_lights);
+    w.WriteArray(m_lightInstances);
+    w.WriteArray(m_cameras);
+
+    for (const tfImage &image : m_images)
+    {
+        w.Write((uint64_t)image.m_size);
+        if (image.m_data != NULL)
+            w.Write(image.m_data, image.m_size);
+    }
+
+    // buffers
+    //
+    w.Align(16);
+    header.m_buffersOffset = w.GetOffset();
+    for (const CompiledSceneBuffer &buffer : buffers)
+    {
+        w.Write(buffer.m_pData, (size_t)buffer.m_size);
+        w.Align(16);
+    }
+
+    header.m_magic = COMPILED_SCENE_MAGIC;
+    header.m_version = COMPILED_SCENE_VERSION;
+    header.m_layoutKey = GetLayoutKey();
+    header.m_sourceKey = sourceKey;
+    header.m_fileSize = w.GetOffset();
+
+    file.seekp(0);
+    file.write((const char *)&header, sizeof(header));
+
+    if (!file)
+    {
+        Trace(format("Can't write the compiled scene %s\n", cacheFilename.c_str()));
+        return false;
+    }
+
+    return true;
+}
+
+//
+// Maps a compiled scene, returns false and leaves the GLTFCommon empty if the file is missing, outdated or corrupt
+//
+bool GLTFCommon::LoadCompiledScene(const std::string &cacheFilename, size_t sourceKey)
+{
+    Profile p("GLTFCommon::LoadCompiledScene");
+
+    MemoryMappedFile *pFile = new MemoryMappedFile();
+    if (!pFile->Open(cacheFilename.c_str()))
+    {
+        delete pFile;
+        return false;
+    }
+    m_mappedFiles.push_back(pFile);
+
+    const char *pData = pFile->GetData();
+    size_t size = pFile->GetSize();
+
+    CompiledSceneHeader header;
+    if (size < sizeof(header))
+    {
+        Unload();
+        return false;
+    }
+    memcpy(&header, pData, sizeof(header));
+
+    if (header.m_magic != COMPILED_SCENE_MAGIC || header.m_version != COMPILED_SCENE_VERSION || header.m_layoutKey != GetLayoutKey() ||
+        header.m_sourceKey != sourceKey || header.m_fileSize != size || header.m_buffersOffset > size)
+    {
+        Unload();
+        return false;
+    }
+
+    const char *pBuffers = pData + header.m_buffersOffset;
+    uint64_t buffersSize = size - header.m_buffersOffset;
+
+    CompiledSceneReader r(pData + sizeof(header), (size_t)header.m_buffersOffset - sizeof(header));
+
+    // the scene is outdated if any of the files it was compiled from changed
+    //
+    uint32_t dependencyCount = r.ReadCount();
+    for (uint32_t i = 0; i < dependencyCount && !r.Failed(); i++)
+    {
+        std::string dependency = r.ReadString();
+        uint64_t dependencySize = r.Read<uint64_t>();
+        uint64_t writeTime = r.Read<uint64_t>();
+
+        uint64_t currentSize, currentWriteTime;
+        if (!GetFileStamp(m_path + dependency, &currentSize, &currentWriteTime) || currentSize != dependencySize || currentWriteTime != writeTime)
+        {
+            Unload();
+            return false;
+        }
+    }
+
+    m_buffersData.resize(r.ReadCount());
+    for (int i = 0; i < m_buffersData.size(); i++)
+    {
+        uint64_t offset = r.Read<uint64_t>();
+        uint64_t bufferSize = r.Read<uint64_t>();
+        if (offset + bufferSize > buffersSize)
+        {
+            Unload();
+            return false;
+        }
+        m_buffersData[i] = pBuffers + offset;
+    }
+
+    r.ReadArray(&m_bufferViews);
+    for (tfBufferView &bufferView : m_bufferViews)
+        bufferView.m_data = (const char *)FromOffset(bufferView.m_data, pBuffers, buffersSize);
+
+    r.ReadArray(&m_accessors);
+    for (tfAccessor &accessor : m_accessors)
+        FromOffsets(&accessor, pBuffers, buffersSize);
+
+    m_meshes.resize(r.ReadCount());
+    for (tfMesh &mesh : m_meshes)
+    {
+        mesh.m_pPrimitives.resize(r.ReadCount());
+        for (tfPrimitives &primitive : mesh.m_pPrimitives)
+        {
+            primitive.m_center = r.Read<math::Vector4>();
+            primitive.m_radius = r.Read<math::Vector4>();
+            uint32_t attributeCount = r.ReadCount();
+            for (uint32_t a = 0; a < attributeCount; a++)
+            {
+                std::string name = r.ReadString();
+                primitive.m_attributes[name] = r.Read<int>();
+            }
+            primitive.m_indices = r.Read<int>();
+            primitive.m_material = r.Read<int>();
+            primitive.m_mode = r.Read<int>();
+            primitive.m_targets.resize(r.ReadCount());
+            for (auto &target : primitive.m_targets)
+            {
+                uint32_t targetAttributeCount = r.ReadCount();
+                for (uint32_t a = 0; a < targetAttributeCount; a++)
+                {
+                    std::string name = r.ReadString();
+                    target[name] = r.Read<int>();
+                }
+            }
+            primitive.m_morphTargets.resize(primitive.m_targets.size());
+            for (tfMorphTarget &target : primitive.m_morphTargets)
+            {
+                uint32_t targetAttributeCount = r.ReadCount();
+                for (uint32_t a = 0; a < targetAttributeCount; a++)
+                {
+                    tfMorphDelta &delta = target.m_attributes[r.ReadString()];
+                    r.ReadArray(&delta.m_indices);
+                    r.ReadArray(&delta.m_deltas);
+                }
+            }
+        }
+        r.ReadArray(&mesh.m_weights);
+    }
+
+    m_materials.resize(r.ReadCount());
+    for (tfMaterial &material : m_materials)
+    {
+        material.m_doubleSided = r.Read<bool>();
+        material.m_alphaMode = r.ReadString();
+        material.m_alphaCutoff = r.Read<float>();
+        material.m_metallicRoughness = r.Read<bool>();
+        material.m_specularGlossiness = r.Read<bool>();
+        uint32_t textureCount = r.ReadCount();
+        for (uint32_t t = 0; t < textureCount; t++)
+        {
+            tfTextureRef *pRef = &material.m_textures[r.ReadString()];
+            pRef->m_index = r.Read<int>();
+            pRef->m_texCoord = r.Read<int>();
+        }
+
+        PBRMaterialParameters &pbr = material.m_pbrMaterialParameters;
+        pbr.m_doubleSided = r.Read<bool>();
+        pbr.m_blending = r.Read<bool>();
+        uint32_t defineCount = r.ReadCount();
+        for (uint32_t d = 0; d < defineCount; d++)
+        {
+            std::string name = r.ReadString();
+            pbr.m_defines[name] = r.ReadString();
+        }
+        pbr.m_params = r.Read<PBRMaterialParametersConstantBuffer>();
+    }
+
+    m_images.resize(r.ReadCount());
+    for (tfImage &image : m_images)
+    {
+        image.m_name = r.ReadString();
+        image.m_uri = r.ReadString();
+        image.m_mimeType = r.ReadString();
+        image.m_bufferView = r.Read<int>();
+    }
+
+    r.ReadArray(&m_textures);
+    r.ReadArray(&m_textureSamplers);
+
+    m_nodes.resize(r.ReadCount());
+    for (tfNode &node : m_nodes)
+    {
+        r.ReadArray(&node.m_children);
+        node.skinIndex = r.Read<int>();
+        node.meshIndex = r.Read<int>();
+        node.channel = r.Read<int>();
+        node.bIsJoint = r.Read<bool>();
+        node.m_name = r.ReadString();
+        node.m_transform = r.Read<Transform>();
+        r.ReadArray(&node.m_weights);
+    }
+
+    m_scenes.resize(r.ReadCount());
+    for (tfScene &scene : m_scenes)
+        r.ReadArray(&scene.m_nodes);
+
+    uint32_t instancedNodeCount = r.ReadCount();
+    for (uint32_t i = 0; i < instancedNodeCount && !r.Failed(); i++)
+    {
+        int node = r.Read<int>();
+        r.ReadArray(&m_nodeInstances[node]);
+    }
+
+    m_skins.resize(r.ReadCount());
+    for (tfSkins &skin : m_skins)
+    {
+        skin.m_InverseBindMatrices = r.Read<tfAccessor>();
+        FromOffsets(&skin.m_InverseBindMatrices, pBuffers, buffersSize);
+        int skeleton = r.Read<int>();
+        skin.m_pSkeleton = (skeleton >= 0 && skeleton < m_nodes.size()) ? &m_nodes[skeleton] : NULL;
+        r.ReadArray(&skin.m_jointsNodeIdx);
+    }
+
+    m_animations.resize(r.ReadCount());
+    for (tfAnimation &animation : m_animations)
+    {
+        animation.m_duration = r.Read<float>();
+        uint32_t channelCount = r.ReadCount();
+        for (uint32_t c = 0; c < channelCount; c++)
+        {
+            tfChannel *pChannel = &animation.m_channels[r.Read<int>()];
+            for (tfSampler **ppSampler : { &pChannel->m_pTranslation, &pChannel->m_pRotation, &pChannel->m_pScale, &pChannel->m_pWeights })
+            {
+                *ppSampler = NULL;
+                if (!r.Read<bool>())
+                    continue;
+
+                *ppSampler = new tfSampler();
+                (*ppSampler)->m_time = r.Read<tfAccessor>();
+                (*ppSampler)->m_value = r.Read<tfAccessor>();
+                (*ppSampler)->m_interpolation = (tfSampler::Interpolation)r.Read<int>();
+                FromOffsets(&(*ppSampler)->m_time, pBuffers, buffersSize);
+                FromOffsets(&(*ppSampler)->m_value, pBuffers, buffersSize);
+            }
+        }
+
+        tfPackedAnimation &packed = animation.m_packed;
+        r.ReadArray(&packed.m_nodes);
+        r.ReadArray(&packed.m_tracks);
+        r.ReadArray(&packed.m_defaults);
+        r.ReadArray(&packed.m_times);
+        r.ReadArray(&packed.m_values);
+        r.ReadArray(&packed.m_rotations);
+    }
+
+    r.ReadArray(&m_lights);
+    r.ReadArray(&m_lightInstances);
+    r.ReadArray(&m_cameras);
+
+    for (tfImage &image : m_images)
+    {
+        image.m_size = (size_t)r.Read<uint64_t>();
+        image.m_data = (image.m_size > 0) ? r.ReadBytes(image.m_size) : NULL;
+    }
+
+    // nothing read from the file has been dereferenced so far
+    if (r.Failed())
+    {
+        Trace(format("The compiled scene %s is corrupt\n", cacheFilename.c_str()));
+        Unload();
+        return false;
+    }
+
+    InitTransformedData();
+
+    return true;
+}
@@ -19,6 +19,8 @@
 
 #include "stdafx.h"
 #include "GltfHelpers.h"
+#include "GltfPbrMaterial.h"
+#include "GltfStructures.h"
 
 int GetFormatSize(int id)
 {
@@ -35,6 +37,99 @@ int GetFormatSize(int id)
     return -1;
 }
 
+//
+// Value of a normalized integer component as the GPU reads it (UNORM/SNORM), signed values are clamped to -1
+//
+float NormalizeComponent(float value, int componentType)
+{
+    switch (componentType)
+    {
+        case 5120: return std::max(value / 127.0f, -1.0f); //(BYTE)
+        case 5121: return value / 255.0f; //(UNSIGNED_BYTE)
+        case 5122: return std::max(value / 32767.0f, -1.0f); //(SHORT)
+        case 5123: return value / 65535.0f; //(UNSIGNED_SHORT)
+    }
+    return value;
+}
+
+static float GetComponent(const char *pData, int componentType, bool normalized)
+{
+    float value;
+    switch (componentType)
+    {
+        case 5120: value = *(const int8_t *)pData; break;
+        case 5121: value = *(const uint8_t *)pData; break;
+        case 5122: value = *(const int16_t *)pData; break;
+        case 5123: value = *(const uint16_t *)pData; break;
+        case 5124: value = (float)*(const int32_t *)pData; break;
+        case 5125: value = (float)*(const uint32_t *)pData; break;
+        default: return *(const float *)pData;
+    }
+    return normalized ? NormalizeComponent(value, componentType) : value;
+}
+
+//
+// Vertex buffers keep the elements 4 byte aligned, vec3 of 8 and 16 bit components are read as 4 component formats
+//
+int GetVertexStride(const tfAccessor &accessor)
+{
+    return (accessor.m_dimension * accessor.m_type + 3) & ~3;
+}
+
+//
+// Copies the elements of an accessor (interleaved or not) stride bytes apart, the padding is set to zero
+//
+void CopyAccessorElements(const tfAccessor &accessor, int stride, void *pOut)
+{
+    const int elementSize = accessor.m_dimension * accessor.m_type;
+    if (stride == elementSize && stride == accessor.m_stride)
+    {
+        memcpy(pOut, accessor.m_data, (size_t)accessor.m_count * stride);
+        return;
+    }
+
+    char *pDst = (char *)pOut;
+    const char *pSrc = (const char *)accessor.m_data;
+    for (int i = 0; i < accessor.m_count; i++, pDst += stride, pSrc += accessor.m_stride)
+    {
+        memcpy(pDst, pSrc, elementSize);
+        memset(pDst + elementSize, 0, stride - elementSize);
+    }
+}
+
+//
+// Converts the elements of an accessor to floats, m_count * m_dimension of them
+//
+void DequantizeAccessor(const tfAccessor &accessor, float *pOut)
+{
+    if (accessor.m_componentType == 5126 && accessor.m_stride == accessor.m_dimension * 4)
+    {
+        memcpy(pOut, accessor.m_data, (size_t)accessor.m_count * accessor.m_stride);
+        return;
+    }
+
+    const char *pSrc = (const char *)accessor.m_data;
+    for (int i = 0; i < accessor.m_count; i++, pSrc += accessor.m_stride)
+    {
+        for (int c = 0; c < accessor.m_dimension; c++)
+            *pOut++ = GetComponent(pSrc + c * accessor.m_type, accessor.m_componentType, accessor.m_normalized);
+    }
+}
+
+//
+// Element i of an index accessor, 8, 16 or 32 bit
+//
+uint32_t GetIndex(const tfAccessor &accessor, int i)
+{
+    const void *pIndex = accessor.Get(i);
+    switch (accessor.m_type)
+    {
+    case 1: return *(const uint8_t *)pIndex;
+    case 2: return *(const uint16_t *)pIndex;
+    default: return *(const uint32_t *)pIndex;
+    }
+}
+
 int GetDimensions(const std::string &str)
 {
     if (str == "SCALAR")    return  1;
@@ -24,8 +24,17 @@
 
 using json = nlohmann::json;
 
+class tfAccessor;
+
 int GetFormatSize(int id);
 int GetDimensions(const std::string &str);
+
+// KHR_mesh_quantization, vertex attributes can be 8 and 16 bit integers, normalized or not
+float NormalizeComponent(float value, int componentType);
+int GetVertexStride(const tfAccessor &accessor);
+void CopyAccessorElements(const tfAccessor &accessor, int stride, void *pOut);
+void DequantizeAccessor(const tfAccessor &accessor, float *pOut);
+uint32_t GetIndex(const tfAccessor &accessor, int i);
 void SplitGltfAttribute(std::string attribute, std::string *semanticName, uint32_t *semanticIndex);
 
 math::Vector4 GetVector(const json::array_t &accessor);
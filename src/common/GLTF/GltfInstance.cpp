@@ -0,0 +1,149 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "GltfInstance.h"
+#include "GltfAnimation.h"
+#include "Misc/Async.h"
+
+void GLTFInstance::OnCreate(const GLTFCommon *pGLTFCommon, int sceneIndex)
+{
+    m_pGLTFCommon = pGLTFCommon;
+    m_sceneIndex = sceneIndex;
+
+    // nodes that are not animated keep their rest transform
+    const std::vector<tfNode> &nodes = m_pGLTFCommon->m_nodes;
+    m_animatedMats.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        m_animatedMats[i] = nodes[i].m_transform.GetWorldMat();
+    }
+
+    m_worldSpaceMats.resize(nodes.size());
+
+    m_worldSpaceSkeletonMats.resize(m_pGLTFCommon->m_skins.size());
+    for (size_t i = 0; i < m_worldSpaceSkeletonMats.size(); i++)
+    {
+        m_worldSpaceSkeletonMats[i].resize(m_pGLTFCommon->m_skins[i].m_InverseBindMatrices.m_count);
+    }
+
+    m_cursors.resize(m_pGLTFCommon->m_animations.size());
+}
+
+void GLTFInstance::OnDestroy()
+{
+    m_animatedMats.clear();
+    m_worldSpaceMats.clear();
+    m_worldSpaceSkeletonMats.clear();
+    m_layers.clear();
+    m_cursors.clear();
+    m_pGLTFCommon = NULL;
+}
+
+void GLTFInstance::SetAnimationTime(uint32_t animationIndex, float time)
+{
+    m_layers.resize(1);
+    m_layers[0] = tfAnimationLayer();
+    m_layers[0].m_animationIndex = animationIndex;
+    m_layers[0].m_time = time;
+}
+
+//
+// Blends the animation layers into m_animatedMats, same as GLTFCommon::SetAnimationLayers() but on the calling thread
+// and with the cursors of the instance, the poses live in a per thread scratch so they don't take memory per instance.
+// The morph weights are not blended, see the comment of the class.
+//
+void GLTFInstance::Animate()
+{
+    static thread_local std::vector<tfPose> s_poses;
+    static thread_local std::vector<uint8_t> s_nodeMask;
+    static thread_local std::vector<tfNodeIdx> s_nodes;
+
+    const std::vector<tfAnimation> &animations = m_pGLTFCommon->m_animations;
+
+    s_poses.resize(m_animatedMats.size());
+    s_nodeMask.assign(m_animatedMats.size(), 0);
+    s_nodes.clear();
+
+    for (const tfAnimationLayer &layer : m_layers)
+    {
+        if (layer.m_animationIndex >= animations.size())
+            continue;
+
+        const tfPackedAnimation &packed = animations[layer.m_animationIndex].m_packed;
+        InitPackedAnimationPoses(packed, s_poses.data());
+
+        for (tfNodeIdx nodeIdx : packed.m_nodes)
+        {
+            if (s_nodeMask[nodeIdx] == 0)
+            {
+                s_nodeMask[nodeIdx] = 1;
+                s_nodes.push_back(nodeIdx);
+            }
+        }
+    }
+
+    for (const tfAnimationLayer &layer : m_layers)
+    {
+        if (layer.m_animationIndex >= animations.size())
+            continue;
+
+        const tfAnimation &anim = animations[layer.m_animationIndex];
+        std::vector<int> &cursors = m_cursors[layer.m_animationIndex];
+        cursors.resize(anim.m_packed.m_tracks.size());
+
+        const float time = fmod(layer.m_time, anim.m_duration);
+        BlendPackedAnimation(anim.m_packed, time, layer.m_weight, layer.m_additive, 0, anim.m_packed.m_nodes.size(), cursors.data(), s_poses.data());
+    }
+
+    ComposePoses(s_poses.data(), s_nodes.data(), s_nodes.size(), m_animatedMats.data());
+}
+
+void GLTFInstance::Update()
+{
+    if (!m_layers.empty())
+        Animate();
+
+    // the nodes of the scene are sorted by depth, so the parents are always transformed before their children
+    //
+    const tfScene &scene = m_pGLTFCommon->m_scenes[m_sceneIndex];
+    for (size_t i = 0; i < scene.m_flatNodes.size(); i++)
+    {
+        tfNodeIdx nodeIdx = scene.m_flatNodes[i];
+        int parent = scene.m_flatParents[i];
+
+        math::Matrix4 parentMat = (parent < 0) ? m_world : m_worldSpaceMats[scene.m_flatNodes[parent]].GetCurrent();
+        m_worldSpaceMats[nodeIdx].Set(parentMat * m_animatedMats[nodeIdx]);
+    }
+
+    for (uint32_t i = 0; i < m_worldSpaceSkeletonMats.size(); i++)
+    {
+        m_pGLTFCommon->ComputeSkinningMatrices(i, m_worldSpaceMats.data(), m_worldSpaceSkeletonMats[i].data());
+    }
+}
+
+void GLTFInstance::UpdateInstances(GLTFInstance *pInstances, size_t count)
+{
+    const size_t batchSize = 8;
+    ExecBatches(count, batchSize, [pInstances](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+            pInstances[i].Update();
+    });
+}
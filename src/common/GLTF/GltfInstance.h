@@ -0,0 +1,68 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#pragma once
+
+#include "GltfCommon.h"
+
+//
+// A lightweight copy of a glTF, to draw crowds of the same animated model.
+//
+// The GLTFCommon holds all the immutable data (buffers, hierarchy, skins and animations) and is shared by all its
+// instances, each instance only owns its state (world matrix, animation layers) and the matrices it produces, so
+// the memory grows with the number of nodes and joints, not with the size of the asset.
+// The instances don't modify the GLTFCommon, so many of them can be updated concurrently, see UpdateInstances().
+//
+// Only the node transforms are animated per instance, the "weights" channels are not sampled: the morph targets are
+// applied by the GLTFCommon into streams shared by all the draws of a node, so every instance of a morphed mesh shows
+// the weights of the GLTFCommon (see SetAnimationLayers() there).
+// No render pass consumes the instances yet, they produce matrices that the application draws with on its own.
+//
+class GLTFInstance
+{
+public:
+    std::vector<math::Matrix4> m_animatedMats;      // object space matrices of each node after being animated
+    std::vector<Matrix2> m_worldSpaceMats;          // world space matrices of each node after processing the hierarchy
+    std::vector<std::vector<SkinningMatrix>> m_worldSpaceSkeletonMats;  // skinning matrices of each skin, following the m_jointsNodeIdx order
+
+    void OnCreate(const GLTFCommon *pGLTFCommon, int sceneIndex = 0);
+    void OnDestroy();
+
+    void SetWorldMatrix(const math::Matrix4 &world) { m_world = world; }
+    void SetAnimationTime(uint32_t animationIndex, float time);
+    void SetAnimationLayers(const std::vector<tfAnimationLayer> &layers) { m_layers = layers; }
+
+    // animates the nodes, transforms the hierarchy and computes the skinning matrices
+    void Update();
+
+    // updates the instances in batches spread across the ThreadPool
+    static void UpdateInstances(GLTFInstance *pInstances, size_t count);
+
+    const GLTFCommon *GetGLTFCommon() const { return m_pGLTFCommon; }
+
+private:
+    const GLTFCommon *m_pGLTFCommon = NULL;
+    int m_sceneIndex = 0;
+    math::Matrix4 m_world = math::Matrix4::identity();
+    std::vector<tfAnimationLayer> m_layers;
+
+    // key found by the last lookup of each track, per animation, allocated when the animation is first played
+    std::vector<std::vector<int>> m_cursors;
+
+    void Animate();
+};
@@ -0,0 +1,412 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "GltfCommon.h"
+#include "GltfHelpers.h"
+#include "Misc/Misc.h"
+#include "Misc/Async.h"
+#include "Misc/FrustumCulling.h"
+
+//
+// Static mesh merging
+//
+// Scenes made of many small static nodes spend most of their time in per node work (building the batch lists,
+// binding and drawing every primitive). When GLTFLoadOptions::m_mergeStaticMeshes is set, the primitives of the
+// static nodes are transformed to the space of their scene and concatenated into new float vertex buffers and 32 bit
+// index buffers, one merged primitive per material and vertex format. A merged primitive is split in chunks of nearby
+// primitives so it can still be frustum culled.
+//
+// The merged primitives live in a new mesh drawn by a new root node of each scene, so TransformScene() still applies the
+// scene's world matrix to them. The source nodes are kept (their children, cameras and lights are unaffected) but their
+// meshIndex is set to -1, m_mergedRanges tells which node and primitive each range of merged indices came from.
+//
+
+struct MergeSource
+{
+    tfNodeIdx m_node;
+    int m_mesh;
+    int m_primitive;
+    math::Matrix4 m_world;      // node to scene transform
+    math::Vector4 m_center;     // center of the primitive's bounds, in scene space
+    uint32_t m_vertexCount;
+    uint32_t m_indexCount;
+};
+
+struct MergeChunk
+{
+    int m_mesh;                 // merged mesh and primitive
+    int m_primitive;
+    std::vector<MergeSource> m_sources;
+};
+
+//
+// Merged primitives are grouped by material and vertex format, primitives that can't be merged return an empty key.
+// Blended primitives are left alone since they need to be sorted one by one.
+//
+static std::string GetMergeKey(const GLTFCommon &gltf, const tfPrimitives &primitive)
+{
+    if (primitive.m_mode != 4 || !primitive.m_targets.empty() || primitive.m_attributes.find("POSITION") == primitive.m_attributes.end())
+        return std::string();
+
+    if (primitive.m_material >= 0 && gltf.m_materials[primitive.m_material].m_alphaMode == "BLEND")
+        return std::string();
+
+    std::string key = std::to_string(primitive.m_material);
+    for (auto const &attribute : primitive.m_attributes)
+    {
+        if (attribute.first.compare(0, 6, "JOINTS") == 0 || attribute.first.compare(0, 7, "WEIGHTS") == 0)
+            return std::string();
+
+        key += format(" %s%d", attribute.first.c_str(), gltf.GetAccessor(attribute.second).m_dimension);
+    }
+
+    return key;
+}
+
+//
+// Splits sources [first, last) at the median of the longest axis of their centers until the chunks have at most
+// chunkVertices vertices (or a single primitive)
+//
+static void SplitChunks(std::vector<MergeSource> &sources, size_t first, size_t last, uint32_t chunkVertices, std::vector<std::pair<size_t, size_t>> *pChunks)
+{
+    AxisAlignedBoundingBox bounds;
+    uint32_t vertexCount = 0;
+    for (size_t i = first; i < last; i++)
+    {
+        bounds.Grow(sources[i].m_center);
+        vertexCount += sources[i].m_vertexCount;
+    }
+
+    if (vertexCount <= chunkVertices || last - first == 1)
+    {
+        pChunks->push_back(std::make_pair(first, last));
+        return;
+    }
+
+    math::Vector4 size = bounds.m_max - bounds.m_min;
+    int axis = (size.getX() >= size.getY() && size.getX() >= size.getZ()) ? 0 : (size.getY() >= size.getZ() ? 1 : 2);
+
+    size_t middle = first + (last - first) / 2;
+    std::nth_element(sources.begin() + first, sources.begin() + middle, sources.begin() + last, [axis](const MergeSource &a, const MergeSource &b)
+    {
+        return a.m_center.getElem(axis) < b.m_center.getElem(axis);
+    });
+
+    SplitChunks(sources, first, middle, chunkVertices, pChunks);
+    SplitChunks(sources, middle, last, chunkVertices, pChunks);
+}
+
+void GLTFCommon::MergeStaticMeshes(uint32_t chunkVertices)
+{
+    Profile p("GLTFCommon::MergeStaticMeshes");
+
+    // nodes moved by the animations, their children move with them
+    std::vector<uint8_t> animated(m_nodes.size(), 0);
+    for (const tfAnimation &animation : m_animations)
+    {
+        for (auto const &channel : animation.m_channels)
+        {
+            if (channel.first < (int)m_nodes.size())
+                animated[channel.first] = 1;
+        }
+    }
+
+    // the merged mesh belongs to a single scene, nodes shared by several scenes are left alone
+    std::vector<int> sceneCount(m_nodes.size(), 0);
+    for (const tfScene &scene : m_scenes)
+    {
+        for (tfNodeIdx node : scene.m_flatNodes)
+            sceneCount[node]++;
+    }
+
+    std::vector<MergeChunk> chunks;
+    for (int s = 0; s < (int)m_scenes.size(); s++)
+    {
+        const tfScene &scene = m_scenes[s];
+
+        // scene space transforms, and whether the node or one of its parents is animated
+        std::vector<math::Matrix4> flatWorld(scene.m_flatNodes.size());
+        std::vector<uint8_t> flatAnimated(scene.m_flatNodes.size());
+
+        std::map<std::string, std::vector<MergeSource>> groups;
+        for (size_t i = 0; i < scene.m_flatNodes.size(); i++)
+        {
+            tfNodeIdx nodeIdx = scene.m_flatNodes[i];
+            const tfNode &node = m_nodes[nodeIdx];
+            int parent = scene.m_flatParents[i];
+
+            math::Matrix4 local = node.m_transform.GetWorldMat();
+            flatWorld[i] = (parent < 0) ? local : flatWorld[parent] * local;
+            flatAnimated[i] = animated[nodeIdx] || (parent >= 0 && flatAnimated[parent]);
+
+            if (node.meshIndex < 0 || flatAnimated[i] || sceneCount[nodeIdx] != 1 || node.skinIndex != -1 || node.bIsJoint)
+                continue;
+            if (m_morphWeights.find(nodeIdx) != m_morphWeights.end() || m_nodeInstances.find(nodeIdx) != m_nodeInstances.end())
+                continue;
+
+            // a node is merged as a whole, or not at all
+            const tfMesh &mesh = m_meshes[node.meshIndex];
+            std::vector<std::string> keys;
+            for (const tfPrimitives &primitive : mesh.m_pPrimitives)
+            {
+                keys.push_back(GetMergeKey(*this, primitive));
+                if (keys.back().empty())
+                    break;
+            }
+            if (keys.empty() || keys.back().empty())
+                continue;
+
+            for (int p = 0; p < (int)mesh.m_pPrimitives.size(); p++)
+            {
+                const tfPrimitives &primitive = mesh.m_pPrimitives[p];
+                AxisAlignedBoundingBox bounds = TransformBoundingBox(flatWorld[i], primitive.m_center, primitive.m_radius);
+
+                MergeSource source;
+                source.m_node = nodeIdx;
+                source.m_mesh = node.meshIndex;
+                source.m_primitive = p;
+                source.m_world = flatWorld[i];
+                source.m_center = (bounds.m_min + bounds.m_max) * 0.5f;
+                source.m_vertexCount = m_accessors[primitive.m_attributes.at("POSITION")].m_count;
+                source.m_indexCount = (primitive.m_indices >= 0) ? m_accessors[primitive.m_indices].m_count : source.m_vertexCount;
+                source.m_indexCount -= source.m_indexCount % 3;
+                groups[keys[p]].push_back(source);
+            }
+        }
+
+        if (groups.empty())
+            continue;
+
+        // the merged mesh and the root node that draws it
+        tfMesh mergedMesh;
+        int mergedMeshIndex = (int)m_meshes.size();
+        for (auto &group : groups)
+        {
+            std::vector<std::pair<size_t, size_t>> ranges;
+            SplitChunks(group.second, 0, group.second.size(), chunkVertices, &ranges);
+
+            const tfPrimitives &first = m_meshes[group.second[0].m_mesh].m_pPrimitives[group.second[0].m_primitive];
+            for (const std::pair<size_t, size_t> &range : ranges)
+            {
+                MergeChunk chunk;
+                chunk.m_mesh = mergedMeshIndex;
+                chunk.m_primitive = (int)mergedMesh.m_pPrimitives.size();
+                chunk.m_sources.assign(group.second.begin() + range.first, group.second.begin() + range.second);
+
+                uint32_t vertexCount = 0, indexCount = 0;
+                for (const MergeSource &source : chunk.m_sources)
+                {
+                    vertexCount += source.m_vertexCount;
+                    indexCount += source.m_indexCount;
+                }
+
+                // float attributes and 32 bit indices, the memory is released on Unload()
+                tfPrimitives merged;
+                merged.m_material = first.m_material;
+                merged.m_mode = first.m_mode;
+                for (auto const &attribute : first.m_attributes)
+                {
+                    tfAccessor accessor;
+                    accessor.m_count = vertexCount;
+                    accessor.m_dimension = m_accessors[attribute.second].m_dimension;
+                    accessor.m_type = 4;
+                    accessor.m_stride = accessor.m_dimension * 4;
+                    accessor.m_componentType = 5126;
+                    accessor.m_data = malloc((size_t)vertexCount * accessor.m_stride);
+                    m_allocatedData.push_back((char *)accessor.m_data);
+
+                    merged.m_attributes[attribute.first] = (int)m_accessors.size();
+                    m_accessors.push_back(accessor);
+                }
+
+                tfAccessor indices;
+                indices.m_count = indexCount;
+                indices.m_dimension = 1;
+                indices.m_type = 4;
+                indices.m_stride = 4;
+                indices.m_componentType = 5125;
+                indices.m_data = malloc((size_t)indexCount * 4);
+                m_allocatedData.push_back((char *)indices.m_data);
+
+                merged.m_indices = (int)m_accessors.size();
+                m_accessors.push_back(indices);
+
+                mergedMesh.m_pPrimitives.push_back(merged);
+                chunks.push_back(std::move(chunk));
+            }
+        }
+
+        // the merged nodes don't draw anything on their own anymore
+        for (auto const &group : groups)
+        {
+            for (const MergeSource &source : group.second)
+                m_nodes[source.m_node].meshIndex = -1;
+        }
+
+        m_meshes.push_back(std::move(mergedMesh));
+
+        tfNode mergedNode;
+        mergedNode.meshIndex = mergedMeshIndex;
+        mergedNode.m_name = "merged static meshes";
+        m_nodes.push_back(mergedNode);
+        m_scenes[s].m_nodes.push_back((tfNodeIdx)(m_nodes.size() - 1));
+    }
+
+    // the chunks write to their own buffers, fill them on the ThreadPool
+    //
+    std::vector<std::vector<tfMergedRange>> chunkRanges(chunks.size());
+    ExecBatches(chunks.size(), 1, [this, &chunks, &chunkRanges](size_t firstChunk, size_t lastChunk)
+    {
+        std::vector<float> scratch;
+        for (size_t c = firstChunk; c < lastChunk; c++)
+        {
+            const MergeChunk &chunk = chunks[c];
+            tfPrimitives &merged = m_meshes[chunk.m_mesh].m_pPrimitives[chunk.m_primitive];
+            uint32_t *pIndices = (uint32_t *)m_accessors[merged.m_indices].m_data;
+
+            AxisAlignedBoundingBox bounds;
+            uint32_t firstVertex = 0, firstIndex = 0;
+            for (const MergeSource &source : chunk.m_sources)
+            {
+                const tfPrimitives &primitive = m_meshes[source.m_mesh].m_pPrimitives[source.m_primitive];
+
+                // normals go through the inverse transpose, mirroring transforms flip the winding and the bitangents
+                math::Matrix3 world3x3 = source.m_world.getUpper3x3();
+                math::Matrix3 normalMatrix = transpose(inverse(world3x3));
+                bool bMirrored = determinant(world3x3) < 0.0f;
+
+                for (auto const &attribute : primitive.m_attributes)
+                {
+                    const tfAccessor &src = m_accessors[attribute.second];
+                    tfAccessor &dst = m_accessors[merged.m_attributes.at(attribute.first)];
+
+                    scratch.resize((size_t)src.m_count * src.m_dimension);
+                    DequantizeAccessor(src, scratch.data());
+
+                    float *pDst = (float *)dst.m_data + (size_t)firstVertex * dst.m_dimension;
+                    if (attribute.first == "POSITION")
+                    {
+                        for (int v = 0; v < src.m_count; v++)
+                        {
+                            const float *pSrc = &scratch[v * 3];
+                            math::Vector4 position = source.m_world * math::Point3(pSrc[0], pSrc[1], pSrc[2]);
+                            pDst[v * 3 + 0] = position.getX();
+                            pDst[v * 3 + 1] = position.getY();
+                            pDst[v * 3 + 2] = position.getZ();
+                            bounds.Grow(math::Vector4(position.getXYZ(), 1.0f));
+                        }
+                    }
+                    else if (attribute.first == "NORMAL" || attribute.first == "TANGENT")
+                    {
+                        const bool bTangent = attribute.first == "TANGENT";
+                        const int dimension = src.m_dimension;
+                        for (int v = 0; v < src.m_count; v++)
+                        {
+                            const float *pSrc = &scratch[v * dimension];
+                            math::Vector3 direction(pSrc[0], pSrc[1], pSrc[2]);
+                            direction = bTangent ? world3x3 * direction : normalMatrix * direction;
+                            float directionLength = length(direction);
+                            if (directionLength > 0.0f)
+                                direction /= directionLength;
+
+                            pDst[v * dimension + 0] = direction.getX();
+                            pDst[v * dimension + 1] = direction.getY();
+                            pDst[v * dimension + 2] = direction.getZ();
+                            if (dimension == 4)
+                                pDst[v * dimension + 3] = bMirrored ? -pSrc[3] : pSrc[3];
+                        }
+                    }
+                    else
+                    {
+                        memcpy(pDst, scratch.data(), scratch.size() * sizeof(float));
+                    }
+                }
+
+                for (uint32_t i = 0; i < source.m_indexCount; i += 3)
+                {
+                    uint32_t triangle[3];
+                    for (uint32_t k = 0; k < 3; k++)
+                        triangle[k] = (primitive.m_indices >= 0) ? GetIndex(m_accessors[primitive.m_indices], i + k) : i + k;
+
+                    pIndices[firstIndex + i + 0] = firstVertex + triangle[0];
+                    pIndices[firstIndex + i + 1] = firstVertex + triangle[bMirrored ? 2 : 1];
+                    pIndices[firstIndex + i + 2] = firstVertex + triangle[bMirrored ? 1 : 2];
+                }
+
+                tfMergedRange range;
+                range.m_node = source.m_node;
+                range.m_mesh = source.m_mesh;
+                range.m_primitive = source.m_primitive;
+                range.m_firstIndex = firstIndex;
+                range.m_indexCount = source.m_indexCount;
+                chunkRanges[c].push_back(range);
+
+                firstVertex += source.m_vertexCount;
+                firstIndex += source.m_indexCount;
+            }
+
+            tfAccessor &positions = m_accessors[merged.m_attributes.at("POSITION")];
+            positions.m_min = bounds.m_min;
+            positions.m_max = bounds.m_max;
+
+            merged.m_center = math::Vector4(((bounds.m_min + bounds.m_max) * 0.5f).getXYZ(), 1.0f);
+            merged.m_radius = math::Vector4((bounds.m_max - merged.m_center).getXYZ(), 0.0f);
+        }
+    });
+
+    for (size_t c = 0; c < chunks.size(); c++)
+        m_mergedRanges[std::make_pair(chunks[c].m_mesh, chunks[c].m_primitive)] = std::move(chunkRanges[c]);
+
+    // the meshes no node draws anymore are flagged so the passes don't upload them or build their pipelines, their
+    // primitives stay since m_mergedRanges refers to them by index
+    std::vector<uint8_t> usedMeshes(m_meshes.size(), 0);
+    for (const tfNode &node : m_nodes)
+    {
+        if (node.meshIndex >= 0)
+            usedMeshes[node.meshIndex] = 1;
+    }
+    for (size_t i = 0; i < m_meshes.size(); i++)
+    {
+        if (!usedMeshes[i])
+            m_meshes[i].m_mergedAway = true;
+    }
+
+    // the new nodes need their matrices, and the batches the new meshIndex of the merged nodes
+    InitTransformedData();
+}
+
+//
+// Node and primitive a triangle of a merged primitive came from, NULL if the primitive is not a merged one
+//
+const tfMergedRange *GLTFCommon::GetMergedSource(int meshIndex, int primitiveIndex, uint32_t triangle) const
+{
+    auto it = m_mergedRanges.find(std::make_pair(meshIndex, primitiveIndex));
+    if (it == m_mergedRanges.end())
+        return NULL;
+
+    const uint32_t index = triangle * 3;
+    const std::vector<tfMergedRange> &ranges = it->second;
+    auto range = std::upper_bound(ranges.begin(), ranges.end(), index, [](uint32_t i, const tfMergedRange &r) { return i < r.m_firstIndex; });
+    if (range == ranges.begin())
+        return NULL;
+
+    --range;
+    return (index < range->m_firstIndex + range->m_indexCount) ? &*range : NULL;
+}
@@ -0,0 +1,286 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "GltfCommon.h"
+#include "GltfHelpers.h"
+#include "Misc/Misc.h"
+#include "Misc/Async.h"
+#include "Misc/FrustumCulling.h"
+
+//
+// Meshlets
+//
+// The primitives only have one bounding box, so a primitive that is partly visible is drawn whole. When
+// GLTFLoadOptions::m_buildMeshlets is set the triangle lists are also cut into meshlets, runs of consecutive triangles
+// that use at most maxVertices vertices and maxTriangles triangles (the usual mesh shader limits). Consecutive triangles
+// are close to each other once the indices are ordered for the vertex cache (GLTFLoadOptions::m_optimizeMeshes), which
+// makes for tighter meshlets.
+//
+// Every meshlet has a bounding sphere for frustum culling and a backface cone: all its triangles face away from a
+// camera that is in the cone with its tip at m_coneApex, opening along -m_coneAxis, that is when
+//
+//      dot(normalize(m_coneApex - camera), m_coneAxis) > cutoff
+//
+// where cutoff is the sine of the largest angle between the normals of the triangles and the axis.
+//
+
+static math::Vector3 GetPosition(const std::vector<float> &positions, uint32_t vertex)
+{
+    return math::Vector3(positions[vertex * 3 + 0], positions[vertex * 3 + 1], positions[vertex * 3 + 2]);
+}
+
+static void ComputeMeshletBounds(const tfPrimitives &primitive, const std::vector<float> &positions, tfMeshlet *pMeshlet)
+{
+    const uint32_t *pVertices = &primitive.m_meshletVertices[pMeshlet->m_firstVertex];
+    const uint8_t *pTriangles = &primitive.m_meshletTriangles[pMeshlet->m_firstTriangle * 3];
+
+    // sphere around the center of the bounding box
+    AxisAlignedBoundingBox box;
+    for (uint32_t v = 0; v < pMeshlet->m_vertexCount; v++)
+        box.Grow(math::Vector4(GetPosition(positions, pVertices[v]), 1.0f));
+
+    math::Vector3 center = ((box.m_min + box.m_max) * 0.5f).getXYZ();
+    float radius = 0.0f;
+    for (uint32_t v = 0; v < pMeshlet->m_vertexCount; v++)
+        radius = std::max(radius, (float)length(GetPosition(positions, pVertices[v]) - center));
+
+    pMeshlet->m_sphere = math::Vector4(center, radius);
+
+    // the axis of the cone is the average of the normals, the degenerate triangles have no normal and are ignored
+    std::vector<math::Vector3> normals(pMeshlet->m_triangleCount);
+    math::Vector3 axis(0.0f);
+    for (uint32_t t = 0; t < pMeshlet->m_triangleCount; t++)
+    {
+        math::Vector3 p0 = GetPosition(positions, pVertices[pTriangles[t * 3 + 0]]);
+        math::Vector3 p1 = GetPosition(positions, pVertices[pTriangles[t * 3 + 1]]);
+        math::Vector3 p2 = GetPosition(positions, pVertices[pTriangles[t * 3 + 2]]);
+
+        math::Vector3 normal = cross(p1 - p0, p2 - p0);
+        float normalLength = length(normal);
+        normals[t] = (normalLength > 0.0f) ? normal / normalLength : math::Vector3(0.0f);
+        axis += normals[t];
+    }
+
+    pMeshlet->m_coneApex = math::Vector4(center, 1.0f);
+    pMeshlet->m_coneAxis = math::Vector4(0.0f, 0.0f, 0.0f, 2.0f);
+
+    float axisLength = length(axis);
+    if (axisLength < 1e-6f)
+        return;
+    axis /= axisLength;
+
+    float minDot = 1.0f;
+    for (const math::Vector3 &normal : normals)
+    {
+        if (lengthSqr(normal) > 0.0f)
+            minDot = std::min(minDot, (float)dot(normal, axis));
+    }
+
+    // the triangles face more than a half space, no camera position sees them all from behind
+    if (minDot <= 0.0f)
+        return;
+
+    // the apex is moved back along the axis until it is behind the planes of all the triangles
+    float maxT = 0.0f;
+    for (uint32_t t = 0; t < pMeshlet->m_triangleCount; t++)
+    {
+        if (lengthSqr(normals[t]) == 0.0f)
+            continue;
+
+        math::Vector3 p0 = GetPosition(positions, pVertices[pTriangles[t * 3 + 0]]);
+        maxT = std::max(maxT, (float)(dot(center - p0, normals[t]) / dot(axis, normals[t])));
+    }
+
+    pMeshlet->m_coneApex = math::Vector4(center - axis * maxT, 1.0f);
+    pMeshlet->m_coneAxis = math::Vector4(axis, sqrtf(1.0f - minDot * minDot));
+}
+
+//
+// Cuts the triangles of a primitive into meshlets in the order of its indices, the degenerate triangles are dropped
+//
+static void BuildPrimitiveMeshlets(const GLTFCommon &gltf, uint32_t maxVertices, uint32_t maxTriangles, tfPrimitives *pPrimitive)
+{
+    const tfAccessor &positions = gltf.GetAccessor(pPrimitive->m_attributes.at("POSITION"));
+    const uint32_t vertexCount = (uint32_t)positions.m_count;
+    const uint32_t indexCount = (pPrimitive->m_indices >= 0) ? (uint32_t)gltf.GetAccessor(pPrimitive->m_indices).m_count : vertexCount;
+
+    std::vector<uint32_t> indices(indexCount);
+    for (uint32_t i = 0; i < indexCount; i++)
+    {
+        indices[i] = (pPrimitive->m_indices >= 0) ? GetIndex(gltf.GetAccessor(pPrimitive->m_indices), i) : i;
+        if (indices[i] >= vertexCount)
+        {
+            Trace(format("Primitive has out of range indices, no meshlets are built for it\n"));
+            return;
+        }
+    }
+
+    std::vector<float> xyz(vertexCount * 3);
+    DequantizeAccessor(positions, xyz.data());
+
+    std::vector<uint32_t> localIndex(vertexCount, ~0u);     // index of the vertices in the current meshlet
+    tfMeshlet meshlet;
+
+    auto FinishMeshlet = [&]()
+    {
+        if (meshlet.m_triangleCount == 0)
+            return;
+
+        for (uint32_t v = 0; v < meshlet.m_vertexCount; v++)
+            localIndex[pPrimitive->m_meshletVertices[meshlet.m_firstVertex + v]] = ~0u;
+
+        ComputeMeshletBounds(*pPrimitive, xyz, &meshlet);
+        pPrimitive->m_meshlets.push_back(meshlet);
+
+        meshlet = tfMeshlet();
+        meshlet.m_firstVertex = (uint32_t)pPrimitive->m_meshletVertices.size();
+        meshlet.m_firstTriangle = (uint32_t)pPrimitive->m_meshletTriangles.size() / 3;
+    };
+
+    for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const uint32_t *pTriangle = &indices[i];
+        if (pTriangle[0] == pTriangle[1] || pTriangle[1] == pTriangle[2] || pTriangle[0] == pTriangle[2])
+            continue;
+
+        uint32_t newVertices = 0;
+        for (int k = 0; k < 3; k++)
+            newVertices += (localIndex[pTriangle[k]] == ~0u) ? 1 : 0;
+
+        if (meshlet.m_vertexCount + newVertices > maxVertices || meshlet.m_triangleCount == maxTriangles)
+            FinishMeshlet();
+
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t &local = localIndex[pTriangle[k]];
+            if (local == ~0u)
+            {
+                local = meshlet.m_vertexCount++;
+                pPrimitive->m_meshletVertices.push_back(pTriangle[k]);
+            }
+            pPrimitive->m_meshletTriangles.push_back((uint8_t)local);
+        }
+        meshlet.m_triangleCount++;
+    }
+
+    FinishMeshlet();
+}
+
+void GLTFCommon::BuildMeshlets(bool bParallel, uint32_t maxVertices, uint32_t maxTriangles)
+{
+    Profile p("GLTFCommon::BuildMeshlets");
+
+    // the local indices are 8 bits
+    maxVertices = std::min(std::max(maxVertices, 3u), 256u);
+    maxTriangles = std::max(maxTriangles, 1u);
+
+    std::vector<tfPrimitives *> primitives;
+    for (tfMesh &mesh : m_meshes)
+    {
+        if (mesh.m_mergedAway)
+            continue;
+
+        for (tfPrimitives &primitive : mesh.m_pPrimitives)
+        {
+            primitive.m_meshlets.clear();
+            primitive.m_meshletVertices.clear();
+            primitive.m_meshletTriangles.clear();
+
+            if (primitive.m_mode == 4 && primitive.m_attributes.find("POSITION") != primitive.m_attributes.end())
+                primitives.push_back(&primitive);
+        }
+    }
+
+    auto job = [this, &primitives, maxVertices, maxTriangles](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+            BuildPrimitiveMeshlets(*this, maxVertices, maxTriangles, primitives[i]);
+    };
+
+    if (bParallel)
+        ExecBatches(primitives.size(), 1, job);
+    else
+        job(0, primitives.size());
+}
+
+//
+// Frustum and backface culls the meshlets of a primitive of a node with the camera of perFrame, the indices of the
+// visible meshlets are compacted into pVisible (which must hold m_meshlets.size() of them). Returns the number of visible
+// meshlets, 0 when the primitive has no meshlets, in which case it should be drawn whole.
+// The bounds are those of the rest pose of a single instance, so all the meshlets of the skinned, morphed and instanced
+// nodes are visible.
+//
+uint32_t GLTFCommon::CullMeshlets(int nodeIndex, int primitiveIndex, const per_frame &perFrame, uint32_t *pVisible) const
+{
+    const tfNode &node = m_nodes[nodeIndex];
+    const tfPrimitives &primitive = m_meshes[node.meshIndex].m_pPrimitives[primitiveIndex];
+    const uint32_t meshletCount = (uint32_t)primitive.m_meshlets.size();
+
+    if (node.skinIndex >= 0 || m_morphWeights.find(nodeIndex) != m_morphWeights.end() || IsNodeInstanced(nodeIndex))
+    {
+        for (uint32_t i = 0; i < meshletCount; i++)
+            pVisible[i] = i;
+        return meshletCount;
+    }
+
+    const math::Matrix4 world = m_worldSpaceMats[nodeIndex].GetCurrent();
+
+    // the planes of the frustum in the space of the primitive, they are normalized in that space so the radii of the
+    // spheres can be used as they are
+    FrustumPlanes frustum;
+    GetFrustumPlanes(perFrame.mCameraCurrViewProj * world, &frustum);
+    for (math::Vector4 &plane : frustum.m_planes)
+    {
+        float planeLength = length(plane.getXYZ());
+        if (planeLength > 0.0f)
+            plane /= planeLength;
+    }
+
+    // the cones are tested against the camera in the space of the primitive, which gives the same facing as in world
+    // space as long as the transform keeps the orientation. A mirroring transform (negative determinant) flips the
+    // winding the rasterizer sees, the front faces are then the ones the cones call back faces, so those nodes skip the
+    // test. The double sided materials draw the back faces.
+    const bool bMirrored = determinant(world.getUpper3x3()) < 0.0f;
+    const bool bBackfaceCull = !bMirrored && (primitive.m_material < 0 || !m_materials[primitive.m_material].m_doubleSided);
+    const math::Vector3 camera = (inverse(world) * math::Vector4(perFrame.cameraPos.getXYZ(), 1.0f)).getXYZ();
+
+    uint32_t visibleCount = 0;
+    for (uint32_t i = 0; i < meshletCount; i++)
+    {
+        const tfMeshlet &meshlet = primitive.m_meshlets[i];
+        const math::Vector4 center(meshlet.m_sphere.getXYZ(), 1.0f);
+        const float radius = meshlet.m_sphere.getW();
+
+        bool bCulled = false;
+        for (const math::Vector4 &plane : frustum.m_planes)
+            bCulled |= dot(plane, center) < -radius;
+
+        if (!bCulled && bBackfaceCull)
+        {
+            math::Vector3 direction = meshlet.m_coneApex.getXYZ() - camera;
+            bCulled = dot(direction, meshlet.m_coneAxis.getXYZ()) > meshlet.m_coneAxis.getW() * length(direction);
+        }
+
+        if (!bCulled)
+            pVisible[visibleCount++] = i;
+    }
+
+    return visibleCount;
+}
@@ -0,0 +1,126 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "GltfCommon.h"
+#include "GltfHelpers.h"
+#include "Misc/Misc.h"
+#include "Misc/OcclusionCulling.h"
+
+//
+// Occluders
+//
+// No occluders are authored in the glTF files, they are picked every frame among the primitives in the frustum: the
+// opaque triangle lists of the nodes that are neither skinned, morphed nor instanced, the ones that cover the largest
+// part of the screen first. Their positions are those of the primitive and the occlusion buffer is rasterized
+// conservatively, so a box is only culled behind geometry that is actually drawn, up to the float precision of the
+// rasterizer and its depth bias. The pixels only covered by several triangles together hide nothing, and the
+// triangles are limited to keep the rasterization cheap.
+//
+
+static const uint32_t OcclusionBufferWidth = 256;
+static const uint32_t OcclusionBufferHeight = 128;
+static const uint32_t MaxOccluderTriangles = 8192;
+
+const tfOccluderMesh &GLTFCommon::GetOccluderMesh(int meshIndex, int primitiveIndex)
+{
+    auto it = m_occluderMeshes.find(std::make_pair(meshIndex, primitiveIndex));
+    if (it != m_occluderMeshes.end())
+        return it->second;
+
+    tfOccluderMesh &occluder = m_occluderMeshes[std::make_pair(meshIndex, primitiveIndex)];
+
+    // the masked and blended materials have holes, the points and lines cover nothing
+    const tfPrimitives &primitive = m_meshes[meshIndex].m_pPrimitives[primitiveIndex];
+    if (primitive.m_mode != 4 || primitive.m_attributes.find("POSITION") == primitive.m_attributes.end())
+        return occluder;
+    if (primitive.m_material >= 0 && m_materials[primitive.m_material].m_alphaMode != "OPAQUE")
+        return occluder;
+
+    const tfAccessor &positions = m_accessors[primitive.m_attributes.at("POSITION")];
+    const uint32_t vertexCount = (uint32_t)positions.m_count;
+    const uint32_t indexCount = (primitive.m_indices >= 0) ? (uint32_t)m_accessors[primitive.m_indices].m_count : vertexCount;
+    if (indexCount < 3 || indexCount / 3 > MaxOccluderTriangles)
+        return occluder;
+
+    std::vector<uint32_t> indices(indexCount - indexCount % 3);
+    for (uint32_t i = 0; i < (uint32_t)indices.size(); i++)
+    {
+        indices[i] = (primitive.m_indices >= 0) ? GetIndex(m_accessors[primitive.m_indices], i) : i;
+        if (indices[i] >= vertexCount)
+            return occluder;
+    }
+
+    occluder.m_positions.resize(vertexCount * 3);
+    DequantizeAccessor(positions, occluder.m_positions.data());
+    occluder.m_indices = std::move(indices);
+    return occluder;
+}
+
+//
+// Renders the occlusion buffer used by CullPrimitives() for mCameraViewProj. The primitives are ranked by the square of
+// the size of their box over its distance along the view direction, the boxes around the camera come first.
+//
+void GLTFCommon::RenderOccluders(const math::Matrix4 &mCameraViewProj)
+{
+    if (m_occlusionBuffer.GetWidth() == 0)
+        m_occlusionBuffer.OnCreate(OcclusionBufferWidth, OcclusionBufferHeight);
+
+    // CullPrimitives() ignores the buffer until End()
+    m_occlusionBuffer.Begin(mCameraViewProj);
+
+    std::vector<tfBvhRange> ranges;
+    CullPrimitives(mCameraViewProj, &ranges);
+
+    const math::Vector4 wRow = transpose(mCameraViewProj).getCol3();
+    std::vector<std::pair<float, uint32_t>> candidates;
+    for (const tfBvhRange &range : ranges)
+    {
+        for (uint32_t i = range.m_firstItem; i < range.m_firstItem + range.m_itemCount; i++)
+        {
+            const tfBvhItem &item = m_bvhItems[i];
+            if (item.m_primitive < 0 || m_nodes[item.m_node].skinIndex >= 0 || m_morphWeights.find(item.m_node) != m_morphWeights.end())
+                continue;
+
+            const math::Vector4 center(m_bvhItemBoxes.m_center[0][i], m_bvhItemBoxes.m_center[1][i], m_bvhItemBoxes.m_center[2][i], 1.0f);
+            const math::Vector3 extent(m_bvhItemBoxes.m_extent[0][i], m_bvhItemBoxes.m_extent[1][i], m_bvhItemBoxes.m_extent[2][i]);
+            const float w = std::max((float)dot(wRow, center), 1.0e-3f);
+            candidates.push_back(std::make_pair((float)lengthSqr(extent) / (w * w), i));
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, uint32_t> &a, const std::pair<float, uint32_t> &b)
+    {
+        return a.first > b.first;
+    });
+
+    uint32_t occluderCount = 0;
+    for (size_t c = 0; c < candidates.size() && occluderCount < m_maxOccluders; c++)
+    {
+        const tfBvhItem &item = m_bvhItems[candidates[c].second];
+        const tfOccluderMesh &occluder = GetOccluderMesh(m_nodes[item.m_node].meshIndex, item.m_primitive);
+        if (occluder.m_indices.empty())
+            continue;
+
+        m_occlusionBuffer.AddOccluder(m_worldSpaceMats[item.m_node].GetCurrent(), occluder.m_positions.data(), (uint32_t)occluder.m_positions.size() / 3, occluder.m_indices.data(), (uint32_t)occluder.m_indices.size());
+        occluderCount++;
+    }
+
+    m_occlusionBuffer.End();
+}
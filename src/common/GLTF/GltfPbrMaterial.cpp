@@ -20,6 +20,7 @@
 #include "stdafx.h"
 #include "GltfPbrMaterial.h"
 #include "GltfHelpers.h"
+#include "GltfStructures.h"
 
 //
 // Set some default parameters 
@@ -186,43 +187,42 @@ bool DoesMaterialUseSemantic(DefineList &defines, const std::string semanticName
 // 1) determine the color space if the texture and also the cut out level. Authoring software saves albedo and emissive images in SRGB mode, the rest are linear mode
 // 2) tell the cutOff value, to prevent thinning of alpha tested PNGs when lower mips are used. 
 //
-void GetSrgbAndCutOffOfImageGivenItsUse(int imageIndex, const json &materials, std::unordered_map<int, int> const &textureToImage, bool *pSrgbOut, float *pCutoff)
+void GetSrgbAndCutOffOfImageGivenItsUse(int imageIndex, const std::vector<tfMaterial> &materials, const std::vector<tfTexture> &textures, bool *pSrgbOut, float *pCutoff)
 {
     *pSrgbOut = false;
     *pCutoff = 1.0f; // no cutoff
 
-    auto GetImageID = [&](int textureID) {
-      if (textureToImage.find(textureID) != textureToImage.end()) 
-        return textureToImage.find(textureID)->second;
-      return -1;
+    auto GetImageID = [&](const tfMaterial &material, const char *textureName) {
+        auto it = material.m_textures.find(textureName);
+        if (it == material.m_textures.end() || it->second.m_index < 0 || it->second.m_index >= textures.size())
+            return -1;
+        return textures[it->second.m_index].m_source;
     };
 
-    for (int m = 0; m < materials.size(); m++)
+    for (const tfMaterial &material : materials)
     {
-        const json &material = materials[m];
-
-        if (GetImageID(GetElementInt(material, "pbrMetallicRoughness/baseColorTexture/index", -1)) == imageIndex)
+        if (GetImageID(material, "baseColorTexture") == imageIndex)
         {
             *pSrgbOut = true;
 
-            *pCutoff = GetElementFloat(material, "alphaCutoff", 0.5);
+            *pCutoff = material.m_alphaCutoff;
 
             return;
         }
 
-        if (GetImageID(GetElementInt(material, "extensions/KHR_materials_pbrSpecularGlossiness/specularGlossinessTexture/index", -1)) == imageIndex)
+        if (GetImageID(material, "specularGlossinessTexture") == imageIndex)
         {
             *pSrgbOut = true;
             return;
         }
 
-        if (GetImageID(GetElementInt(material, "extensions/KHR_materials_pbrSpecularGlossiness/diffuseTexture/index", -1)) == imageIndex)
+        if (GetImageID(material, "diffuseTexture") == imageIndex)
         {
             *pSrgbOut = true;
             return;
         }
 
-        if (GetImageID(GetElementInt(material, "emissiveTexture/index", -1)) == imageIndex)
+        if (GetImageID(material, "emissiveTexture") == imageIndex)
         {
             *pSrgbOut = true;
             return;
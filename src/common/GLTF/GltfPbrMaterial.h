@@ -46,10 +46,13 @@ struct PBRMaterialParameters
 };
 
 
+struct tfMaterial;
+struct tfTexture;
+
 // Read GLTF material and store it in our structure
 //
 void SetDefaultMaterialParamters(PBRMaterialParameters *pPbrMaterialParameters);
 void ProcessMaterials(const json::object_t &material, PBRMaterialParameters *tfmat, std::map<std::string, int> &textureIds);
 bool DoesMaterialUseSemantic(DefineList &defines, const std::string semanticName);
 bool ProcessGetTextureIndexAndTextCoord(const json::object_t &material, const std::string &textureName, int *pIndex, int *pTexCoord);
-void GetSrgbAndCutOffOfImageGivenItsUse(int imageIndex, const json &materials, std::unordered_map<int, int> const &textureToImage, bool *pSrgbOut, float *pCutoff);
\ No newline at end of file
+void GetSrgbAndCutOffOfImageGivenItsUse(int imageIndex, const std::vector<tfMaterial> &materials, const std::vector<tfTexture> &textures, bool *pSrgbOut, float *pCutoff);
\ No newline at end of file
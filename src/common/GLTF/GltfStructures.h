@@ -23,17 +23,41 @@
 // This file holds all the structures/classes used to load a glTF model
 //
 
+struct tfBufferView
+{
+    const char *m_data = NULL;
+    size_t m_byteLength = 0;
+    int m_byteStride = 0;       // 0 means tightly packed
+};
+
+struct tfSparseAccessor
+{
+    int m_count = 0;            // number of displaced elements, 0 if the accessor is not sparse
+    const void *m_indices = NULL;
+    int m_indexType = 0;        // size in bytes of each index
+    const void *m_values = NULL;
+
+    // accessors that are sparse or have no bufferView are decoded into a dense copy at load time (except the morph
+    // targets, see tfMorphDelta), m_data then points to the copy and m_base to the data the values were applied on
+    bool m_decoded = false;
+    const void *m_base = NULL;  // NULL means zeros
+};
+
 class tfAccessor
 {
 public:
     const void *m_data = NULL;
     int m_count = 0;
-    int m_stride;
+    int m_stride;               // bytes between elements, the bufferView's byteStride when the vertices are interleaved
     int m_dimension;
-    int m_type;
+    int m_type;                 // size in bytes of each component
+    int m_componentType = 0;    // glTF component type, i.e. 5126 (FLOAT)
+    bool m_normalized = false;
 
-    math::Vector4 m_min;
-    math::Vector4 m_max;
+    math::Vector4 m_min = math::Vector4(0.0f);
+    math::Vector4 m_max = math::Vector4(0.0f);
+
+    tfSparseAccessor m_sparse;
 
     const void *Get(int i) const
     {
@@ -65,15 +89,140 @@ public:
     }
 };
 
+//
+// One attribute of a morph target, only the vertices it displaces are stored
+//
+struct tfMorphDelta
+{
+    std::vector<uint32_t> m_indices;
+    std::vector<float> m_deltas;                // xyz per index, plus a trailing 0 so the SIMD loads don't read past the end
+};
+
+struct tfMorphTarget
+{
+    std::map<std::string, tfMorphDelta> m_attributes;   // POSITION, NORMAL and TANGENT
+};
+
+//
+// A cluster of nearby triangles of a primitive, with the bounds GLTFCommon::CullMeshlets() tests. See GltfMeshlets.cpp
+//
+struct tfMeshlet
+{
+    uint32_t m_firstVertex = 0;         // in tfPrimitives::m_meshletVertices
+    uint32_t m_vertexCount = 0;
+    uint32_t m_firstTriangle = 0;       // in tfPrimitives::m_meshletTriangles, 3 local vertex indices per triangle
+    uint32_t m_triangleCount = 0;
+
+    math::Vector4 m_sphere;             // bounding sphere, xyz is the center and w the radius
+    math::Vector4 m_coneApex;           // the triangles all face away from the points of the backface cone
+    math::Vector4 m_coneAxis;           // w is the cutoff, greater than 1 when the triangles face too many ways to be culled
+};
+
 struct tfPrimitives
 {
     math::Vector4 m_center;
     math::Vector4 m_radius;
+
+    std::map<std::string, int> m_attributes;    // attribute name -> accessor index
+    int m_indices = -1;                         // accessor index
+    int m_material = -1;
+    int m_mode = 4;                             // TRIANGLES
+
+    std::vector<std::map<std::string, int>> m_targets;  // morph targets, attribute name -> accessor index
+    std::vector<tfMorphTarget> m_morphTargets;          // the same targets as sparse deltas
+
+    // meshlets of the triangle lists, empty unless GLTFLoadOptions::m_buildMeshlets is set
+    std::vector<tfMeshlet> m_meshlets;
+    std::vector<uint32_t> m_meshletVertices;            // vertex indices of the primitive used by each meshlet
+    std::vector<uint8_t> m_meshletTriangles;            // indices into the meshlet's vertices
+
+    bool HasMorphTarget(const std::string &attribute) const
+    {
+        for (auto const &target : m_targets)
+        {
+            if (target.find(attribute) != target.end())
+                return true;
+        }
+        return false;
+    }
+};
+
+//
+// Vertices of a morphed attribute of a primitive, rewritten every frame by GLTFCommon::MorphMeshes()
+//
+struct tfMorphedStream
+{
+    int m_primitive = -1;       // index in the mesh
+    int m_accessor = -1;        // accessor of the attribute it replaces
+    std::string m_attribute;    // POSITION, NORMAL or TANGENT
+    int m_dimension = 3;        // floats per vertex
+    int m_count = 0;            // number of vertices
+    std::vector<float> m_data;  // m_count * m_dimension floats, plus one of padding for the SIMD stores
 };
 
 struct tfMesh
 {
     std::vector<tfPrimitives> m_pPrimitives;
+    std::vector<float> m_weights;               // default weights of the morph targets
+    bool m_mergedAway = false;                  // no node draws it since MergeStaticMeshes(), it is neither uploaded nor drawn
+};
+
+struct tfTextureRef
+{
+    int m_index = -1;           // texture index
+    int m_texCoord = 0;
+};
+
+struct tfMaterial
+{
+    bool m_doubleSided = false;
+    std::string m_alphaMode = "OPAQUE";
+    float m_alphaCutoff = 0.5f;
+    bool m_metallicRoughness = false;       // uses pbrMetallicRoughness
+    bool m_specularGlossiness = false;      // uses KHR_materials_pbrSpecularGlossiness instead
+
+    // textures keyed by their glTF name, i.e. "baseColorTexture" or "normalTexture"
+    std::map<std::string, tfTextureRef> m_textures;
+
+    // constants and #defines for the shaders, see ProcessMaterials()
+    PBRMaterialParameters m_pbrMaterialParameters;
+
+    bool GetTexture(const std::string &textureName, int *pIndex, int *pTexCoord) const
+    {
+        auto it = m_textures.find(textureName);
+        if (it == m_textures.end())
+            return false;
+
+        *pIndex = it->second.m_index;
+        *pTexCoord = it->second.m_texCoord;
+        return true;
+    }
+};
+
+struct tfImage
+{
+    std::string m_name;
+    std::string m_uri;          // empty when the image is embedded, in a bufferView or in a data URI
+    std::string m_mimeType;
+    int m_bufferView = -1;
+
+    // decoded data URI
+    const char *m_data = NULL;
+    size_t m_size = 0;
+};
+
+struct tfTexture
+{
+    int m_source = -1;          // image index
+    int m_sampler = -1;
+};
+
+struct tfTextureSampler
+{
+    int m_magFilter = -1;       // -1 means not specified
+    int m_minFilter = -1;
+    int m_wrapS = 10497;        // REPEAT
+    int m_wrapT = 10497;
 };
 
 struct Transform
@@ -96,6 +245,52 @@ struct Transform
 
 typedef int tfNodeIdx;
 
+//
+// Indices of a merged primitive that come from a static primitive, see GLTFCommon::MergeStaticMeshes()
+//
+struct tfMergedRange
+{
+    tfNodeIdx m_node;           // node that drew the source primitive, its meshIndex is -1 once merged
+    int m_mesh;                 // source mesh and primitive
+    int m_primitive;
+    uint32_t m_firstIndex;
+    uint32_t m_indexCount;
+};
+
+//
+// Bounding volume hierarchy over the primitives of the transformed scene, see GltfBvh.cpp
+//
+struct tfBvhItem
+{
+    tfNodeIdx m_node;
+    int m_primitive;            // -1 for all the primitives of an instanced node, their instances are culled one by one
+};
+
+struct tfBvhNode
+{
+    math::Vector4 m_min;        // world space bounds
+    math::Vector4 m_max;
+    uint32_t m_firstItem;       // the items of a subtree are contiguous
+    uint32_t m_itemCount;
+    uint32_t m_left;            // first child, the second one follows it. 0 for the leaves
+    int m_parent;
+};
+
+struct tfBvhRange
+{
+    uint32_t m_firstItem;
+    uint32_t m_itemCount;
+};
+
+//
+// Positions and triangle list of a primitive rasterized by the occlusion culling, see GLTFCommon::RenderOccluders()
+//
+struct tfOccluderMesh
+{
+    std::vector<float> m_positions;     // xyz, dequantized
+    std::vector<uint32_t> m_indices;    // empty when the primitive can't be an occluder
+};
+
 struct tfNode
 {
     std::vector<tfNodeIdx> m_children;
@@ -108,6 +303,8 @@ struct tfNode
     std::string m_name;
 
     Transform m_transform;
+
+    std::vector<float> m_weights;           // morph target weights, overrides the ones of the mesh
 };
 
 struct NodeMatrixPostTransform
@@ -118,6 +315,11 @@ struct NodeMatrixPostTransform
 struct tfScene
 {
     std::vector<tfNodeIdx> m_nodes;
+
+    // the hierarchy flattened so parents always come before their children, see GLTFCommon::FlattenScene()
+    std::vector<tfNodeIdx> m_flatNodes;     // nodes sorted by depth
+    std::vector<int> m_flatParents;         // position of the parent in m_flatNodes, -1 for the root nodes
+    std::vector<uint32_t> m_levels;         // nodes at depth d are m_flatNodes[m_levels[d], m_levels[d + 1])
 };
 
 struct tfSkins
@@ -127,32 +329,92 @@ struct tfSkins
     std::vector<int> m_jointsNodeIdx;
 };
 
+//
+// Returns the last key whose time is <= time, or -1 if time is before the first key.
+// The time of an animation moves very little from one frame to the next, so the search walks from the key found by the
+// previous lookup (*pCursor) and only does a binary search when the key is far away (seeks, loops).
+//
+inline int FindKeyFromCursor(const float *pTimes, int count, float time, int *pCursor)
+{
+    const int maxSteps = 4;
+
+    int i = *pCursor;
+    if (pTimes[i] <= time)
+    {
+        for (int step = 0; step < maxSteps; step++, i++)
+        {
+            if (i + 1 == count || pTimes[i + 1] > time)
+            {
+                *pCursor = i;
+                return i;
+            }
+        }
+    }
+    else
+    {
+        for (int step = 0; step < maxSteps; step++)
+        {
+            if (--i < 0)
+            {
+                *pCursor = 0;
+                return -1;
+            }
+
+            if (pTimes[i] <= time)
+            {
+                *pCursor = i;
+                return i;
+            }
+        }
+    }
+
+    i = (int)(std::upper_bound(pTimes, pTimes + count, time) - pTimes) - 1;
+    *pCursor = std::max<int>(i, 0);
+    return i;
+}
+
 class tfSampler
 {
 public:
+    enum Interpolation { INTERPOLATION_LINEAR, INTERPOLATION_STEP, INTERPOLATION_CUBICSPLINE };
+
     tfAccessor m_time;
-    tfAccessor m_value;
+    tfAccessor m_value;         // for cubic splines each key has 3 values: in-tangent, value and out-tangent
+    Interpolation m_interpolation = INTERPOLATION_LINEAR;
 
-    void SampleLinear(float time, float *frac, float **pCurr, float **pNext) const
+    // returns the last key whose time is <= time, or -1 if time is before the first key. The sampler is shared by
+    // everything that plays the animation, so the cursor of the search (see FindKeyFromCursor()) belongs to the caller.
+    int FindKey(float time, int *pCursor) const
     {
-        int curr_index = m_time.FindClosestFloatIndex(time);
+        return FindKeyFromCursor((const float*)m_time.m_data, m_time.m_count, time, pCursor);
+    }
+
+    // samples the keys around time, step interpolation gives a frac of 0 and the tangents of the cubic splines are ignored
+    void SampleLinear(float time, int *pCursor, float *frac, float **pCurr, float **pNext) const
+    {
+        int curr_index = FindKey(time, pCursor);
         int next_index = std::min<int>(curr_index + 1, m_time.m_count - 1);
 
         if (curr_index < 0) curr_index++;
 
-        if (curr_index == next_index)
+        // indices are in range, no need to go through tfAccessor::Get()
+        const float *pTimes = (const float*)m_time.m_data;
+        const char *pValues = (const char*)m_value.m_data;
+
+        const int valuesPerKey = (m_interpolation == INTERPOLATION_CUBICSPLINE) ? 3 : 1;
+        const int valueOffset = (m_interpolation == INTERPOLATION_CUBICSPLINE) ? 1 : 0;
+        *pCurr = (float*)(pValues + m_value.m_stride * (curr_index * valuesPerKey + valueOffset));
+        *pNext = (float*)(pValues + m_value.m_stride * (next_index * valuesPerKey + valueOffset));
+
+        if (curr_index == next_index || m_interpolation == INTERPOLATION_STEP)
         {
             *frac = 0;
-            *pCurr = (float*)m_value.Get(curr_index);
-            *pNext = (float*)m_value.Get(next_index);
             return;
         }
 
-        float curr_time = *(float*)m_time.Get(curr_index);
-        float next_time = *(float*)m_time.Get(next_index);
+        float curr_time = pTimes[curr_index];
+        float next_time = pTimes[next_index];
 
-        *pCurr = (float*)m_value.Get(curr_index);
-        *pNext = (float*)m_value.Get(next_index);
         *frac = (time - curr_time) / (next_time - curr_time);
         assert(*frac >= 0 && *frac <= 1.0);
     }
@@ -166,17 +428,66 @@ public:
         delete m_pTranslation;
         delete m_pRotation;
         delete m_pScale;
+        delete m_pWeights;
     }
 
     tfSampler *m_pTranslation;
     tfSampler *m_pRotation;
     tfSampler *m_pScale;
+    tfSampler *m_pWeights;      // morph target weights, not part of the packed animation
+};
+
+//
+// The channels of an animation repacked as flat arrays for the SIMD evaluation, see GltfAnimation.h
+// Each channel has 3 tracks (translation, rotation and scale), stored at [channel * 3 + component].
+//
+struct tfPackedTrack
+{
+    uint32_t m_firstKey = 0;    // in m_times
+    uint32_t m_firstValue = 0;  // in m_values, or in m_rotations (in units of 3) when the track is quantized
+    uint32_t m_keyCount = 0;    // 0 if the component is not animated, then m_defaults is used
+    uint8_t m_interpolation = tfSampler::INTERPOLATION_LINEAR;
+    bool m_quantized = false;   // rotation keys encoded in 48 bits, see GltfAnimation.cpp
+};
+
+struct tfPackedAnimation
+{
+    std::vector<tfNodeIdx> m_nodes;             // target node of each channel
+    std::vector<tfPackedTrack> m_tracks;
+    std::vector<math::Vector4> m_defaults;      // value of the components that are not animated, from the nodes
+    std::vector<float> m_times;                 // key times of all the tracks
+    std::vector<math::Vector4> m_values;        // one value per key (3 for cubic splines), xyz or a quaternion
+    std::vector<uint16_t> m_rotations;          // quantized rotation keys, 3 words per key
+};
+
+//
+// Local transform of a node as TRS, used to blend the animation layers
+//
+struct tfPose
+{
+    math::Vector4 m_translation;
+    math::Vector4 m_rotation;       // quaternion
+    math::Vector4 m_scale;
+};
+
+//
+// An animation played at a given time. Layers are applied in order, a regular layer blends the pose towards its own
+// by m_weight, an additive layer adds m_weight times its difference with the rest pose of the nodes.
+//
+struct tfAnimationLayer
+{
+    uint32_t m_animationIndex = 0;
+    float m_time = 0.0f;
+    float m_weight = 1.0f;
+    bool m_additive = false;
 };
 
 struct tfAnimation
 {
     float m_duration;
     std::map<int, tfChannel> m_channels;
+
+    tfPackedAnimation m_packed;
 };
 
 struct tfLight
@@ -135,3 +135,31 @@ std::mutex Async::s_mutex;
 std::condition_variable Async::s_condition;
 bool Async::s_bExiting = false;
 int Async::s_maxThreads = std::thread::hardware_concurrency();
+
+//
+// Calls job(first, last) on ranges of batchSize items that cover [0, count), the ranges run on the ThreadPool
+// unless there are only a couple of them. The first range is processed by the calling thread.
+//
+void ExecBatches(size_t count, size_t batchSize, std::function<void(size_t, size_t)> job)
+{
+    if (count < 2 * batchSize)
+    {
+        job(0, count);
+        return;
+    }
+
+    Sync sync;
+    for (size_t batch = batchSize; batch < count; batch += batchSize)
+    {
+        size_t batchLast = std::min(batch + batchSize, count);
+        sync.Inc();
+        GetThreadPool()->AddJob([&sync, &job, batch, batchLast]()
+        {
+            job(batch, batchLast);
+            sync.Dec();
+        });
+    }
+
+    job(0, batchSize);
+    sync.Wait();
+}
@@ -101,3 +101,6 @@ public:
 };
 
 void ExecAsyncIfThereIsAPool(AsyncPool *pAsyncPool, std::function<void()> job);
+
+// Splits [0, count) in ranges of batchSize items processed on the ThreadPool, returns once they are all done
+void ExecBatches(size_t count, size_t batchSize, std::function<void(size_t, size_t)> job);
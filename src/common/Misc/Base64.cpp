@@ -0,0 +1,234 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "Base64.h"
+
+#include <intrin.h>
+
+//
+// Scalar decoding, a table maps each character to its 6 bit value or to 0xFF when it is not part of the alphabet
+//
+struct Base64Table
+{
+    uint8_t m_values[256];
+
+    Base64Table()
+    {
+        memset(m_values, 0xFF, sizeof(m_values));
+
+        const char *pAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (uint8_t i = 0; i < 64; i++)
+            m_values[(uint8_t)pAlphabet[i]] = i;
+    }
+};
+
+static const Base64Table s_base64Table;
+
+static bool DecodeScalar(const char *pSrc, size_t srcSize, char *pDst, size_t *pDstSize)
+{
+    const uint8_t *pValues = s_base64Table.m_values;
+
+    // quads of 4 characters give 3 bytes
+    size_t i = 0;
+    size_t o = 0;
+    for (; i + 4 <= srcSize; i += 4)
+    {
+        uint32_t a = pValues[(uint8_t)pSrc[i + 0]];
+        uint32_t b = pValues[(uint8_t)pSrc[i + 1]];
+        uint32_t c = pValues[(uint8_t)pSrc[i + 2]];
+        uint32_t d = pValues[(uint8_t)pSrc[i + 3]];
+        if ((a | b | c | d) == 0xFF)
+            break;  // stop at the padding, or at an invalid character
+
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        pDst[o++] = (char)(v >> 16);
+        pDst[o++] = (char)(v >> 8);
+        pDst[o++] = (char)v;
+    }
+
+    // what is left must be the last quad, with 2 or 3 characters and optionally padded with '='
+    size_t rest = srcSize - i;
+    size_t count = rest;
+    if (rest == 4)
+    {
+        while (count > 2 && pSrc[i + count - 1] == '=')
+            count--;
+    }
+
+    *pDstSize = o;
+    if (rest == 0)
+        return true;
+    if (rest > 4 || count == 4 || count < 2)
+        return false;
+
+    uint32_t v = 0;
+    for (size_t j = 0; j < count; j++)
+    {
+        uint32_t value = pValues[(uint8_t)pSrc[i + j]];
+        if (value == 0xFF)
+            return false;
+        v |= value << (18 - 6 * j);
+    }
+
+    pDst[o++] = (char)(v >> 16);
+    if (count == 3)
+        pDst[o++] = (char)(v >> 8);
+
+    *pDstSize = o;
+    return true;
+}
+
+//
+// SIMD decoding, see "Faster Base64 Encoding and Decoding using AVX2 Instructions" (Mula, Lemire).
+// The high and low nibbles of each character index two tables whose AND is not zero for characters out of the
+// alphabet, a third table gives the offset that turns each range of the alphabet ('A'-'Z', 'a'-'z', '0'-'9', '+', '/')
+// into its value. Then the 6 bit values are packed with multiply-adds and a shuffle drops the empty bytes.
+//
+// Each block writes a few bytes more than it decodes, so a block is only decoded when there are enough characters
+// after it to overwrite those bytes, the tail (and anything with padding or invalid characters) goes to DecodeScalar.
+//
+static size_t DecodeSSSE3(const char *pSrc, size_t srcSize, char *pDst)
+{
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F = _mm_set1_epi8(0x2F);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // 16 characters in, 12 bytes decoded and 16 written
+    size_t i = 0;
+    for (; i + 16 + 8 <= srcSize; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(pSrc + i));
+
+        __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask2F);
+        __m128i loNibbles = _mm_and_si128(in, mask2F);
+        __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+        __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+            break;
+
+        __m128i eq2F = _mm_cmpeq_epi8(in, mask2F);
+        __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+        __m128i values = _mm_add_epi8(in, roll);
+
+        __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        __m128i out = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+        out = _mm_shuffle_epi8(out, pack);
+
+        _mm_storeu_si128((__m128i *)(pDst + i / 4 * 3), out);
+    }
+
+    return i;
+}
+
+static size_t DecodeAVX2(const char *pSrc, size_t srcSize, char *pDst)
+{
+    const __m256i lutLo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask2F = _mm256_set1_epi8(0x2F);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i joinLanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+    // 32 characters in, 24 bytes decoded and 32 written
+    size_t i = 0;
+    for (; i + 32 + 16 <= srcSize; i += 32)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(pSrc + i));
+
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask2F);
+        __m256i loNibbles = _mm256_and_si256(in, mask2F);
+        __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        __m256i eq2F = _mm256_cmpeq_epi8(in, mask2F);
+        __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles));
+        __m256i values = _mm256_add_epi8(in, roll);
+
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        __m256i out = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        out = _mm256_shuffle_epi8(out, pack);
+        out = _mm256_permutevar8x32_epi32(out, joinLanes);
+
+        _mm256_storeu_si256((__m256i *)(pDst + i / 4 * 3), out);
+    }
+
+    return i;
+}
+
+enum Base64Path { BASE64_SCALAR, BASE64_SSSE3, BASE64_AVX2 };
+
+static Base64Path GetBase64Path()
+{
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool bSSSE3 = (info[2] & (1 << 9)) != 0;
+    bool bOSXSAVE = (info[2] & (1 << 27)) != 0;
+    bool bAVX = (info[2] & (1 << 28)) != 0;
+
+    // AVX2 also needs the OS to save the YMM registers
+    if (maxLeaf >= 7 && bAVX && bOSXSAVE && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if ((info[1] & (1 << 5)) != 0)
+            return BASE64_AVX2;
+    }
+
+    return bSSSE3 ? BASE64_SSSE3 : BASE64_SCALAR;
+}
+
+size_t Base64GetDecodedSize(const char *pSrc, size_t srcSize)
+{
+    size_t padding = 0;
+    while (padding < 2 && padding < srcSize && pSrc[srcSize - 1 - padding] == '=')
+        padding++;
+
+    return (srcSize - padding) / 4 * 3 + ((srcSize - padding) % 4 * 3) / 4;
+}
+
+bool Base64Decode(const char *pSrc, size_t srcSize, char *pDst, size_t *pDstSize)
+{
+    static const Base64Path path = GetBase64Path();
+
+    size_t decoded = 0;
+    if (path == BASE64_AVX2)
+        decoded = DecodeAVX2(pSrc, srcSize, pDst);
+    if (path >= BASE64_SSSE3)
+        decoded += DecodeSSSE3(pSrc + decoded, srcSize - decoded, pDst + decoded / 4 * 3);
+
+    size_t tailSize;
+    bool result = DecodeScalar(pSrc + decoded, srcSize - decoded, pDst + decoded / 4 * 3, &tailSize);
+    *pDstSize = decoded / 4 * 3 + tailSize;
+    return result;
+}
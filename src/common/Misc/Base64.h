@@ -0,0 +1,31 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#pragma once
+
+//
+// Base64 decoding (RFC 4648 alphabet, '=' padding is optional), as used by the data URIs in glTF files.
+// Blocks of 32 (AVX2) or 16 (SSSE3) characters are decoded with SIMD when the CPU supports it, the rest with a table.
+//
+
+// Upper bound of the size of the decoded data, it's exact unless the text is invalid
+size_t Base64GetDecodedSize(const char *pSrc, size_t srcSize);
+
+// Decodes srcSize characters into pDst, which must hold at least Base64GetDecodedSize() bytes.
+// Returns false if the text is not valid base64, *pDstSize gets the number of bytes written.
+bool Base64Decode(const char *pSrc, size_t srcSize, char *pDst, size_t *pDstSize);
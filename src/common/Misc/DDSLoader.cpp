@@ -52,6 +52,24 @@ struct DDS_HEADER
     UINT32       dwReserved2;
 };
 
+typedef enum RESOURCE_DIMENSION
+{
+    RESOURCE_DIMENSION_UNKNOWN = 0,
+    RESOURCE_DIMENSION_BUFFER = 1,
+    RESOURCE_DIMENSION_TEXTURE1D = 2,
+    RESOURCE_DIMENSION_TEXTURE2D = 3,
+    RESOURCE_DIMENSION_TEXTURE3D = 4
+} RESOURCE_DIMENSION;
+
+typedef struct
+{
+    DXGI_FORMAT      dxgiFormat;
+    RESOURCE_DIMENSION  resourceDimension;
+    UINT32           miscFlag;
+    UINT32           arraySize;
+    UINT32           reserved;
+} DDS_HEADER_DXT10;
+
 //--------------------------------------------------------------------------------------
 // retrieve the GetDxgiFormat from a DDS_PIXELFORMAT
 //--------------------------------------------------------------------------------------
@@ -108,24 +126,6 @@ DDSLoader::~DDSLoader()
 
 bool DDSLoader::Load(const char *pFilename, float cutOff, IMG_INFO *pInfo)
 {
-    typedef enum RESOURCE_DIMENSION
-    {
-        RESOURCE_DIMENSION_UNKNOWN = 0,
-        RESOURCE_DIMENSION_BUFFER = 1,
-        RESOURCE_DIMENSION_TEXTURE1D = 2,
-        RESOURCE_DIMENSION_TEXTURE2D = 3,
-        RESOURCE_DIMENSION_TEXTURE3D = 4
-    } RESOURCE_DIMENSION;
-
-    typedef struct
-    {
-        DXGI_FORMAT      dxgiFormat;
-        RESOURCE_DIMENSION  resourceDimension;
-        UINT32           miscFlag;
-        UINT32           arraySize;
-        UINT32           reserved;
-    } DDS_HEADER_DXT10;
-
     if (GetFileAttributesA(pFilename) == 0xFFFFFFFF)
         return false;
 
@@ -144,50 +144,97 @@ bool DDSLoader::Load(const char *pFilename, float cutOff, IMG_INFO *pInfo)
     // read the header
     char headerData[4 + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10)];
     DWORD dwBytesRead = 0;
-    if (ReadFile(m_handle, headerData, 4 + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10), &dwBytesRead, NULL))
+    if (!ReadFile(m_handle, headerData, 4 + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10), &dwBytesRead, NULL))
     {
-        char *pByteData = headerData;
-        UINT32 dwMagic = *reinterpret_cast<UINT32 *>(pByteData);
-        if (dwMagic != ' SDD')   // "DDS "
-        {
-            return false;
-        }
+        return false;
+    }
 
-        pByteData += 4;
-        rawTextureSize -= 4;
+    if (!ParseHeader(headerData, dwBytesRead, pInfo, &rawTextureSize))
+    {
+        return false;
+    }
 
-        DDS_HEADER *header = reinterpret_cast<DDS_HEADER *>(pByteData);
-        pByteData += sizeof(DDS_HEADER);
-        rawTextureSize -= sizeof(DDS_HEADER);
+    SetFilePointer(m_handle, fileSize - rawTextureSize, 0, FILE_BEGIN);
+    return true;
+}
 
-        pInfo->width = header->dwWidth;
-        pInfo->height = header->dwHeight;
-        pInfo->depth = header->dwDepth ? header->dwDepth : 1;
-        pInfo->mipMapCount = header->dwMipMapCount ? header->dwMipMapCount : 1;
+bool DDSLoader::Load(const void *pData, size_t size, float cutOff, IMG_INFO *pInfo)
+{
+    UINT32 rawTextureSize = (UINT32)size;
+    if (!ParseHeader((const char *)pData, size, pInfo, &rawTextureSize))
+    {
+        return false;
+    }
 
-        if (header->ddspf.fourCC == '01XD')
-        {
-            DDS_HEADER_DXT10 *header10 = reinterpret_cast<DDS_HEADER_DXT10*>((char*)header + sizeof(DDS_HEADER));
-            rawTextureSize -= sizeof(DDS_HEADER_DXT10);
+    m_pMemory = (const char *)pData + (size - rawTextureSize);
+    return true;
+}
 
-            pInfo->arraySize = header10->arraySize;
-            pInfo->format = header10->dxgiFormat;
-            pInfo->bitCount = header->ddspf.bitCount;
-        }
-        else
+//--------------------------------------------------------------------------------------
+// fills the IMG_INFO from the header, rawTextureSize gets reduced by the size of the headers
+//--------------------------------------------------------------------------------------
+bool DDSLoader::ParseHeader(const char *pHeaderData, size_t headerDataSize, IMG_INFO *pInfo, UINT32 *pRawTextureSize)
+{
+    if (headerDataSize < 4 + sizeof(DDS_HEADER))
+    {
+        return false;
+    }
+
+    const char *pByteData = pHeaderData;
+    UINT32 dwMagic = *reinterpret_cast<const UINT32 *>(pByteData);
+    if (dwMagic != ' SDD')   // "DDS "
+    {
+        return false;
+    }
+
+    pByteData += 4;
+    *pRawTextureSize -= 4;
+
+    const DDS_HEADER *header = reinterpret_cast<const DDS_HEADER *>(pByteData);
+    pByteData += sizeof(DDS_HEADER);
+    *pRawTextureSize -= sizeof(DDS_HEADER);
+
+    pInfo->width = header->dwWidth;
+    pInfo->height = header->dwHeight;
+    pInfo->depth = header->dwDepth ? header->dwDepth : 1;
+    pInfo->mipMapCount = header->dwMipMapCount ? header->dwMipMapCount : 1;
+
+    if (header->ddspf.fourCC == '01XD')
+    {
+        if (headerDataSize < 4 + sizeof(DDS_HEADER) + sizeof(DDS_HEADER_DXT10))
         {
-            pInfo->arraySize = (header->dwCubemapFlags == 0xfe00) ? 6 : 1;
-            pInfo->format = GetDxgiFormat(header->ddspf);
-            pInfo->bitCount = (UINT32)BitsPerPixel(pInfo->format);
+            return false;
         }
+
+        const DDS_HEADER_DXT10 *header10 = reinterpret_cast<const DDS_HEADER_DXT10*>((const char*)header + sizeof(DDS_HEADER));
+        *pRawTextureSize -= sizeof(DDS_HEADER_DXT10);
+
+        pInfo->arraySize = header10->arraySize;
+        pInfo->format = header10->dxgiFormat;
+        pInfo->bitCount = header->ddspf.bitCount;
+    }
+    else
+    {
+        pInfo->arraySize = (header->dwCubemapFlags == 0xfe00) ? 6 : 1;
+        pInfo->format = GetDxgiFormat(header->ddspf);
+        pInfo->bitCount = (UINT32)BitsPerPixel(pInfo->format);
     }
 
-    SetFilePointer(m_handle, fileSize - rawTextureSize, 0, FILE_BEGIN);
     return true;
 }
 
 void DDSLoader::CopyPixels(void *pDest, uint32_t stride, uint32_t bytesWidth, uint32_t height)
 {
+    if (m_pMemory != NULL)
+    {
+        for (uint32_t y = 0; y < height; y++)
+        {
+            memcpy((char*)pDest + y*stride, m_pMemory, bytesWidth);
+            m_pMemory += bytesWidth;
+        }
+        return;
+    }
+
     assert(m_handle != INVALID_HANDLE_VALUE);
     for (uint32_t y = 0; y < height; y++)
     {
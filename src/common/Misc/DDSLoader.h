@@ -28,10 +28,14 @@ class DDSLoader : public ImgLoader
 public:
     ~DDSLoader();
     bool Load(const char *pFilename, float cutOff, IMG_INFO *pInfo);
+    bool Load(const void *pData, size_t size, float cutOff, IMG_INFO *pInfo);
     // after calling Load, calls to CopyPixels return each time a lower mip level 
     void CopyPixels(void *pDest, uint32_t stride, uint32_t width, uint32_t height);
 private:
+    bool ParseHeader(const char *pHeaderData, size_t headerDataSize, IMG_INFO *pInfo, UINT32 *pRawTextureSize);
+
     HANDLE m_handle = INVALID_HANDLE_VALUE;
+    const char *m_pMemory = NULL;
 };
 
 
@@ -0,0 +1,217 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "FrustumCulling.h"
+
+#include <intrin.h>
+
+void BoundingBoxArrays::Resize(size_t count)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        m_center[axis].resize(count);
+        m_extent[axis].resize(count);
+    }
+}
+
+void BoundingBoxArrays::Set(size_t i, const AxisAlignedBoundingBox &box)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float min = box.m_min.getElem(axis);
+        float max = box.m_max.getElem(axis);
+        m_center[axis][i] = (min + max) * 0.5f;
+        m_extent[axis][i] = (max - min) * 0.5f;
+    }
+}
+
+AxisAlignedBoundingBox BoundingBoxArrays::Get(size_t i) const
+{
+    math::Vector4 center(m_center[0][i], m_center[1][i], m_center[2][i], 1.0f);
+    math::Vector4 extent(m_extent[0][i], m_extent[1][i], m_extent[2][i], 0.0f);
+
+    AxisAlignedBoundingBox box;
+    box.Grow(center - extent);
+    box.Grow(center + extent);
+    return box;
+}
+
+//
+// The rows of the view projection give the planes of the clip space tests of CameraFrustumToBoxCollision(),
+// i.e. x >= -w is (row3 + row0) . p >= 0
+//
+void GetFrustumPlanes(const math::Matrix4 &mCameraViewProj, FrustumPlanes *pFrustum)
+{
+    const math::Matrix4 rows = transpose(mCameraViewProj);
+    pFrustum->m_planes[0] = rows.getCol3() + rows.getCol0();   // left
+    pFrustum->m_planes[1] = rows.getCol3() - rows.getCol0();   // right
+    pFrustum->m_planes[2] = rows.getCol3() + rows.getCol1();   // bottom
+    pFrustum->m_planes[3] = rows.getCol3() - rows.getCol1();   // top
+    pFrustum->m_planes[4] = rows.getCol2();                    // z >= 0
+}
+
+//
+// The box is behind a plane when the distance of its center plus its extent projected on the normal is negative.
+// The SIMD versions do the same operations in the same order so all the paths give the same results.
+//
+static bool IsBoxVisible(const FrustumPlanes &frustum, const BoundingBoxArrays &boxes, size_t i)
+{
+    for (uint32_t p = 0; p < FrustumPlaneCount; p++)
+    {
+        const math::Vector4 &plane = frustum.m_planes[p];
+        float distance = plane.getW() + plane.getX() * boxes.m_center[0][i] + plane.getY() * boxes.m_center[1][i] + plane.getZ() * boxes.m_center[2][i];
+        float radius = fabsf(plane.getX()) * boxes.m_extent[0][i] + fabsf(plane.getY()) * boxes.m_extent[1][i] + fabsf(plane.getZ()) * boxes.m_extent[2][i];
+        if (distance + radius < 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+static size_t CullBoxesSSE(const FrustumPlanes &frustum, const BoundingBoxArrays &boxes, size_t first, size_t count, size_t i, uint32_t *pVisibleMask)
+{
+    __m128 a[FrustumPlaneCount], b[FrustumPlaneCount], c[FrustumPlaneCount], d[FrustumPlaneCount];
+    __m128 absA[FrustumPlaneCount], absB[FrustumPlaneCount], absC[FrustumPlaneCount];
+    for (uint32_t p = 0; p < FrustumPlaneCount; p++)
+    {
+        const math::Vector4 &plane = frustum.m_planes[p];
+        a[p] = _mm_set1_ps(plane.getX());
+        b[p] = _mm_set1_ps(plane.getY());
+        c[p] = _mm_set1_ps(plane.getZ());
+        d[p] = _mm_set1_ps(plane.getW());
+        absA[p] = _mm_set1_ps(fabsf(plane.getX()));
+        absB[p] = _mm_set1_ps(fabsf(plane.getY()));
+        absC[p] = _mm_set1_ps(fabsf(plane.getZ()));
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(&boxes.m_center[0][first + i]);
+        __m128 cy = _mm_loadu_ps(&boxes.m_center[1][first + i]);
+        __m128 cz = _mm_loadu_ps(&boxes.m_center[2][first + i]);
+        __m128 ex = _mm_loadu_ps(&boxes.m_extent[0][first + i]);
+        __m128 ey = _mm_loadu_ps(&boxes.m_extent[1][first + i]);
+        __m128 ez = _mm_loadu_ps(&boxes.m_extent[2][first + i]);
+
+        __m128 culled = zero;
+        for (uint32_t p = 0; p < FrustumPlaneCount; p++)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(d[p], _mm_mul_ps(a[p], cx)), _mm_mul_ps(b[p], cy)), _mm_mul_ps(c[p], cz));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absA[p], ex), _mm_mul_ps(absB[p], ey)), _mm_mul_ps(absC[p], ez));
+            culled = _mm_or_ps(culled, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+        }
+
+        uint32_t visible = ~(uint32_t)_mm_movemask_ps(culled) & 0xF;
+        pVisibleMask[i / 32] |= visible << (i % 32);
+    }
+
+    return i;
+}
+
+static size_t CullBoxesAVX2(const FrustumPlanes &frustum, const BoundingBoxArrays &boxes, size_t first, size_t count, size_t i, uint32_t *pVisibleMask)
+{
+    __m256 a[FrustumPlaneCount], b[FrustumPlaneCount], c[FrustumPlaneCount], d[FrustumPlaneCount];
+    __m256 absA[FrustumPlaneCount], absB[FrustumPlaneCount], absC[FrustumPlaneCount];
+    for (uint32_t p = 0; p < FrustumPlaneCount; p++)
+    {
+        const math::Vector4 &plane = frustum.m_planes[p];
+        a[p] = _mm256_set1_ps(plane.getX());
+        b[p] = _mm256_set1_ps(plane.getY());
+        c[p] = _mm256_set1_ps(plane.getZ());
+        d[p] = _mm256_set1_ps(plane.getW());
+        absA[p] = _mm256_set1_ps(fabsf(plane.getX()));
+        absB[p] = _mm256_set1_ps(fabsf(plane.getY()));
+        absC[p] = _mm256_set1_ps(fabsf(plane.getZ()));
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 cx = _mm256_loadu_ps(&boxes.m_center[0][first + i]);
+        __m256 cy = _mm256_loadu_ps(&boxes.m_center[1][first + i]);
+        __m256 cz = _mm256_loadu_ps(&boxes.m_center[2][first + i]);
+        __m256 ex = _mm256_loadu_ps(&boxes.m_extent[0][first + i]);
+        __m256 ey = _mm256_loadu_ps(&boxes.m_extent[1][first + i]);
+        __m256 ez = _mm256_loadu_ps(&boxes.m_extent[2][first + i]);
+
+        __m256 culled = zero;
+        for (uint32_t p = 0; p < FrustumPlaneCount; p++)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(d[p], _mm256_mul_ps(a[p], cx)), _mm256_mul_ps(b[p], cy)), _mm256_mul_ps(c[p], cz));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absA[p], ex), _mm256_mul_ps(absB[p], ey)), _mm256_mul_ps(absC[p], ez));
+            culled = _mm256_or_ps(culled, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+        }
+
+        uint32_t visible = ~(uint32_t)_mm256_movemask_ps(culled) & 0xFF;
+        pVisibleMask[i / 32] |= visible << (i % 32);
+    }
+
+    return i;
+}
+
+static bool HasAVX2()
+{
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bool bOSXSAVE = (info[2] & (1 << 27)) != 0;
+    bool bAVX = (info[2] & (1 << 28)) != 0;
+
+    // AVX2 also needs the OS to save the YMM registers
+    if (maxLeaf < 7 || !bAVX || !bOSXSAVE || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+void CullBoxes(const FrustumPlanes &frustum, const BoundingBoxArrays &boxes, size_t first, size_t count, uint32_t *pVisibleMask)
+{
+    static const bool bAVX2 = HasAVX2();
+
+    memset(pVisibleMask, 0, DivideRoundingUp<size_t>(count, 32) * sizeof(uint32_t));
+
+    // the AVX2 blocks leave a multiple of 8 boxes done, so the SSE blocks stay aligned on the 4 bit groups
+    size_t i = bAVX2 ? CullBoxesAVX2(frustum, boxes, first, count, 0, pVisibleMask) : 0;
+    i = CullBoxesSSE(frustum, boxes, first, count, i, pVisibleMask);
+
+    for (; i < count; i++)
+    {
+        if (IsBoxVisible(frustum, boxes, first + i))
+            pVisibleMask[i / 32] |= 1u << (i % 32);
+    }
+}
+
+AxisAlignedBoundingBox TransformBoundingBox(const math::Matrix4 &mTransform, const math::Vector4 &boxCenter, const math::Vector4 &boxExtent)
+{
+    math::Vector4 center = mTransform * math::Vector4(boxCenter.getXYZ(), 1.0f);
+    math::Vector4 extent = absPerElem(mTransform.getCol0()) * boxExtent.getX()
+                         + absPerElem(mTransform.getCol1()) * boxExtent.getY()
+                         + absPerElem(mTransform.getCol2()) * boxExtent.getZ();
+    extent.setW(0.0f);
+
+    AxisAlignedBoundingBox box;
+    box.Grow(center - extent);
+    box.Grow(center + extent);
+    return box;
+}
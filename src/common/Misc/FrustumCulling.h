@@ -0,0 +1,60 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "Misc.h"
+
+//
+// Batched frustum culling of world space boxes. The planes of a view projection are extracted once and the boxes are
+// stored as one array per component of their centers and extents, so 8 (AVX2) or 4 (SSE) boxes are tested at a time.
+//
+// The planes are those of CameraFrustumToBoxCollision(): left, right, bottom, top and z >= 0. There is no far plane,
+// which one it is depends on the depth convention (it is z = 0 with inverted depth). A box is culled when it is behind
+// one of the planes, that is when CameraFrustumToBoxCollision() would find its 8 corners outside of that plane.
+//
+
+static const uint32_t FrustumPlaneCount = 5;
+
+struct FrustumPlanes
+{
+    math::Vector4 m_planes[FrustumPlaneCount];  // (a, b, c, d), the points inside have a*x + b*y + c*z + d >= 0
+};
+
+struct BoundingBoxArrays
+{
+    std::vector<float> m_center[3];     // x, y and z of the centers
+    std::vector<float> m_extent[3];     // half sizes
+
+    size_t Size() const { return m_center[0].size(); }
+    void Resize(size_t count);
+    void Clear() { Resize(0); }
+    void Set(size_t i, const AxisAlignedBoundingBox &box);
+    AxisAlignedBoundingBox Get(size_t i) const;
+};
+
+void GetFrustumPlanes(const math::Matrix4 &mCameraViewProj, FrustumPlanes *pFrustum);
+
+// Tests the boxes [first, first + count), bit i of pVisibleMask is set when the box first + i is visible.
+// pVisibleMask must hold DivideRoundingUp(count, 32) words.
+void CullBoxes(const FrustumPlanes &frustum, const BoundingBoxArrays &boxes, size_t first, size_t count, uint32_t *pVisibleMask);
+
+// Box of the 8 transformed corners (x, y and z, w is ignored), from the transformed center and the absolute value of the
+// matrix applied to the extent instead of the corners themselves (Arvo, "Transforming Axis-Aligned Bounding Boxes")
+AxisAlignedBoundingBox TransformBoundingBox(const math::Matrix4 &mTransform, const math::Vector4 &boxCenter, const math::Vector4 &boxExtent);
@@ -38,4 +38,15 @@ ImgLoader *CreateImageLoader(const char *pFilename)
     }
 }
 
-
+ImgLoader *CreateImageLoader(const void *pData, size_t size)
+{
+    // there is no file extension, look at the magic number instead
+    if (size >= 4 && memcmp(pData, "DDS ", 4) == 0)
+    {
+        return new DDSLoader();
+    }
+    else
+    {
+        return new WICLoader();
+    }
+}
@@ -38,11 +38,14 @@ class ImgLoader
 public:
     virtual ~ImgLoader() {};
     virtual bool Load(const char *pFilename, float cutOff, IMG_INFO *pInfo) = 0;
+    // same as above but the encoded image is already in memory (i.e. embedded in a .glb), the memory must stay valid until the loader is deleted
+    virtual bool Load(const void *pData, size_t size, float cutOff, IMG_INFO *pInfo) = 0;
     // after calling Load, calls to CopyPixels return each time a lower mip level 
     virtual void CopyPixels(void *pDest, uint32_t stride, uint32_t width, uint32_t height) = 0;
 };
 
 
 ImgLoader *CreateImageLoader(const char *pFilename);
+ImgLoader *CreateImageLoader(const void *pData, size_t size);
 
 
@@ -0,0 +1,274 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "MeshOptimizer.h"
+
+//
+// FIFO post-transform cache simulation, a vertex is in the cache while less than cacheSize vertices have been
+// transformed since it was. Bumping the time by cacheSize + 1 flushes the cache.
+//
+static uint32_t CountCacheMisses(const uint32_t *pTriangle, uint32_t cacheSize, uint32_t *pCacheTime, uint32_t *pTime)
+{
+    uint32_t misses = 0;
+    for (int k = 0; k < 3; k++)
+    {
+        uint32_t v = pTriangle[k];
+        if (*pTime - pCacheTime[v] > cacheSize)
+        {
+            pCacheTime[v] = (*pTime)++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+void OptimizeVertexCache(uint32_t *pIndices, size_t indexCount, size_t vertexCount, uint32_t cacheSize, std::vector<uint32_t> *pClusters)
+{
+    pClusters->clear();
+
+    const size_t triangleCount = indexCount / 3;
+    indexCount = triangleCount * 3;
+    if (triangleCount == 0)
+        return;
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        if (pIndices[i] >= vertexCount)
+            return;
+    }
+
+    // triangles that use each vertex
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < indexCount; i++)
+        offsets[pIndices[i] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<uint32_t> adjacency(indexCount);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; i++)
+        adjacency[fill[pIndices[i]]++] = (uint32_t)(i / 3);
+
+    std::vector<uint32_t> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        live[v] = offsets[v + 1] - offsets[v];
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    deadEnd.reserve(indexCount);
+    output.reserve(indexCount);
+
+    uint32_t time = cacheSize + 1;
+    size_t cursor = 0;
+    int64_t fanning = pIndices[0];
+    bool bFlushed = true;
+    while (fanning >= 0)
+    {
+        // a cluster starts wherever the next vertex is not in the cache anymore
+        if (bFlushed)
+            pClusters->push_back((uint32_t)(output.size() / 3));
+
+        // emit all the remaining triangles around the fanning vertex
+        candidates.clear();
+        for (uint32_t k = offsets[fanning]; k < offsets[fanning + 1]; k++)
+        {
+            uint32_t t = adjacency[k];
+            if (emitted[t])
+                continue;
+
+            for (int j = 0; j < 3; j++)
+            {
+                uint32_t v = pIndices[t * 3 + j];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[t] = 1;
+        }
+
+        // the next fanning vertex is the candidate that has been in the cache the longest and that will still be
+        // there once its remaining triangles are emitted, or else any candidate with triangles left
+        int64_t next = -1;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+                continue;
+
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+
+        // dead end, go back to the most recent vertex with triangles left, or else to the next one in the mesh
+        while (next < 0 && !deadEnd.empty())
+        {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0)
+                next = v;
+        }
+        if (next < 0)
+        {
+            while (cursor < vertexCount && live[cursor] == 0)
+                cursor++;
+            if (cursor < vertexCount)
+                next = cursor;
+        }
+
+        bFlushed = next >= 0 && time - cacheTime[next] > cacheSize;
+        fanning = next;
+    }
+
+    memcpy(pIndices, output.data(), indexCount * sizeof(uint32_t));
+}
+
+void OptimizeOverdraw(uint32_t *pIndices, size_t indexCount, const float *pPositions, size_t vertexCount, uint32_t cacheSize, const std::vector<uint32_t> &clusters, float threshold)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || clusters.empty())
+        return;
+
+    // cache misses per triangle of the whole mesh
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    uint32_t meshMisses = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+        meshMisses += CountCacheMisses(&pIndices[t * 3], cacheSize, cacheTime.data(), &time);
+    const float maxAcmr = threshold * (float)meshMisses / (float)triangleCount;
+
+    // split the clusters as soon as they are about as cache efficient as the whole mesh, smaller clusters sort better
+    std::vector<uint32_t> softClusters;
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        uint32_t start = clusters[c];
+        uint32_t end = (c + 1 < clusters.size()) ? clusters[c + 1] : (uint32_t)triangleCount;
+
+        time += cacheSize + 1;
+        softClusters.push_back(start);
+        uint32_t clusterStart = start;
+        uint32_t clusterMisses = 0;
+        for (uint32_t t = start; t < end; t++)
+        {
+            clusterMisses += CountCacheMisses(&pIndices[t * 3], cacheSize, cacheTime.data(), &time);
+            if (t + 1 < end && (float)clusterMisses <= maxAcmr * (float)(t + 1 - clusterStart))
+            {
+                time += cacheSize + 1;
+                softClusters.push_back(t + 1);
+                clusterStart = t + 1;
+                clusterMisses = 0;
+            }
+        }
+    }
+
+    // area weighted centroid and normal of each cluster, and centroid of the whole mesh
+    const size_t clusterCount = softClusters.size();
+    std::vector<float> clusterData(clusterCount * 6, 0.0f);
+    float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        uint32_t start = softClusters[c];
+        uint32_t end = (c + 1 < clusterCount) ? softClusters[c + 1] : (uint32_t)triangleCount;
+        float *pCentroid = &clusterData[c * 6];
+        float *pNormal = &clusterData[c * 6 + 3];
+        float clusterArea = 0.0f;
+
+        for (uint32_t t = start; t < end; t++)
+        {
+            const float *p0 = &pPositions[pIndices[t * 3 + 0] * 3];
+            const float *p1 = &pPositions[pIndices[t * 3 + 1] * 3];
+            const float *p2 = &pPositions[pIndices[t * 3 + 2] * 3];
+
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+            for (int k = 0; k < 3; k++)
+            {
+                float center = (p0[k] + p1[k] + p2[k]) / 3.0f;
+                pCentroid[k] += center * area;
+                meshCentroid[k] += center * area;
+                pNormal[k] += n[k];
+            }
+            clusterArea += area;
+        }
+
+        meshArea += clusterArea;
+        for (int k = 0; k < 3; k++)
+            pCentroid[k] = (clusterArea > 0.0f) ? pCentroid[k] / clusterArea : 0.0f;
+    }
+    for (int k = 0; k < 3; k++)
+        meshCentroid[k] = (meshArea > 0.0f) ? meshCentroid[k] / meshArea : 0.0f;
+
+    // clusters that face away from the center are more likely to occlude the rest, draw them first
+    std::vector<float> sortKeys(clusterCount);
+    std::vector<uint32_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        const float *pCentroid = &clusterData[c * 6];
+        const float *pNormal = &clusterData[c * 6 + 3];
+        float length = sqrtf(pNormal[0] * pNormal[0] + pNormal[1] * pNormal[1] + pNormal[2] * pNormal[2]);
+        float key = 0.0f;
+        for (int k = 0; k < 3; k++)
+            key += (pCentroid[k] - meshCentroid[k]) * pNormal[k];
+        sortKeys[c] = (length > 0.0f) ? key / length : 0.0f;
+        order[c] = (uint32_t)c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(triangleCount * 3);
+    for (uint32_t c : order)
+    {
+        uint32_t start = softClusters[c];
+        uint32_t end = (c + 1 < clusterCount) ? softClusters[c + 1] : (uint32_t)triangleCount;
+        sorted.insert(sorted.end(), pIndices + start * 3, pIndices + end * 3);
+    }
+
+    memcpy(pIndices, sorted.data(), sorted.size() * sizeof(uint32_t));
+}
+
+size_t OptimizeVertexFetchRemap(uint32_t *pRemap, const uint32_t *pIndices, size_t indexCount, size_t vertexCount)
+{
+    memset(pRemap, 0xff, vertexCount * sizeof(uint32_t));
+
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        uint32_t v = pIndices[i];
+        if (v < vertexCount && pRemap[v] == ~0u)
+            pRemap[v] = next++;
+    }
+
+    return next;
+}
@@ -0,0 +1,41 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#pragma once
+
+#include <vector>
+
+//
+// Load time reordering of indexed triangle lists, based on "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw" (Sander, Nehab, Barczak 2007). The three steps are meant to be run in this order:
+//
+//  1) OptimizeVertexCache, reorders the triangles for the post-transform cache and returns the clusters it made
+//  2) OptimizeOverdraw, splits the clusters further and sorts them so the triangles facing out of the mesh come first
+//  3) OptimizeVertexFetchRemap, numbers the vertices in the order the indices use them for the pre-transform fetch
+//
+
+// Tipsify with a cache of cacheSize vertices, the triangles are reordered in place. pClusters receives the index of the
+// first triangle of each cluster (a run of triangles that ends where the algorithm had to jump elsewhere in the mesh).
+void OptimizeVertexCache(uint32_t *pIndices, size_t indexCount, size_t vertexCount, uint32_t cacheSize, std::vector<uint32_t> *pClusters);
+
+// Splits the clusters where their cache efficiency is within threshold (i.e. 1.05) of the whole mesh's and sorts them by
+// how much they face away from the center of the mesh. pPositions holds xyz floats per vertex.
+void OptimizeOverdraw(uint32_t *pIndices, size_t indexCount, const float *pPositions, size_t vertexCount, uint32_t cacheSize, const std::vector<uint32_t> &clusters, float threshold);
+
+// pRemap receives the new index of every vertex, ~0u for the ones the indices don't use. Returns the number of used vertices.
+size_t OptimizeVertexFetchRemap(uint32_t *pRemap, const uint32_t *pIndices, size_t indexCount, size_t vertexCount);
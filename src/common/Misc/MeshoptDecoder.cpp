@@ -0,0 +1,566 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "MeshoptDecoder.h"
+
+#include <intrin.h>
+
+//
+// Vertex codec. The vertices are split in blocks, each byte of the vertex is delta coded against the same byte of the
+// previous vertex, zigzag encoded, and the bytes of a block are stored per byte position in groups of 16. A 2 bit
+// header per group says how its bytes are packed: all zeros, 2 bits, 4 bits (the max value escapes to a full byte
+// stored after the packed bits), or 16 raw bytes.
+//
+static const uint8_t VERTEX_HEADER = 0xA0;
+static const size_t VERTEX_BLOCK_SIZE_BYTES = 8192;
+static const size_t VERTEX_BLOCK_MAX_SIZE = 256;
+static const size_t BYTE_GROUP_SIZE = 16;
+static const size_t BYTE_GROUP_DECODE_LIMIT = 24;   // a group never reads more than this, so only one check per group is needed
+static const size_t VERTEX_TAIL_MAX_SIZE = 32;
+
+static size_t GetVertexBlockSize(size_t stride)
+{
+    size_t result = (VERTEX_BLOCK_SIZE_BYTES / stride) & ~(BYTE_GROUP_SIZE - 1);
+    return std::min(result, VERTEX_BLOCK_MAX_SIZE);
+}
+
+static const uint8_t *DecodeBytesGroupScalar(const uint8_t *pData, uint8_t *pOut, int bitslog2)
+{
+    switch (bitslog2)
+    {
+    case 0:
+        memset(pOut, 0, BYTE_GROUP_SIZE);
+        return pData;
+    case 1:
+    case 2:
+    {
+        // values are packed from the most significant bits, the ones that are all ones escape to the next extra byte
+        int bits = 1 << bitslog2;
+        uint8_t escape = (uint8_t)((1 << bits) - 1);
+        const uint8_t *pExtra = pData + BYTE_GROUP_SIZE * bits / 8;
+        for (size_t i = 0; i < BYTE_GROUP_SIZE; i++)
+        {
+            size_t bit = i * bits;
+            uint8_t value = (pData[bit / 8] >> (8 - bits - bit % 8)) & escape;
+            pOut[i] = (value == escape) ? *pExtra++ : value;
+        }
+        return pExtra;
+    }
+    default:
+        memcpy(pOut, pData, BYTE_GROUP_SIZE);
+        return pData + BYTE_GROUP_SIZE;
+    }
+}
+
+//
+// SSSE3 group decoding, the packed values are spread to one byte each and the escaped ones are filled with a shuffle
+// that gathers the extra bytes. The shuffle for each half of the group comes from a table indexed by its escape mask.
+//
+struct ByteGroupTables
+{
+    uint8_t m_shuffle[256][8];
+    uint8_t m_count[256];
+
+    ByteGroupTables()
+    {
+        for (int mask = 0; mask < 256; mask++)
+        {
+            uint8_t count = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                bool bEscaped = ((mask >> i) & 1) != 0;
+                m_shuffle[mask][i] = bEscaped ? count : 0x80;
+                count += bEscaped ? 1 : 0;
+            }
+            m_count[mask] = count;
+        }
+    }
+};
+
+static const ByteGroupTables s_byteGroupTables;
+
+static const uint8_t *FillEscapedBytes(const uint8_t *pExtra, uint8_t *pOut, __m128i sel, __m128i escape)
+{
+    __m128i rest = _mm_loadu_si128((const __m128i *)pExtra);
+
+    __m128i mask = _mm_cmpeq_epi8(sel, escape);
+    int mask16 = _mm_movemask_epi8(mask);
+    uint8_t mask0 = (uint8_t)(mask16 & 255);
+    uint8_t mask1 = (uint8_t)(mask16 >> 8);
+
+    // the second half gathers the extra bytes that follow the ones of the first half, 0x80 + n still clears the byte
+    __m128i shuffle0 = _mm_loadl_epi64((const __m128i *)s_byteGroupTables.m_shuffle[mask0]);
+    __m128i shuffle1 = _mm_loadl_epi64((const __m128i *)s_byteGroupTables.m_shuffle[mask1]);
+    shuffle1 = _mm_add_epi8(shuffle1, _mm_set1_epi8((char)s_byteGroupTables.m_count[mask0]));
+    __m128i shuffle = _mm_unpacklo_epi64(shuffle0, shuffle1);
+
+    __m128i result = _mm_or_si128(_mm_shuffle_epi8(rest, shuffle), _mm_andnot_si128(mask, sel));
+    _mm_storeu_si128((__m128i *)pOut, result);
+
+    return pExtra + s_byteGroupTables.m_count[mask0] + s_byteGroupTables.m_count[mask1];
+}
+
+static const uint8_t *DecodeBytesGroupSSSE3(const uint8_t *pData, uint8_t *pOut, int bitslog2)
+{
+    switch (bitslog2)
+    {
+    case 0:
+        _mm_storeu_si128((__m128i *)pOut, _mm_setzero_si128());
+        return pData;
+    case 1:
+    {
+        // 4 bytes of 2 bit values, the shifts spread them to one byte each in order
+        __m128i sel2 = _mm_cvtsi32_si128(*(const int *)pData);
+        __m128i sel22 = _mm_unpacklo_epi8(_mm_srli_epi16(sel2, 4), sel2);
+        __m128i sel2222 = _mm_unpacklo_epi8(_mm_srli_epi16(sel22, 2), sel22);
+        __m128i sel = _mm_and_si128(sel2222, _mm_set1_epi8(3));
+        return FillEscapedBytes(pData + 4, pOut, sel, _mm_set1_epi8(3));
+    }
+    case 2:
+    {
+        // 8 bytes of 4 bit values
+        __m128i sel4 = _mm_loadl_epi64((const __m128i *)pData);
+        __m128i sel44 = _mm_unpacklo_epi8(_mm_srli_epi16(sel4, 4), sel4);
+        __m128i sel = _mm_and_si128(sel44, _mm_set1_epi8(15));
+        return FillEscapedBytes(pData + 8, pOut, sel, _mm_set1_epi8(15));
+    }
+    default:
+        _mm_storeu_si128((__m128i *)pOut, _mm_loadu_si128((const __m128i *)pData));
+        return pData + BYTE_GROUP_SIZE;
+    }
+}
+
+typedef const uint8_t *(*DecodeBytesGroupFn)(const uint8_t *pData, uint8_t *pOut, int bitslog2);
+
+static const uint8_t *DecodeBytes(const uint8_t *pData, const uint8_t *pEnd, uint8_t *pOut, size_t size, DecodeBytesGroupFn decodeGroup)
+{
+    // 4 group headers per byte
+    const uint8_t *pHeader = pData;
+    size_t headerSize = (size / BYTE_GROUP_SIZE + 3) / 4;
+    if ((size_t)(pEnd - pData) < headerSize)
+        return NULL;
+
+    pData += headerSize;
+    for (size_t i = 0; i < size; i += BYTE_GROUP_SIZE)
+    {
+        if ((size_t)(pEnd - pData) < BYTE_GROUP_DECODE_LIMIT)
+            return NULL;
+
+        size_t group = i / BYTE_GROUP_SIZE;
+        int bitslog2 = (pHeader[group / 4] >> ((group % 4) * 2)) & 3;
+        pData = decodeGroup(pData, pOut + i, bitslog2);
+    }
+
+    return pData;
+}
+
+static const uint8_t *DecodeVertexBlock(const uint8_t *pData, const uint8_t *pEnd, uint8_t *pOut, size_t count, size_t stride, uint8_t *pLastVertex, DecodeBytesGroupFn decodeGroup)
+{
+    uint8_t bytes[VERTEX_BLOCK_MAX_SIZE];
+    size_t alignedCount = (count + BYTE_GROUP_SIZE - 1) & ~(BYTE_GROUP_SIZE - 1);
+
+    for (size_t k = 0; k < stride; k++)
+    {
+        pData = DecodeBytes(pData, pEnd, bytes, alignedCount, decodeGroup);
+        if (pData == NULL)
+            return NULL;
+
+        // undo the zigzag and the delta, and transpose back to vertices
+        uint8_t prev = pLastVertex[k];
+        for (size_t i = 0; i < count; i++)
+        {
+            uint8_t v = (uint8_t)(-(bytes[i] & 1) ^ (bytes[i] >> 1)) + prev;
+            pOut[i * stride + k] = v;
+            prev = v;
+        }
+    }
+
+    memcpy(pLastVertex, pOut + (count - 1) * stride, stride);
+    return pData;
+}
+
+static bool HasSSSE3()
+{
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+}
+
+bool MeshoptDecodeVertexBuffer(void *pDst, size_t count, size_t stride, const uint8_t *pSrc, size_t srcSize)
+{
+    static const DecodeBytesGroupFn decodeGroup = HasSSSE3() ? DecodeBytesGroupSSSE3 : DecodeBytesGroupScalar;
+
+    if (stride == 0 || stride > 256 || (stride % 4) != 0)
+        return false;
+
+    const uint8_t *pData = pSrc;
+    const uint8_t *pEnd = pSrc + srcSize;
+    if (srcSize < 1 + stride)
+        return false;
+
+    // only version 0 of the codec exists
+    if (*pData++ != VERTEX_HEADER)
+        return false;
+
+    // the tail holds the vertex the deltas of the first block are relative to
+    uint8_t lastVertex[256];
+    memcpy(lastVertex, pEnd - stride, stride);
+
+    uint8_t *pOut = (uint8_t *)pDst;
+    size_t blockSize = GetVertexBlockSize(stride);
+    for (size_t first = 0; first < count; first += blockSize)
+    {
+        size_t blockCount = std::min(blockSize, count - first);
+        pData = DecodeVertexBlock(pData, pEnd, pOut + first * stride, blockCount, stride, lastVertex, decodeGroup);
+        if (pData == NULL)
+            return false;
+    }
+
+    return (size_t)(pEnd - pData) == std::max(VERTEX_TAIL_MAX_SIZE, stride);
+}
+
+//
+// Index codecs, indices are either written as small varints or as references into fifos of recent vertices and edges
+//
+static const uint8_t INDEX_HEADER = 0xE0;
+static const uint8_t SEQUENCE_HEADER = 0xD0;
+
+static uint32_t DecodeVByte(const uint8_t *&pData)
+{
+    uint8_t lead = *pData++;
+    if (lead < 128)
+        return lead;
+
+    // at most 4 more bytes, even on invalid data
+    uint32_t result = lead & 127;
+    uint32_t shift = 7;
+    for (int i = 0; i < 4; i++)
+    {
+        uint8_t group = *pData++;
+        result |= (uint32_t)(group & 127) << shift;
+        shift += 7;
+        if (group < 128)
+            break;
+    }
+
+    return result;
+}
+
+static uint32_t DecodeIndex(const uint8_t *&pData, uint32_t last)
+{
+    uint32_t v = DecodeVByte(pData);
+    uint32_t delta = (v >> 1) ^ (uint32_t)-(int32_t)(v & 1);
+    return last + delta;
+}
+
+static void WriteIndex(void *pDst, size_t i, size_t indexSize, uint32_t index)
+{
+    if (indexSize == 2)
+        ((uint16_t *)pDst)[i] = (uint16_t)index;
+    else
+        ((uint32_t *)pDst)[i] = index;
+}
+
+struct IndexFifos
+{
+    uint32_t m_edges[16][2];
+    uint32_t m_vertices[16];
+    size_t m_edgeOffset = 0;
+    size_t m_vertexOffset = 0;
+
+    IndexFifos()
+    {
+        memset(m_edges, -1, sizeof(m_edges));
+        memset(m_vertices, -1, sizeof(m_vertices));
+    }
+
+    // the fifos have to be updated exactly as the encoder did
+    void PushVertex(uint32_t v, bool bPush = true)
+    {
+        m_vertices[m_vertexOffset] = v;
+        m_vertexOffset = (m_vertexOffset + (bPush ? 1 : 0)) & 15;
+    }
+
+    void PushEdge(uint32_t a, uint32_t b)
+    {
+        m_edges[m_edgeOffset][0] = a;
+        m_edges[m_edgeOffset][1] = b;
+        m_edgeOffset = (m_edgeOffset + 1) & 15;
+    }
+
+    void PushTriangle(uint32_t a, uint32_t b, uint32_t c)
+    {
+        PushEdge(b, a);
+        PushEdge(c, b);
+        PushEdge(a, c);
+    }
+
+    uint32_t Vertex(int i) const { return m_vertices[(m_vertexOffset - i) & 15]; }
+};
+
+bool MeshoptDecodeIndexBuffer(void *pDst, size_t count, size_t indexSize, const uint8_t *pSrc, size_t srcSize)
+{
+    if ((count % 3) != 0 || (indexSize != 2 && indexSize != 4))
+        return false;
+
+    // header, one code per triangle and the 16 byte table of the most common extra codes
+    if (srcSize < 1 + count / 3 + 16)
+        return false;
+    if ((pSrc[0] & 0xF0) != INDEX_HEADER)
+        return false;
+
+    int version = pSrc[0] & 0x0F;
+    if (version > 1)
+        return false;
+
+    // version 1 uses the last two vertex fifo codes for +1/-1 deltas from the last free index
+    int fecMax = (version >= 1) ? 13 : 15;
+
+    IndexFifos fifos;
+    uint32_t next = 0;
+    uint32_t last = 0;
+
+    const uint8_t *pCode = pSrc + 1;
+    const uint8_t *pData = pCode + count / 3;
+    const uint8_t *pDataSafeEnd = pSrc + srcSize - 16;
+    const uint8_t *pCodeAuxTable = pDataSafeEnd;
+
+    for (size_t i = 0; i < count; i += 3)
+    {
+        // a triangle reads at most 16 bytes, which the table guarantees
+        if (pData > pDataSafeEnd)
+            return false;
+
+        uint8_t codeTri = *pCode++;
+        if (codeTri < 0xF0)
+        {
+            // an edge from the fifo and a third vertex that is new, in the fifo or a free index
+            int fe = codeTri >> 4;
+            uint32_t a = fifos.m_edges[(fifos.m_edgeOffset - 1 - fe) & 15][0];
+            uint32_t b = fifos.m_edges[(fifos.m_edgeOffset - 1 - fe) & 15][1];
+
+            int fec = codeTri & 15;
+            uint32_t c;
+            if (fec < fecMax)
+            {
+                c = (fec == 0) ? next++ : fifos.Vertex(1 + fec);
+                fifos.PushVertex(c, fec == 0);
+            }
+            else
+            {
+                // 13 and 14 decode to -1 and +1
+                c = last = (fec != 15) ? last + (fec - (fec ^ 3)) : DecodeIndex(pData, last);
+                fifos.PushVertex(c);
+            }
+
+            WriteIndex(pDst, i + 0, indexSize, a);
+            WriteIndex(pDst, i + 1, indexSize, b);
+            WriteIndex(pDst, i + 2, indexSize, c);
+            fifos.PushEdge(c, b);
+            fifos.PushEdge(a, c);
+        }
+        else if (codeTri < 0xFE)
+        {
+            // no edge reuse, the first vertex is new and the codes of the others are in the table
+            uint8_t codeAux = pCodeAuxTable[codeTri & 15];
+            int feb = codeAux >> 4;
+            int fec = codeAux & 15;
+
+            uint32_t a = next++;
+            uint32_t b = (feb == 0) ? next++ : fifos.Vertex(feb);
+            uint32_t c = (fec == 0) ? next++ : fifos.Vertex(fec);
+
+            WriteIndex(pDst, i + 0, indexSize, a);
+            WriteIndex(pDst, i + 1, indexSize, b);
+            WriteIndex(pDst, i + 2, indexSize, c);
+
+            fifos.PushVertex(a);
+            fifos.PushVertex(b, feb == 0);
+            fifos.PushVertex(c, fec == 0);
+            fifos.PushTriangle(a, b, c);
+        }
+        else
+        {
+            // same as above but the codes are in the data, 15 means a free index and a zero byte resets the counter
+            uint8_t codeAux = *pData++;
+            int fea = (codeTri == 0xFE) ? 0 : 15;
+            int feb = codeAux >> 4;
+            int fec = codeAux & 15;
+
+            if (codeAux == 0)
+                next = 0;
+
+            uint32_t a = (fea == 0) ? next++ : 0;
+            uint32_t b = (feb == 0) ? next++ : fifos.Vertex(feb);
+            uint32_t c = (fec == 0) ? next++ : fifos.Vertex(fec);
+
+            if (fea == 15)
+                last = a = DecodeIndex(pData, last);
+            if (feb == 15)
+                last = b = DecodeIndex(pData, last);
+            if (fec == 15)
+                last = c = DecodeIndex(pData, last);
+
+            WriteIndex(pDst, i + 0, indexSize, a);
+            WriteIndex(pDst, i + 1, indexSize, b);
+            WriteIndex(pDst, i + 2, indexSize, c);
+
+            fifos.PushVertex(a);
+            fifos.PushVertex(b, feb == 0 || feb == 15);
+            fifos.PushVertex(c, fec == 0 || fec == 15);
+            fifos.PushTriangle(a, b, c);
+        }
+    }
+
+    // all the data must have been used, up to the table
+    return pData == pDataSafeEnd;
+}
+
+bool MeshoptDecodeIndexSequence(void *pDst, size_t count, size_t indexSize, const uint8_t *pSrc, size_t srcSize)
+{
+    if (indexSize != 2 && indexSize != 4)
+        return false;
+
+    // header, at least a byte per index and a 4 byte tail
+    if (srcSize < 1 + count + 4)
+        return false;
+    if ((pSrc[0] & 0xF0) != SEQUENCE_HEADER || (pSrc[0] & 0x0F) > 1)
+        return false;
+
+    const uint8_t *pData = pSrc + 1;
+    const uint8_t *pDataSafeEnd = pSrc + srcSize - 4;
+
+    // the lowest bit picks which of the two baselines the delta is relative to
+    uint32_t last[2] = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        if (pData >= pDataSafeEnd)
+            return false;
+
+        uint32_t v = DecodeVByte(pData);
+        uint32_t baseline = v & 1;
+        v >>= 1;
+
+        uint32_t index = last[baseline] + ((v >> 1) ^ (uint32_t)-(int32_t)(v & 1));
+        last[baseline] = index;
+        WriteIndex(pDst, i, indexSize, index);
+    }
+
+    return pData == pDataSafeEnd;
+}
+
+//
+// Filters
+//
+template<typename T> static void DecodeOctahedral(T *pData, size_t count)
+{
+    const float maxValue = (float)((1 << (sizeof(T) * 8 - 1)) - 1);
+
+    for (size_t i = 0; i < count; i++, pData += 4)
+    {
+        // z stores 1.0 at the same precision as x and y, which are folded for the lower hemisphere
+        float x = (float)pData[0];
+        float y = (float)pData[1];
+        float z = (float)pData[2] - fabsf(x) - fabsf(y);
+
+        float t = (z >= 0.0f) ? 0.0f : z;
+        x += (x >= 0.0f) ? t : -t;
+        y += (y >= 0.0f) ? t : -t;
+
+        float scale = maxValue / sqrtf(x * x + y * y + z * z);
+        pData[0] = (T)(int)(x * scale + (x >= 0.0f ? 0.5f : -0.5f));
+        pData[1] = (T)(int)(y * scale + (y >= 0.0f ? 0.5f : -0.5f));
+        pData[2] = (T)(int)(z * scale + (z >= 0.0f ? 0.5f : -0.5f));
+    }
+}
+
+static void DecodeQuaternion(int16_t *pData, size_t count)
+{
+    const float invSqrt2 = 0.70710678f;
+
+    for (size_t i = 0; i < count; i++, pData += 4)
+    {
+        // the 4th component holds the index of the dropped (largest) component in its 2 low bits, the rest is the scale
+        int scaleBits = pData[3] | 3;
+        float scale = invSqrt2 / (float)scaleBits;
+
+        float x = pData[0] * scale;
+        float y = pData[1] * scale;
+        float z = pData[2] * scale;
+        float ww = 1.0f - x * x - y * y - z * z;
+        float w = sqrtf(std::max(ww, 0.0f));
+
+        int16_t xi = (int16_t)(int)(x * 32767.0f + (x >= 0.0f ? 0.5f : -0.5f));
+        int16_t yi = (int16_t)(int)(y * 32767.0f + (y >= 0.0f ? 0.5f : -0.5f));
+        int16_t zi = (int16_t)(int)(z * 32767.0f + (z >= 0.0f ? 0.5f : -0.5f));
+        int16_t wi = (int16_t)(int)(w * 32767.0f + 0.5f);
+
+        int largest = pData[3] & 3;
+        pData[(largest + 1) & 3] = xi;
+        pData[(largest + 2) & 3] = yi;
+        pData[(largest + 3) & 3] = zi;
+        pData[(largest + 0) & 3] = wi;
+    }
+}
+
+static void DecodeExponential(uint32_t *pData, size_t count)
+{
+    // 24 bit signed mantissa and 8 bit signed exponent, the power of two is built straight into the float bits
+    for (size_t i = 0; i < count; i++)
+    {
+        int32_t mantissa = (int32_t)(pData[i] << 8) >> 8;
+        int32_t exponent = (int32_t)pData[i] >> 24;
+
+        uint32_t bits = (uint32_t)(exponent + 127) << 23;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        value *= (float)mantissa;
+        memcpy(&pData[i], &value, sizeof(value));
+    }
+}
+
+bool MeshoptDecodeFilter(void *pData, size_t count, size_t stride, MeshoptFilter filter)
+{
+    switch (filter)
+    {
+    case MESHOPT_FILTER_NONE:
+        return true;
+    case MESHOPT_FILTER_OCTAHEDRAL:
+        if (stride == 4)
+            DecodeOctahedral((int8_t *)pData, count);
+        else if (stride == 8)
+            DecodeOctahedral((int16_t *)pData, count);
+        else
+            return false;
+        return true;
+    case MESHOPT_FILTER_QUATERNION:
+        if (stride != 8)
+            return false;
+        DecodeQuaternion((int16_t *)pData, count);
+        return true;
+    case MESHOPT_FILTER_EXPONENTIAL:
+        if ((stride % 4) != 0)
+            return false;
+        DecodeExponential((uint32_t *)pData, count * stride / 4);
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,45 @@
+// AMD Cauldron code
+// 
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#pragma once
+
+//
+// Decoders for the EXT_meshopt_compression bitstreams (the meshoptimizer vertex and index codecs, and its filters).
+// The byte groups of the vertex codec are unpacked with SSSE3 shuffles when the CPU supports it.
+// All the functions return false when the data is truncated or is not a stream they understand.
+//
+
+enum MeshoptFilter
+{
+    MESHOPT_FILTER_NONE,
+    MESHOPT_FILTER_OCTAHEDRAL,
+    MESHOPT_FILTER_QUATERNION,
+    MESHOPT_FILTER_EXPONENTIAL,
+};
+
+// "ATTRIBUTES" mode, writes count elements of stride bytes, stride must be a multiple of 4 and at most 256
+bool MeshoptDecodeVertexBuffer(void *pDst, size_t count, size_t stride, const uint8_t *pSrc, size_t srcSize);
+
+// "TRIANGLES" mode, count is the number of indices (a multiple of 3), indexSize is 2 or 4
+bool MeshoptDecodeIndexBuffer(void *pDst, size_t count, size_t indexSize, const uint8_t *pSrc, size_t srcSize);
+
+// "INDICES" mode, count is the number of indices, indexSize is 2 or 4
+bool MeshoptDecodeIndexSequence(void *pDst, size_t count, size_t indexSize, const uint8_t *pSrc, size_t srcSize);
+
+// Undoes a filter in place on count elements of stride bytes that have been decoded with MeshoptDecodeVertexBuffer
+bool MeshoptDecodeFilter(void *pData, size_t count, size_t stride, MeshoptFilter filter);
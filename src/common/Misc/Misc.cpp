@@ -19,6 +19,7 @@
 
 #include "stdafx.h"
 #include "Misc.h"
+#include "FrustumCulling.h"
 
 //
 // Get current time in milliseconds
@@ -347,29 +348,10 @@ bool AxisAlignedBoundingBox::HasNoVolume() const
         || (m_max.getX() == m_min.getX() && m_max.getY() == m_min.getY() && m_max.getZ() == m_min.getZ());
 }
 
+// the box of the 8 transformed corners, computed without transforming them
 AxisAlignedBoundingBox GetAABBInGivenSpace(const math::Matrix4& mTransform, const math::Vector4& boxCenter, const math::Vector4& boxExtent)
 {
-    float ex = boxExtent.getX();
-    float ey = boxExtent.getY();
-    float ez = boxExtent.getZ();
-
-    AxisAlignedBoundingBox aabb;
-
-    // get the position of each corner of the bounding box in the camera space
-    math::Vector4 p[8];
-    p[0] = mTransform * (boxCenter + math::Vector4(ex, ey, ez, 0));
-    p[1] = mTransform * (boxCenter + math::Vector4(ex, ey, -ez, 0));
-    p[2] = mTransform * (boxCenter + math::Vector4(ex, -ey, ez, 0));
-    p[3] = mTransform * (boxCenter + math::Vector4(ex, -ey, -ez, 0));
-    p[4] = mTransform * (boxCenter + math::Vector4(-ex, ey, ez, 0));
-    p[5] = mTransform * (boxCenter + math::Vector4(-ex, ey, -ez, 0));
-    p[6] = mTransform * (boxCenter + math::Vector4(-ex, -ey, ez, 0));
-    p[7] = mTransform * (boxCenter + math::Vector4(-ex, -ey, -ez, 0));
-
-    for (int i = 0; i < 8; ++i)
-        aabb.Grow(p[i]);
-    
-    return aabb;
+    return TransformBoundingBox(mTransform, boxCenter, boxExtent);
 }
 
 
@@ -0,0 +1,322 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "stdafx.h"
+#include "OcclusionCulling.h"
+#include "Async.h"
+
+#include <intrin.h>
+
+static const float MinW = 1.0e-5f;          // the vertices and corners nearer than this are considered behind the camera
+static const float GuardBand = 8192.0f;     // the triangles reaching farther than this out of the screen are skipped
+static const float DepthBias = 1.0e-3f;     // relative, keeps the occluders from hiding their own boxes
+static const uint32_t RowsPerBatch = 8;     // rows rasterized by each job
+
+void OcclusionBuffer::OnCreate(uint32_t width, uint32_t height)
+{
+    m_width = AlignUp<uint32_t>(std::max(width, 4u), 4);
+    m_height = std::max(height, 1u);
+    m_depth.assign(m_width * m_height, 0.0f);
+    m_bValid = false;
+}
+
+void OcclusionBuffer::OnDestroy()
+{
+    m_width = 0;
+    m_height = 0;
+    m_depth.clear();
+    m_bValid = false;
+
+    m_occluders.clear();
+    m_vertices.clear();
+    m_triangles.clear();
+}
+
+void OcclusionBuffer::Begin(const math::Matrix4 &mCameraViewProj)
+{
+    std::fill(m_depth.begin(), m_depth.end(), 0.0f);
+    m_viewProj = mCameraViewProj;
+    m_bValid = false;
+    m_occluders.clear();
+}
+
+void OcclusionBuffer::AddOccluder(const math::Matrix4 &mWorld, const float *pPositions, uint32_t vertexCount, const uint32_t *pIndices, uint32_t indexCount)
+{
+    if (vertexCount == 0 || indexCount < 3)
+        return;
+
+    m_occluders.push_back({ mWorld, pPositions, vertexCount, pIndices, indexCount - indexCount % 3 });
+}
+
+//
+// Projects the vertices of an occluder and computes the edge functions and the 1/w plane of its triangles. They are
+// biased so that evaluated at the top left corner of a pixel they give their minimum over the whole pixel: the edges
+// are then all positive only for the pixels the triangle fully covers, and 1/w is the farthest the triangle gets in
+// the pixel.
+//
+void OcclusionBuffer::SetupTriangles(const Occluder &occluder, math::Vector4 *pVertices, Triangle *pTriangles) const
+{
+    const math::Matrix4 mTransform = m_viewProj * occluder.m_world;
+    const float halfWidth = 0.5f * (float)m_width;
+    const float halfHeight = 0.5f * (float)m_height;
+
+    for (uint32_t v = 0; v < occluder.m_vertexCount; v++)
+    {
+        const float *pPosition = &occluder.m_pPositions[v * 3];
+        math::Vector4 clip = mTransform * math::Vector4(pPosition[0], pPosition[1], pPosition[2], 1.0f);
+        float w = clip.getW();
+        if (w <= MinW)
+        {
+            pVertices[v] = math::Vector4(0.0f, 0.0f, 0.0f, -1.0f);
+            continue;
+        }
+
+        // the rows go down the screen
+        float invW = 1.0f / w;
+        pVertices[v] = math::Vector4((clip.getX() * invW + 1.0f) * halfWidth, (1.0f - clip.getY() * invW) * halfHeight, invW, w);
+    }
+
+    for (uint32_t t = 0; t < occluder.m_indexCount / 3; t++)
+    {
+        Triangle &triangle = pTriangles[t];
+        triangle.m_minX = triangle.m_minY = 0;
+        triangle.m_maxX = triangle.m_maxY = -1;
+
+        const uint32_t *pIndices = &occluder.m_pIndices[t * 3];
+        if (pIndices[0] >= occluder.m_vertexCount || pIndices[1] >= occluder.m_vertexCount || pIndices[2] >= occluder.m_vertexCount)
+            continue;
+
+        math::Vector4 v[3];
+        bool bSkip = false;
+        for (int k = 0; k < 3; k++)
+        {
+            v[k] = pVertices[pIndices[k]];
+            bSkip |= v[k].getW() < 0.0f;
+            bSkip |= fabsf(v[k].getX() - halfWidth) > GuardBand || fabsf(v[k].getY() - halfHeight) > GuardBand;
+        }
+        if (bSkip)
+            continue;
+
+        float area = (v[1].getX() - v[0].getX()) * (v[2].getY() - v[0].getY()) - (v[2].getX() - v[0].getX()) * (v[1].getY() - v[0].getY());
+        if (fabsf(area) < 1.0e-6f)
+            continue;
+
+        // edge k is the one facing vertex k, it is positive inside the triangle whatever its winding
+        const float sign = (area > 0.0f) ? 1.0f : -1.0f;
+        float plane[3] = { 0.0f, 0.0f, 0.0f };
+        for (int k = 0; k < 3; k++)
+        {
+            const math::Vector4 &a = v[(k + 1) % 3];
+            const math::Vector4 &b = v[(k + 2) % 3];
+            float *pEdge = triangle.m_edges[k];
+            pEdge[0] = sign * (a.getY() - b.getY());
+            pEdge[1] = sign * (b.getX() - a.getX());
+            pEdge[2] = sign * (a.getX() * b.getY() - b.getX() * a.getY());
+
+            // the edge functions divided by the area are the barycentric coordinates
+            float weight = v[k].getZ() / fabsf(area);
+            for (int c = 0; c < 3; c++)
+                plane[c] += pEdge[c] * weight;
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            float *pEdge = triangle.m_edges[k];
+            pEdge[2] += std::min(pEdge[0], 0.0f) + std::min(pEdge[1], 0.0f);
+        }
+        plane[2] += std::min(plane[0], 0.0f) + std::min(plane[1], 0.0f);
+        memcpy(triangle.m_invW, plane, sizeof(plane));
+
+        float minX = std::min(std::min(v[0].getX(), v[1].getX()), v[2].getX());
+        float maxX = std::max(std::max(v[0].getX(), v[1].getX()), v[2].getX());
+        float minY = std::min(std::min(v[0].getY(), v[1].getY()), v[2].getY());
+        float maxY = std::max(std::max(v[0].getY(), v[1].getY()), v[2].getY());
+        triangle.m_minX = std::max((int)floorf(minX), 0);
+        triangle.m_maxX = std::min((int)floorf(maxX), (int)m_width - 1);
+        triangle.m_minY = std::max((int)floorf(minY), 0);
+        triangle.m_maxY = std::min((int)floorf(maxY), (int)m_height - 1);
+    }
+}
+
+//
+// Every band of rows goes through all the triangles, the pixels are tested at their top left corner 4 at a time (see
+// SetupTriangles()) and keep the nearest occluder, that is the largest 1/w
+//
+void OcclusionBuffer::RasterizeRows(uint32_t firstRow, uint32_t lastRow)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+    for (const Triangle &triangle : m_triangles)
+    {
+        const int minY = std::max(triangle.m_minY, (int)firstRow);
+        const int maxY = std::min(triangle.m_maxY, (int)lastRow - 1);
+        if (triangle.m_maxX < triangle.m_minX || maxY < minY)
+            continue;
+
+        __m128 a[3], b[3], c[3];
+        for (int k = 0; k < 3; k++)
+        {
+            a[k] = _mm_set1_ps(triangle.m_edges[k][0]);
+            b[k] = _mm_set1_ps(triangle.m_edges[k][1]);
+            c[k] = _mm_set1_ps(triangle.m_edges[k][2]);
+        }
+        const __m128 depthA = _mm_set1_ps(triangle.m_invW[0]);
+
+        // the rows are a multiple of 4 pixels, so the blocks starting on a multiple of 4 never go past them
+        const int firstX = triangle.m_minX & ~3;
+        for (int y = minY; y <= maxY; y++)
+        {
+            const float cornerY = (float)y;
+            __m128 rowEdges[3];
+            for (int k = 0; k < 3; k++)
+                rowEdges[k] = _mm_add_ps(_mm_mul_ps(b[k], _mm_set1_ps(cornerY)), c[k]);
+            const __m128 rowDepth = _mm_set1_ps(triangle.m_invW[1] * cornerY + triangle.m_invW[2]);
+
+            float *pRow = &m_depth[y * m_width];
+            for (int x = firstX; x <= triangle.m_maxX; x += 4)
+            {
+                const __m128 cornerX = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], cornerX), rowEdges[0]), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], cornerX), rowEdges[1]), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], cornerX), rowEdges[2]), zero));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+
+                // the pixels not fully covered get 0, which never replaces anything
+                __m128 depth = _mm_and_ps(inside, _mm_add_ps(_mm_mul_ps(depthA, cornerX), rowDepth));
+                _mm_storeu_ps(&pRow[x], _mm_max_ps(_mm_loadu_ps(&pRow[x]), depth));
+            }
+        }
+    }
+}
+
+void OcclusionBuffer::End()
+{
+    Profile p("OcclusionBuffer::End");
+
+    if (m_width == 0)
+        return;
+
+    std::vector<size_t> vertexOffsets(m_occluders.size() + 1, 0);
+    std::vector<size_t> triangleOffsets(m_occluders.size() + 1, 0);
+    for (size_t i = 0; i < m_occluders.size(); i++)
+    {
+        vertexOffsets[i + 1] = vertexOffsets[i] + m_occluders[i].m_vertexCount;
+        triangleOffsets[i + 1] = triangleOffsets[i] + m_occluders[i].m_indexCount / 3;
+    }
+    m_vertices.resize(vertexOffsets.back());
+    m_triangles.resize(triangleOffsets.back());
+
+    ExecBatches(m_occluders.size(), 1, [this, &vertexOffsets, &triangleOffsets](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+            SetupTriangles(m_occluders[i], m_vertices.data() + vertexOffsets[i], m_triangles.data() + triangleOffsets[i]);
+    });
+
+    // the bands of rows don't overlap so they are written without synchronization
+    ExecBatches(m_height, RowsPerBatch, [this](size_t first, size_t last)
+    {
+        RasterizeRows((uint32_t)first, (uint32_t)last);
+    });
+
+    m_occluders.clear();
+    m_bValid = true;
+}
+
+bool OcclusionBuffer::IsValidFor(const math::Matrix4 &mCameraViewProj) const
+{
+    return m_bValid && memcmp(&m_viewProj, &mCameraViewProj, sizeof(math::Matrix4)) == 0;
+}
+
+//
+// The box is visible when one of the pixels its projection touches, even partially, doesn't have an occluder nearer
+// than its nearest corner
+//
+bool OcclusionBuffer::IsBoxVisible(const math::Vector4 &boxMin, const math::Vector4 &boxMax) const
+{
+    if (!m_bValid)
+        return true;
+
+    float minX = FLT_MAX, minY = FLT_MAX;
+    float maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float nearest = 0.0f;
+    for (int i = 0; i < 8; i++)
+    {
+        math::Vector4 corner((i & 1) ? boxMax.getX() : boxMin.getX(), (i & 2) ? boxMax.getY() : boxMin.getY(), (i & 4) ? boxMax.getZ() : boxMin.getZ(), 1.0f);
+        math::Vector4 clip = m_viewProj * corner;
+        float w = clip.getW();
+        if (w <= MinW)
+            return true;
+
+        float invW = 1.0f / w;
+        float x = (clip.getX() * invW + 1.0f) * 0.5f * (float)m_width;
+        float y = (1.0f - clip.getY() * invW) * 0.5f * (float)m_height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::max(nearest, invW);
+    }
+
+    // the boxes out of the screen are left to the frustum culling
+    if (maxX < 0.0f || maxY < 0.0f || minX >= (float)m_width || minY >= (float)m_height)
+        return true;
+
+    const int x0 = (int)std::max(minX, 0.0f);
+    const int x1 = (int)std::min(maxX, (float)(m_width - 1));
+    const int y0 = (int)std::max(minY, 0.0f);
+    const int y1 = (int)std::min(maxY, (float)(m_height - 1));
+
+    const __m128 threshold = _mm_set1_ps(nearest * (1.0f + DepthBias));
+    for (int y = y0; y <= y1; y++)
+    {
+        const float *pRow = &m_depth[y * m_width];
+        for (int x = x0 & ~3; x <= x1; x += 4)
+        {
+            // the lanes of the block that are in the rectangle
+            uint32_t lanes = 0xF;
+            if (x < x0)
+                lanes &= 0xF << (x0 - x);
+            if (x + 3 > x1)
+                lanes &= 0xF >> (x + 3 - x1);
+
+            if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(&pRow[x]), threshold)) & lanes)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void OcclusionBuffer::CullBoxes(const BoundingBoxArrays &boxes, size_t first, size_t count, uint32_t *pVisibleMask) const
+{
+    if (!m_bValid)
+        return;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((pVisibleMask[i / 32] & (1u << (i % 32))) == 0)
+            continue;
+
+        AxisAlignedBoundingBox box = boxes.Get(first + i);
+        if (!IsBoxVisible(box.m_min, box.m_max))
+            pVisibleMask[i / 32] &= ~(1u << (i % 32));
+    }
+}
@@ -0,0 +1,98 @@
+// AMD Cauldron code
+//
+// Copyright(c) 2020 Advanced Micro Devices, Inc.All rights reserved.
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#pragma once
+
+#include "Misc.h"
+#include "FrustumCulling.h"
+
+//
+// Software occlusion culling. A few occluder meshes are rasterized on the CPU into a small depth buffer, then the world
+// space boxes are projected on it and are occluded when all the pixels they cover hold an occluder nearer than the
+// nearest corner of the box.
+//
+// The buffer holds 1/w of the nearest occluder of each pixel (0 when there is none). 1/w is linear in screen space so it
+// is interpolated exactly across the triangles and it doesn't depend on the depth convention of the projection. The rows
+// are a multiple of 4 pixels wide so they are rasterized and tested 4 pixels at a time with SSE.
+//
+// The rasterization is conservative: a pixel only gets a triangle that covers all of it, with the farthest 1/w of the
+// triangle over the pixel, and the boxes are tested against every pixel they touch. So a box is only occluded when
+// the occluders are in front of all of it. The price is a one pixel gap along the edges shared by two triangles, which
+// neither of them covers fully. The triangles crossing the near plane are not rasterized and the boxes crossing it are
+// always visible.
+//
+// Usage: Begin() with the view projection, AddOccluder() for each occluder, End() rasterizes them on the ThreadPool.
+// The buffer can then be tested from several threads until the next Begin().
+//
+
+class OcclusionBuffer
+{
+public:
+    void OnCreate(uint32_t width, uint32_t height);
+    void OnDestroy();
+
+    uint32_t GetWidth() const { return m_width; }
+    uint32_t GetHeight() const { return m_height; }
+    const float *GetDepth() const { return m_depth.data(); }
+
+    void Begin(const math::Matrix4 &mCameraViewProj);
+    // pPositions holds vertexCount xyz triplets in the space of mWorld, pIndices is a triangle list. The arrays aren't
+    // copied and must stay valid until End().
+    void AddOccluder(const math::Matrix4 &mWorld, const float *pPositions, uint32_t vertexCount, const uint32_t *pIndices, uint32_t indexCount);
+    void End();
+
+    // true when End() rasterized the occluders for this view projection
+    bool IsValidFor(const math::Matrix4 &mCameraViewProj) const;
+
+    bool IsBoxVisible(const math::Vector4 &boxMin, const math::Vector4 &boxMax) const;
+    // Clears the bits of pVisibleMask of the boxes [first, first + count) that are occluded, same layout as CullBoxes()
+    void CullBoxes(const BoundingBoxArrays &boxes, size_t first, size_t count, uint32_t *pVisibleMask) const;
+
+private:
+    struct Occluder
+    {
+        math::Matrix4 m_world;
+        const float *m_pPositions;
+        uint32_t m_vertexCount;
+        const uint32_t *m_pIndices;
+        uint32_t m_indexCount;
+    };
+
+    // screen space triangle, the edge functions and 1/w are planes a*x + b*y + c of the pixel coordinates
+    struct Triangle
+    {
+        int m_minX, m_minY, m_maxX, m_maxY;     // clamped bounding rectangle of the pixels, empty when max < min
+        float m_edges[3][3];
+        float m_invW[3];
+    };
+
+    void SetupTriangles(const Occluder &occluder, math::Vector4 *pVertices, Triangle *pTriangles) const;
+    void RasterizeRows(uint32_t firstRow, uint32_t lastRow);
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::vector<float> m_depth;
+
+    math::Matrix4 m_viewProj;
+    bool m_bValid = false;
+
+    std::vector<Occluder> m_occluders;
+    std::vector<math::Vector4> m_vertices;  // screen x, y and 1/w of the vertices of the occluders, w < 0 when behind the camera
+    std::vector<Triangle> m_triangles;
+};
@@ -91,6 +91,32 @@ bool WICLoader::Load(const char *pFilename, float cutOff, IMG_INFO *pInfo)
     // no data, no success.
     if (!m_pData) return false;
 
+    InitInfo(width, height, cutOff, pInfo);
+
+#ifdef USE_WIC
+    pIFormatConverter->Release();
+    pBitmapDecoder->Release();
+    pWicStream->Release();
+#endif
+    
+    return true;
+}
+
+bool WICLoader::Load(const void *pData, size_t size, float cutOff, IMG_INFO *pInfo)
+{
+    int32_t width, height, channels;
+    m_pData = (char*)stbi_load_from_memory((const stbi_uc *)pData, (int)size, &width, &height, &channels, STBI_rgb_alpha);
+
+    // no data, no success.
+    if (!m_pData) return false;
+
+    InitInfo(width, height, cutOff, pInfo);
+
+    return true;
+}
+
+void WICLoader::InitInfo(uint32_t width, uint32_t height, float cutOff, IMG_INFO *pInfo)
+{
     // compute number of mips
     //
     uint32_t mipWidth  = width;
@@ -123,14 +149,6 @@ bool WICLoader::Load(const char *pFilename, float cutOff, IMG_INFO *pInfo)
         m_alphaTestCoverage = GetAlphaCoverage(width, height, 1.0f, (int)(255 * m_cutOff));
     else
         m_alphaTestCoverage = 1.0f;
-
-#ifdef USE_WIC
-    pIFormatConverter->Release();
-    pBitmapDecoder->Release();
-    pWicStream->Release();
-#endif
-    
-    return true;
 }
 
 void WICLoader::CopyPixels(void *pDest, uint32_t stride, uint32_t bytesWidth, uint32_t height)
@@ -28,9 +28,11 @@ class WICLoader : public ImgLoader
 public:
     ~WICLoader();
     bool Load(const char *pFilename, float cutOff, IMG_INFO *pInfo);
+    bool Load(const void *pData, size_t size, float cutOff, IMG_INFO *pInfo);
     // after calling Load, calls to CopyPixels return each time a lower mip level 
     void CopyPixels(void *pDest, uint32_t stride, uint32_t width, uint32_t height);
 private:
+    void InitInfo(uint32_t width, uint32_t height, float cutOff, IMG_INFO *pInfo);
     void MipImage(uint32_t width, uint32_t height);
     // scale alpha to prevent thinning when lower mips are used
     float GetAlphaCoverage(uint32_t width, uint32_t height, float scale, int cutoff) const;